@@ -7,23 +7,164 @@
  * only the limited subset of needed functionalieties has been implemented
  * */
 
-#include "frameUtils.h"
-#include "bufferUtils.h"
+#include "xbus.h"
 #include <stdint.h>
 #include "UARTdriver.h"
 #include <stddef.h>
 #include "usart.h"
 
-#define IMU_BUFFER_LEN 100	//local buffer length
+#define IMU_BUFFER_LEN 100	//local buffer length (bytes read from the driver at once)
+#define IMU_MSG_MAX_LEN 255	//maximum data length of received messages (longer ones are dropped)
+#define IMU_SAMPLE_RING_LEN 32	//number of samples kept in the sample ring (power of 2)
+#define IMU_MAG_MAX_RATE 100	//maximum output rate of the magnetic field (Hz)
+#define IMU_CAPTURE_LEN 8192	//raw capture ring length (bytes, power of 2)
+
+/* Output rate profiles
+ * each profile sets the output rate of rate of turn and acceleration (the magnetic field is limited
+ * to IMU_MAG_MAX_RATE, so at higher rates it is found only in some of the samples) and the baud rate
+ * of the link, chosen to keep the line load around 50%
+ * the orientation profiles add the quaternion and the free acceleration computed by the MTi sensor
+ * fusion at the same rate, so that no attitude estimation is needed on the MCU
+ * */
+typedef enum{
+	imu_profile_100hz,	//100 Hz, 115200 baud (default)
+	imu_profile_200hz,	//200 Hz, 230400 baud
+	imu_profile_400hz,	//400 Hz, 460800 baud
+	imu_profile_100hz_orientation,	//100 Hz with orientation, 230400 baud
+	imu_profile_200hz_orientation,	//200 Hz with orientation, 460800 baud
+	IMU_PROFILE_NUM
+} imu_profile;
+
+/* Sample ring
+ * every data packet decoded (by acquireIMUSamples() or by the read functions) is stored in a ring
+ * of the last IMU_SAMPLE_RING_LEN samples, with the tick of decoding and a sequence number
+ * consumers (of any task) read the latest sample, or every sample since their last read through a
+ * cursor: samples overwritten before being read are counted as dropped in the cursor
+ * */
+
+//sample stored in the ring
+typedef struct{
+	mtdata2_sample data;	//decoded outputs (data.sampleTimeFine is the imu timestamp)
+	uint32_t tick;			//HAL tick when the packet was decoded
+	uint32_t seq;			//sequence number (+1 for every sample stored)
+} imu_sample;
+
+//consumer position in the ring, to be initialized with initIMUCursor()
+typedef struct{
+	uint32_t next;		//sequence number of the next sample to read
+	uint32_t dropped;	//samples overwritten before being read (reset by the user)
+} imu_sample_cursor;
+
+/* Decimation
+ * a decimator reads the ring with its own cursor and averages groups of samples, so that each
+ * consumer gets the rate it needs (e.g. 200 Hz to control, 50 Hz to telemetry) from the samples
+ * decoded once
+ * */
+#define IMU_AVERAGED_NUM 5	//outputs averaged (quaternion, acceleration, free acceleration, rate of turn, magnetic field)
+
+typedef struct{
+	imu_sample_cursor cursor;	//position in the ring (cursor.dropped counts lost samples)
+	uint32_t factor;			//samples averaged in each output sample
+	uint32_t count;				//samples accumulated so far
+	mtdata2_sample sum;			//sums of the averaged outputs
+	uint32_t num[IMU_AVERAGED_NUM];	//samples containing each averaged output
+} imu_decimator;
+
+/* Raw capture
+ * while the capture is running, every chunk of bytes read from the imu uart is also written in a
+ * ring of IMU_CAPTURE_LEN bytes (the oldest chunks are overwritten), as a record:
+ * | TICK (4 bytes) | LEN (2 bytes) | LEN bytes |
+ * (little endian, tick is the HAL tick when the chunk was read), so that the traffic can be dumped
+ * and replayed through the same decoder off target (see Host/examples/imuReplay.c)
+ * */
+
+//decoder counters
+typedef struct{
+	uint32_t messages;			//valid messages decoded
+	uint32_t checksumErrors;	//messages dropped because of a wrong checksum
+	uint32_t lengthErrors;		//headers rejected because of a length longer than IMU_MSG_MAX_LEN
+	uint32_t malformed;			//data packets whose entries do not match their length
+} imu_stats;
 
 /* Function to init IMU, it delays so it must be called when HAL_GetTick interrupts are enabled */
 /* You should passs the IMU UART handle as argument*/
 /* returns 1 in case of success, 0 otherwise (no ack received) */
 uint8_t initIMUConfig(UART_HandleTypeDef* IMUhandle);
 
+/* Init IMU with an output rate profile, as initIMUConfig() (that uses imu_profile_100hz) */
+/* nothing is sent if the MTi is already measuring with the outputs and rate of the profile, */
+/* otherwise the output configuration is written only if different from the MTi one; an MTi */
+/* still starting up is waited for (WakeUp message), so no fixed delay is needed */
+/* if the baud rate of the profile is different from the one of the uart, the MTi baud rate is */
+/* changed (it is kept by the MTi across power cycles) and the MTi is reset, then the uart is */
+/* set to the new rate; if the MTi does not answer at the uart rate, the rates of the other */
+/* profiles are tried */
+/* returns 1 in case of success, 0 otherwise (no ack received) */
+uint8_t initIMUProfile(UART_HandleTypeDef* IMUhandle, imu_profile profile);
+
+/* Output rate (Hz) of the configured profile */
+uint32_t getIMURate(void);
+
+/* Init only the decoder (initIMUProfile() does it), to acquire from an imu configured elsewhere */
+/* (e.g. traffic replayed on the host), counters are cleared */
+void initIMUDecoder(void);
+
+/* Copy the decoder counters inside stats */
+void getIMUStats(imu_stats* stats);
+
+/* Clear the capture ring and start capturing */
+void startIMUCapture(void);
+
+/* Stop capturing, the ring content is kept */
+void stopIMUCapture(void);
+
+/* Number of bytes (whole records) in the capture ring */
+uint32_t getIMUCaptureLen(void);
+
+/* Copy up to len bytes of the capture ring, from offset (0 is the start of the oldest record), */
+/* inside buff; the capture should be stopped while the ring is read in more calls */
+//returns the number of bytes copied
+uint32_t readIMUCapture(uint32_t offset, uint8_t* buff, uint32_t len);
+
+/* Continuous acquisition: wait (up to timeout ms) for a data packet, then decode all the bytes */
+/* already received without waiting more, storing every packet in the sample ring */
+/* to be called in a loop by the task owning the IMU uart */
+//returns the number of samples stored
+uint32_t acquireIMUSamples(UART_HandleTypeDef* IMUhandle, uint32_t timeout);
+
+/* Init a cursor to read the samples stored from now on */
+void initIMUCursor(imu_sample_cursor* cursor);
+
+/* Read up to maxNum samples (in order) stored since the last read with cursor inside samples */
+/* if the ring has overwritten some of them, the cursor skips to the oldest sample available */
+/* and cursor->dropped is increased */
+//returns the number of samples read (0 if there are no new samples)
+uint32_t readIMUSamples(imu_sample_cursor* cursor, imu_sample* samples, uint32_t maxNum);
+
+/* Read the latest sample stored inside sample */
+//returns 1 in case of success, 0 if no sample was stored yet
+uint8_t readIMULatest(imu_sample* sample);
+
+/* Init a decimator outputting (rate) samples per second from the samples stored from now on */
+/* (the factor is the integer closest to getIMURate()/rate, at least 1) */
+void initIMUDecimator(imu_decimator* dec, uint32_t rate);
+
+/* Read the samples stored since the last call until an averaged sample is complete, placing it */
+/* inside sample: quaternion (normalized), acceleration, free acceleration, rate of turn and */
+/* magnetic field are averaged over the samples containing them, the other members are the ones */
+/* of the last sample */
+/* the samples left are kept for the next call, so it can be called in a loop until it returns 0 */
+//returns 1 if an averaged sample is complete, 0 otherwise
+uint8_t readIMUDecimated(imu_decimator* dec, imu_sample* sample);
+
+/* Wait and read an IMU data packet (MTData2), decoding all the outputs it contains inside sample */
+/* the outputs found are flagged in sample->fields, see xbus.h */
+//returns 1 in case of success, 0 otherwise
+uint8_t readIMUSample(UART_HandleTypeDef* IMUhandle, mtdata2_sample* sample, uint32_t timeout);
+
 /* Wait and read an IMU packet*/
 /* Ypu should pass the IMU UART handle, the buffers where to store the data and the read timeout*/
-//returns 1 in case of success, 0 otherwise
+//returns 1 in case of success, 0 otherwise (also if the packet lacks one of the three outputs)
 uint8_t readIMUPacket(UART_HandleTypeDef* IMUhandle, float gyroscope[3], float magnetometer[3], float accelerometer[3], uint32_t timeout);
 
 #endif
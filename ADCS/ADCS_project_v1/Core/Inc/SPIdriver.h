@@ -0,0 +1,67 @@
+#ifndef SPIDRIVER_H
+#define SPIDRIVER_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+
+/* DMA transaction queue for SPI
+ *
+ * A transaction is a full-duplex transfer of up to SPI_TRANSACTION_LEN bytes framed by a chip
+ * select (command bytes and readback in the same transfer, HAL_SPI_TransmitReceive_DMA).
+ * queueDriver_SPI() copies the transaction in a SPI_QUEUE_LEN ring and, if the bus is idle,
+ * lowers the chip select and starts the DMA. The transfer complete interrupt raises the chip
+ * select, calls the callback of the transaction and starts the next queued one, so transactions
+ * are chained without the CPU waiting on the bus. Callbacks run in the interrupt and can queue
+ * further transactions (e.g. read the data register once the status says it is ready).
+ * While transactions are queued the blocking HAL SPI calls on the same bus return HAL_BUSY. */
+
+//maximum number of spis the driver can handle (one slot per instance: SPI2)
+#define MAX_SPI_HANDLE 1
+//transactions waiting on a bus (the one in flight included)
+#define SPI_QUEUE_LEN 16
+//maximum bytes of a transaction
+#define SPI_TRANSACTION_LEN 4
+
+typedef struct spi_transaction spi_transaction;
+
+//function called from the transfer complete (or error) interrupt, with the chip select already
+//raised; the transaction is a copy that is valid only during the call
+typedef void (*spi_transaction_callback)(spi_transaction* transaction);
+
+struct spi_transaction{
+	uint8_t tx[SPI_TRANSACTION_LEN];	//bytes to send
+	uint8_t rx[SPI_TRANSACTION_LEN];	//bytes received (filled by the driver)
+	uint16_t len;						//bytes of the transfer
+	GPIO_TypeDef* csPort;				//chip select, active low (NULL if none)
+	uint16_t csPin;
+	spi_transaction_callback callback;	//NULL if none
+	void* ctx;							//user context for the callback
+	uint8_t error;						//set by the driver: 1 if the transfer failed
+};
+
+//per bus counters, counting since addDriver_SPI()
+typedef struct{
+	uint32_t transactions;	//transactions completed (failed ones included)
+	uint32_t errors;		//transactions failed
+	uint32_t queueFull;		//transactions refused because the queue was full
+	uint32_t highWater;		//maximum number of transactions in the queue
+} spi_stats;
+
+//init driver data structure
+void initDriver_SPI();
+
+//add a SPI to the driver handlers, the HAL handle must have its rx and tx DMA channels linked
+//returns 0 in case of success, 1 otherwise
+//NB. this function is not thread safe and should be called by the same thread
+uint8_t addDriver_SPI(SPI_HandleTypeDef* hspiHandle);
+
+//function to queue a transaction on spi (hspiHandle), callable from tasks and interrupts
+//returns 0 in case of success, 1 otherwise (queue full, spi not added or transaction too long)
+uint8_t queueDriver_SPI(SPI_HandleTypeDef* hspiHandle, const spi_transaction* transaction);
+
+//function to copy the counters of spi (hspiHandle) in stats
+//returns 0 in case of success, 1 otherwise (spi not added to the driver)
+uint8_t getStatsDriver_SPI(SPI_HandleTypeDef* hspiHandle, spi_stats* stats);
+
+#endif
@@ -3,15 +3,36 @@
 
 #include "FreeRTOS.h"
 #include "queue.h"
+#include "task.h"
 #include "main.h"
 
 /* Interrupt driver for UART usinf FreeRTOS queues */
 
+/* DMA RX mode: if the HAL handle has an RX DMA channel linked (huart->hdmarx, set up
+ * in usart.c as circular), addDriver_UART() starts a circular reception with idle line
+ * detection (HAL_UARTEx_ReceiveToIdle_DMA) instead of the per-byte interrupt.
+ * The DMA writes straight into the RX buffer and the interrupt only fires on half
+ * buffer, full buffer and idle line events; receiveDriver_UART() copies directly out
+ * of the DMA ring. The DMA cannot be held back, so in this mode the RX policy is
+ * always keep_new: if the reader falls more than SERIAL_RX_BUFF_LEN bytes behind,
+ * the oldest bytes are lost.
+ * Ports without an RX DMA channel keep the per-byte interrupt mode.
+ *
+ * DMA TX mode: if the HAL handle has a TX DMA channel linked (huart->hdmatx),
+ * sendDriver_UART() only copies the bytes in a SERIAL_TX_BUFF_LEN ring and, if the
+ * line is idle, launches HAL_UART_Transmit_DMA on the largest contiguous span.
+ * Further spans are chained from the transfer complete interrupt, so there is one
+ * interrupt per chunk instead of one per byte. The keep_old policy still applies. */
+
 //maximum number of uarts the driver can handle
+//(one slot per instance: USART1, USART2, USART3, UART4)
 #define MAX_UART_HANDLE 4
 //buffer lengths (bytes)
 #define SERIAL_RX_BUFF_LEN 256
 #define SERIAL_TX_BUFF_LEN 4096
+//task notification bit set by the ISR to wake receiveDriver_UART_Wait()
+//counting notifications (xTaskNotifyGive) of the same task must stay below it
+#define UART_NOTIFY_RX_BIT (1UL<<31)
 
 //init driver data structure
 void initDriver_UART();
@@ -22,10 +43,25 @@ typedef enum{
 	keep_new,	//remove older bytes and insert new
 } fifo_policy;
 
+//per port counters, counting since addDriver_UART() or the last resetStatsDriver_UART()
+typedef struct{
+	uint32_t rxBytes;		//bytes received from the line (dropped ones included)
+	uint32_t txBytes;		//bytes sent on the line
+	uint32_t rxEvents;		//rx interrupts served (per byte in interrupt mode, half/full/idle events in DMA mode)
+	uint32_t txEvents;		//tx complete interrupts served (per byte in interrupt mode, per chunk in DMA mode)
+	uint32_t overrunErrors;	//overrun errors
+	uint32_t framingErrors;	//framing errors
+	uint32_t noiseErrors;	//noise and parity errors
+	uint32_t rxDropped;		//rx bytes lost because the rx buffer was full (new ones with keep_old, old ones with keep_new)
+	uint32_t txDropped;		//tx bytes refused because the tx buffer was full (or lost in an aborted DMA transfer)
+	uint32_t rxHighWater;	//maximum number of bytes waiting in the rx buffer
+	uint32_t txHighWater;	//maximum number of bytes waiting in the tx buffer
+} uart_stats;
+
 //add an UART to the driver handlers
 //you must pass the HAL uart handle pointer (huardHandle) and the irq number (irq)
 //you must also pass a policy (policyRX) for RX queue, the TX queue will always be 
-//treated with the keep_old policy
+//treated with the keep_old policy (in DMA RX mode policyRX is ignored, see above)
 //returns 0 in case of success, 1 otherwise
 //NB. this function is not thread safe and should be called by the same thread
 uint8_t addDriver_UART(UART_HandleTypeDef* huartHandle, IRQn_Type irq, fifo_policy policyRX);
@@ -34,6 +70,18 @@ uint8_t addDriver_UART(UART_HandleTypeDef* huartHandle, IRQn_Type irq, fifo_poli
 //returns the actual number of receviced bytes
 uint32_t receiveDriver_UART(UART_HandleTypeDef* huartHandle, uint8_t* buff, uint32_t size);
 
+//function to receive an amout (size) of bytes (buff) from uart (huardHandle) waiting
+//for data: the calling task blocks until at least minBytes bytes are available or
+//timeoutTicks (FreeRTOS ticks) expire, then reads what is there as receiveDriver_UART()
+//the task is woken by the uart ISR (or by the DMA half/full/idle events in DMA RX mode)
+//with a direct to task notification, so no CPU is used while waiting
+//with size 0 the function only waits (buff can be NULL)
+//returns the actual number of received bytes
+//NB. only one task at a time should wait on the same uart, the UART_NOTIFY_RX_BIT of the
+//calling task notification is used (other notifications are left pending for their own
+//wait). Before the scheduler starts the function does not wait.
+uint32_t receiveDriver_UART_Wait(UART_HandleTypeDef* huartHandle, uint8_t* buff, uint32_t size, uint32_t minBytes, uint32_t timeoutTicks);
+
 //function to send an amout (size) of bytes (buff) to uart (huardHandle)
 //returns the actual number of sent bytes
 uint32_t sendDriver_UART(UART_HandleTypeDef* huardHandle,uint8_t* buff,uint32_t size);
@@ -44,4 +92,16 @@ void flushRXDriver_UART(UART_HandleTypeDef* huartHandle);
 //function to flush uart (huardHandle) TX buffer
 void flushTXDriver_UART(UART_HandleTypeDef* huartHandle);
 
+//function to change the baud rate of uart (huartHandle): transfers are aborted, the rx and tx
+//buffers are flushed and reception is restarted at the new rate
+//returns 0 in case of success, 1 otherwise
+uint8_t setBaudDriver_UART(UART_HandleTypeDef* huartHandle, uint32_t baudRate);
+
+//function to copy the counters of uart (huartHandle) in stats
+//returns 0 in case of success, 1 otherwise (uart not added to the driver)
+uint8_t getStatsDriver_UART(UART_HandleTypeDef* huartHandle, uart_stats* stats);
+
+//function to reset the counters of uart (huartHandle)
+void resetStatsDriver_UART(UART_HandleTypeDef* huartHandle);
+
 #endif
@@ -14,15 +14,49 @@ extern const float Rmagnetorquer[]; //Ohm
 extern bool int_flag1,int_flag2;
 
 //Structure
+//timer kernel clock of TIM1 (APB2) and TIM2/TIM3 (APB1), RCC.APBxTimFreq_Value in the .ioc
+#define ACT_TIM_CLOCK 40000000UL //Hz
+//largest auto-reload used for the PWM (16 bit timers, TIM2 is kept in the same range)
+#define ACT_ARR_MAX 65535UL
+//duty cycle resolution set by init_actuator_handler() (counts per PWM period, see actuator_set_pwm()):
+//0 for the best one at the requested frequency (e.g. 400 steps at 100kHz, 4000 at 10kHz, 40000 at 1kHz),
+//200 for the 0.5% steps of the CubeMX configuration (Period = 199)
+#define ACT_PWM_RESOLUTION 0
+
 typedef struct{
 	TIM_HandleTypeDef* htim;
-	float Freq;
+	float Freq;	//Hz, PWM frequency of the timer (as obtained from prescaler and auto-reload)
 	uint32_t pwm_channel1;
 	uint32_t pwm_channel2;
 	float duty_cycle;
 	bool dir;
+	uint32_t counts;	//compare value of the duty cycle channel (timer counts, 0..ARR)
+	bool dither;		//Q15 commands dithered (see actuator_set_dither())
+	uint16_t residue;	//dithering: fraction of count carried to the next command (Q15)
 }Actuator_struct;
 
+/* Integer command API
+ * The duty cycle is given in timer counts (0..ARR) or in Q15 (ACT_DUTY_ONE = 100%, the sign is
+ * the direction), with the same channel mapping as update_duty_dir(): the channel of the
+ * direction is held at ARR, the other one gets the duty cycle. No floating point, no printf.
+ * The compare registers are preloaded (enabled by init_actuator_handler()), so a new duty cycle
+ * starts with the next PWM period of its timer and a period is never cut short.
+ * actuator_apply_all() writes the commands of several actuators with the update events of their
+ * timers disabled (UDIS), and restores UDIS as it was at the end (a call from an interrupt, e.g. the
+ * current loop, leaves them disabled inside a batch or a frequency change of a task, on a shared
+ * timer): every timer moves all its channels
+ * (e.g. MagneTorquer1 and MagneTorquer2 on TIM3) at the same update event, the new values are
+ * never split between two periods. An update event falling while the values are written is
+ * skipped, the old values are then kept for one more period.
+ * With dithering enabled, a Q15 command that falls between two counts is not rounded: the
+ * fraction of count left is carried to the next command of the actuator (first order
+ * sigma-delta), which gets one count more when the carried fractions add up to one. Repeating a
+ * command every PWM period (or every control step) gives an average duty cycle that is the
+ * commanded one within a count over the number of commands, below the resolution of the timer.
+ * */
+#define ACT_DUTY_ONE 32768	//100% duty cycle in Q15
+
+
 //FUNCTIONS
 /**
   * @brief Function to define handler of an actuator
@@ -30,6 +64,8 @@ typedef struct{
   * @param htim timer handler
   * @param pwm_channel1 htim timer channel 1
   * @param pwm_channel2 htim timer channel 2
+  * @param pwm_freq PWM frequency (Hz, 4..200000), with the resolution ACT_PWM_RESOLUTION
+  * @param duty_cycle initial duty cycle (percent, FORWARD)
   * @retval none
   */
 void init_actuator_handler(Actuator_struct *act,TIM_HandleTypeDef* htim,uint32_t pwm_channel1,uint32_t pwm_channel2,uint32_t pwm_freq,uint8_t duty_cycle);
@@ -41,13 +77,190 @@ void init_actuator_handler(Actuator_struct *act,TIM_HandleTypeDef* htim,uint32_t
   * @retval none
   */
 void get_actuator_current(ADC_HandleTypeDef *hadc,volatile float voltagebuf[],volatile float currentbuf[],uint8_t Channels_mask[]);
+/**
+  * @brief  Function to read the raw codes of the current sense channels, without conversion
+  * @param hadc Handler for ADC1
+  * @param rawbuf is the buffer that contains the 12 bit codes of all actuators (left unchanged if not in the mask)
+  * @retval none
+  */
+void get_actuator_current_raw(ADC_HandleTypeDef *hadc,uint16_t rawbuf[],uint8_t Channels_mask[]);
 //void get_actuator_current(void)
+/* Continuous acquisition of the actuator currents (scan mode)
+ * actuator_scan_start() configures ADC1 once with the 5 current sense channels as a regular sequence
+ * (same order as the buffers of get_actuator_current(): IN1, IN2, IN3, IN4, IN16), triggered by the
+ * update event (TRGO) of a PWM timer, and streams the results by DMA in a circular double buffer of
+ * two scans. Every scan starts at the beginning of a PWM period of that timer, so the samples keep the
+ * same phase with respect to its PWM. Triggers arriving while a scan is converting are ignored by the
+ * ADC: the scan rate is the PWM frequency divided down to the scan time (5 channels, 16 oversamples
+ * of ACT_SCAN_SAMPLETIME + 12.5 cycles at 32 MHz, about 650 us with 247.5 cycles).
+ * The half and full transfer interrupts publish the half just written, actuator_scan_read() copies the
+ * latest complete scan while the DMA keeps writing the other half. No CPU time is spent acquiring.
+ * The counter of the trigger timer is started if needed (outputs are not touched) and is left running
+ * by init_actuator_handler(), so actuators and scans can be set up in any order; stopping all the
+ * PWM channels of that timer with actuator_STOP() pauses the scans.
+ * The blocking get_actuator_current() and get_actuator_current_raw() cannot be used while scanning.
+ * */
+#define ACT_SCAN_SAMPLETIME ADC_SAMPLETIME_247CYCLES_5
+
 /**
-  * @brief  Function to update pwm freq on run-time
-  * @param act actuator handler
+  * @brief  Function to start the continuous acquisition of the actuator currents
+  * @param hadc Handler for ADC1
+  * @param htim PWM timer (TIM1, TIM2 or TIM3) whose update event triggers the scans
+  * @retval 0 in case of success, 1 otherwise
+  */
+uint8_t actuator_scan_start(ADC_HandleTypeDef *hadc,TIM_HandleTypeDef *htim);
+/**
+  * @brief  Function to stop the continuous acquisition, ADC1 is left configured for the blocking functions
+  * @param hadc Handler for ADC1
+  * @retval none
+  */
+void actuator_scan_stop(ADC_HandleTypeDef *hadc);
+/**
+  * @brief  Function to copy the codes of the latest complete scan (callable from tasks)
+  * @param rawbuf is the buffer that receives the 12 bit codes of all actuators (unchanged if there are no scans yet)
+  * @retval number of scans completed since actuator_scan_start() (0 if none)
+  */
+uint32_t actuator_scan_read(uint16_t rawbuf[]);
+/**
+  * @brief  Function to convert the latest complete scan as get_actuator_current() does
+  * @param voltagebuf is the buffer that contains the voltages of the current sense channels
+  * @param currentbuf is the buffer that contains the current flowing trough all actuators
+  * @retval number of scans completed since actuator_scan_start() (0 if none, buffers unchanged)
+  */
+uint32_t get_actuator_current_scan(volatile float voltagebuf[],volatile float currentbuf[]);
+
+/* Current statistics over windows of scans
+ * Every scan completed by the DMA is added, in the same interrupt, to running per actuator
+ * aggregates in fixed point on the 12 bit codes: minimum, maximum, sum and sum of squares, and
+ * the samples above the over current threshold of the actuator (ACT_RW_CURRENT_MAX for the
+ * reaction wheels, ACT_MT_CURRENT_MAX for the magnetorquers, converted to codes when the scan is
+ * started). After ACT_STATS_WINDOW scans (or the window set with actuator_stats_window()) the mean
+ * and the RMS are computed (codes in Q4, integer square root), the window is published and the
+ * next one starts. Rising crossings of the thresholds are also counted since actuator_scan_start(),
+ * so none is lost when windows are not read.
+ * */
+#define ACT_STATS_WINDOW 256		//default scans per window (about 170 ms at 650 us per scan)
+#define ACT_STATS_WINDOW_MAX 4096	//longest window (scans)
+#define ACT_RW_NUM 2				//actuators 0 and 1 are the reaction wheels, the others the magnetorquers
+#define ACT_RW_CURRENT_MAX 1.0f		//A, over current threshold of the reaction wheels
+#define ACT_MT_CURRENT_MAX 0.05f	//A, over current threshold of the magnetorquers
+
+typedef struct{
+	uint16_t min;		//smallest code
+	uint16_t max;		//largest code
+	uint16_t mean;		//mean code, Q4 (1/16 code)
+	uint16_t rms;		//RMS code, Q4
+	uint16_t over;		//samples above the threshold
+} act_window_stats;
+
+typedef struct{
+	act_window_stats ch[NUM_DRIVERS];	//last complete window, per actuator
+	uint16_t threshold[NUM_DRIVERS];	//over current thresholds (codes)
+	uint32_t crossings[NUM_DRIVERS];	//rising crossings of the thresholds since actuator_scan_start()
+	uint32_t scans;						//scans of the window
+	uint32_t windows;					//windows completed since actuator_scan_start() (0 if none)
+} act_current_stats;
+
+/**
+  * @brief  Function to set the length of the statistics windows, applied from the next window
+  * @param scans scans per window (1 to ACT_STATS_WINDOW_MAX)
+  * @retval 0 in case of success, 1 otherwise
+  */
+uint8_t actuator_stats_window(uint32_t scans);
+/**
+  * @brief  Function to copy the statistics of the last complete window (callable from tasks)
+  * @param stats structure that receives the statistics (windows is 0 if no window is complete yet)
+  * @retval number of windows completed since actuator_scan_start()
+  */
+uint32_t actuator_stats_read(act_current_stats *stats);
+/**
+  * @brief  Function to convert the statistics of a window to currents, as get_actuator_current() does
+  * @param stats statistics read with actuator_stats_read()
+  * @param meanbuf, rmsbuf, maxbuf are the buffers that contain mean, RMS and peak current of all actuators
+  * @retval none
+  */
+void get_actuator_current_stats(const act_current_stats *stats,float meanbuf[],float rmsbuf[],float maxbuf[]);
+
+/* Magnetorquer current loop
+ * The current of a magnetorquer (so its dipole) is regulated to a setpoint by a PI in fixed point,
+ * run by the scan interrupts of actuator_scan_start() on every scan (about 1.5 kHz with the default
+ * sample time), with the code of the current sense channel of the driver as the measure. The
+ * setpoint is converted to a code once (same conversion as get_actuator_current()), the PI works
+ * on the code error with gains in Q8 (Q15 duty cycle per code of error) and gives the Q15 duty
+ * cycle, committed with actuator_apply_all() (all the loops of a timer at the same update event,
+ * dithered if the actuator has dithering enabled). The coil resistance and the supply voltage are
+ * not used: the duty cycle is whatever gives the setpoint current.
+ * Anti-windup: the integral term is kept within the duty cycle range and does not integrate
+ * further while the output is saturated (0 or 100%) in the direction of the error. The current
+ * sense measures the magnitude only, the direction is the sign of the setpoint: a change of sign
+ * restarts the integral term from 0.
+ * The actuators under current control must not be commanded by the tasks meanwhile.
+ * */
+#define ACT_LOOP_KP 1280	//proportional gain, Q8 (5 Q15 per code)
+#define ACT_LOOP_KI 2560	//integral gain per scan, Q8 (10 Q15 per code)
+
+typedef struct{
+	int32_t setpoint;	//codes, the sign is the direction
+	uint16_t measured;	//code of the last scan
+	int32_t duty;		//last duty cycle commanded (Q15, signed)
+	uint32_t runs;		//scans run by the loop since actuator_current_loop_start()
+	uint32_t saturated;	//scans with the output saturated
+} act_loop_state;
+
+/**
+  * @brief  Function to start the current loop of a magnetorquer, from the next scan
+  * @param driver current sense channel of the actuator (ACT_RW_NUM..NUM_DRIVERS-1)
+  * @param act actuator handler (started with actuator_START())
+  * @param kp proportional gain (Q8, 0 for ACT_LOOP_KP)
+  * @param ki integral gain (Q8, 0 for ACT_LOOP_KI)
+  * @retval 0 in case of success, 1 otherwise
+  */
+uint8_t actuator_current_loop_start(uint32_t driver,Actuator_struct *act,uint16_t kp,uint16_t ki);
+/**
+  * @brief  Function to stop the current loop of a magnetorquer, its duty cycle is set to 0
+  * @param driver current sense channel of the actuator
   * @retval none
   */
-void update_pwm_Frequency(Actuator_struct *act);  //DA IMPLEMENTARE
+void actuator_current_loop_stop(uint32_t driver);
+/**
+  * @brief  Function to set the current of a magnetorquer under current control (callable from tasks)
+  * @param driver current sense channel of the actuator
+  * @param current A, the sign is the direction (clamped to the ADC range)
+  * @retval 0 in case of success, 1 otherwise (loop not running)
+  */
+uint8_t actuator_current_setpoint(uint32_t driver,float current);
+/**
+  * @brief  Function to copy the state of a current loop
+  * @param driver current sense channel of the actuator
+  * @param state structure that receives the state
+  * @retval 0 in case of success, 1 otherwise (loop not running)
+  */
+uint8_t actuator_current_loop_read(uint32_t driver,act_loop_state *state);
+
+/* Run-time PWM frequency
+ * The frequency belongs to the timer: the actuators sharing it (MagneTorquer3 and Reaction2 on
+ * TIM2, MagneTorquer1 and MagneTorquer2 on TIM3) change together, each one keeping its duty cycle
+ * and direction (compare values scaled to the new auto-reload). Prescaler, auto-reload (ARPE set)
+ * and compare values are written with the update events disabled and all reach the outputs at the
+ * next update event: the running period ends with the old values, no pulse is cut or stretched.
+ * The actuators are found through the handlers given to init_actuator_handler().
+ * */
+
+/**
+  * @brief  Function to update pwm freq on run-time to act->Freq, with the best duty cycle resolution
+  *         (smallest prescaler, auto-reload up to ACT_ARR_MAX)
+  * @param act actuator handler
+  * @retval 0 in case of success, 1 otherwise (frequency out of 4Hz..200kHz)
+  */
+uint8_t update_pwm_Frequency(Actuator_struct *act);
+/**
+  * @brief  Function to change PWM frequency and resolution on run-time
+  * @param act actuator handler
+  * @param pwm_freq requested frequency (Hz, 4..200000), act->Freq receives the one obtained
+  * @param resolution counts per period (ARR+1, 2..ACT_ARR_MAX+1), 0 for the best resolution at pwm_freq
+  * @retval 0 in case of success, 1 otherwise
+  */
+uint8_t actuator_set_pwm(Actuator_struct *act,uint32_t pwm_freq,uint32_t resolution);
 /**
   * @brief  Function to update either dutycyle or current direction or both
   * @param act actuator handler
@@ -55,6 +268,43 @@ void update_pwm_Frequency(Actuator_struct *act);  //DA IMPLEMENTARE
   * @retval none
   */
 void update_duty_dir(Actuator_struct *act,float duty,bool dir);
+/**
+  * @brief  Function to convert a Q15 duty cycle to timer counts of an actuator
+  * @param act actuator handler
+  * @param duty duty cycle in Q15 (-ACT_DUTY_ONE..ACT_DUTY_ONE, clamped), the sign is ignored
+  * @retval compare value (0..ARR)
+  */
+uint32_t actuator_duty_counts(const Actuator_struct *act,int32_t duty);
+/**
+  * @brief  Function to set duty cycle (timer counts) and current direction, from the next PWM period
+  * @param act actuator handler
+  * @param counts compare value of the duty cycle channel (clamped to ARR)
+  * @param dir current direction (1 FORWARD, 0 REVERSE)
+  * @retval none
+  */
+void actuator_set_counts(Actuator_struct *act,uint32_t counts,bool dir);
+/**
+  * @brief  Function to set a signed Q15 duty cycle (negative is REVERSE), from the next PWM period
+  * @param act actuator handler
+  * @param duty duty cycle in Q15 (-ACT_DUTY_ONE..ACT_DUTY_ONE, clamped)
+  * @retval none
+  */
+void actuator_set_duty_q15(Actuator_struct *act,int32_t duty);
+/**
+  * @brief  Function to command several actuators, committed by each timer at its next update event
+  * @param acts actuator handlers
+  * @param duty signed Q15 duty cycles, one per actuator
+  * @param num number of actuators
+  * @retval none
+  */
+void actuator_apply_all(Actuator_struct *const acts[],const int32_t duty[],uint32_t num);
+/**
+  * @brief  Function to enable or disable the dithering of the Q15 commands of an actuator
+  * @param act actuator handler
+  * @param enable true to carry the fraction of count of each command to the next one, false to round
+  * @retval none
+  */
+void actuator_set_dither(Actuator_struct *act,bool enable);
 /**
   * @brief  Function to START PWM
   * @param act actuator handler
@@ -21,8 +21,20 @@
 
 #define ln(x) log(x)
 #define N 16
+#define ADC_CODE_MAX ((1UL<<N)-1) //largest code of the external ADC
 #define Vref 3.3 //volt
 
+//housekeeping sent as raw ADC codes (housekeepingRawADCS) instead of temperatures and currents
+//(housekeepingADCS), the conversion is done on ground by the CDH daemon (calibration.py)
+#define housekeeping_raw 1
+//version of the sensor constants used by the ground calibration (NTC R, R_25, B, Vdd, Vref, Rsense,
+//Aipropri), to be increased when they change and added to CDHdaemon/calibration.py
+#define SENSOR_CONFIG_VERSION 1
+
+//largest payload of the link to the CDH (SDL_MAX_PAY_LEN on the CDH side), every message sent
+//to it must fit
+#define CDH_MAX_PAY_LEN 128
+
 #define stack_size 4096
 #define stack_size1 8192
 
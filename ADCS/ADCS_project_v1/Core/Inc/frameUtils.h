@@ -36,6 +36,53 @@ typedef struct{
 	head_tail_policy policy;	///< policy for partial heads' or tails' bytes inside frame
 } search_frame_rule;
 
+/**
+ * @brief Maximum head/tail sequence length of a compiled rule.
+ * 
+ * Rules with longer sequences can't be compiled with compileFrameRule(),
+ * searchFrame() and searchFrameAdvance() will still accept them but they
+ * will fall back to a slower generic search.
+ */
+#define FRAMEUTILS_MAX_PATT_LEN	16
+
+/**
+ * @brief Compiled directives for frame search.
+ * 
+ * Built from a search_frame_rule by compileFrameRule(), contains the
+ * matching automatons of head and tail sequences so that they don't need
+ * to be computed again at each search.
+ * The user should never touch its members directly.
+ */
+typedef struct{
+	search_frame_rule rule;		///< copy of the compiled rule (head and tail arrays are NOT copied)
+	uint32_t tailLen;			///< tail length used for matching (0 in tail-less mode)
+	uint32_t lookAhead;			///< number of bytes needed after a byte to take a decision on it
+	uint8_t headFail[FRAMEUTILS_MAX_PATT_LEN];	///< KMP failure function of head sequence
+	uint8_t tailFail[FRAMEUTILS_MAX_PATT_LEN];	///< KMP failure function of tail sequence
+	uint8_t forbidden[32];		///< bitmap of the bytes which are part of head or tail (used with hard policy)
+} compiled_frame_rule;
+
+/**
+ * @brief Context of a resumable frame search.
+ * 
+ * Used by searchFrameResume() and searchFrameAdvanceResume() to remember
+ * the progress of the search between calls, so that the bytes already
+ * scanned aren't scanned again at each call.
+ * The user should never touch its members directly, the context only needs
+ * to be reset with searchContextReset() before its first use.
+ */
+typedef struct{
+	uint8_t valid;			///< 0 if the search must restart from the stream head
+	uint8_t state;			///< search state (waiting for a head or inside a frame)
+	uint32_t startPos;		///< virtual index of the last head byte of the current frame
+	uint32_t nextHead;		///< first head end found inside the current frame (0 if none)
+	uint32_t scanIndex;		///< virtual index of the next byte to be scanned
+	uint8_t* buff;			///< stream memory array at the end of the last search
+	uint32_t streamStart;	///< stream start index at the end of the last search
+	uint32_t streamElem;	///< stream number of elements at the end of the last search
+	compiled_frame_rule* compiled;	///< compiled rule used in the last search
+} search_frame_context;
+
 /**
  * @brief Function to search a frame inside a circular buffer.
  * 
@@ -171,6 +218,85 @@ typedef struct{
  */
 uint32_t searchFrame(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule);
 
+/**
+ * @brief Function to compile a frame search rule.
+ * 
+ * The compiled rule can be passed to searchFrameCompiled() and
+ * searchFrameAdvanceCompiled(), which will then search frames with a single
+ * forward pass over the stream (head and tail sequences are matched by KMP
+ * automatons, and single byte heads are searched with memchr()), instead of
+ * checking every byte against all the possible shifts of head and tail
+ * sequences.
+ * searchFrame() and searchFrameAdvance() compile the rule at each call, so
+ * compiling it once is useful when the same rule is used many times.
+ * NB. the head and tail arrays of rule are not copied, so they must remain
+ * valid (and unchanged) for all the time the compiled rule is used, if they
+ * change the rule should be compiled again.
+ * The function will also correct an eventual policy error of rule, as
+ * searchFrame() does.
+ * 
+ * @param compiled compiled rule to be filled
+ * @param rule set of rules to be compiled
+ * @return uint8_t 0 if the rule can't be compiled (NULL or empty head or
+ *                 sequences longer than FRAMEUTILS_MAX_PATT_LEN), !0 otherwise
+ */
+uint8_t compileFrameRule(compiled_frame_rule* compiled, search_frame_rule* rule);
+
+/**
+ * @brief Function to search a frame inside a circular buffer with a compiled
+ *        rule.
+ * 
+ * Same as searchFrame() but with a rule previously compiled by
+ * compileFrameRule(), the search is linear in the stream length.
+ * 
+ * @param stream circular buffer where to search the frame 
+ * @param frame output circular buffer where the found frame will be returned
+ * @param compiled compiled set of rules to configure the search
+ * @return uint32_t starting virtual index of found frame (first head byte)
+ *                  otherwise it will return stream->elemNum
+ */
+uint32_t searchFrameCompiled(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled);
+
+/**
+ * @brief Function to reset a resumable search context.
+ * 
+ * After the reset the next search with the context will start from the
+ * stream head.
+ * 
+ * @param ctx search context to be reset
+ */
+void searchContextReset(search_frame_context* ctx);
+
+/**
+ * @brief Function to search a frame inside a circular buffer, resuming the
+ *        search from where the previous call stopped.
+ * 
+ * Same as searchFrameCompiled() but the progress of the search is saved
+ * inside ctx, so that at the next call only the newly arrived bytes are
+ * scanned (apart from the last few ones, whose outcome could depend on the
+ * bytes that were still to be received). The result is always the same that
+ * searchFrameCompiled() would return on the current stream content.
+ * 
+ * The context stays valid if, between two calls, bytes are pushed to the
+ * stream tail and/or pulled from the stream head (the shift is detected from
+ * the stream start index). Any other operation on the stream (cBuffFlush(),
+ * cBuffCut(), pushes overwriting old bytes, pulling all the bytes and pushing
+ * them again...), or a change of the compiled rule, requires the context to
+ * be reset with searchContextReset(), the search then starts again from the
+ * stream head. A changed compiled rule pointer or stream memory array are
+ * detected automatically.
+ * When a frame is found the context is reset, so the next call will search
+ * again from the stream head.
+ * 
+ * @param stream circular buffer where to search the frame 
+ * @param frame output circular buffer where the found frame will be returned
+ * @param compiled compiled set of rules to configure the search
+ * @param ctx search context, reset before the first call
+ * @return uint32_t starting virtual index of found frame (first head byte)
+ *                  otherwise it will return stream->elemNum
+ */
+uint32_t searchFrameResume(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, search_frame_context* ctx);
+
 /**
  * @brief Flag to not perform any shift of buffer.
  * 
@@ -268,4 +394,42 @@ uint32_t searchFrame(circular_buffer_handle* stream, circular_buffer_handle* fra
  */
 uint8_t searchFrameAdvance(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule, uint8_t shiftFlags);
 
+/**
+ * @brief Function to search a frame inside a circular buffer with a compiled
+ *        rule and automatically advance the buffer.
+ * 
+ * Same as searchFrameAdvance() but with a rule previously compiled by
+ * compileFrameRule().
+ * 
+ * @param stream circular buffer where to search the frame and which will be
+ *               automatically advanced
+ * @param frame output circular buffer where the found frame will be returned
+ * @param compiled compiled set of rules to configure the search
+ * @param shiftFlags flags to configure the advance functionality
+ * @return uint8_t 0 if no frame was found, !0 otherwise
+ */
+uint8_t searchFrameAdvanceCompiled(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, uint8_t shiftFlags);
+
+/**
+ * @brief Function to search a frame inside a circular buffer, resuming the
+ *        search from where the previous call stopped, and automatically
+ *        advance the buffer.
+ * 
+ * Same as searchFrameAdvanceCompiled() but with the resumable search of
+ * searchFrameResume(), the bytes shifted out by the function are taken into
+ * account by the context.
+ * This is meant to be called while polling a stream that is filled byte by
+ * byte: the cost of each call is then proportional to the new bytes and
+ * not to the whole buffer.
+ * 
+ * @param stream circular buffer where to search the frame and which will be
+ *               automatically advanced
+ * @param frame output circular buffer where the found frame will be returned
+ * @param compiled compiled set of rules to configure the search
+ * @param ctx search context, reset before the first call
+ * @param shiftFlags flags to configure the advance functionality
+ * @return uint8_t 0 if no frame was found, !0 otherwise
+ */
+uint8_t searchFrameAdvanceResume(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, search_frame_context* ctx, uint8_t shiftFlags);
+
 #endif
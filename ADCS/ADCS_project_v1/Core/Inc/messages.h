@@ -28,6 +28,13 @@ typedef struct {
 	float b_x;
 	float b_y;
 	float b_z;
+	float q_0;
+	float q_1;
+	float q_2;
+	float q_3;
+	float free_acc_x;
+	float free_acc_y;
+	float free_acc_z;
 	float DC_x;
 	float DC_y;
 	float DC_z;
@@ -51,6 +58,54 @@ typedef struct {
 	uint32_t ticktime;
 }__attribute__((packed)) housekeepingADCS;
 
+// message name: imuCaptureADCS code: 23
+#define IMUCAPTUREADCS_CODE 23
+typedef struct {
+	uint8_t code;
+	uint32_t offset;
+	uint32_t total;
+	uint16_t len;
+	uint8_t data[117];
+}__attribute__((packed)) imuCaptureADCS;
+
+// message name: housekeepingRawADCS code: 24
+#define HOUSEKEEPINGRAWADCS_CODE 24
+typedef struct {
+	uint8_t code;
+	uint8_t config;
+	uint16_t temperatureRAW[8];
+	uint16_t currentRAW[5];
+	uint32_t ticktime;
+}__attribute__((packed)) housekeepingRawADCS;
+
+// message name: currentStatsADCS code: 25
+#define CURRENTSTATSADCS_CODE 25
+typedef struct {
+	uint8_t code;
+	float currentMean[5];
+	float currentRms[5];
+	float currentMax[5];
+	uint16_t currentOver[5];
+	uint32_t currentCrossings[5];
+	uint16_t currentScans;
+	uint32_t ticktime;
+}__attribute__((packed)) currentStatsADCS;
+
+// message name: currentStatsRawADCS code: 26
+#define CURRENTSTATSRAWADCS_CODE 26
+typedef struct {
+	uint8_t code;
+	uint8_t config;
+	uint16_t currentMinRAW[5];
+	uint16_t currentMaxRAW[5];
+	uint16_t currentMeanRAW[5];
+	uint16_t currentRmsRAW[5];
+	uint16_t currentOver[5];
+	uint32_t currentCrossings[5];
+	uint16_t currentScans;
+	uint32_t ticktime;
+}__attribute__((packed)) currentStatsRawADCS;
+
 // message name: setOpmodeADCS code: 0
 #define SETOPMODEADCS_CODE 0
 typedef struct {
@@ -76,4 +131,11 @@ typedef struct {
 	float dtheta_z;
 }__attribute__((packed)) setAttitudeADCS;
 
+// message name: imuCaptureCmdADCS code: 2
+#define IMUCAPTURECMDADCS_CODE 2
+typedef struct {
+	uint8_t code;
+	uint8_t command;
+}__attribute__((packed)) imuCaptureCmdADCS;
+
 #endif
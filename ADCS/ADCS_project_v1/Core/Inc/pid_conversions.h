@@ -56,6 +56,9 @@ typedef struct{
 
   float B[3];  //TODO be updated at each Current reading		Dynamic vector  	Current sensor reading
 
+  float q_Measured[4];		//Updated at each IMU reading (orientation profiles)		Dynamic vector		MTi orientation quaternion
+  uint8_t q_Valid;			//1 if q_Measured comes from the last IMU reading
+
 
 
 } PID_Inputs_struct;
@@ -23,11 +23,31 @@ typedef struct{
 	float gyro_msr[3];
 	float mag_msr[3];
 	float acc_msr[3];
+	float quat_msr[4];		//MTi orientation quaternion (q0 q1 q2 q3)
+	float free_acc_msr[3];	//MTi free acceleration (gravity removed, earth frame)
+	uint8_t fused;			//1 if quat_msr and free_acc_msr are valid (orientation profiles)
 } imu_queue_struct;
 
+/* IMU samples are passed from IMU Task to Control and OBC Task in blocks of IMU_BLOCK_SAMPLES
+ * samples taken from a static pool, the same block is posted to every consumer queue and goes back
+ * to the pool when the last consumer releases it (reference count, no locks and no heap)
+ * */
+#define IMU_BLOCK_SAMPLES	16	//samples in a block
+#define IMU_BLOCK_NUM		16	//blocks in the pool (max 32)
+#define IMU_BLOCK_MAX_AGE	50	//ms after which a block that is not full is sent anyway
+
+typedef struct{
+	imu_queue_struct sample[IMU_BLOCK_SAMPLES];	//oldest first
+	uint32_t num;		//valid samples
+	uint32_t tick;		//reception tick (ms) of the first sample
+	uint32_t refs;		//consumers still holding the block
+} imu_block;
+
 typedef struct{
 	float current[NUM_ACTUATORS];
 	float temperature[NUM_TEMP_SENS];
+	uint16_t currentRAW[NUM_ACTUATORS];		//12 bit codes of ADC1
+	uint16_t temperatureRAW[NUM_TEMP_SENS];	//16 bit codes of the external ADC
 } Current_Temp_Struct;
 
 //Functions
@@ -69,6 +89,13 @@ void receive_IMUqueue_OBC(void *event,void *attitude);
   * @retval none
   */
 void receive_Current_Tempqueue_OBC(void *event,void *current_temp_struct);
+/**
+  * @brief  Function to handle received Temperatures and currents queue(sent by Check Task) elements arriving to OBC Task, raw codes only (housekeeping_raw)
+  * @param	event First pointer to void variable
+  * @param	current_temp_struct Second pointer to void variable (housekeepingRawADCS)
+  * @retval none
+  */
+void receive_Current_Tempqueue_raw_OBC(void *event,void *current_temp_struct);
 /**
   * @brief  
   * @param	event First pointer to void variable
@@ -77,4 +104,29 @@ void receive_Current_Tempqueue_OBC(void *event,void *current_temp_struct);
   */
 void receive_Attitudequeue_control(void *event,void *attitude_adcs);
 
+/**
+  * @brief  Take an empty IMU block from the pool (lock free, callable by any task)
+  * @retval the block, NULL if the pool is empty
+  */
+imu_block* allocIMUBlock(void);
+/**
+  * @brief  Post an IMU block to the queues of its consumers, the block must not be touched afterwards
+  * @param	block Block taken with allocIMUBlock()
+  * @param	queues Consumer queues
+  * @param	num Number of queues
+  * @retval number of queues the block was posted to (the block goes back to the pool if 0)
+  */
+uint32_t sendIMUBlock(imu_block *block,const osMessageQId *queues,uint32_t num);
+/**
+  * @brief  Release an IMU block received from a queue, it goes back to the pool after the last consumer
+  * @param	block Received block
+  * @retval none
+  */
+void releaseIMUBlock(imu_block *block);
+/**
+  * @brief  Number of IMU blocks that could not be taken from the pool since boot
+  * @retval misses
+  */
+uint32_t getIMUBlockMisses(void);
+
 #endif /* INC_QUEUE_STRUCTS_H_ */
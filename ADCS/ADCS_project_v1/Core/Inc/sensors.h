@@ -4,6 +4,8 @@
 //on the ADCS board
 #include "spi.h"
 #include "UARTdriver.h"
+#include "SPIdriver.h"
+#include "timers.h"
 #include <math.h>
 #include <stdio.h> //for printf()
 #include "constants.h"
@@ -24,11 +26,65 @@ typedef struct{
   float Vdd;
 }T_formula_const;
 
+/* NTC lookup tables: raw code to temperature without log/pow at run time. For each sensor
+ * init_tempsens_handler() samples the Beta formula (voltage_to_temperature_conv()) at
+ * NTC_LUT_LEN evenly spaced codes, ntc_code_to_temperature() then interpolates linearly between
+ * the two entries around the code (a shift, a mask and one multiply-add in float).
+ * NTC_LUT_BITS selects the accuracy: 2^NTC_LUT_BITS segments of 2^(N-NTC_LUT_BITS) codes, the
+ * error is divided by 4 for each bit. Largest error against the formula from -40 to 125 degrees
+ * (sensorsBench): 7 bits 0.30, 8 bits 0.08, 9 bits 0.02, 10 bits 0.005 degrees. Tables take
+ * NUM_TEMP_SENS*NTC_LUT_LEN floats (8 KB with 8 bits).
+ * Outside [NTC_LUT_T_MIN, NTC_LUT_T_MAX] (open or shorted sensor) entries are clamped.
+ * */
+#ifndef NTC_LUT_BITS
+#define NTC_LUT_BITS	8
+#endif
+#define NTC_LUT_LEN		((1<<NTC_LUT_BITS)+1)
+#define NTC_LUT_SHIFT	(N-NTC_LUT_BITS)	//codes per segment: 1<<NTC_LUT_SHIFT
+#define NTC_LUT_T_MIN	-80.0f				//degrees
+#define NTC_LUT_T_MAX	200.0f				//degrees
+
 typedef struct{
   float temp[8];
   T_formula_const values;
+  float lut[8][NTC_LUT_LEN];	//temperature at code k<<NTC_LUT_SHIFT (built by init_tempsens_handler())
 
 }Temp_values;
+
+/* NTC acquisition scheduler: the 8 mux channels are converted back to back in single
+ * conversion mode without any task waiting on them. Every step is a transaction on the SPI DMA
+ * queue (SPIdriver.h) chained from the completion of the previous one: select the channel and
+ * start the conversion, read the status register until its RDY bit (the same information of
+ * the DOUT/RDY pin) says that the conversion has ended, read the data register in the same
+ * transfer as its command, then the next channel. The status reads are timed by a one shot
+ * software timer, started NTC_CONV_MS after the conversion start and every NTC_POLL_MS after.
+ * The raw codes of a sweep are published at once and the task is notified only then.
+ * */
+#define NTC_STATUS_RDY		0x80	//status register RDY bit: 1 while the conversion is running
+#define NTC_CONV_MS			10		//ms after the start of a conversion of the first status read
+#define NTC_POLL_MS			2		//ms between the following status reads
+#define NTC_CONV_TIMEOUT_MS	200		//ms after which a conversion is given up and started again
+#define NTC_SWEEP_TIMEOUT_MS	(NUM_TEMP_SENS*NTC_CONV_TIMEOUT_MS)	//longest time of a sweep
+
+typedef enum{
+  ntc_converting,	//conversion running, the timer reads the status
+  ntc_restart		//the timer starts the conversion again (a transaction failed)
+}ntc_state;
+
+typedef struct{
+  SPI_HandleTypeDef *spi;
+  TaskHandle_t task;				//task notified at the end of every sweep
+  TimerHandle_t timer;
+  StaticTimer_t timerBuffer;
+  volatile ntc_state state;
+  volatile uint8_t channel;			//channel being converted
+  volatile uint32_t startTick;		//start of the conversion (ticks)
+  uint16_t raw[NUM_TEMP_SENS];		//codes of the sweep in progress
+  uint16_t sweep[NUM_TEMP_SENS];	//codes of the last complete sweep
+  volatile uint32_t sweeps;			//sweeps of the 8 channels completed
+  volatile uint32_t timeouts;		//conversions given up
+  volatile uint32_t errors;			//transactions failed or refused by the queue
+}ntc_scheduler;
 //FUNCTIONS
 /**
   * @brief  Function to initialize all structure and variables needed for management of ADC(internal and external)
@@ -66,7 +122,76 @@ float ADC_Conversion(SPI_HandleTypeDef *spi_struct,uint8_t mode);
   */
 void voltage_to_temperature_conv(float value,Temp_values *s1,uint8_t i);
 
+/**
+  * @brief  Function to build the lookup tables of the NTCs from the constants in values (called by init_tempsens_handler())
+  * @param	Temp_values Struct with the NTC constants, where the tables are written
+  * @retval none
+  */
+void init_ntc_lut(Temp_values *Temp_values);
+
+/**
+  * @brief  Function to convert a raw code of the external ADC to temperature with the lookup table of a sensor
+  * @param	Temp_values Struct with the lookup tables
+  * @param	i Sensor (0 to 7)
+  * @param	code Raw code of the data register
+  * @retval temperature (degrees)
+  */
+float ntc_code_to_temperature(const Temp_values *Temp_values,uint8_t i,uint16_t code);
+
 
+/**
+  * @brief  Function to convert one NTC channel and update its temperature (blocking SPI calls, it waits
+  * for the end of the conversion; not to be used while the acquisition scheduler runs)
+  * @param	spi_struct Structure needed to handle SPI communication with external ADC
+  * @param	temp_struct Struct with temperatures and NTC constants
+  * @param	counter Channel to convert (0 to 7)
+  * @retval none
+  */
 void get_temperatures(SPI_HandleTypeDef *spi_struct,Temp_values *temp_struct, uint8_t counter);
 
+/**
+  * @brief  Function to start a single conversion of the external ADC on the channel selected by the mux
+  * @param	spi_struct Structure needed to handle SPI communication with external ADC
+  * @retval none
+  */
+void ADC_Start_Conversion(SPI_HandleTypeDef *spi_struct);
+
+/**
+  * @brief  Function to check if the conversion started by ADC_Start_Conversion() has ended
+  * @param	spi_struct Structure needed to handle SPI communication with external ADC
+  * @retval 1 if the data register holds a new result, 0 otherwise
+  */
+uint8_t ADC_Conversion_Ready(SPI_HandleTypeDef *spi_struct);
+
+/**
+  * @brief  Function to read the result of the last conversion
+  * @param	spi_struct Structure needed to handle SPI communication with external ADC
+  * @retval voltage (v)
+  */
+float ADC_Read_Voltage(SPI_HandleTypeDef *spi_struct);
+
+/**
+  * @brief  Function to convert a data register code of the external ADC to voltage
+  * @param	code Raw code
+  * @retval voltage (v)
+  */
+float ADC_Code_To_Voltage(uint16_t code);
+
+/**
+  * @brief  Function to start the NTC acquisition scheduler, it runs by itself from then on
+  * @param	sched Scheduler (static storage, it is used by the interrupts)
+  * @param	spi_struct SPI of the external ADC, added to the SPI driver (addDriver_SPI())
+  * @param	task Task notified (xTaskNotifyGive) at the end of every sweep
+  * @retval none
+  */
+void start_ntc_scheduler(ntc_scheduler *sched,SPI_HandleTypeDef *spi_struct,TaskHandle_t task);
+
+/**
+  * @brief  Function to copy the raw codes of the last complete sweep
+  * @param	sched Scheduler
+  * @param	raw Codes of the 8 channels
+  * @retval number of sweeps completed (0 if raw was not written)
+  */
+uint32_t read_ntc_sweep(ntc_scheduler *sched,uint16_t raw[NUM_TEMP_SENS]);
+
 #endif
@@ -0,0 +1,128 @@
+#ifndef XBUS_H
+#define XBUS_H
+
+/* Streaming decoder for Xbus messages (MTi-2 / MTi-3 imu protocol)
+ * protocol description: https://www.xsens.com/hubfs/Downloads/Manuals/MT_Low-Level_Documentation.pdf
+ *
+ * message format:
+ * | PREAMBLE (0xFA) | BID | MID | LEN | [EXTLEN (2 bytes, if LEN=0xFF)] | DATA (LEN bytes) | CHECKSUM |
+ * the checksum makes the sum of all the bytes after the preamble equal to 0 (modulo 256)
+ *
+ * the bytes received from the line are passed to xbusDecode() in chunks of any size, each byte
+ * is examined once by a state machine with a running checksum (no search, no copies apart from
+ * the data field), every complete and valid message is reported to a callback
+ * a rejected message, because of a length that no message can have (above XBUS_MAX_LEN or the
+ * buffer), rejected as soon as it is known, or of a wrong checksum, means that the preamble was a
+ * data byte: the bytes after it are decoded again, so a real message starting inside is not lost
+ * (the bytes of the message being decoded are kept in the buffer for this, header and checksum too)
+ * */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define XBUS_PREAMBLE	0xFA
+#define XBUS_BID		0xFF	//bus identifier of messages to/from the master
+#define XBUS_EXTLEN		0xFF	//LEN value signaling an extended length message
+#define XBUS_MAX_LEN	2048	//longest data field of a message (extended length)
+#define XBUS_HEADER_LEN	6		//preamble to extended length
+#define XBUS_FRAME_LEN(dataLen) ((dataLen)+XBUS_HEADER_LEN+1)	//buffer needed for messages of dataLen data bytes
+
+//decoder states
+typedef enum{
+	xbus_preamble,
+	xbus_bid,
+	xbus_mid,
+	xbus_len,
+	xbus_extlen_h,
+	xbus_extlen_l,
+	xbus_data,
+	xbus_checksum
+} xbus_state;
+
+//function called for every complete message with a correct checksum
+//ctx is the pointer given to xbusInit(), data is valid until the next call to xbusDecode()
+//if it returns !=0 xbusDecode() stops right after this message
+typedef uint8_t (*xbus_msg_callback)(void* ctx, uint8_t mid, const uint8_t* data, uint16_t len);
+
+//decoder handle, members should not be touched by the user (apart from reading counters)
+typedef struct{
+	xbus_state state;
+	uint8_t mid;
+	uint16_t len;			//data length of the message being decoded
+	uint16_t pos;			//bytes of the message received (header included)
+	uint8_t hdrLen;			//header length of the message being decoded (data offset in buff)
+	uint8_t checksum;		//running checksum (from BID)
+	uint16_t rescanPos;		//bytes of rejected messages still to decode again: buff[rescanPos..rescanEnd)
+	uint16_t rescanEnd;
+	uint8_t* buff;			//message buffer
+	uint16_t buffLen;
+	xbus_msg_callback callback;
+	void* ctx;
+	uint32_t msgCount;			//valid messages decoded
+	uint32_t checksumErrors;	//messages rejected because of a wrong checksum
+	uint32_t lengthErrors;		//headers rejected because of a length longer than the buffer allows (or XBUS_MAX_LEN)
+} xbus_decoder;
+
+//init a decoder with the buffer where to store messages (buff, buffLen bytes: XBUS_FRAME_LEN(n) for
+//messages up to n data bytes, longer ones are dropped) and the callback (with its ctx pointer) to
+//report messages, without a buffer of at least XBUS_FRAME_LEN(0) bytes nothing is decoded
+void xbusInit(xbus_decoder* dec, uint8_t* buff, uint16_t buffLen, xbus_msg_callback callback, void* ctx);
+
+//change the callback (and ctx) of a decoder
+void xbusSetCallback(xbus_decoder* dec, xbus_msg_callback callback, void* ctx);
+
+//drop the message being decoded (and the bytes to decode again), the next byte will be searched as preamble
+void xbusReset(xbus_decoder* dec);
+
+//decode (len) bytes of data, calling the callback for every complete message
+//returns the number of bytes consumed: len, or less if the callback stopped the decoding
+//(the remaining bytes should be passed again in the next call)
+uint32_t xbusDecode(xbus_decoder* dec, const uint8_t* data, uint32_t len);
+
+/* MTData2 data packets
+ * the data field of an MTData2 message is a sequence of {XDI (2 bytes), size (1 byte), payload} entries,
+ * xbusDecodeMTData2() walks them and converts each known output straight into an mtdata2_sample
+ * (big endian to host order), unknown outputs are skipped
+ * outputs are matched on the data identifier and on the payload size: floating point outputs are
+ * supported in float32 precision only (other precisions have a different size and are skipped)
+ * */
+
+#define XBUS_MTDATA2_MID	0x36
+
+//data identifiers (group and type, the format bits are ignored)
+#define XDI_TYPE_MASK			0xFFF0
+#define XDI_SAMPLE_TIME_FINE	0x1060
+#define XDI_QUATERNION			0x2010
+#define XDI_ACCELERATION		0x4020
+#define XDI_FREE_ACCELERATION	0x4030
+#define XDI_RATE_OF_TURN		0x8020
+#define XDI_MAGNETIC_FIELD		0xC020
+#define XDI_STATUS_WORD			0xE020
+
+//flags of the outputs found in a packet (mtdata2_sample.fields)
+#define MTDATA2_SAMPLE_TIME_FINE	(1U<<0)
+#define MTDATA2_QUATERNION			(1U<<1)
+#define MTDATA2_ACCELERATION		(1U<<2)
+#define MTDATA2_RATE_OF_TURN		(1U<<3)
+#define MTDATA2_MAGNETIC_FIELD		(1U<<4)
+#define MTDATA2_STATUS_WORD			(1U<<5)
+#define MTDATA2_FREE_ACCELERATION	(1U<<6)
+
+//decoded MTData2 packet
+typedef struct{
+	uint32_t fields;			//outputs found in the last decoded packet (MTDATA2_xxx flags)
+	uint32_t sampleTimeFine;	//sample time (10 kHz counter)
+	uint32_t statusWord;		//status word
+	float quaternion[4];		//orientation quaternion (q0 q1 q2 q3)
+	float acceleration[3];		//calibrated acceleration (m/s^2)
+	float freeAcceleration[3];	//acceleration without gravity, in the earth frame (m/s^2)
+	float rateOfTurn[3];		//calibrated rate of turn (rad/s)
+	float magneticField[3];		//calibrated magnetic field (normalized units)
+} mtdata2_sample;
+
+//decode the data field (data, len bytes) of an MTData2 message inside sample
+//sample->fields is set with the outputs found, the other members are left untouched
+//returns 1 in case of success, 0 if the entries do not match the data length (malformed packet)
+uint8_t xbusDecodeMTData2(const uint8_t* data, uint16_t len, mtdata2_sample* sample);
+
+#endif
@@ -1,4 +1,6 @@
 #include "MTi1.h"
+#include <math.h>
+#include <string.h>
 
 #ifdef DEBUG_MODE
 
@@ -8,13 +10,16 @@
 
 #define IMU_ACK_DELAY 100	//maximum time to wait for ack
 #define IMU_CONFIG_RETRY 2 //number of times configuration commands will be sent if ack is not received
+#define IMU_WAKEUP_DELAY 1000	//maximum time to wait for the WakeUp message after a reset
+#define IMU_STREAM_CHECK_DELAY 50	//time spent listening to the imu before configuring it
+#define IMU_SAMPLE_TIME_FREQ 10000	//sample time fine clock (Hz)
 
 
 //structure to pass message data
 //(excluding preamble, bid and crc)
 typedef struct{
 	uint8_t mid;
-	uint8_t len;
+	uint16_t len;
 	uint8_t* data;
 } imu_packet_struct;
 
@@ -28,30 +33,163 @@ typedef struct{
 #define IMU_SET_OCONFIG_ACK_MID		0xC1
 #define IMU_GOTO_MEAS_MID 			0x10
 #define IMU_GOTO_MEAS_ACK_MID		0x11
-#define IMU_DATA_PACKET_MID 		0x36
+#define IMU_SET_BAUD_MID			0x18
+#define IMU_SET_BAUD_ACK_MID		0x19
+#define IMU_RESET_MID				0x40
+#define IMU_RESET_ACK_MID			0x41
+#define IMU_WAKEUP_MID				0x3E
+#define IMU_WAKEUP_ACK_MID			0x3F
+#define IMU_DATA_PACKET_MID 		XBUS_MTDATA2_MID
 //LEN definitions (for messages with LEN!=0)
-#define IMU_SET_OCONFIG_LEN 		sizeof(outputConfigData)
-#define IMU_SET_OCONFIG_ACK_LEN 	sizeof(outputConfigAckData)
-#define IMU_DATA_PACKET_LEN			45
-//data definitions
-#define IMU_OUTPUT_CONFIG 		0x80, 0x20, 0x04, 0x80, /* Rate of turn */ \
-								0xC0, 0x20, 0x04, 0x80, /* Magnetic Field */\
-								0x40, 0x20, 0x04, 0x80 /*Accelerometer data*/
-
-#define IMU_OUTPUT_CONFIG_ACK 	0x80, 0x20, 0x04, 0x80, /* Rate of turn */ \
-								0xC0, 0x20, 0x04, 0x80, /* Magnetic Field */\
-								0x40, 0x20, 0x04, 0x80 /*Accelerometer data*/
-//others
-#define IMU_DATA_GYRO_INDEX	3	//starting index (inside data) for gyroscope data
-#define IMU_DATA_MAG_INDEX	18	//starting index (inside data) of magnetometer data
-#define IMU_DATA_ACC_INDEX 33 //starting index (inside data) of accelerometer data
-
-const uint8_t outputConfigData[]=		{IMU_OUTPUT_CONFIG};
-const uint8_t outputConfigAckData[]=	{IMU_OUTPUT_CONFIG_ACK};
-
-circular_buffer_handle rxcBuff; //rx and search buffer
-uint8_t rxBuffer[IMU_BUFFER_LEN]; //memory buffer for rxBuff
-uint8_t tmpBuff[IMU_BUFFER_LEN]; //temporary buffer where to store received packets
+#define IMU_SET_BAUD_LEN			1
+#define IMU_ANY_LEN					0xFFFF	//format len matching messages of any length
+//output configuration: {XDI, rate} couples (big endian), sample time fine in every packet,
+//magnetic field up to IMU_MAG_MAX_RATE, the other outputs at the profile rate
+#define IMU_RATE_EVERY_PACKET		0xFFFF
+#define IMU_RAW_FIELDS				(MTDATA2_SAMPLE_TIME_FINE | MTDATA2_RATE_OF_TURN | MTDATA2_MAGNETIC_FIELD | MTDATA2_ACCELERATION)
+#define IMU_ORIENTATION_FIELDS		(IMU_RAW_FIELDS | MTDATA2_QUATERNION | MTDATA2_FREE_ACCELERATION)
+
+//outputs that profiles can request, in configuration order
+static const struct{
+	uint32_t field;
+	uint16_t xdi;
+} _imuOutputs[]={
+	{MTDATA2_SAMPLE_TIME_FINE,	XDI_SAMPLE_TIME_FINE},
+	{MTDATA2_RATE_OF_TURN,		XDI_RATE_OF_TURN},
+	{MTDATA2_MAGNETIC_FIELD,	XDI_MAGNETIC_FIELD},
+	{MTDATA2_ACCELERATION,		XDI_ACCELERATION},
+	{MTDATA2_QUATERNION,		XDI_QUATERNION},
+	{MTDATA2_FREE_ACCELERATION,	XDI_FREE_ACCELERATION},
+};
+
+#define IMU_OUTPUT_MAX				(sizeof(_imuOutputs)/sizeof(_imuOutputs[0]))
+
+//output rate profile
+typedef struct{
+	uint16_t rate;		//output rate (Hz)
+	uint32_t baud;		//uart baud rate
+	uint8_t baudCode;	//SetBaudrate code of baud
+	uint32_t fields;	//outputs (MTDATA2_xxx flags)
+} imu_profile_def;
+
+static const imu_profile_def _imuProfiles[IMU_PROFILE_NUM]={
+	[imu_profile_100hz]={100,	115200,	0x02,	IMU_RAW_FIELDS},
+	[imu_profile_200hz]={200,	230400,	0x01,	IMU_RAW_FIELDS},
+	[imu_profile_400hz]={400,	460800,	0x00,	IMU_RAW_FIELDS},
+	[imu_profile_100hz_orientation]={100,	230400,	0x01,	IMU_ORIENTATION_FIELDS},
+	[imu_profile_200hz_orientation]={200,	460800,	0x00,	IMU_ORIENTATION_FIELDS},
+};
+
+uint32_t imuRate=100; //output rate of the configured profile
+volatile uint8_t imuWokeUp=0; //flag to signal that the WakeUp message was received
+
+xbus_decoder imuDecoder; //decoder of the messages received from the imu
+uint8_t imuMsgBuff[XBUS_FRAME_LEN(IMU_MSG_MAX_LEN)]; //last decoded message (data field passed to the callbacks)
+uint8_t imuRxChunk[IMU_BUFFER_LEN]; //bytes read from the driver
+uint32_t imuRxChunkLen=0; //number of bytes in imuRxChunk
+uint32_t imuRxChunkPos=0; //number of bytes of imuRxChunk already decoded
+
+imu_sample imuSampleRing[IMU_SAMPLE_RING_LEN]; //last decoded samples
+volatile uint32_t imuSampleSeq=0; //number of samples stored (sequence number of the next one)
+uint32_t imuMalformed=0; //malformed data packets
+
+#define IMU_CAPTURE_HEADER_LEN 6	//tick and length of a capture record
+uint8_t imuCaptureRing[IMU_CAPTURE_LEN]; //raw capture records
+uint32_t imuCaptureHead=0; //bytes written in the capture ring since start (next write position)
+uint32_t imuCaptureTail=0; //position of the oldest record (same counting as imuCaptureHead)
+volatile uint8_t imuCapturing=0; //flag to signal that the capture is running
+
+//structure to pass the wanted message to the decoder callback
+typedef struct{
+	imu_packet_struct* pckt;	//where to place the message (can be NULL)
+	imu_packet_struct* format;	//wanted mid and len (NULL for any message)
+	uint8_t found;				//flag to signal that the message was found
+} imu_msg_request;
+
+//drop the bytes read from the driver and not yet decoded, and the partially decoded message
+static void flushIMU(void){
+	xbusReset(&imuDecoder);
+	imuRxChunkLen=0;
+	imuRxChunkPos=0;
+}
+
+//copy len bytes of the capture ring from position pos (imuCaptureHead counting) inside buff
+static void copyFromCapture(uint32_t pos, uint8_t* buff, uint32_t len){
+	for(uint32_t b=0;b<len;b++) buff[b]=imuCaptureRing[(pos+b)%IMU_CAPTURE_LEN];
+}
+
+//append a record with the bytes read from the uart to the capture ring, if capturing
+static void captureIMUBytes(const uint8_t* data, uint32_t len){
+	if(!imuCapturing || len==0) return;
+
+	uint8_t header[IMU_CAPTURE_HEADER_LEN];
+	uint32_t tick=HAL_GetTick();
+	for(uint32_t b=0;b<4;b++) header[b]=(uint8_t)(tick>>(8*b));
+	header[4]=(uint8_t)len;
+	header[5]=(uint8_t)(len>>8);
+	uint32_t recordLen=IMU_CAPTURE_HEADER_LEN+len;
+
+	//short critical section (a chunk is at most IMU_BUFFER_LEN bytes), readers may be in other tasks
+	taskENTER_CRITICAL();
+	//dropping the oldest records until the new one fits
+	while(imuCaptureHead+recordLen-imuCaptureTail>IMU_CAPTURE_LEN){
+		uint8_t oldLen[2];
+		copyFromCapture(imuCaptureTail+4, oldLen, 2);
+		imuCaptureTail+=IMU_CAPTURE_HEADER_LEN+(oldLen[0] | (oldLen[1]<<8));
+	}
+	for(uint32_t b=0;b<recordLen;b++){
+		imuCaptureRing[(imuCaptureHead+b)%IMU_CAPTURE_LEN]=(b<IMU_CAPTURE_HEADER_LEN) ? header[b] : data[b-IMU_CAPTURE_HEADER_LEN];
+	}
+	imuCaptureHead+=recordLen;
+	taskEXIT_CRITICAL();
+}
+
+//decode a data packet and store it in the sample ring
+//returns 1 if stored, 0 if the packet is malformed
+static uint8_t storeIMUSample(const uint8_t* data, uint16_t len){
+	imu_sample sample;
+
+	if(!xbusDecodeMTData2(data, len, &sample.data)){
+		imuMalformed++;
+		return 0;
+	}
+	sample.tick=HAL_GetTick();
+
+	//the slot is written in a critical section, as readers of other tasks may be copying it
+	taskENTER_CRITICAL();
+	sample.seq=imuSampleSeq;
+	imuSampleRing[sample.seq&(IMU_SAMPLE_RING_LEN-1)]=sample;
+	imuSampleSeq=sample.seq+1;
+	taskEXIT_CRITICAL();
+
+	return 1;
+}
+
+//decoder callback of the continuous acquisition, stores data packets and never stops
+static uint8_t onIMUAcquire(void* ctx, uint8_t mid, const uint8_t* data, uint16_t len){
+	if(mid==IMU_DATA_PACKET_MID) storeIMUSample(data, len);
+	if(mid==IMU_WAKEUP_MID) imuWokeUp=1;
+	return 0;
+}
+
+//decoder callback, stops the decoding when the wanted message is found
+//data packets are stored in the sample ring in any case
+static uint8_t onIMUMsg(void* ctx, uint8_t mid, const uint8_t* data, uint16_t len){
+	imu_msg_request* req=(imu_msg_request*)ctx;
+
+	if(mid==IMU_DATA_PACKET_MID && !storeIMUSample(data, len)) return 0; //malformed packet, skipped
+	if(mid==IMU_WAKEUP_MID) imuWokeUp=1;
+
+	if(req->format!=NULL && (mid!=req->format->mid || (req->format->len!=IMU_ANY_LEN && len!=req->format->len))) return 0; //skip other messages
+
+	if(req->pckt!=NULL){
+		req->pckt->mid=mid;
+		req->pckt->len=len;
+		req->pckt->data=(uint8_t*)data;
+	}
+	req->found=1;
+	return 1;
+}
 
 //function to compute message checksum
 static uint8_t computeChecksum(imu_packet_struct * pckt){
@@ -73,7 +211,8 @@ static void sendMsg(UART_HandleTypeDef* IMUhandle, imu_packet_struct * pckt){
 	tmp=IMU_BID;
 	sendDriver_UART(IMUhandle, &tmp, 1);
 	sendDriver_UART(IMUhandle, &pckt->mid, 1);
-	sendDriver_UART(IMUhandle, &pckt->len, 1);
+	tmp=(uint8_t)pckt->len; //commands are never extended length
+	sendDriver_UART(IMUhandle, &tmp, 1);
 	sendDriver_UART(IMUhandle, pckt->data, pckt->len);
 	tmp=computeChecksum(pckt);
 	sendDriver_UART(IMUhandle, &tmp, 1);
@@ -82,120 +221,50 @@ static void sendMsg(UART_HandleTypeDef* IMUhandle, imu_packet_struct * pckt){
 //function to receive next message, returns 1 if something was
 //received, otherwise returns 0
 //places the eventually received message inside pckt, if this is not needed pckt can be set NULL
-//if checkCRC is !=0 the message CRC will be checked to approve the message
-//NB. not checking crc is risky for many reasons but one of the worst is that
-//len field could arrive corrupted so always check that len is the expected one
-//format can be passed if a specific mid and len are required, otherwise can be left to NULL
-//the buffer is automatically shifted out and filled at every call, user can eventually
-//flush buffers before calling to get most recent messages
-static uint8_t receiveMsg(UART_HandleTypeDef* IMUhandle, imu_packet_struct * pckt, imu_packet_struct* format, uint8_t checkCRC, uint32_t timeout){
+//(pckt->data points to the decoder buffer, valid until the next call)
+//format can be passed if a specific mid and len are required (other messages are skipped, len can be
+//IMU_ANY_LEN to match only the mid), otherwise can be left to NULL
+//the checksum of every message is always checked
+//every byte read from the driver is decoded once: the ones following the returned message are kept
+//for the next call, user can eventually flush buffers before calling to get most recent messages
+static uint8_t receiveMsg(UART_HandleTypeDef* IMUhandle, imu_packet_struct * pckt, imu_packet_struct* format, uint32_t timeout){
 	uint32_t startTick=HAL_GetTick();
-	uint8_t len=0; //temporary variable to store target number of bytes to search
-	uint8_t mid=0; //temporary variable to store message id
-
-	typedef enum{
-		_header,
-		_packet
-	} search_phase;
-
-	search_phase phase=_header;
-
-	uint8_t headTail[4]={IMU_PREAMBLE,IMU_BID,0,0};
 
-	search_frame_rule rule;
-
-	rule.head=(uint8_t *) headTail;
-	rule.tail=NULL;
-	rule.tailLen=0;
-	rule.maxLen=0;
-	rule.policy=soft;
-
-	circular_buffer_handle foundPckt;
-	imu_packet_struct tmpPckt;
-	tmpPckt.data=tmpBuff;
+	imu_msg_request req;
+	req.pckt=pckt;
+	req.format=format;
+	req.found=0;
+	xbusSetCallback(&imuDecoder, onIMUMsg, &req);
 
 	do{
-		//filling buffer until is full or no more bytes available
-		while(!cBuffFull(&rxcBuff)){ //fill buffer with new packets
-			uint8_t c;
-			if(receiveDriver_UART(IMUhandle, &c, 1)){
-				cBuffPush(&rxcBuff, &c, 1,1);
-			}else{
-				break;
-			}
-		}
+		//decoding the bytes not yet decoded
+		imuRxChunkPos+=xbusDecode(&imuDecoder, &imuRxChunk[imuRxChunkPos], imuRxChunkLen-imuRxChunkPos);
+		if(req.found) return 1;
 
-		//analyzing buffer
-		if(phase==_header){ //if we are searching an header
+		//reading new bytes, blocking (until timeout) until some arrive instead of polling
+		uint32_t elapsed=HAL_GetTick()-startTick;
+		if(elapsed>=timeout) break;
+		imuRxChunkLen=receiveDriver_UART_Wait(IMUhandle, imuRxChunk, sizeof(imuRxChunk), 1, pdMS_TO_TICKS(timeout-elapsed));
+		imuRxChunkPos=0;
+		captureIMUBytes(imuRxChunk, imuRxChunkLen);
 
-			if(format!=NULL){	//if format specified
-				mid=format->mid;
-				len=format->len;
-				phase=_packet;
-				continue;	//jump to packet search
-			}
-
-			//search a complete xbus header (shiftOut disabled)
-			rule.headLen=2;
-			rule.minLen=2;
-			if(searchFrameAdvance(&rxcBuff, &foundPckt, &rule, SHIFTOUT_FULL | SHIFTOUT_CURR | SHIFTOUT_FAST)){	//if we found a header, get MID and LEN fields
-				mid=foundPckt.buff[2];
-				len=foundPckt.buff[3];
-				phase=_packet;
-			}
-		}else if(phase==_packet){
-			headTail[2]=mid;
-			headTail[3]=len;
-			rule.headLen=4;
-			rule.minLen=len+1;	//len+1 to house CRC
-
-			//search for the complete packet with shiftOut active
-			if(searchFrameAdvance(&rxcBuff, &foundPckt, &rule, SHIFTOUT_FULL | SHIFTOUT_NEXT | SHIFTOUT_FAST)){
-#if enable_printf
-				printf("RAW IMU FRAME:\n");
-#endif
-				//cBuffPrint(&foundPckt,PRINTBUFF_HEX | PRINTBUFF_NOEMPTY);
-
-				tmpPckt.mid=mid;
-				tmpPckt.len=len;
-				if(len!=0) cBuffRead(&foundPckt,tmpPckt.data,foundPckt.elemNum,0,4);
-
-				if(pckt!=NULL){ //if we want the packet to be output
-					pckt->mid=mid;
-					pckt->len=len;
-					if(len!=0) pckt->data=tmpPckt.data;
-				}
-
-				//if crc must be checked
-				if(checkCRC){
-					if(cBuffReadByte(&foundPckt,1,0)==computeChecksum(&tmpPckt)){	//if correct crc
-						return 1;
-					}else phase=_header;	//continue search from next byte
-				}else return 1;
-#if enable_printf
-				printf("Checksum verification failed!\n");
-#endif
-			}
-		}else{
-			phase=_header;	//in case of any state error, return to default state
-		}
-
-	}while((HAL_GetTick()-startTick) < timeout);
+	}while(1);
 
 	return 0;
 }
 
 //function to send command to imu and wait for the right acknowledge
 //the ack should be the next received or the transaction is considered failed
+//on success ack is filled with the received message (len and data, valid until the next receive)
 //returns 1 if ack received, 0 otherwise
 static uint8_t imuAckTransaction(UART_HandleTypeDef* IMUhandle, imu_packet_struct * cmd, imu_packet_struct * ack, uint32_t timeout){
 	if(cmd==NULL || ack==NULL) return 0;
 
-	cBuffFlush(&rxcBuff); //flush circular buffer
+	flushIMU(); //flush local buffers
 
 	sendMsg(IMUhandle, cmd);
 
-    if(receiveMsg(IMUhandle, NULL, ack, 1, timeout)){
+    if(receiveMsg(IMUhandle, ack, ack, timeout)){
     	return 1;
     }else{
     	return 0;
@@ -203,37 +272,185 @@ static uint8_t imuAckTransaction(UART_HandleTypeDef* IMUhandle, imu_packet_struc
 
 }
 
+//send a command with retries until its ack is received, returns 1 if acked, 0 otherwise
+static uint8_t imuCommand(UART_HandleTypeDef* IMUhandle, imu_packet_struct * cmd, imu_packet_struct * ack){
+	for(uint32_t retry=0;retry<IMU_CONFIG_RETRY;retry++){
+		if(imuAckTransaction(IMUhandle,cmd,ack,IMU_ACK_DELAY)) return 1;
+	}
+	return 0;
+}
+
+//put the imu in config mode, if it does not answer at the uart baud rate the ones of the
+//profiles are tried (the imu keeps its baud rate across power cycles)
+//returns 1 in case of success (uart left at the imu rate), 0 otherwise
+static uint8_t imuGoToConfig(UART_HandleTypeDef* IMUhandle){
+	imu_packet_struct cmd={.mid=IMU_GOTO_CONFIG_MID, .len=0};
+	imu_packet_struct ack={.mid=IMU_GOTO_CONFIG_ACK_MID, .len=0};
+
+	if(imuCommand(IMUhandle,&cmd,&ack)) return 1;
+
+	uint32_t baud=IMUhandle->Init.BaudRate;
+	for(uint32_t p=0;p<IMU_PROFILE_NUM;p++){
+		uint32_t q=0;
+		while(q<p && _imuProfiles[q].baud!=_imuProfiles[p].baud) q++;
+		if(_imuProfiles[p].baud==baud || q<p) continue; //rate already tried
+		setBaudDriver_UART(IMUhandle, _imuProfiles[p].baud);
+		if(imuAckTransaction(IMUhandle,&cmd,&ack,IMU_ACK_DELAY)) return 1;
+	}
+
+	setBaudDriver_UART(IMUhandle, baud);
+	return 0;
+}
+
+//change the imu baud rate (in config mode): the new rate is applied by a reset, after which the
+//uart is switched and the imu is brought back to config mode
+//returns 1 in case of success, 0 otherwise
+static uint8_t imuSetBaud(UART_HandleTypeDef* IMUhandle, const imu_profile_def* profile){
+	imu_packet_struct cmd;
+	imu_packet_struct ack;
+	uint8_t code=profile->baudCode;
+
+	cmd.mid=IMU_SET_BAUD_MID;
+	cmd.len=IMU_SET_BAUD_LEN;
+	cmd.data=&code;
+	ack.mid=IMU_SET_BAUD_ACK_MID;
+	ack.len=0;
+	if(!imuCommand(IMUhandle,&cmd,&ack)) return 0;
+
+	cmd.mid=IMU_RESET_MID;
+	cmd.len=0;
+	ack.mid=IMU_RESET_ACK_MID;
+	if(!imuCommand(IMUhandle,&cmd,&ack)) return 0;
+
+	setBaudDriver_UART(IMUhandle, profile->baud);
+	flushIMU();
+
+	//acknowledging the WakeUp message the imu stays in config mode, otherwise it starts measuring
+	//and is brought back to config mode anyway
+	ack.mid=IMU_WAKEUP_MID;
+	ack.len=0;
+	if(receiveMsg(IMUhandle, NULL, &ack, IMU_WAKEUP_DELAY)){
+		cmd.mid=IMU_WAKEUP_ACK_MID;
+		cmd.len=0;
+		sendMsg(IMUhandle, &cmd);
+	}
+
+	return imuGoToConfig(IMUhandle);
+}
+
+//listen to the imu for IMU_STREAM_CHECK_DELAY
+//returns 1 if it is already measuring with the outputs and the rate of the profile (def), checked
+//on consecutive packets (sample time fine steps), 0 otherwise
+//an imu just started is in the WakeUp state: its WakeUp is acknowledged, so it stays in config mode
+static uint8_t imuCheckStream(UART_HandleTypeDef* IMUhandle, const imu_profile_def* def){
+	uint16_t magRate=(def->rate<IMU_MAG_MAX_RATE) ? def->rate : IMU_MAG_MAX_RATE;
+	uint32_t needed=(def->rate+magRate-1)/magRate+1; //packets with all the outputs and one step at least
+	uint32_t startTick=HAL_GetTick();
+	uint32_t fields=0;
+	uint32_t packets=0;
+	uint32_t lastTime=0;
+	imu_packet_struct msg;
+	imu_sample sample;
+
+	do{
+		uint32_t elapsed=HAL_GetTick()-startTick;
+		if(elapsed>=IMU_STREAM_CHECK_DELAY || !receiveMsg(IMUhandle, &msg, NULL, IMU_STREAM_CHECK_DELAY-elapsed)) return 0;
+
+		if(msg.mid==IMU_WAKEUP_MID){
+			imu_packet_struct cmd={.mid=IMU_WAKEUP_ACK_MID, .len=0};
+			sendMsg(IMUhandle, &cmd);
+			return 0;
+		}
+		if(msg.mid!=IMU_DATA_PACKET_MID || !readIMULatest(&sample)) continue;
+
+		if(!(sample.data.fields & MTDATA2_SAMPLE_TIME_FINE)) return 0;
+		if(packets!=0 && sample.data.sampleTimeFine-lastTime!=IMU_SAMPLE_TIME_FREQ/def->rate) return 0;
+		lastTime=sample.data.sampleTimeFine;
+		fields|=sample.data.fields;
+		packets++;
+	}while(packets<needed);
+
+	return fields==def->fields;
+}
+
+//output configuration of a profile (def) inside data (IMU_OUTPUT_MAX*4 bytes at least)
+//returns its length
+static uint16_t imuOutputConfig(const imu_profile_def* def, uint8_t* data){
+	uint16_t magRate=(def->rate<IMU_MAG_MAX_RATE) ? def->rate : IMU_MAG_MAX_RATE;
+	uint16_t len=0;
+
+	for(uint32_t o=0;o<IMU_OUTPUT_MAX;o++){
+		if(!(def->fields & _imuOutputs[o].field)) continue;
+		uint16_t rate=def->rate;
+		if(_imuOutputs[o].field==MTDATA2_SAMPLE_TIME_FINE) rate=IMU_RATE_EVERY_PACKET;
+		if(_imuOutputs[o].field==MTDATA2_MAGNETIC_FIELD) rate=magRate;
+		data[len++]=_imuOutputs[o].xdi>>8;
+		data[len++]=_imuOutputs[o].xdi&0xff;
+		data[len++]=rate>>8;
+		data[len++]=rate&0xff;
+	}
+	return len;
+}
+
 uint8_t initIMUConfig(UART_HandleTypeDef* IMUhandle){
-	//initializing circular buffer
-	cBuffInit(&rxcBuff, rxBuffer, sizeof(rxBuffer),0);
+	return initIMUProfile(IMUhandle, imu_profile_100hz);
+}
+
+uint8_t initIMUProfile(UART_HandleTypeDef* IMUhandle, imu_profile profile){
+	if(profile>=IMU_PROFILE_NUM) return 0;
+	const imu_profile_def* def=&_imuProfiles[profile];
 
-    HAL_Delay(500);
+	initIMUDecoder();
+	imuWokeUp=0;
 
+    //the imu is expected at the baud rate of the profile (kept from a previous configuration)
+    if(IMUhandle->Init.BaudRate!=def->baud) setBaudDriver_UART(IMUhandle, def->baud);
     flushRXDriver_UART(IMUhandle);
 
+    //already measuring as wanted (e.g. only the MCU was restarted): nothing to do
+    if(imuCheckStream(IMUhandle, def)){
+    	imuRate=def->rate;
+    	return 1;
+    }
+
     imu_packet_struct cmd;
     imu_packet_struct ack;
 
-    cmd.len=0;
-    ack.len=0;
-
-    //going to config mode
+    //going to config mode: if the imu does not answer it may be still starting up, its WakeUp is
+    //waited for (unless already received) before trying again (and scanning the baud rates)
     cmd.mid=IMU_GOTO_CONFIG_MID;
+    cmd.len=0;
     ack.mid=IMU_GOTO_CONFIG_ACK_MID;
-    for(uint32_t retry=0;retry<IMU_CONFIG_RETRY;retry++){
-    	if(imuAckTransaction(IMUhandle,&cmd,&ack,IMU_ACK_DELAY)) break;
-    	else if(retry==(IMU_CONFIG_RETRY-1)) return 0;
+    ack.len=0;
+    if(!imuAckTransaction(IMUhandle,&cmd,&ack,IMU_ACK_DELAY)){
+    	ack.mid=IMU_WAKEUP_MID;
+    	if(!imuWokeUp && receiveMsg(IMUhandle, NULL, &ack, IMU_WAKEUP_DELAY)){
+    		cmd.mid=IMU_WAKEUP_ACK_MID;
+    		sendMsg(IMUhandle, &cmd);
+    	}
+    	if(!imuGoToConfig(IMUhandle)) return 0;
     }
 
-    //set output config
+    //changing baud rate
+    if(IMUhandle->Init.BaudRate!=def->baud && !imuSetBaud(IMUhandle, def)) return 0;
+
+    //output config, written only if different from the current one (kept by the imu across power cycles)
+    uint8_t outputConfigData[IMU_OUTPUT_MAX*4];
+    uint16_t outputConfigLen=imuOutputConfig(def, outputConfigData);
     cmd.mid=IMU_SET_OCONFIG_MID;
-    cmd.len=IMU_SET_OCONFIG_LEN;
-    cmd.data=(uint8_t *)outputConfigData;
+    cmd.len=0;	//without data the current configuration is requested
 	ack.mid=IMU_SET_OCONFIG_ACK_MID;
-	ack.len=IMU_SET_OCONFIG_ACK_LEN;
-	for(uint32_t retry=0;retry<IMU_CONFIG_RETRY;retry++){
-		if(imuAckTransaction(IMUhandle,&cmd,&ack,IMU_ACK_DELAY)) break;
-		else if(retry==(IMU_CONFIG_RETRY-1)) return 0;
+	ack.len=IMU_ANY_LEN;
+	uint8_t configured=imuCommand(IMUhandle,&cmd,&ack) && ack.len==outputConfigLen
+			&& memcmp(ack.data, outputConfigData, outputConfigLen)==0;
+
+	if(!configured){
+		cmd.mid=IMU_SET_OCONFIG_MID;
+		cmd.len=outputConfigLen;
+		cmd.data=outputConfigData;
+		ack.mid=IMU_SET_OCONFIG_ACK_MID;
+		ack.len=outputConfigLen;	//the configuration is echoed back
+		if(!imuCommand(IMUhandle,&cmd,&ack)) return 0;
 	}
 
     //go to measurement state
@@ -241,14 +458,63 @@ uint8_t initIMUConfig(UART_HandleTypeDef* IMUhandle){
     cmd.len=0;
 	ack.mid=IMU_GOTO_MEAS_ACK_MID;
 	ack.len=0;
-	for(uint32_t retry=0;retry<IMU_CONFIG_RETRY;retry++){
-		if(imuAckTransaction(IMUhandle,&cmd,&ack,IMU_ACK_DELAY)) break;
-		else if(retry==(IMU_CONFIG_RETRY-1)) return 0;
-	}
+	if(!imuCommand(IMUhandle,&cmd,&ack)) return 0;
 
+	imuRate=def->rate;
 	return 1;
 }
 
+uint32_t getIMURate(void){
+	return imuRate;
+}
+
+void initIMUDecoder(void){
+	xbusInit(&imuDecoder, imuMsgBuff, sizeof(imuMsgBuff), NULL, NULL);
+	flushIMU();
+	imuMalformed=0;
+}
+
+void getIMUStats(imu_stats* stats){
+	if(stats==NULL) return;
+
+	stats->messages=imuDecoder.msgCount;
+	stats->checksumErrors=imuDecoder.checksumErrors;
+	stats->lengthErrors=imuDecoder.lengthErrors;
+	stats->malformed=imuMalformed;
+}
+
+void startIMUCapture(void){
+	taskENTER_CRITICAL();
+	imuCaptureHead=0;
+	imuCaptureTail=0;
+	imuCapturing=1;
+	taskEXIT_CRITICAL();
+}
+
+void stopIMUCapture(void){
+	imuCapturing=0;
+}
+
+uint32_t getIMUCaptureLen(void){
+	taskENTER_CRITICAL();
+	uint32_t len=imuCaptureHead-imuCaptureTail;
+	taskEXIT_CRITICAL();
+	return len;
+}
+
+uint32_t readIMUCapture(uint32_t offset, uint8_t* buff, uint32_t len){
+	if(buff==NULL) return 0;
+
+	taskENTER_CRITICAL();
+	uint32_t available=imuCaptureHead-imuCaptureTail;
+	if(offset>available) offset=available;
+	if(len>available-offset) len=available-offset;
+	copyFromCapture(imuCaptureTail+offset, buff, len);
+	taskEXIT_CRITICAL();
+
+	return len;
+}
+
 // function to fill a 32 bit variable
 // from a 4-byte wide buffer
 uint32_t buff2Int32(uint8_t buff[4])
@@ -262,42 +528,206 @@ uint32_t buff2Int32(uint8_t buff[4])
 	return retval;
 }
 
-/* Extract fields from IMU data field and converts it into host order before placing it inside data array*/
-// frame is data field buffer, data is output data array, dataSize is number of data fields
-void writeIMUDataArray(uint8_t* frame, uint32_t* data, uint32_t dataSize)
+uint32_t acquireIMUSamples(UART_HandleTypeDef* IMUhandle, uint32_t timeout)
+{
+	uint32_t startSeq=imuSampleSeq;
+
+	imu_packet_struct format={
+		.mid=IMU_DATA_PACKET_MID,
+		.len=IMU_ANY_LEN,
+	};
+
+	//waiting for the first packet (stored by the decoder callback)
+	if(!receiveMsg(IMUhandle, NULL, &format, timeout)) return 0;
+
+	//then decoding what is already in the driver, without waiting
+	xbusSetCallback(&imuDecoder, onIMUAcquire, NULL);
+	do{
+		xbusDecode(&imuDecoder, &imuRxChunk[imuRxChunkPos], imuRxChunkLen-imuRxChunkPos);
+		imuRxChunkLen=receiveDriver_UART(IMUhandle, imuRxChunk, sizeof(imuRxChunk));
+		imuRxChunkPos=0;
+		captureIMUBytes(imuRxChunk, imuRxChunkLen);
+	}while(imuRxChunkLen>0);
+
+	return imuSampleSeq-startSeq;
+}
+
+void initIMUCursor(imu_sample_cursor* cursor)
+{
+	if(cursor==NULL) return;
+
+	cursor->next=imuSampleSeq;
+	cursor->dropped=0;
+}
+
+uint32_t readIMUSamples(imu_sample_cursor* cursor, imu_sample* samples, uint32_t maxNum)
 {
-	for(uint32_t d=0;d<dataSize;d++){
-		uint32_t raw=0;
-		for(uint32_t byte=0;byte<4;byte++){
-			raw|=((uint32_t)frame[d*4+byte])<<(8*(3-byte));
+	if(cursor==NULL || samples==NULL) return 0;
+
+	uint32_t num=0;
+	while(num<maxNum){
+		//one sample per critical section, so that the writer is not held for long
+		taskENTER_CRITICAL();
+		uint32_t seq=imuSampleSeq;
+		if(seq-cursor->next>IMU_SAMPLE_RING_LEN){
+			//overwritten samples, skipping to the oldest one still in the ring
+			cursor->dropped+=seq-IMU_SAMPLE_RING_LEN-cursor->next;
+			cursor->next=seq-IMU_SAMPLE_RING_LEN;
 		}
-		data[d]=raw;
+		if(cursor->next==seq){
+			taskEXIT_CRITICAL();
+			break;
+		}
+		samples[num++]=imuSampleRing[cursor->next&(IMU_SAMPLE_RING_LEN-1)];
+		cursor->next++;
+		taskEXIT_CRITICAL();
 	}
-	return;
+
+	return num;
 }
 
-uint8_t readIMUPacket(UART_HandleTypeDef* IMUhandle, float gyroscope[3], float magnetometer[3], float accelerometer[3] ,uint32_t timeout)
+uint8_t readIMULatest(imu_sample* sample)
+{
+	if(sample==NULL) return 0;
+
+	uint8_t ret=0;
+	taskENTER_CRITICAL();
+	uint32_t seq=imuSampleSeq;
+	if(seq!=0){
+		*sample=imuSampleRing[(seq-1)&(IMU_SAMPLE_RING_LEN-1)];
+		ret=1;
+	}
+	taskEXIT_CRITICAL();
+
+	return ret;
+}
+
+//outputs averaged by the decimators
+typedef struct{
+	uint32_t field;		//flag of the output
+	uint16_t offset;	//float array inside mtdata2_sample
+	uint8_t size;		//number of floats
+} imu_averaged_output;
+
+static const imu_averaged_output _imuAveraged[]={
+	{MTDATA2_QUATERNION,		offsetof(mtdata2_sample,quaternion),	4},
+	{MTDATA2_ACCELERATION,		offsetof(mtdata2_sample,acceleration),	3},
+	{MTDATA2_FREE_ACCELERATION,	offsetof(mtdata2_sample,freeAcceleration),	3},
+	{MTDATA2_RATE_OF_TURN,		offsetof(mtdata2_sample,rateOfTurn),	3},
+	{MTDATA2_MAGNETIC_FIELD,	offsetof(mtdata2_sample,magneticField),	3},
+};
+
+//a new averaged output needs its entry here and IMU_AVERAGED_NUM in MTi1.h
+_Static_assert(IMU_AVERAGED_NUM==sizeof(_imuAveraged)/sizeof(_imuAveraged[0]), "IMU_AVERAGED_NUM does not match _imuAveraged");
+_Static_assert(IMU_AVERAGED_NUM==sizeof(((imu_decimator*)0)->num)/sizeof(uint32_t), "imu_decimator.num does not match _imuAveraged");
+
+//position of an output in _imuAveraged (IMU_AVERAGED_NUM if not averaged)
+static uint32_t averagedIndex(uint32_t field)
+{
+	uint32_t o;
+	for(o=0;o<IMU_AVERAGED_NUM && _imuAveraged[o].field!=field;o++);
+	return o;
+}
+
+void initIMUDecimator(imu_decimator* dec, uint32_t rate)
+{
+	if(dec==NULL) return;
+
+	initIMUCursor(&dec->cursor);
+	dec->factor=(rate==0) ? 1 : (getIMURate()+rate/2)/rate;
+	if(dec->factor==0) dec->factor=1;
+	dec->count=0;
+}
+
+uint8_t readIMUDecimated(imu_decimator* dec, imu_sample* sample)
 {
-	//flush driver rx buffer
-	cBuffFlush(&rxcBuff); //flushing local buffer
+	if(dec==NULL || sample==NULL) return 0;
+
+	imu_sample in;
+	const uint32_t quaternion=averagedIndex(MTDATA2_QUATERNION);
+	while(readIMUSamples(&dec->cursor, &in, 1)){
+		if(dec->count==0){
+			memset(&dec->sum, 0, sizeof(dec->sum));
+			memset(dec->num, 0, sizeof(dec->num));
+		}
+
+		//q and -q are the same orientation: quaternions are summed on the same side as the first one
+		if((in.data.fields & MTDATA2_QUATERNION) && quaternion<IMU_AVERAGED_NUM && dec->num[quaternion]!=0){
+			float dot=0;
+			for(uint32_t c=0;c<4;c++) dot+=in.data.quaternion[c]*dec->sum.quaternion[c];
+			if(dot<0){
+				for(uint32_t c=0;c<4;c++) in.data.quaternion[c]=-in.data.quaternion[c];
+			}
+		}
+
+		for(uint32_t o=0;o<IMU_AVERAGED_NUM;o++){
+			if(!(in.data.fields & _imuAveraged[o].field)) continue;
+			const float* src=(const float*)((const uint8_t*)&in.data+_imuAveraged[o].offset);
+			float* dst=(float*)((uint8_t*)&dec->sum+_imuAveraged[o].offset);
+			for(uint32_t c=0;c<_imuAveraged[o].size;c++) dst[c]+=src[c];
+			dec->num[o]++;
+		}
+		dec->count++;
+
+		if(dec->count<dec->factor) continue;
+
+		//group complete: averages, the rest from the last sample
+		*sample=in;
+		for(uint32_t o=0;o<IMU_AVERAGED_NUM;o++) sample->data.fields&=~_imuAveraged[o].field;
+		for(uint32_t o=0;o<IMU_AVERAGED_NUM;o++){
+			if(dec->num[o]==0) continue;
+			const float* src=(const float*)((const uint8_t*)&dec->sum+_imuAveraged[o].offset);
+			float* dst=(float*)((uint8_t*)&sample->data+_imuAveraged[o].offset);
+			for(uint32_t c=0;c<_imuAveraged[o].size;c++) dst[c]=src[c]/dec->num[o];
+			sample->data.fields|=_imuAveraged[o].field;
+		}
+		if(sample->data.fields & MTDATA2_QUATERNION){
+			float norm=0;
+			for(uint32_t c=0;c<4;c++) norm+=sample->data.quaternion[c]*sample->data.quaternion[c];
+			norm=sqrtf(norm);
+			if(norm>0){
+				for(uint32_t c=0;c<4;c++) sample->data.quaternion[c]/=norm;
+			}
+		}
+		dec->count=0;
+		return 1;
+	}
+
+	return 0;
+}
+
+uint8_t readIMUSample(UART_HandleTypeDef* IMUhandle, mtdata2_sample* sample, uint32_t timeout)
+{
+	//bytes already read are not flushed: the decoder goes on from where it stopped,
+	//so packets arriving back to back are not lost
 
 	imu_packet_struct format={
 		.mid=IMU_DATA_PACKET_MID,
-		.len=IMU_DATA_PACKET_LEN,
+		.len=IMU_ANY_LEN,	//the length depends on the output configuration
 	};
 
-	imu_packet_struct meas;
+	imu_sample last;
 
-	if(receiveMsg(IMUhandle,&meas, &format, 1, timeout)){
-		//found packet
+	//the packet found is already decoded in the sample ring
+	if(receiveMsg(IMUhandle, NULL, &format, timeout) && readIMULatest(&last)){
+		if(sample!=NULL) *sample=last.data;
+		return 1;
+	}
 
-		//writing acc data
-		writeIMUDataArray(&meas.data[IMU_DATA_ACC_INDEX], (uint32_t*)accelerometer, 3);
-		//writing gyro data
-		writeIMUDataArray(&meas.data[IMU_DATA_GYRO_INDEX], (uint32_t*)gyroscope, 3);
-		//writing mag data
-		writeIMUDataArray(&meas.data[IMU_DATA_MAG_INDEX], (uint32_t*)magnetometer, 3);
+	return 0;
+}
 
+uint8_t readIMUPacket(UART_HandleTypeDef* IMUhandle, float gyroscope[3], float magnetometer[3], float accelerometer[3] ,uint32_t timeout)
+{
+	const uint32_t needed=MTDATA2_RATE_OF_TURN | MTDATA2_MAGNETIC_FIELD | MTDATA2_ACCELERATION;
+	mtdata2_sample sample;
+
+	if(readIMUSample(IMUhandle, &sample, timeout) && (sample.fields & needed)==needed){
+		for(uint32_t axis=0;axis<3;axis++){
+			gyroscope[axis]=sample.rateOfTurn[axis];
+			magnetometer[axis]=sample.magneticField[axis];
+			accelerometer[axis]=sample.acceleration[axis];
+		}
 		return 1;
 	}
 
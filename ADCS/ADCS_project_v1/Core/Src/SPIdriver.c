@@ -0,0 +1,150 @@
+
+#include "SPIdriver.h"
+#include <string.h>
+
+typedef struct DriverHandle_SPI
+{
+    uint8_t _usageFlag;                  				//to flag that the strcture is valid (0 if not used)
+    SPI_HandleTypeDef* _hspiHandle;       				//SPI handle
+    spi_transaction _queue[SPI_QUEUE_LEN];				//transactions ring, the one in flight is at _tail
+    uint32_t _head;										//ring position where the next transaction is written
+    uint32_t _tail;										//ring position of the oldest transaction
+    uint32_t _count;									//transactions in the ring (in flight one included)
+    uint8_t _busy;										//1 while a DMA transfer is in flight
+    spi_stats _stats;									//bus counters
+} DriverHandle_SPI;
+
+static DriverHandle_SPI _driverHandle_SPI[MAX_SPI_HANDLE]; 	//handle structures array (one slot per spi instance)
+
+//slot of a spi inside the handle structures array, MAX_SPI_HANDLE if the instance is not handled
+static uint32_t getHandleIndex(SPI_HandleTypeDef* hspiHandle)
+{
+	switch((uintptr_t)hspiHandle->Instance)
+	{
+	case SPI2_BASE: return 0;
+	default: return MAX_SPI_HANDLE;
+	}
+}
+
+//get the driver structure of a spi, NULL if the spi was not added to the driver
+static DriverHandle_SPI* getHandle(SPI_HandleTypeDef* hspiHandle)
+{
+	uint32_t handleIndex = getHandleIndex(hspiHandle);
+
+	if(handleIndex >= MAX_SPI_HANDLE) return NULL;
+	if(_driverHandle_SPI[handleIndex]._usageFlag != 1 || _driverHandle_SPI[handleIndex]._hspiHandle != hspiHandle) return NULL;
+	return &_driverHandle_SPI[handleIndex];
+}
+
+static void finishTransaction(DriverHandle_SPI* handle, uint8_t error);
+
+//start the oldest queued transaction if the bus is idle
+//NB. must be called with the interrupts masked or from the DMA/SPI interrupt
+static void startTransaction(DriverHandle_SPI* handle)
+{
+	if(handle->_busy || handle->_count == 0) return;
+
+	spi_transaction* transaction = &handle->_queue[handle->_tail];
+	if(transaction->csPort != NULL) HAL_GPIO_WritePin(transaction->csPort, transaction->csPin, GPIO_PIN_RESET);
+	handle->_busy = 1;
+	if(HAL_SPI_TransmitReceive_DMA(handle->_hspiHandle, transaction->tx, transaction->rx, transaction->len) != HAL_OK)
+	{
+		finishTransaction(handle, 1);	//starts the next one
+	}
+}
+
+//end the transaction in flight: chip select up, callback, next transaction
+//the transaction leaves the ring before the callback, so the callback can queue new ones
+static void finishTransaction(DriverHandle_SPI* handle, uint8_t error)
+{
+	spi_transaction transaction = handle->_queue[handle->_tail];
+
+	if(transaction.csPort != NULL) HAL_GPIO_WritePin(transaction.csPort, transaction.csPin, GPIO_PIN_SET);
+	handle->_tail = (handle->_tail + 1) % SPI_QUEUE_LEN;
+	handle->_count--;
+	handle->_busy = 0;
+	handle->_stats.transactions++;
+	if(error)
+	{
+		handle->_stats.errors++;
+		transaction.error = 1;
+	}
+
+	if(transaction.callback != NULL) transaction.callback(&transaction);
+	startTransaction(handle);
+}
+
+void initDriver_SPI()
+{
+	memset(_driverHandle_SPI, 0, sizeof(_driverHandle_SPI));
+}
+
+uint8_t addDriver_SPI(SPI_HandleTypeDef* hspiHandle)
+{
+	if(hspiHandle == NULL) return 1;
+	uint32_t handleIndex = getHandleIndex(hspiHandle);
+	if(handleIndex >= MAX_SPI_HANDLE) return 1;
+
+	DriverHandle_SPI* handle = &_driverHandle_SPI[handleIndex];
+	memset(handle, 0, sizeof(DriverHandle_SPI));
+	handle->_hspiHandle = hspiHandle;
+	handle->_usageFlag = 1;
+	return 0;
+}
+
+uint8_t queueDriver_SPI(SPI_HandleTypeDef* hspiHandle, const spi_transaction* transaction)
+{
+	DriverHandle_SPI* handle = getHandle(hspiHandle);
+	if(handle == NULL || transaction == NULL) return 1;
+	if(transaction->len == 0 || transaction->len > SPI_TRANSACTION_LEN) return 1;
+
+	//the FROM_ISR critical section only masks interrupts, so it is valid in tasks too
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	if(handle->_count >= SPI_QUEUE_LEN)
+	{
+		handle->_stats.queueFull++;
+		taskEXIT_CRITICAL_FROM_ISR(mask);
+		return 1;
+	}
+	handle->_queue[handle->_head] = *transaction;
+	handle->_queue[handle->_head].error = 0;
+	handle->_head = (handle->_head + 1) % SPI_QUEUE_LEN;
+	handle->_count++;
+	if(handle->_count > handle->_stats.highWater) handle->_stats.highWater = handle->_count;
+	startTransaction(handle);
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	return 0;
+}
+
+uint8_t getStatsDriver_SPI(SPI_HandleTypeDef* hspiHandle, spi_stats* stats)
+{
+	DriverHandle_SPI* handle = getHandle(hspiHandle);
+	if(handle == NULL || stats == NULL) return 1;
+
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	*stats = handle->_stats;
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	return 0;
+}
+
+//HAL callbacks, called from the DMA/SPI interrupts
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	DriverHandle_SPI* handle = getHandle(hspi);
+	if(handle == NULL || !handle->_busy) return;
+
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	finishTransaction(handle, 0);
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	DriverHandle_SPI* handle = getHandle(hspi);
+	if(handle == NULL || !handle->_busy) return;
+
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	finishTransaction(handle, 1);
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+}
@@ -1,5 +1,6 @@
 
 #include "UARTdriver.h"
+#include <string.h>
 
 typedef struct DriverHandel_UART
 {
@@ -15,9 +16,126 @@ typedef struct DriverHandel_UART
     uint8_t _txQueueStorageBuffer[SERIAL_TX_BUFF_LEN];	//tx queue data buffer
     StaticQueue_t _txQueueBuffer;						//tx queue buffer
     fifo_policy _policyRX;								//rx buffer policy
+    uint8_t _rxDMA;										//1 if rx uses the circular DMA (rx queue storage is the DMA ring)
+    uint32_t _rxDMAPos;									//ring position reported by the last DMA event
+    uint32_t _rxDMACount;								//bytes written by the DMA up to the last DMA event
+    uint32_t _rxDMARead;								//bytes consumed from the ring
+    uint32_t _rxDMAReadPos;								//ring position of the next byte to consume
+    uint8_t _txDMA;										//1 if tx uses the DMA (tx queue storage is the tx ring)
+    uint32_t _txDMAHead;								//ring position where the next byte to send is written
+    uint32_t _txDMATail;								//ring position of the first byte not yet sent
+    uint32_t _txDMACount;								//bytes in the ring (in flight ones included)
+    uint32_t _txDMALen;									//bytes of the DMA transfer in flight (0 if tx idle)
+    TaskHandle_t _rxWaitTask;							//task blocked in receiveDriver_UART_Wait() (NULL if none)
+    uint32_t _rxWaitMin;								//number of bytes the blocked task is waiting for
+    uart_stats _stats;									//port counters
 } DriverHandel_UART;
 
-volatile DriverHandel_UART _driverHandle_UART[MAX_UART_HANDLE]; 	//handle structures array
+volatile DriverHandel_UART _driverHandle_UART[MAX_UART_HANDLE]; 	//handle structures array (one slot per uart instance)
+
+//slot of a uart inside the handle structures array: each instance has its own fixed slot,
+//so the lookup (done at every callback) does not need to scan the array
+//returns MAX_UART_HANDLE if the instance is not handled by the driver
+static uint32_t getHandleIndex(UART_HandleTypeDef* huartHandle)
+{
+	switch((uintptr_t)huartHandle->Instance)
+	{
+	case USART1_BASE: return 0;
+	case USART2_BASE: return 1;
+	case USART3_BASE: return 2;
+	case UART4_BASE: return 3;
+	default: return MAX_UART_HANDLE;
+	}
+}
+
+//get the driver structure of a uart, NULL if the uart was not added to the driver
+static volatile DriverHandel_UART* getHandle(UART_HandleTypeDef* huartHandle)
+{
+	uint32_t handleIndex = getHandleIndex(huartHandle);
+
+	if(handleIndex >= MAX_UART_HANDLE) return NULL;
+	if(_driverHandle_UART[handleIndex]._usageFlag != 1 || _driverHandle_UART[handleIndex]._huartHandle != huartHandle) return NULL;
+	return &_driverHandle_UART[handleIndex];
+}
+
+//(re)start the circular DMA reception, discarding what is in the ring
+//called with the uart IRQ disabled or from the uart ISR
+static void startRxDMA(volatile DriverHandel_UART* handle)
+{
+	handle->_rxDMAPos = 0;
+	handle->_rxDMACount = 0;
+	handle->_rxDMARead = 0;
+	handle->_rxDMAReadPos = 0;
+	HAL_UARTEx_ReceiveToIdle_DMA(handle->_huartHandle,(uint8_t*)handle->_rxQueueStorageBuffer,SERIAL_RX_BUFF_LEN);
+}
+
+//number of bytes in the ring not yet consumed, the DMA position is read live so the bytes
+//received after the last DMA event are counted too
+//NB. must be called with the uart/DMA interrupts masked
+static uint32_t unreadRxDMA(volatile DriverHandel_UART* handle)
+{
+	uint32_t pos = SERIAL_RX_BUFF_LEN - __HAL_DMA_GET_COUNTER(handle->_huartHandle->hdmarx);
+	if(pos >= SERIAL_RX_BUFF_LEN) pos = 0;
+	uint32_t written = handle->_rxDMACount + ((pos >= handle->_rxDMAPos) ? pos - handle->_rxDMAPos : pos + SERIAL_RX_BUFF_LEN - handle->_rxDMAPos);
+	uint32_t unread = written - handle->_rxDMARead;
+
+	//the DMA lapped the reader: the oldest bytes were overwritten, skip them
+	if(unread > SERIAL_RX_BUFF_LEN)
+	{
+		handle->_stats.rxDropped += unread - SERIAL_RX_BUFF_LEN;
+		handle->_rxDMARead += unread - SERIAL_RX_BUFF_LEN;
+		handle->_rxDMAReadPos = (handle->_rxDMAReadPos + unread - SERIAL_RX_BUFF_LEN) % SERIAL_RX_BUFF_LEN;
+		unread = SERIAL_RX_BUFF_LEN;
+	}
+	return unread;
+}
+
+//mark (size) bytes of the ring as consumed
+//NB. must be called with the uart/DMA interrupts masked
+static void consumeRxDMA(volatile DriverHandel_UART* handle, uint32_t size)
+{
+	handle->_rxDMARead += size;
+	handle->_rxDMAReadPos = (handle->_rxDMAReadPos + size) % SERIAL_RX_BUFF_LEN;
+}
+
+//wake the task blocked in receiveDriver_UART_Wait() if (available) bytes are enough
+//called from the uart/DMA ISR
+static void notifyRxWait(volatile DriverHandel_UART* handle, uint32_t available)
+{
+	if(handle->_rxWaitTask != NULL && available >= handle->_rxWaitMin)
+	{
+		BaseType_t woken = pdFALSE;
+		xTaskNotifyFromISR(handle->_rxWaitTask,UART_NOTIFY_RX_BIT,eSetBits,&woken);
+		handle->_rxWaitTask = NULL;
+		portYIELD_FROM_ISR(woken);
+	}
+}
+
+//launch a DMA transfer on the largest contiguous span of the tx ring (if any)
+//NB. must be called with the uart/DMA interrupts masked (or from their ISR) and no transfer in flight
+static void startTxDMA(volatile DriverHandel_UART* handle)
+{
+	uint32_t len = SERIAL_TX_BUFF_LEN - handle->_txDMATail;
+	if(len > handle->_txDMACount) len = handle->_txDMACount;
+	if(len == 0) return;
+
+	handle->_txDMALen = len;
+	if(HAL_UART_Transmit_DMA(handle->_huartHandle,(uint8_t*)&handle->_txQueueStorageBuffer[handle->_txDMATail],len) != HAL_OK)
+	{
+		//uart busy, nothing launched (retried by the next send)
+		handle->_txDMALen = 0;
+	}
+}
+
+//the transfer in flight has ended (sent or aborted): release its span and chain the next one
+//called from the uart/DMA ISR
+static void endTxDMA(volatile DriverHandel_UART* handle)
+{
+	handle->_txDMATail = (handle->_txDMATail + handle->_txDMALen) % SERIAL_TX_BUFF_LEN;
+	handle->_txDMACount -= handle->_txDMALen;
+	handle->_txDMALen = 0;
+	startTxDMA(handle);
+}
 
 void initDriver_UART()
 {
@@ -30,191 +148,394 @@ void initDriver_UART()
 
 uint8_t addDriver_UART(UART_HandleTypeDef* huartHandle, IRQn_Type irq, fifo_policy policyRX)
 {
-    //scan the data structure to find a free position (or if the handle is already inserted)
-    for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
+    //find the slot of this uart instance
+    uint32_t handleIndex = getHandleIndex(huartHandle);
+    if(handleIndex >= MAX_UART_HANDLE)
     {
-        //if it finds an occupied position
-        if(_driverHandle_UART[handleIndex]._usageFlag == 1)
-        {
-            //if the handle is already inside the structure
-            if(_driverHandle_UART[handleIndex]._huartHandle == huartHandle)
-            {
-                //error
-                return 1; 
-            }
-        }
-        else
-        {
-        	//disable the IRQ
-        	uint32_t irqState=NVIC_GetEnableIRQ(irq);
-        	NVIC_DisableIRQ(irq);
+        //uart not handled by the driver
+        return 1;
+    }
 
-            //intialize the strcture for this handle
-            _driverHandle_UART[handleIndex]._huartHandle = huartHandle;
-            _driverHandle_UART[handleIndex]._rxQueueHandle = xQueueCreateStatic(SERIAL_RX_BUFF_LEN,1,(void*)&_driverHandle_UART[handleIndex]._rxQueueStorageBuffer,&_driverHandle_UART[handleIndex]._rxQueueBuffer);
-            _driverHandle_UART[handleIndex]._txQueueHandle = xQueueCreateStatic(SERIAL_TX_BUFF_LEN,1,(void*)&_driverHandle_UART[handleIndex]._txQueueStorageBuffer,&_driverHandle_UART[handleIndex]._txQueueBuffer);
-            _driverHandle_UART[handleIndex]._usageFlag = 1;
-            _driverHandle_UART[handleIndex]._policyRX = policyRX;
+    //if the uart is already inside the structure
+    if(_driverHandle_UART[handleIndex]._usageFlag == 1)
+    {
+        //error
+        return 1;
+    }
 
-            HAL_UART_Receive_IT(huartHandle,&_driverHandle_UART[handleIndex]._rxByte,1);
+	//disable the IRQ
+	uint32_t irqState=NVIC_GetEnableIRQ(irq);
+	NVIC_DisableIRQ(irq);
 
-            if(irqState) NVIC_EnableIRQ(irq);
+    //intialize the strcture for this handle
+    _driverHandle_UART[handleIndex]._huartHandle = huartHandle;
+    //with an rx DMA channel linked the rx queue storage becomes the DMA ring
+    _driverHandle_UART[handleIndex]._rxDMA = (huartHandle->hdmarx != NULL);
+    if(!_driverHandle_UART[handleIndex]._rxDMA)
+    {
+        _driverHandle_UART[handleIndex]._rxQueueHandle = xQueueCreateStatic(SERIAL_RX_BUFF_LEN,1,(void*)&_driverHandle_UART[handleIndex]._rxQueueStorageBuffer,(StaticQueue_t*)&_driverHandle_UART[handleIndex]._rxQueueBuffer);
+    }
+    _driverHandle_UART[handleIndex]._irq = irq;
+    //with a tx DMA channel linked the tx queue storage becomes the tx ring
+    _driverHandle_UART[handleIndex]._txDMA = (huartHandle->hdmatx != NULL);
+    _driverHandle_UART[handleIndex]._txDMAHead = 0;
+    _driverHandle_UART[handleIndex]._txDMATail = 0;
+    _driverHandle_UART[handleIndex]._txDMACount = 0;
+    _driverHandle_UART[handleIndex]._txDMALen = 0;
+    if(!_driverHandle_UART[handleIndex]._txDMA)
+    {
+        _driverHandle_UART[handleIndex]._txQueueHandle = xQueueCreateStatic(SERIAL_TX_BUFF_LEN,1,(void*)&_driverHandle_UART[handleIndex]._txQueueStorageBuffer,(StaticQueue_t*)&_driverHandle_UART[handleIndex]._txQueueBuffer);
+    }
+    _driverHandle_UART[handleIndex]._rxWaitTask = NULL;
+    memset((uart_stats*)&_driverHandle_UART[handleIndex]._stats,0,sizeof(uart_stats));
+    _driverHandle_UART[handleIndex]._usageFlag = 1;
+    _driverHandle_UART[handleIndex]._policyRX = policyRX;
 
-            return 0;
-        }
+    if(_driverHandle_UART[handleIndex]._rxDMA)
+    {
+        startRxDMA(&_driverHandle_UART[handleIndex]);
+    }
+    else
+    {
+        HAL_UART_Receive_IT(huartHandle,(uint8_t*)&_driverHandle_UART[handleIndex]._rxByte,1);
     }
-    return 1;
+
+    if(irqState) NVIC_EnableIRQ(irq);
+
+    return 0;
 }
 
 uint32_t receiveDriver_UART(UART_HandleTypeDef* huartHandle, uint8_t* buff, uint32_t size){
 
     if(size == 0) return 0;
 
-    //scanning the array with the structures to find the handle
-    for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
-    {
-        //if it finds the handle
-        if((_driverHandle_UART[handleIndex]._usageFlag == 1) && (huartHandle == _driverHandle_UART[handleIndex]._huartHandle))
-        {
-        	uint8_t rxNum=0;
-        	while(rxNum<size && xQueueReceive(_driverHandle_UART[handleIndex]._rxQueueHandle,&buff[rxNum],0)==pdTRUE){
-        		rxNum++;
-        	}
-
-            //0 bytes read
-            return rxNum;
-
-            //in case reception crashed and error handle didn't relaunch it, relaunch it (this should not happen)
-            //disable the IRQ
-            //EDIT: removed part that disables interrupt to avoid losing packets if this function is
-            //preempted, execution SHOULD be IRQ safe anyway
-        	//NVIC_DisableIRQ(_driverHandle_UART[handleIndex]._irq);
-            HAL_UART_Receive_IT(huartHandle,&_driverHandle_UART[handleIndex]._rxByte,1);
-            //NVIC_EnableIRQ(_driverHandle_UART[handleIndex]._irq);
+    volatile DriverHandel_UART* handle = getHandle(huartHandle);
+    if(handle == NULL) return 0;
 
-        }
-    }
-    return 0;
+	if(handle->_rxDMA)
+	{
+		taskENTER_CRITICAL();
+		uint32_t rxNum = unreadRxDMA(handle);
+		if(rxNum > size) rxNum = size;
+
+		//copying out of the ring, in two pieces if it wraps
+		uint32_t firstNum = SERIAL_RX_BUFF_LEN - handle->_rxDMAReadPos;
+		if(firstNum > rxNum) firstNum = rxNum;
+		memcpy(buff,(uint8_t*)&handle->_rxQueueStorageBuffer[handle->_rxDMAReadPos],firstNum);
+		memcpy(&buff[firstNum],(uint8_t*)handle->_rxQueueStorageBuffer,rxNum-firstNum);
+		consumeRxDMA(handle,rxNum);
+		taskEXIT_CRITICAL();
+
+		return rxNum;
+	}
+
+	uint32_t rxNum=0;
+	while(rxNum<size && xQueueReceive(handle->_rxQueueHandle,&buff[rxNum],0)==pdTRUE){
+		rxNum++;
+	}
+
+    //0 bytes read
+    return rxNum;
+
+    //in case reception crashed and error handle didn't relaunch it, relaunch it (this should not happen)
+    //disable the IRQ
+    //EDIT: removed part that disables interrupt to avoid losing packets if this function is
+    //preempted, execution SHOULD be IRQ safe anyway
+	//NVIC_DisableIRQ(handle->_irq);
+    HAL_UART_Receive_IT(huartHandle,(uint8_t*)&handle->_rxByte,1);
+    //NVIC_EnableIRQ(handle->_irq);
 }
 
-uint32_t sendDriver_UART(UART_HandleTypeDef* huartHandle,uint8_t* buff,uint32_t size){
-	if(size == 0) return 0;
+uint32_t receiveDriver_UART_Wait(UART_HandleTypeDef* huartHandle, uint8_t* buff, uint32_t size, uint32_t minBytes, uint32_t timeoutTicks){
+
+    volatile DriverHandel_UART* handle = getHandle(huartHandle);
+    if(handle == NULL) return 0;
 
-	//scanning the array with the structures to find the handle
-	for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
+	//the rx buffer can't hold more than its length
+	if(minBytes > SERIAL_RX_BUFF_LEN) minBytes = SERIAL_RX_BUFF_LEN;
+
+	//without scheduler there is no task to block, just read what is there
+	if(xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
 	{
-		//if it finds the handle
-		if((_driverHandle_UART[handleIndex]._usageFlag == 1) && (huartHandle == _driverHandle_UART[handleIndex]._huartHandle))
+		TickType_t startTick = xTaskGetTickCount();
+		for(;;)
 		{
-			//inserting bytes inside queue
-			uint8_t txNum=0;
-			while((txNum+1)<size && xQueueSendToBack(_driverHandle_UART[handleIndex]._txQueueHandle,&buff[txNum],0)==pdTRUE){
-				txNum++;
-			}
-			//if no transmission ongoing and pipe is not empty, start transmission now
-            //disable the IRQ
-        	NVIC_DisableIRQ(_driverHandle_UART[handleIndex]._irq);
-
-			if(huartHandle->gState == HAL_UART_STATE_READY){
-				_driverHandle_UART[handleIndex]._txByte=buff[txNum];
-				HAL_UART_Transmit_IT(_driverHandle_UART[handleIndex]._huartHandle, &_driverHandle_UART[handleIndex]._txByte, 1); //try restarting transmit if not ongoing
-				txNum++;
-			}else{
-				if(xQueueSendToBack(_driverHandle_UART[handleIndex]._txQueueHandle,&buff[txNum],0)==pdTRUE){
-					txNum++;
-                }
+			taskENTER_CRITICAL();
+			uint32_t available = handle->_rxDMA ? unreadRxDMA(handle) : uxQueueMessagesWaiting(handle->_rxQueueHandle);
+			TickType_t elapsed = xTaskGetTickCount() - startTick;
+			if(available >= minBytes || elapsed >= timeoutTicks)
+			{
+				taskEXIT_CRITICAL();
+				break;
 			}
 
-            NVIC_EnableIRQ(_driverHandle_UART[handleIndex]._irq);
+			//registering as waiting task, the ISR notifies when minBytes are available
+			handle->_rxWaitTask = xTaskGetCurrentTaskHandle();
+			handle->_rxWaitMin = minBytes;
+			taskEXIT_CRITICAL();
 
-			return txNum;
+			//only the rx bit is consumed, other notifications of the task stay pending
+			//(a stale rx bit or another notification just wakes it early: the loop checks again)
+			xTaskNotifyWait(0,UART_NOTIFY_RX_BIT,NULL,timeoutTicks - elapsed);
+
+			taskENTER_CRITICAL();
+			handle->_rxWaitTask = NULL;
+			taskEXIT_CRITICAL();
 		}
 	}
 
-	return 0;
+	return receiveDriver_UART(huartHandle,buff,size);
+}
+
+uint32_t sendDriver_UART(UART_HandleTypeDef* huartHandle,uint8_t* buff,uint32_t size){
+	if(size == 0) return 0;
+
+	volatile DriverHandel_UART* handle = getHandle(huartHandle);
+	if(handle == NULL) return 0;
+
+	if(handle->_txDMA)
+	{
+		taskENTER_CRITICAL();
+		//keep_old policy: what does not fit is discarded
+		uint32_t txNum = SERIAL_TX_BUFF_LEN - handle->_txDMACount;
+		if(txNum > size) txNum = size;
+		handle->_stats.txDropped += size - txNum;
+
+		//copying in the ring, in two pieces if it wraps
+		uint32_t firstNum = SERIAL_TX_BUFF_LEN - handle->_txDMAHead;
+		if(firstNum > txNum) firstNum = txNum;
+		memcpy((uint8_t*)&handle->_txQueueStorageBuffer[handle->_txDMAHead],buff,firstNum);
+		memcpy((uint8_t*)handle->_txQueueStorageBuffer,&buff[firstNum],txNum-firstNum);
+		handle->_txDMAHead = (handle->_txDMAHead + txNum) % SERIAL_TX_BUFF_LEN;
+		handle->_txDMACount += txNum;
+		if(handle->_txDMACount > handle->_stats.txHighWater) handle->_stats.txHighWater = handle->_txDMACount;
+
+		//if no transmission ongoing start it now, otherwise it is chained on transfer complete
+		if(handle->_txDMALen == 0) startTxDMA(handle);
+		taskEXIT_CRITICAL();
+
+		return txNum;
+	}
+
+	//inserting bytes inside queue
+	uint32_t txNum=0;
+	while((txNum+1)<size && xQueueSendToBack(handle->_txQueueHandle,&buff[txNum],0)==pdTRUE){
+		txNum++;
+	}
+	//if no transmission ongoing and pipe is not empty, start transmission now
+    //disable the IRQ
+	NVIC_DisableIRQ(handle->_irq);
+
+	if(huartHandle->gState == HAL_UART_STATE_READY){
+		handle->_txByte=buff[txNum];
+		HAL_UART_Transmit_IT(handle->_huartHandle, (uint8_t*)&handle->_txByte, 1); //try restarting transmit if not ongoing
+		txNum++;
+	}else{
+		if(xQueueSendToBack(handle->_txQueueHandle,&buff[txNum],0)==pdTRUE){
+			txNum++;
+        }
+	}
+
+	uint32_t waiting = uxQueueMessagesWaiting(handle->_txQueueHandle);
+	if(waiting > handle->_stats.txHighWater) handle->_stats.txHighWater = waiting;
+	handle->_stats.txDropped += size - txNum;
+
+    NVIC_EnableIRQ(handle->_irq);
+
+	return txNum;
 }
 
 void flushRXDriver_UART(UART_HandleTypeDef* huartHandle){
-	//scanning the structure array
-	for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
+	volatile DriverHandel_UART* handle = getHandle(huartHandle);
+	if(handle == NULL) return;
+
+	if(handle->_rxDMA)
 	{
-		//if it finds the handle in the structure
-		if(_driverHandle_UART[handleIndex]._usageFlag == 1 && huartHandle == _driverHandle_UART[handleIndex]._huartHandle)
-		{
-			//flushing queue
-			xQueueReset(_driverHandle_UART[handleIndex]._rxQueueHandle);
-		}
+		//skipping everything the DMA wrote so far
+		taskENTER_CRITICAL();
+		consumeRxDMA(handle,unreadRxDMA(handle));
+		taskEXIT_CRITICAL();
+		return;
 	}
+
+	//flushing queue
+	xQueueReset(handle->_rxQueueHandle);
 }
 
 void flushTXDriver_UART(UART_HandleTypeDef* huartHandle){
-	//scanning the structure array
-	for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
+	volatile DriverHandel_UART* handle = getHandle(huartHandle);
+	if(handle == NULL) return;
+
+	if(handle->_txDMA)
 	{
-		//if it finds the handle in the structure
-		if(_driverHandle_UART[handleIndex]._usageFlag == 1 && huartHandle == _driverHandle_UART[handleIndex]._huartHandle)
-		{
-			//flushing queue
-			xQueueReset(_driverHandle_UART[handleIndex]._txQueueHandle);
-		}
+		//dropping everything but the transfer in flight
+		taskENTER_CRITICAL();
+		handle->_txDMAHead = (handle->_txDMATail + handle->_txDMALen) % SERIAL_TX_BUFF_LEN;
+		handle->_txDMACount = handle->_txDMALen;
+		taskEXIT_CRITICAL();
+		return;
 	}
+
+	//flushing queue
+	xQueueReset(handle->_txQueueHandle);
+}
+
+uint8_t setBaudDriver_UART(UART_HandleTypeDef* huartHandle, uint32_t baudRate){
+	volatile DriverHandel_UART* handle = getHandle(huartHandle);
+	if(handle == NULL || baudRate == 0) return 1;
+
+	//disable the IRQ
+	uint32_t irqState=NVIC_GetEnableIRQ(handle->_irq);
+	NVIC_DisableIRQ(handle->_irq);
+
+	//bytes on the line are lost anyway when the rate changes
+	HAL_UART_Abort(huartHandle);
+	huartHandle->Init.BaudRate = baudRate;
+	uint8_t ret = (HAL_UART_Init(huartHandle) != HAL_OK);
+
+	if(handle->_txDMA)
+	{
+		handle->_txDMAHead = 0;
+		handle->_txDMATail = 0;
+		handle->_txDMACount = 0;
+		handle->_txDMALen = 0;
+	}
+	else
+	{
+		xQueueReset(handle->_txQueueHandle);
+	}
+
+	//restarting reception from an empty buffer
+	if(handle->_rxDMA)
+	{
+		startRxDMA(handle);
+	}
+	else
+	{
+		xQueueReset(handle->_rxQueueHandle);
+		HAL_UART_Receive_IT(huartHandle,(uint8_t*)&handle->_rxByte,1);
+	}
+
+	if(irqState) NVIC_EnableIRQ(handle->_irq);
+
+	return ret;
+}
+
+uint8_t getStatsDriver_UART(UART_HandleTypeDef* huartHandle, uart_stats* stats){
+	volatile DriverHandel_UART* handle = getHandle(huartHandle);
+	if(handle == NULL || stats == NULL) return 1;
+
+	//copying in one shot so the counters are coherent with each other
+	taskENTER_CRITICAL();
+	memcpy(stats,(uart_stats*)&handle->_stats,sizeof(uart_stats));
+	taskEXIT_CRITICAL();
+
+	return 0;
+}
+
+void resetStatsDriver_UART(UART_HandleTypeDef* huartHandle){
+	volatile DriverHandel_UART* handle = getHandle(huartHandle);
+	if(handle == NULL) return;
+
+	taskENTER_CRITICAL();
+	memset((uart_stats*)&handle->_stats,0,sizeof(uart_stats));
+	taskEXIT_CRITICAL();
 }
 
 void HAL_UART_ErrorCallback(UART_HandleTypeDef *huartHandle){
-//scanning the array with the structures to find the handle
+    volatile DriverHandel_UART* handle = getHandle(huartHandle);
+    if(handle == NULL) return;
 
-    for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
+    //counting line errors
+    if(huartHandle->ErrorCode & HAL_UART_ERROR_ORE) handle->_stats.overrunErrors++;
+    if(huartHandle->ErrorCode & HAL_UART_ERROR_FE) handle->_stats.framingErrors++;
+    if(huartHandle->ErrorCode & (HAL_UART_ERROR_NE | HAL_UART_ERROR_PE)) handle->_stats.noiseErrors++;
+
+    //a DMA tx error aborts the transfer in flight: drop it and go on with the rest of the ring
+    if(handle->_txDMA && handle->_txDMALen != 0 && huartHandle->gState == HAL_UART_STATE_READY)
     {
-        //if it finds the handle
-        if((_driverHandle_UART[handleIndex]._usageFlag == 1) && (huartHandle == _driverHandle_UART[handleIndex]._huartHandle))
+        handle->_stats.txDropped += handle->_txDMALen;
+        endTxDMA(handle);
+    }
+
+    if(handle->_rxDMA)
+    {
+        //any error during DMA reception is blocking: the HAL aborted the rx DMA,
+        //restart it (unread bytes are dropped, the stream is broken anyway)
+        if(huartHandle->RxState == HAL_UART_STATE_READY)
         {
-            HAL_UART_Receive_IT(huartHandle,&_driverHandle_UART[handleIndex]._rxByte,1);
-            return;
+            handle->_stats.rxDropped += unreadRxDMA(handle);
+            startRxDMA(handle);
         }
+        return;
     }
-    return;
-    
+
+    HAL_UART_Receive_IT(huartHandle,(uint8_t*)&handle->_rxByte,1);
 }
 
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
-	//scanning the structure array
-    for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
-    {
-        //if it finds the handle in the structure
-        if(_driverHandle_UART[handleIndex]._usageFlag == 1 && huart == _driverHandle_UART[handleIndex]._huartHandle)
-        {
-        	if(_driverHandle_UART[handleIndex]._policyRX==keep_new && xQueueIsQueueFullFromISR(_driverHandle_UART[handleIndex]._rxQueueHandle)){
-        		uint8_t c;
-        		xQueueReceiveFromISR(_driverHandle_UART[handleIndex]._rxQueueHandle, &c, NULL);
-        	}
+    volatile DriverHandel_UART* handle = getHandle(huart);
+    if(handle == NULL) return;
 
-            xQueueSendToBackFromISR(_driverHandle_UART[handleIndex]._rxQueueHandle,(void*)&_driverHandle_UART[handleIndex]._rxByte,NULL);
+    handle->_stats.rxEvents++;
+    handle->_stats.rxBytes++;
 
-            //relaunching ISR
-            HAL_UART_Receive_IT(huart,&_driverHandle_UART[handleIndex]._rxByte,1);
+	if(handle->_policyRX==keep_new && xQueueIsQueueFullFromISR(handle->_rxQueueHandle)){
+		uint8_t c;
+		xQueueReceiveFromISR(handle->_rxQueueHandle, &c, NULL);
+		handle->_stats.rxDropped++;
+	}
 
-            return;
-        }
+    if(xQueueSendToBackFromISR(handle->_rxQueueHandle,(void*)&handle->_rxByte,NULL)!=pdTRUE){
+    	handle->_stats.rxDropped++; //keep_old policy and queue full
     }
-	return;
+
+    uint32_t waiting = uxQueueMessagesWaitingFromISR(handle->_rxQueueHandle);
+    if(waiting > handle->_stats.rxHighWater) handle->_stats.rxHighWater = waiting;
+    notifyRxWait(handle,waiting);
+
+    //relaunching ISR
+    HAL_UART_Receive_IT(huart,(uint8_t*)&handle->_rxByte,1);
 }
 
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart){
-	//scanning the structure array
-    for(uint32_t handleIndex = 0; handleIndex < MAX_UART_HANDLE; handleIndex++)
-    {
-        //if it finds the handle in the structure
-        if(_driverHandle_UART[handleIndex]._usageFlag == 1 && huart == _driverHandle_UART[handleIndex]._huartHandle)
-        {
-            
-			if(xQueueReceiveFromISR(_driverHandle_UART[handleIndex]._txQueueHandle,&_driverHandle_UART[handleIndex]._txByte,NULL)==pdTRUE){
-				HAL_UART_Transmit_IT(_driverHandle_UART[handleIndex]._huartHandle, &_driverHandle_UART[handleIndex]._txByte, 1);
-			}
+    volatile DriverHandel_UART* handle = getHandle(huart);
+    if(handle == NULL) return;
 
-            return;
-        }
+    handle->_stats.txEvents++;
+
+    if(handle->_txDMA)
+    {
+        //one interrupt per chunk: release it and chain the next span
+        handle->_stats.txBytes += handle->_txDMALen;
+        endTxDMA(handle);
+        return;
     }
-	return;
 
+    handle->_stats.txBytes++;
+	if(xQueueReceiveFromISR(handle->_txQueueHandle,(void*)&handle->_txByte,NULL)==pdTRUE){
+		HAL_UART_Transmit_IT(handle->_huartHandle, (uint8_t*)&handle->_txByte, 1);
+	}
+}
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+    volatile DriverHandel_UART* handle = getHandle(huart);
+    if(handle == NULL) return;
+
+	//half buffer, full buffer or idle line: Size is the DMA position in the ring
+	uint32_t pos = (Size >= SERIAL_RX_BUFF_LEN) ? 0 : Size;
+	uint32_t lastPos = handle->_rxDMAPos;
+	uint32_t received = (pos >= lastPos) ? pos - lastPos : pos + SERIAL_RX_BUFF_LEN - lastPos;
+
+	handle->_rxDMACount += received;
+	handle->_rxDMAPos = pos;
+
+	uint32_t waiting = handle->_rxDMACount - handle->_rxDMARead;
+	if(waiting > SERIAL_RX_BUFF_LEN) waiting = SERIAL_RX_BUFF_LEN;	//lapped, counted as dropped by the reader
+	handle->_stats.rxEvents++;
+	handle->_stats.rxBytes += received;
+	if(waiting > handle->_stats.rxHighWater) handle->_stats.rxHighWater = waiting;
+	notifyRxWait(handle,waiting);
 }
@@ -1,4 +1,5 @@
 #include "actuator_driver.h"
+#include <string.h>
 
 
 const float Rsense[] = {1973,2028,1962,1992,1979}; //Ohm //Rsense value for each motor driver
@@ -6,6 +7,65 @@ const float Aipropri = 1575e-6; //Adimensionale //Mirror ratio of driver current
 const float Rmagnetorquer[] = {30.5,30.5,142}; //Ohm
 bool int_flag1 = 0,int_flag2 = 0;
 
+//actuators given to init_actuator_handler(), to find the ones sharing a timer
+static Actuator_struct *_actuators[NUM_ACTUATORS];
+static uint32_t _actuatorNum;
+
+//scan mode state
+static volatile uint16_t _scanBuf[2][NUM_DRIVERS];	//DMA double buffer, one scan per half
+static volatile uint32_t _scanHalf;					//half with the latest complete scan
+static volatile uint32_t _scanCount;				//scans completed
+static ADC_HandleTypeDef *_scanAdc;					//adc running the scans (NULL if stopped)
+
+//statistics state, written by the scan interrupts
+typedef struct{
+	uint16_t min;
+	uint16_t max;
+	uint16_t over;
+	uint8_t above;		//last sample was above the threshold
+	uint32_t sum;
+	uint64_t sumsq;
+} act_accumulator;
+
+static act_accumulator _acc[NUM_DRIVERS];			//window being accumulated
+static uint32_t _accScans;							//scans in the window being accumulated
+static uint32_t _accWindow;							//length of the window being accumulated
+static volatile uint32_t _statsWindow = ACT_STATS_WINDOW;	//length of the next windows
+static volatile act_current_stats _stats;			//last complete window, published
+
+//current loops state, run by the scan interrupts (one slot per current sense channel)
+typedef struct{
+	Actuator_struct *act;	//NULL if the loop is not running
+	int32_t kp;
+	int32_t ki;
+	int32_t integ;			//integral term, Q8 of the Q15 duty cycle (0..ACT_DUTY_ONE in Q8)
+	uint8_t reverse;		//direction of the integral term
+	act_loop_state state;
+} act_loop;
+
+static volatile act_loop _loop[NUM_DRIVERS];
+
+
+//compare registers of a command (preloaded, they act at the next update event)
+static inline void act_write(Actuator_struct *act,uint32_t counts,bool dir)
+{
+	uint32_t arr = act->htim->Instance->ARR;
+	if(counts > arr) counts = arr;
+	act->counts = counts;
+	act->dir = dir;
+	if(dir)
+	{
+		//IN1 -> 100% PWM, IN2 -> Duty Cycle PWM
+		__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel1, arr);
+		__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel2, counts);
+	}
+	else
+	{
+		//IN1 -> Duty Cycle PWM, IN2 -> 100% PWM
+		__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel1, counts);
+		__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel2, arr);
+	}
+}
 
 //PWM freq puo variare tra 4Hz e 200Khz
 //Duty cycle must be written in percentage in this function!!!
@@ -18,22 +78,91 @@ void init_actuator_handler(Actuator_struct *act,TIM_HandleTypeDef* htim,uint32_t
 	act->pwm_channel2=pwm_channel2;
 	act->duty_cycle = duty_cycle;
 	act->dir = 1; //Initially FORWARD
+	act->counts = 0;
+	act->dither = false;
+	act->residue = 0;
 
+	//the outputs are stopped, the counter keeps running if it was (e.g. triggering the current scans)
+	uint32_t running = act->htim->Instance->CR1 & TIM_CR1_CEN;
 	HAL_TIM_PWM_Stop(act->htim,pwm_channel1);
 	HAL_TIM_PWM_Stop(act->htim,pwm_channel2);
+	if(running) __HAL_TIM_ENABLE(act->htim);
+	//new compare values act at the update event (end of the period)
+	__HAL_TIM_ENABLE_OCxPRELOAD(act->htim, pwm_channel1);
+	__HAL_TIM_ENABLE_OCxPRELOAD(act->htim, pwm_channel2);
+
+	uint32_t i;
+	for(i=0;i<_actuatorNum && _actuators[i]!=act;i++);
+	if(i==_actuatorNum && _actuatorNum<NUM_ACTUATORS) _actuators[_actuatorNum++] = act;
 
 	if(pwm_freq > 200000)  pwm_freq = 200000;
 	else if(pwm_freq < 4) pwm_freq = 4;
-	uint32_t prescaler = (40000000 / (pwm_freq * (act->htim->Init.Period + 1))) - 1;
+	//prescaler and auto-reload are shared by all the actuators on the timer, their duty cycles are kept
+	if(actuator_set_pwm(act,pwm_freq,ACT_PWM_RESOLUTION) != 0) actuator_set_pwm(act,pwm_freq,0);
 
-	// Aggiornare il prescaler
-	__HAL_TIM_SET_PRESCALER(act->htim, prescaler);
+	uint32_t update_value = (uint32_t)roundf((float)(act->htim->Instance->ARR) * (act->duty_cycle * 0.01));
+	act_write(act,update_value,act->dir);
+}
 
+uint32_t actuator_duty_counts(const Actuator_struct *act,int32_t duty)
+{
+	uint32_t mag = (duty < 0) ? (uint32_t)(-(int64_t)duty) : (uint32_t)duty;
+	if(mag > ACT_DUTY_ONE) mag = ACT_DUTY_ONE;
+	//rounded to the nearest count
+	return (uint32_t)(((uint64_t)mag * act->htim->Instance->ARR + ACT_DUTY_ONE/2) >> 15);
+}
 
-	uint32_t update_value = (uint32_t)roundf((float)(act->htim->Instance->ARR) * (act->duty_cycle * 0.01));
-	//if(update_value > act->htim->Instance->ARR)	update_value = act->htim->Instance->ARR;
-	__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel1, (uint32_t)(roundf(act->htim->Instance->ARR)));
-	__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel2, (uint32_t)(roundf(update_value)));
+//counts of a Q15 command: rounded, or with the fraction of count carried to the next command if dithered
+static inline uint32_t act_command_counts(Actuator_struct *act,int32_t duty)
+{
+	if(!act->dither) return actuator_duty_counts(act,duty);
+	uint32_t mag = (duty < 0) ? (uint32_t)(-(int64_t)duty) : (uint32_t)duty;
+	if(mag > ACT_DUTY_ONE) mag = ACT_DUTY_ONE;
+	uint64_t scaled = (uint64_t)mag * act->htim->Instance->ARR;	//counts in Q15
+	uint32_t residue = act->residue + (uint32_t)(scaled & (ACT_DUTY_ONE - 1));
+	act->residue = residue & (ACT_DUTY_ONE - 1);
+	return (uint32_t)(scaled >> 15) + (residue >> 15);
+}
+
+void actuator_set_counts(Actuator_struct *act,uint32_t counts,bool dir)
+{
+	act_write(act,counts,dir);
+}
+
+void actuator_set_duty_q15(Actuator_struct *act,int32_t duty)
+{
+	act_write(act,act_command_counts(act,duty),duty >= 0);
+}
+
+void actuator_apply_all(Actuator_struct *const acts[],const int32_t duty[],uint32_t num)
+{
+	//no update events (no transfer of the preload registers) while the timers are written; the state
+	//of UDIS is restored at the end, a call from an interrupt does not enable the update events inside
+	//a batch or a frequency change of a task
+	TIM_TypeDef *tims[NUM_ACTUATORS];
+	uint32_t udis[NUM_ACTUATORS];
+	uint32_t ntim = 0;
+	for(uint32_t i=0;i<num;i++)
+	{
+		TIM_TypeDef *tim = acts[i]->htim->Instance;
+		uint32_t k;
+		for(k=0;k<ntim && tims[k]!=tim;k++);
+		if(k<ntim || ntim==NUM_ACTUATORS) continue;
+		tims[ntim] = tim;
+		udis[ntim++] = tim->CR1 & TIM_CR1_UDIS;
+		tim->CR1 |= TIM_CR1_UDIS;
+	}
+	for(uint32_t i=0;i<num;i++) act_write(acts[i],act_command_counts(acts[i],duty[i]),duty[i] >= 0);
+	for(uint32_t k=0;k<ntim;k++)
+	{
+		if(!udis[k]) tims[k]->CR1 &= ~TIM_CR1_UDIS;
+	}
+}
+
+void actuator_set_dither(Actuator_struct *act,bool enable)
+{
+	act->dither = enable;
+	act->residue = 0;
 }
 
 void get_actuator_current(ADC_HandleTypeDef *hadc,volatile float voltagebuf[],volatile float currentbuf[],uint8_t Channels_mask[])
@@ -146,43 +275,79 @@ void update_duty_dir(Actuator_struct *act,float duty,bool dir)
 		/* The duty cycle value is a percentage of the reload register value (ARR). Rounding is used.*/
 		uint32_t update_value = (uint32_t)roundf((float)(act->htim->Instance->ARR) * (duty * 0.01));
 
-		/*In case of the dutyCycle being calculated is higher than the reload register, fix it to the reload register*/
-		if(update_value > act->htim->Instance->ARR)	update_value = act->htim->Instance->ARR;
-
-		if(dir)
-		{
-			//IN1 -> 100% PWM
-			//IN2 -> Duty Cycle PWM
-			act->dir = 1; //REVERSE->FORWARD
-			printf("Change of direction: FORWARD!!!!!!! \n");
-			/*Assign the new value of duty cycle to the capture compare register.*/
-			//IN1
-			__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel1, (uint32_t)(roundf(act->htim->Instance->ARR)));
-			//IN2
-			__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel2, (uint32_t)(roundf(update_value)));
-		}
-		else
-		{
-			//IN1 -> Duty Cycle PWM
-			//IN2 -> 100% PWM
-			act->dir = 0;	//FORWARD->REVERSE
-			printf("Change of direction: REVERSE!!!!!!! \n");
-			/*Assign the new value of duty cycle to the capture compare register.*/
-			//IN1
-			__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel1, (uint32_t)(roundf(update_value)));
-			//IN2
-			__HAL_TIM_SET_COMPARE(act->htim, act->pwm_channel2, (uint32_t)(roundf(act->htim->Instance->ARR)));
-		}
+		/*Assign the new value of duty cycle to the capture compare registers (fixed to the reload register if higher).*/
+		act_write(act,update_value,dir);
+#if enable_printf
+		printf("Change of direction: %s!!!!!!! \n",dir ? "FORWARD" : "REVERSE");
+#endif
 	}
 	else
 	{
+#if enable_printf
 		printf("Error: Duty Cycle value is not a correct value !!!!!!! \n");
+#endif
+	}
+
+
+}
+
+uint8_t actuator_set_pwm(Actuator_struct *act,uint32_t pwm_freq,uint32_t resolution)
+{
+	uint32_t prescaler,period;
+	if(pwm_freq > 200000 || pwm_freq < 4) return 1;
+
+	if(resolution == 0)
+	{
+		//smallest prescaler that fits the period in ACT_ARR_MAX+1 counts
+		uint32_t total = (ACT_TIM_CLOCK + pwm_freq/2) / pwm_freq;	//timer clocks per period
+		prescaler = (total - 1) / (ACT_ARR_MAX + 1);
+		period = (total + (prescaler + 1)/2) / (prescaler + 1) - 1;
+	}
+	else
+	{
+		if(resolution < 2 || resolution > ACT_ARR_MAX + 1) return 1;
+		period = resolution - 1;
+		uint64_t clocks = (uint64_t)pwm_freq * resolution;	//timer clocks per second at prescaler 1
+		prescaler = (uint32_t)((ACT_TIM_CLOCK + clocks/2) / clocks);
+		if(prescaler == 0 || prescaler > 65536) return 1;
+		prescaler--;
 	}
 
+	TIM_TypeDef *tim = act->htim->Instance;
+	uint32_t old_period = tim->ARR;
+	float freq = (float)ACT_TIM_CLOCK / ((prescaler + 1) * (period + 1));
+
+	//everything is transferred at the same update event, none while it is written (UDIS restored at the end)
+	uint32_t udis = tim->CR1 & TIM_CR1_UDIS;
+	tim->CR1 |= TIM_CR1_UDIS;
+	tim->CR1 |= TIM_CR1_ARPE;
+	__HAL_TIM_SET_PRESCALER(act->htim, prescaler);
+	__HAL_TIM_SET_AUTORELOAD(act->htim, period);
+	act->htim->Init.Prescaler = prescaler;
+	uint8_t found = 0;
+	for(uint32_t i=0;i<=_actuatorNum;i++)
+	{
+		//registered actuators on the timer, then act if it was not among them
+		Actuator_struct *shared = (i < _actuatorNum) ? _actuators[i] : (found ? NULL : act);
+		if(shared == NULL || shared->htim != act->htim) continue;
+		found |= (shared == act);
+		//same duty cycle on the new auto-reload
+		uint32_t counts = (old_period == 0) ? 0 : (uint32_t)(((uint64_t)shared->counts * period + old_period/2) / old_period);
+		act_write(shared,counts,shared->dir);
+		shared->Freq = freq;
+	}
+	if(!udis) tim->CR1 &= ~TIM_CR1_UDIS;
+	return 0;
+}
 
+uint8_t update_pwm_Frequency(Actuator_struct *act)
+{
+	return actuator_set_pwm(act,(uint32_t)(act->Freq + 0.5f),0);
 }
 
 void actuator_START(Actuator_struct *act){
+	//counter stopped: load prescaler and compare values now, the first period is already the commanded one
+	if(!(act->htim->Instance->CR1 & TIM_CR1_CEN)) act->htim->Instance->EGR = TIM_EGR_UG;
 	HAL_TIM_PWM_Start(act->htim, act->pwm_channel1);//Start pwm signal 1
 	HAL_TIM_PWM_Start(act->htim, act->pwm_channel2);//Start pwm signal 2
 #if enable_printf
@@ -197,6 +362,346 @@ void actuator_STOP(Actuator_struct *act){
 #endif
 }
 
+void get_actuator_current_raw(ADC_HandleTypeDef *hadc,uint16_t rawbuf[],uint8_t Channels_mask[])
+{
+	//same channels as get_actuator_current(), codes are converted on ground
+	static void (*const select[NUM_DRIVERS])(ADC_HandleTypeDef *) = {ADC_Select_CH1,ADC_Select_CH2,ADC_Select_CH3,ADC_Select_CH4,ADC_Select_CH16};
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		if(Channels_mask[i] != 1) continue;
+		select[i](hadc);
+		HAL_ADC_Start(hadc);
+		if (HAL_ADC_PollForConversion(hadc, 10) != HAL_OK)
+		{
+			Error_Handler();
+		}
+		else
+		{
+			rawbuf[i] = HAL_ADC_GetValue(hadc);
+		}
+		HAL_ADC_Stop(hadc);
+	}
+}
+
+uint8_t actuator_scan_start(ADC_HandleTypeDef *hadc,TIM_HandleTypeDef *htim)
+{
+	static const uint32_t channel[NUM_DRIVERS] = {ADC_CHANNEL_1,ADC_CHANNEL_2,ADC_CHANNEL_3,ADC_CHANNEL_4,ADC_CHANNEL_16};
+	static const uint32_t rank[NUM_DRIVERS] = {ADC_REGULAR_RANK_1,ADC_REGULAR_RANK_2,ADC_REGULAR_RANK_3,ADC_REGULAR_RANK_4,ADC_REGULAR_RANK_5};
+	uint32_t trigger;
+
+	if(htim->Instance == TIM1) trigger = ADC_EXTERNALTRIG_T1_TRGO;
+	else if(htim->Instance == TIM2) trigger = ADC_EXTERNALTRIG_T2_TRGO;
+	else if(htim->Instance == TIM3) trigger = ADC_EXTERNALTRIG_T3_TRGO;
+	else return 1;
+
+	actuator_scan_stop(hadc);
+	HAL_ADC_Stop(hadc);
+
+	//whole sequence on each trigger, one DMA request per channel, circular
+	hadc->Init.ScanConvMode = ADC_SCAN_ENABLE;
+	hadc->Init.ContinuousConvMode = DISABLE;
+	hadc->Init.DiscontinuousConvMode = DISABLE;
+	hadc->Init.NbrOfConversion = NUM_DRIVERS;
+	hadc->Init.ExternalTrigConv = trigger;
+	hadc->Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+	hadc->Init.EOCSelection = ADC_EOC_SEQ_CONV;
+	hadc->Init.DMAContinuousRequests = ENABLE;
+	hadc->Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+	if (HAL_ADC_Init(hadc) != HAL_OK) return 1;
+
+	ADC_ChannelConfTypeDef sConfig = {0};
+	sConfig.SamplingTime = ACT_SCAN_SAMPLETIME;
+	sConfig.SingleDiff = ADC_SINGLE_ENDED;
+	sConfig.OffsetNumber = ADC_OFFSET_NONE;
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		sConfig.Channel = channel[i];
+		sConfig.Rank = rank[i];
+		if (HAL_ADC_ConfigChannel(hadc, &sConfig) != HAL_OK) return 1;
+	}
+
+	//TRGO on the update event: a scan at the beginning of each PWM period
+	TIM_MasterConfigTypeDef sMasterConfig = {0};
+	sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+	sMasterConfig.MasterOutputTrigger2 = TIM_TRGO2_RESET;
+	sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+	if (HAL_TIMEx_MasterConfigSynchronization(htim, &sMasterConfig) != HAL_OK) return 1;
+
+	_scanCount = 0;
+	memset(_acc, 0, sizeof(_acc));
+	memset((void *)&_stats, 0, sizeof(_stats));
+	_accScans = 0;
+	_accWindow = _statsWindow;
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		//threshold current to code, as seen by get_actuator_current() (above 4095 it is never reached)
+		float limit = (i < ACT_RW_NUM) ? ACT_RW_CURRENT_MAX : ACT_MT_CURRENT_MAX;
+		float code = limit * Rsense[i] * Aipropri * (4095.0f/3.3f);
+		_stats.threshold[i] = (code < 4095.0f) ? (uint16_t)(code + 0.5f) : 4095;
+	}
+	_scanAdc = hadc;
+	if (HAL_ADC_Start_DMA(hadc, (uint32_t *)_scanBuf, 2*NUM_DRIVERS) != HAL_OK)
+	{
+		_scanAdc = NULL;
+		return 1;
+	}
+	//counter enabled directly: HAL_TIM_Base_Start() would leave the handle busy for the next start
+	__HAL_TIM_ENABLE(htim);
+	return 0;
+}
+
+void actuator_scan_stop(ADC_HandleTypeDef *hadc)
+{
+	if(_scanAdc != hadc) return;
+	HAL_ADC_Stop_DMA(hadc);
+	_scanAdc = NULL;
+
+	//back to software started single conversions for ADC_Select_CHx()
+	hadc->Init.ContinuousConvMode = ENABLE;
+	hadc->Init.NbrOfConversion = 1;
+	hadc->Init.ExternalTrigConv = ADC_SOFTWARE_START;
+	hadc->Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+	hadc->Init.EOCSelection = ADC_EOC_SINGLE_CONV;
+	hadc->Init.DMAContinuousRequests = DISABLE;
+	hadc->Init.Overrun = ADC_OVR_DATA_PRESERVED;
+	HAL_ADC_Init(hadc);
+}
+
+uint32_t actuator_scan_read(uint16_t rawbuf[])
+{
+	uint32_t count;
+	//the half read is rewritten only after the other one completes, which changes the count
+	do{
+		count = _scanCount;
+		if(count == 0) return 0;
+		for(int i=0;i<NUM_DRIVERS;i++) rawbuf[i] = _scanBuf[_scanHalf][i];
+	}while(count != _scanCount);
+	return count;
+}
+
+uint32_t get_actuator_current_scan(volatile float voltagebuf[],volatile float currentbuf[])
+{
+	uint16_t rawbuf[NUM_DRIVERS];
+	uint32_t count = actuator_scan_read(rawbuf);
+	if(count == 0) return 0;
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		voltagebuf[i] = (float)rawbuf[i] * (3.3f/4095.0f);
+		currentbuf[i] = voltagebuf[i]/(Rsense[i]*Aipropri);
+	}
+	return count;
+}
+
+uint8_t actuator_stats_window(uint32_t scans)
+{
+	if(scans == 0 || scans > ACT_STATS_WINDOW_MAX) return 1;
+	_statsWindow = scans;
+	return 0;
+}
+
+uint32_t actuator_stats_read(act_current_stats *stats)
+{
+	uint32_t windows;
+	//the interrupt publishes a whole window before increasing the count
+	do{
+		windows = _stats.windows;
+		memcpy(stats, (const void *)&_stats, sizeof(act_current_stats));
+	}while(windows != _stats.windows);
+	stats->windows = windows;
+	return windows;
+}
+
+void get_actuator_current_stats(const act_current_stats *stats,float meanbuf[],float rmsbuf[],float maxbuf[])
+{
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		float scale = (3.3f/4095.0f)/(Rsense[i]*Aipropri);
+		meanbuf[i] = stats->ch[i].mean * (scale/16.0f);
+		rmsbuf[i] = stats->ch[i].rms * (scale/16.0f);
+		maxbuf[i] = stats->ch[i].max * scale;
+	}
+}
+
+//integer square root (bit by bit)
+static uint32_t isqrt32(uint32_t x)
+{
+	uint32_t root = 0, bit = 1UL << 30;
+	while(bit > x) bit >>= 2;
+	while(bit != 0)
+	{
+		if(x >= root + bit)
+		{
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else root >>= 1;
+		bit >>= 2;
+	}
+	return root;
+}
+
+//adds a scan to the window, publishes the window when it is complete (scan interrupt)
+static void act_stats_add(const volatile uint16_t scan[])
+{
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		uint16_t code = scan[i];
+		act_accumulator *acc = &_acc[i];
+		if(_accScans == 0 || code < acc->min) acc->min = code;
+		if(_accScans == 0 || code > acc->max) acc->max = code;
+		acc->sum += code;
+		acc->sumsq += (uint32_t)code * code;
+		if(code > _stats.threshold[i])
+		{
+			acc->over++;
+			if(!acc->above) _stats.crossings[i]++;
+			acc->above = 1;
+		}
+		else acc->above = 0;
+	}
+	if(++_accScans < _accWindow) return;
+
+	for(int i=0;i<NUM_DRIVERS;i++)
+	{
+		act_accumulator *acc = &_acc[i];
+		_stats.ch[i].min = acc->min;
+		_stats.ch[i].max = acc->max;
+		_stats.ch[i].mean = (uint16_t)((acc->sum * 16 + _accScans / 2) / _accScans);
+		//mean square in Q8 (below 4095^2 * 256, fits 32 bits), its root in Q4
+		_stats.ch[i].rms = (uint16_t)isqrt32((uint32_t)((acc->sumsq * 256 + _accScans / 2) / _accScans));
+		_stats.ch[i].over = acc->over;
+		acc->sum = 0;
+		acc->sumsq = 0;
+		acc->over = 0;
+	}
+	_stats.scans = _accScans;
+	_stats.windows++;
+	_accScans = 0;
+	_accWindow = _statsWindow;
+}
+
+uint8_t actuator_current_loop_start(uint32_t driver,Actuator_struct *act,uint16_t kp,uint16_t ki)
+{
+	if(driver < ACT_RW_NUM || driver >= NUM_DRIVERS || act == NULL) return 1;
+	volatile act_loop *loop = &_loop[driver];
+	//not run by the scan interrupts while it is set up
+	loop->act = NULL;
+	loop->kp = kp ? kp : ACT_LOOP_KP;
+	loop->ki = ki ? ki : ACT_LOOP_KI;
+	loop->integ = 0;
+	loop->reverse = 0;
+	loop->state.setpoint = 0;
+	loop->state.measured = 0;
+	loop->state.duty = 0;
+	loop->state.runs = 0;
+	loop->state.saturated = 0;
+	loop->act = act;
+	return 0;
+}
+
+void actuator_current_loop_stop(uint32_t driver)
+{
+	if(driver < ACT_RW_NUM || driver >= NUM_DRIVERS || _loop[driver].act == NULL) return;
+	Actuator_struct *act = _loop[driver].act;
+	_loop[driver].act = NULL;
+	act_write(act,0,act->dir);
+}
+
+uint8_t actuator_current_setpoint(uint32_t driver,float current)
+{
+	if(driver < ACT_RW_NUM || driver >= NUM_DRIVERS || _loop[driver].act == NULL) return 1;
+	//current to code, as seen by get_actuator_current()
+	float code = current * Rsense[driver] * Aipropri * (4095.0f/3.3f);
+	if(code > 4095.0f) code = 4095.0f;
+	else if(code < -4095.0f) code = -4095.0f;
+	_loop[driver].state.setpoint = (int32_t)roundf(code);
+	return 0;
+}
+
+uint8_t actuator_current_loop_read(uint32_t driver,act_loop_state *state)
+{
+	if(driver < ACT_RW_NUM || driver >= NUM_DRIVERS || _loop[driver].act == NULL) return 1;
+	uint32_t runs;
+	//the interrupt writes the whole state before increasing the count
+	do{
+		runs = _loop[driver].state.runs;
+		*state = _loop[driver].state;
+	}while(runs != _loop[driver].state.runs);
+	return 0;
+}
+
+//one step of the current loops on a scan, the duty cycles are committed together (scan interrupt)
+static void act_loop_run(const volatile uint16_t scan[])
+{
+	Actuator_struct *acts[NUM_DRIVERS];
+	int32_t duty[NUM_DRIVERS];
+	uint32_t num = 0;
+	for(int i=ACT_RW_NUM;i<NUM_DRIVERS;i++)
+	{
+		volatile act_loop *loop = &_loop[i];
+		if(loop->act == NULL) continue;
+		int32_t setpoint = loop->state.setpoint;
+		int32_t error = ((setpoint < 0) ? -setpoint : setpoint) - (int32_t)scan[i];
+		int32_t integ = loop->integ;
+		//the current sense gives the magnitude: a new direction starts from 0
+		if((setpoint < 0) != loop->reverse)
+		{
+			integ = 0;
+			loop->reverse = (setpoint < 0);
+		}
+		//below 2^31: gains up to 2^16, errors up to 2^12, integral term up to 2^23
+		int32_t out = 0;
+		if(setpoint != 0)
+		{
+			int32_t next = integ + loop->ki * error;
+			if(next > (ACT_DUTY_ONE << 8)) next = ACT_DUTY_ONE << 8;
+			else if(next < 0) next = 0;
+			out = (loop->kp * error + next) / 256;
+			//anti-windup: no integration further into the saturation
+			if(out >= ACT_DUTY_ONE)
+			{
+				out = ACT_DUTY_ONE;
+				if(error > 0) next = integ;
+				loop->state.saturated++;
+			}
+			else if(out < 0)
+			{
+				out = 0;
+				if(error < 0) next = integ;
+				loop->state.saturated++;
+			}
+			integ = next;
+		}
+		else integ = 0;
+		loop->integ = integ;
+		loop->state.measured = scan[i];
+		loop->state.duty = (setpoint < 0) ? -out : out;
+		acts[num] = loop->act;
+		duty[num++] = loop->state.duty;
+		loop->state.runs++;
+	}
+	if(num > 0) actuator_apply_all(acts,duty,num);
+}
+
+//DMA half and full transfer interrupts: a scan was completed in the first or second half
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+{
+	if(hadc != _scanAdc) return;
+	_scanHalf = 0;
+	_scanCount++;
+	act_stats_add(_scanBuf[0]);
+	act_loop_run(_scanBuf[0]);
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+	if(hadc != _scanAdc) return;
+	_scanHalf = 1;
+	_scanCount++;
+	act_stats_add(_scanBuf[1]);
+	act_loop_run(_scanBuf[1]);
+}
+
 void ADC_Select_CH1 (ADC_HandleTypeDef *hadc)
 {
 	  ADC_ChannelConfTypeDef sConfig = {0};
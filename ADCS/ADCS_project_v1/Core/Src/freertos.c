@@ -57,10 +57,19 @@ Actuator_struct Reaction2;
 Actuator_struct MagneTorquer1;
 Actuator_struct MagneTorquer2;
 Actuator_struct MagneTorquer3;
+//actuators in the order of the current sense channels (NUM_ACTUATORS), for the batch commands
+Actuator_struct *const Actuators[NUM_ACTUATORS] = {&Reaction1,&Reaction2,&MagneTorquer1,&MagneTorquer2,&MagneTorquer3};
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+//imuCaptureCmdADCS commands
+#define IMU_CAPTURE_STOP	0
+#define IMU_CAPTURE_START	1
+#define IMU_CAPTURE_DUMP	2	//stop and send the capture ring in imuCaptureADCS messages
+_Static_assert(sizeof(imuCaptureADCS)<=CDH_MAX_PAY_LEN, "imuCaptureADCS does not fit a CDH frame");
+_Static_assert(sizeof(housekeepingADCS)<=CDH_MAX_PAY_LEN && sizeof(housekeepingRawADCS)<=CDH_MAX_PAY_LEN, "housekeeping does not fit a CDH frame");
+_Static_assert(sizeof(currentStatsADCS)<=CDH_MAX_PAY_LEN && sizeof(currentStatsRawADCS)<=CDH_MAX_PAY_LEN, "current statistics do not fit a CDH frame");
 
 /* USER CODE END PD */
 
@@ -102,10 +111,10 @@ osMessageQId ADCSHouseKeepingQueueHandle;
 uint8_t ADCSHouseKeepingQueueBuffer[ 256 * sizeof( float ) ];
 osStaticMessageQDef_t ADCSHouseKeepingQueueControlBlock;
 osMessageQId IMUQueue1Handle;
-uint8_t IMUQueue1Buffer[ 256 * sizeof( imu_queue_struct ) ];
+uint8_t IMUQueue1Buffer[ IMU_BLOCK_NUM * sizeof( uint32_t ) ];
 osStaticMessageQDef_t IMUQueue1ControlBlock;
 osMessageQId IMUQueue2Handle;
-uint8_t IMUQueue2Buffer[ 256 * sizeof( imu_queue_struct ) ];
+uint8_t IMUQueue2Buffer[ IMU_BLOCK_NUM * sizeof( uint32_t ) ];
 osStaticMessageQDef_t IMUQueue2ControlBlock;
 osMessageQId setAttitudeADCSQueueHandle;
 uint8_t setAttitudeADCSQueueBuffer[ 256 * sizeof( float ) ];
@@ -139,6 +148,9 @@ uint8_t txFunc1(uint8_t byte){
 uint8_t rxFunc1(uint8_t* byte){
 	return (receiveDriver_UART(&huart1, byte, 1)!=0);
 }
+void waitFunc1(uint32_t timeout){
+	receiveDriver_UART_Wait(&huart1, NULL, 0, 1, pdMS_TO_TICKS(timeout));
+}
 
 uint8_t txFunc4(uint8_t byte){
 	return (sendDriver_UART(&huart4, &byte, 1)!=0);
@@ -255,11 +267,11 @@ void MX_FREERTOS_Init(void) {
 
   /* USER CODE BEGIN RTOS_QUEUES */
   /* add queues, ... */
-  /* definition and creation of IMUQueue1 */
-	osMessageQStaticDef(IMUQueue1, 512, uint32_t,IMUQueue1Buffer, &IMUQueue1ControlBlock);
+  /* definition and creation of IMUQueue1 (imu_block pointers, at most all the pool) */
+	osMessageQStaticDef(IMUQueue1, IMU_BLOCK_NUM, uint32_t,IMUQueue1Buffer, &IMUQueue1ControlBlock);
 	IMUQueue1Handle = osMessageCreate(osMessageQ(IMUQueue1), NULL);
   /* definition and creation of IMUQueue2 */
-	osMessageQStaticDef(IMUQueue2, 512, uint32_t, IMUQueue2Buffer, &IMUQueue2ControlBlock);
+	osMessageQStaticDef(IMUQueue2, IMU_BLOCK_NUM, uint32_t, IMUQueue2Buffer, &IMUQueue2ControlBlock);
 	IMUQueue2Handle = osMessageCreate(osMessageQ(IMUQueue2), NULL);
   /* definition and creation of ADCSHouseKeepingQueue */
 	osMessageQStaticDef(ADCSHouseKeepingQueue, 512, uint32_t, ADCSHouseKeepingQueueBuffer, &ADCSHouseKeepingQueueControlBlock);
@@ -328,33 +340,64 @@ void Check_current_temp(void const * argument)
 	//Inizialize Serial Line for UART3
 	//sdlInitLine(&line,&txFunc3,&rxFunc3,50,2);
 	init_tempsens_handler(&ntc_values);
-	volatile float currentbuf[NUM_ACTUATORS],voltagebuf[NUM_ACTUATORS];
-	Current_Temp_Struct *local_current_temp_struct = (Current_Temp_Struct*) malloc(sizeof(Current_Temp_Struct));
-	static uint8_t count = 0;
-	
+#if !housekeeping_raw
+	volatile float currentbuf[NUM_ACTUATORS] = {0},voltagebuf[NUM_ACTUATORS] = {0};
+#endif
+	uint16_t currentraw[NUM_ACTUATORS] = {0};
+	act_current_stats current_stats = {0};
+	Current_Temp_Struct *local_current_temp_struct;
+	static ntc_scheduler ntc_sched;
+	uint16_t ntc_raw[NUM_TEMP_SENS];
+	uint32_t sent_sweeps = 0;	//NTC sweeps already sent as housekeeping
+	uint32_t sweeps;
+
 	/*Start calibration */
 	if (HAL_ADCEx_Calibration_Start(&hadc1, ADC_SINGLE_ENDED) !=  HAL_OK)
 	{
 	}
 
+	//temperatures are acquired by the scheduler on the SPI DMA queue, this task is woken
+	//when a whole sweep of raw codes is ready (or after the longest sweep time, to check
+	//the currents anyway)
+	initDriver_SPI();
+	addDriver_SPI(&hspi2);
+	start_ntc_scheduler(&ntc_sched,&hspi2,xTaskGetCurrentTaskHandle());
+
+	//actuator currents are scanned continuously by ADC1 and DMA, at the beginning of the TIM1 PWM periods
+	if (actuator_scan_start(&hadc1,&htim1) != 0)
+	{
+		printf("CHECK TASK: current scan not started \n");
+	}
+
 	/* Infinite loop */
 	for(;;)
 	{
 		//volatile float prev = HAL_GetTick();
 		//printf("We are in CHECK TASK \n");
 
-		//----------------------------------------------------------------------
-
 		//GET TEMPERATURES------------------------------------------------------
-		//float prev1 = HAL_GetTick();
-		get_temperatures(&hspi2,&ntc_values,count);
-		//float next1 = HAL_GetTick();
-		//printf("Execussion of get_temperatures: %.1f ms\n",next1-prev1);
-		count ++;
+		ulTaskNotifyTake(pdTRUE,pdMS_TO_TICKS(NTC_SWEEP_TIMEOUT_MS));
+		sweeps = read_ntc_sweep(&ntc_sched,ntc_raw);
+#if !housekeeping_raw
+		//with raw housekeeping the codes are converted on ground
+		if(sweeps != sent_sweeps)
+		{
+			for(int i=0;i<NUM_TEMP_SENS;i++)
+			{
+				ntc_values.temp[i] = ntc_code_to_temperature(&ntc_values,i,ntc_raw[i]);
+			}
+		}
+#endif
 		//----------------------------------------------------------------------
 
 		//GET ACTUATORS CURRENT
-		get_actuator_current(&hadc1,voltagebuf,currentbuf,Channels_mask);
+		//latest scan (the values are kept if no scan was completed)
+		actuator_scan_read(currentraw);
+#if !housekeeping_raw
+		get_actuator_current_scan(voltagebuf,currentbuf);
+#endif
+		//min/max/mean/RMS of every scan of the last window and the over current counters
+		actuator_stats_read(&current_stats);
 		/*for(int i=0;i<NUM_DRIVERS;i++)
 		{
 			printf("Actuator %d current value: %f",i,currentbuf[i]);
@@ -362,28 +405,18 @@ void Check_current_temp(void const * argument)
 		//----------------------------------------------------------------------
 
 		//CHECK IF THEY ARE OK
-		/*for(int i=0;i<NUM_ACTUATORS;i++)
+		//over currents (> 1A reaction wheels, > 50mA magnetorquers) are counted on every scan by the
+		//current statistics (ACT_RW_CURRENT_MAX, ACT_MT_CURRENT_MAX) and sent by the OBC task
+#if enable_printf
+		for(int i=0;i<NUM_ACTUATORS;i++)
 		{
-			if(i>=0 && i<2)
+			if(current_stats.ch[i].over != 0)
 			{
-				//Check Reaction Wheels currents
-				if(current_buf[i] > 1.0f) //> 1A
-				{
-					printf("MAgnetorquer %d current value: %f is above threshold!!!! ",i,currentbuf[i]);
-					error_status = 5;
-				}
-			}
-			else{
-				//Check MagneTorquers currents
-				if(current_buf[i] > 0.05f) // >50mA
-				{
-					printf("Magnetorquer %d current value: %f is above threshold!!!! ",i,currentbuf[i]);
-					error_status = 4;
-				}
+				printf("Actuator %d: %u samples above threshold, %lu crossings \n",i,current_stats.ch[i].over,current_stats.crossings[i]);
 			}
 		}
-
-		for(int i=0;i<NUM_TEMP_SENS;i++)
+#endif
+		/*for(int i=0;i<NUM_TEMP_SENS;i++)
 		{
 			if(ntc_values.temp[i]>50) //>50 gradi
 			{
@@ -399,23 +432,26 @@ void Check_current_temp(void const * argument)
 				//ALL IS OK
 				//Send Housekeeping to OBC task
 				
-				if (local_current_temp_struct == NULL) {
-
-				}
-				else
+				//once per complete sweep of the NTCs, the OBC task frees the struct
+				if(sweeps != sent_sweeps)
 				{
-					if(count == 8)
+					local_current_temp_struct = (Current_Temp_Struct*) malloc(sizeof(Current_Temp_Struct));
+					if (local_current_temp_struct != NULL)
 					{
+#if !housekeeping_raw
 						for(int i=0;i<NUM_ACTUATORS;i++)
 						{
 							local_current_temp_struct->current[i] = currentbuf[i];
 
 			    		}
+#endif
 						for(int i=NUM_ACTUATORS;i<NUM_TEMP_SENS+NUM_ACTUATORS;i++)
 						{
 							local_current_temp_struct->temperature[i - NUM_ACTUATORS] = ntc_values.temp[i - NUM_ACTUATORS];
 
 						}
+						memcpy(local_current_temp_struct->currentRAW,currentraw,sizeof(currentraw));
+						memcpy(local_current_temp_struct->temperatureRAW,ntc_raw,sizeof(ntc_raw));
 
 						//Invio queue a OBC Task
 						if (osMessagePut(ADCSHouseKeepingQueueHandle,(uint32_t)local_current_temp_struct,300) != osOK) {
@@ -424,8 +460,8 @@ void Check_current_temp(void const * argument)
 						} else {
 
 						}
-						count = 0;
 					}
+					sent_sweeps = sweeps;
 				}
 				break;
 			case 1:
@@ -448,7 +484,6 @@ void Check_current_temp(void const * argument)
 		}
 		//volatile next = HAL_GetTick();
 		//printf("Execussion of check task: %.1f ms\n",next-prev);
-	    osDelay(100);
 	  }
   /* USER CODE END Check_pwr_temp */
 }
@@ -460,14 +495,26 @@ void OBC_Comm_Task(void const * argument)
 	static serial_line_handle line1;
 	//Inizialize Serial Line for UART1
 	sdlInitLine(&line1,&txFunc1,&rxFunc1,50,2);
+	sdlSetWaitFunc(&line1,&waitFunc1);	//sleep while waiting for acks
 
 	uint8_t opmode=0;
 	uint32_t rxLen;
 
 	setAttitudeADCS *RxAttitude = (setAttitudeADCS*) malloc(sizeof(setAttitudeADCS));
+#if housekeeping_raw
+	housekeepingRawADCS TxHousekeeping;
+	currentStatsRawADCS TxCurrentStats;
+#else
 	housekeepingADCS TxHousekeeping;
+	currentStatsADCS TxCurrentStats;
+	float mean[NUM_ACTUATORS],rms[NUM_ACTUATORS],max[NUM_ACTUATORS];
+#endif
+	act_current_stats current_stats;
+	uint32_t sent_windows = 0;	//current statistics windows already sent
 	attitudeADCS TxAttitude;
 	setOpmodeADCS RxOpMode;
+	imuCaptureCmdADCS RxCaptureCmd;
+	imuCaptureADCS TxCapture;
 	//opmodeADCS TxOpMode;
 	osEvent retvalue1,retvalue;
 	uint8_t cnt1 = 0,cnt2 = 0;
@@ -508,6 +555,25 @@ void OBC_Comm_Task(void const * argument)
 			 	}
 			}
 	  		
+	  	}else if(rxBuff[0]==IMUCAPTURECMDADCS_CODE && rxLen==sizeof(imuCaptureCmdADCS)){
+
+	  		memcpy(&RxCaptureCmd,rxBuff,sizeof(imuCaptureCmdADCS));
+	  		if(RxCaptureCmd.command==IMU_CAPTURE_START){
+	  			startIMUCapture();
+	  		}else{
+	  			stopIMUCapture();
+	  		}
+	  		if(RxCaptureCmd.command==IMU_CAPTURE_DUMP){
+	  			//bulk transfer: the whole ring in consecutive chunks, the receiver places them by offset
+	  			TxCapture.code=IMUCAPTUREADCS_CODE;
+	  			TxCapture.total=getIMUCaptureLen();
+	  			TxCapture.offset=0;
+	  			do{
+	  				TxCapture.len=readIMUCapture(TxCapture.offset,TxCapture.data,sizeof(TxCapture.data));
+	  				sdlSend(&line1,(uint8_t *)&TxCapture,sizeof(imuCaptureADCS),0);
+	  				TxCapture.offset+=TxCapture.len;
+	  			}while(TxCapture.offset<TxCapture.total);
+	  		}
 	  	}else if(rxBuff[0]==ATTITUDEADCS_CODE && rxLen==sizeof(attitudeADCS)){
 
   			//do something...
@@ -515,6 +581,9 @@ void OBC_Comm_Task(void const * argument)
 	  	}else if(rxBuff[0]==HOUSEKEEPINGADCS_CODE && rxLen==sizeof(housekeepingADCS)){
 
   			//do something...
+  			//(in theory this should never arrive to ADCS)
+	  	}else if(rxBuff[0]==HOUSEKEEPINGRAWADCS_CODE && rxLen==sizeof(housekeepingRawADCS)){
+
   			//(in theory this should never arrive to ADCS)
 	  	}
 	  	else if(rxBuff[0]==OPMODEADCS_CODE && rxLen==sizeof(opmodeADCS)){
@@ -544,7 +613,11 @@ void OBC_Comm_Task(void const * argument)
 	if (retvalue.status == osEventMessage)
 	{
 		cnt1++;
+#if housekeeping_raw
+		processCombinedData((void*)&retvalue,(void *)&TxHousekeeping,receive_Current_Tempqueue_raw_OBC);
+#else
 		processCombinedData((void*)&retvalue,(void *)&TxHousekeeping,receive_Current_Tempqueue_OBC);
+#endif
 		//attitude sampling
 		//in this case we just send the local copy of the structure
 		//ALWAYS remember to set message code (use the generated defines
@@ -554,11 +627,53 @@ void OBC_Comm_Task(void const * argument)
 		if(cnt1 == 1)
 		{
 			printf("OBC TASK: after 7 counts: %lu \n",HAL_GetTick());
+#if housekeeping_raw
+			//raw codes and the version of the constants to convert them on ground
+			TxHousekeeping.code=HOUSEKEEPINGRAWADCS_CODE;
+			TxHousekeeping.config=SENSOR_CONFIG_VERSION;
+#else
 			TxHousekeeping.code=HOUSEKEEPINGADCS_CODE;
+#endif
 			TxHousekeeping.ticktime=HAL_GetTick();
 			//printf("OBC: Trying to send housekeeping \n");
 			//finally we send the message
-            sdlSend(&line1,(uint8_t *)&TxHousekeeping,sizeof(housekeepingADCS),0);
+            sdlSend(&line1,(uint8_t *)&TxHousekeeping,sizeof(TxHousekeeping),0);
+
+			//current statistics in their own message (the housekeeping has to fit a CDH frame),
+			//with the housekeeping and only if a new window was completed since the last one sent
+			if(actuator_stats_read(&current_stats) != sent_windows)
+			{
+				sent_windows = current_stats.windows;
+#if housekeeping_raw
+				//codes (mean and RMS in Q4), converted on ground as the housekeeping
+				for(int i=0;i<NUM_ACTUATORS;i++)
+				{
+					TxCurrentStats.currentMinRAW[i] = current_stats.ch[i].min;
+					TxCurrentStats.currentMaxRAW[i] = current_stats.ch[i].max;
+					TxCurrentStats.currentMeanRAW[i] = current_stats.ch[i].mean;
+					TxCurrentStats.currentRmsRAW[i] = current_stats.ch[i].rms;
+				}
+				TxCurrentStats.code=CURRENTSTATSRAWADCS_CODE;
+				TxCurrentStats.config=SENSOR_CONFIG_VERSION;
+#else
+				get_actuator_current_stats(&current_stats,mean,rms,max);
+				for(int i=0;i<NUM_ACTUATORS;i++)
+				{
+					TxCurrentStats.currentMean[i] = mean[i];
+					TxCurrentStats.currentRms[i] = rms[i];
+					TxCurrentStats.currentMax[i] = max[i];
+				}
+				TxCurrentStats.code=CURRENTSTATSADCS_CODE;
+#endif
+				for(int i=0;i<NUM_ACTUATORS;i++)
+				{
+					TxCurrentStats.currentOver[i] = current_stats.ch[i].over;
+					TxCurrentStats.currentCrossings[i] = current_stats.crossings[i];
+				}
+				TxCurrentStats.currentScans = (uint16_t)current_stats.scans;
+				TxCurrentStats.ticktime=HAL_GetTick();
+				sdlSend(&line1,(uint8_t *)&TxCurrentStats,sizeof(TxCurrentStats),0);
+			}
 		cnt1 = 0;
 		}
 	}
@@ -570,6 +685,11 @@ void OBC_Comm_Task(void const * argument)
 	{
 		cnt2++;
 		processCombinedData((void*)&retvalue1,(void *)&TxAttitude,receive_IMUqueue_OBC);
+		//blocks queued meanwhile are released, the latest sample is kept
+		while ((retvalue1 = osMessageGet(IMUQueue2Handle, 0)).status == osEventMessage)
+		{
+			processCombinedData((void*)&retvalue1,(void *)&TxAttitude,receive_IMUqueue_OBC);
+		}
 		//in this case we just fill the structure with random values
 		//ALWAYS remember to set message code (use the generated defines
 		if(cnt2 == 3)
@@ -602,6 +722,7 @@ void Control_Algorithm_Task(void const * argument)
   /* USER CODE BEGIN Control_Algorithm_Task */
 	uint8_t flag = 0;
 	osEvent retvalue,retvalue1;
+	int32_t duty_q15[NUM_ACTUATORS] = {0};	//signed duty cycles (Q15) of Actuators[]
 
 	//Inizialize actuators struct
 	init_actuator_handler(&Reaction1,&htim1,TIM_CHANNEL_1,TIM_CHANNEL_2,100000,50); //100 khz
@@ -625,6 +746,11 @@ void Control_Algorithm_Task(void const * argument)
 
 		retvalue = osMessageGet(IMUQueue1Handle, 1000);
 		processCombinedData((void*)&retvalue,(void *)&PID_Inputs,receive_IMUqueue_control);
+		//blocks queued meanwhile are released, the latest sample is kept
+		while ((retvalue = osMessageGet(IMUQueue1Handle, 0)).status == osEventMessage)
+		{
+			processCombinedData((void*)&retvalue,(void *)&PID_Inputs,receive_IMUqueue_control);
+		}
 
 		
 		//ALGORITHM
@@ -640,6 +766,10 @@ void Control_Algorithm_Task(void const * argument)
 //			actuator_START(&MagneTorquer1);
 //			actuator_START(&MagneTorquer2);
 //			actuator_START(&MagneTorquer3);
+			//magnetorquer currents regulated by the scan interrupts (current sense channels 2, 3 and 4)
+//			actuator_current_loop_start(2,&MagneTorquer1,0,0);
+//			actuator_current_loop_start(3,&MagneTorquer2,0,0);
+//			actuator_current_loop_start(4,&MagneTorquer3,0,0);
 			flag = 1;
 		}
 
@@ -651,6 +781,10 @@ void Control_Algorithm_Task(void const * argument)
 
 
 
+		//All the actuators in the same PWM period of their timers (Q15 duty, sign is the direction):
+		//actuator_apply_all(Actuators,duty_q15,NUM_ACTUATORS);
+		(void)duty_q15;
+
 		//X Magnetorquer
 		//Change dir :
 		//update_duty_dir(&MagneTorquer1,PID_Inputs.th_Dutycycle[0],1);
@@ -667,6 +801,10 @@ void Control_Algorithm_Task(void const * argument)
 		//No change dir:
 		//update_duty_dir(&MagneTorquer1,PID_Inputs.th_Dutycycle[2],0);
 
+		//Magnetorquers under current control: the current of the dipole instead of the duty cycle
+		//(no dependence on coil resistance and supply voltage), the sign is the direction
+		//for(int i=0;i<3;i++) actuator_current_setpoint(2+i,PID_Inputs.th_Current[i]);
+
 
 
 		/*if (xSemaphoreTake(IMURead_ControlMutex, (TickType_t)10) == pdTRUE) //If control don't read IMU
@@ -689,17 +827,26 @@ void IMU_Task(void const * argument)
 	printf("Initializing IMU \n");
 #endif
 	//uint8_t ret = 1;
-	uint8_t ret = initIMUConfig(&huart4);
+	//raw outputs plus the orientation computed by the MTi (no attitude estimation on the MCU)
+	uint8_t ret = initIMUProfile(&huart4, imu_profile_100hz_orientation);
 #if enable_printf
 	if(ret) printf("IMU correctly configured \n");
 	else printf("Error configuring IMU \n");
+#else
+	(void)ret;
 #endif
 
-	float gyro[3]={1,2,3};
-	float mag[3]={4,5,6};
-	float acc[3] = {7,8,9};
+	const uint32_t imuFields = MTDATA2_RATE_OF_TURN | MTDATA2_ACCELERATION;
+	const uint32_t imuFusedFields = MTDATA2_QUATERNION | MTDATA2_FREE_ACCELERATION;
+	imu_sample sample;
+	imu_sample_cursor cursor;
+	uint8_t firstSample = 1;
+	float mag[3] = {0,0,0};	//at rates above IMU_MAG_MAX_RATE the last magnetic field is held
 
-	imu_queue_struct *local_imu_struct =(imu_queue_struct*) malloc(sizeof(imu_queue_struct));
+	//samples are posted in blocks to Control Task and OBC Task (see queue_structs.h)
+	const osMessageQId imuQueues[2] = {IMUQueue1Handle, IMUQueue2Handle};
+	imu_block *block = NULL;
+	initIMUCursor(&cursor);
 
 	/* Infinite loop */
 	for(;;)
@@ -712,62 +859,64 @@ void IMU_Task(void const * argument)
 		//da CubeMx.
 
 
-		ret=readIMUPacket(&huart4, gyro, mag, acc, 100); //mag measured in Gauss(G) unit -> 1G = 10^-4 Tesla
-		mag[0]/=10000; //1G = 10^-4 Tesla
-		mag[1]/=10000; //1G = 10^-4 Tesla
-		mag[2]/=10000; //1G = 10^-4 Tesla
-		/*if (xSemaphoreTake(IMURead_ControlMutex, (TickType_t)10) == pdTRUE)//If reading IMU DO NOT CONTROL
-		{
-			printf("IMU Task : Taken IMURead_Control control");
-			ret=readIMUPacket(&huart4, gyro, mag, 50);
-			xSemaphoreGive(IMURead_ControlMutex);
-			printf("IMU Task : Released IMURead_Control control");
-		}*/
-		if(ret)
+		//continuous acquisition: every packet received goes in the sample ring (see MTi1.h),
+		//all the new samples are moved to the current block
+		uint32_t acquired = acquireIMUSamples(&huart4, 100);
+		while (readIMUSamples(&cursor, &sample, 1) != 0)
 		{
-			/*for(uint32_t field=0; field<3;field++){
-					printf("%f \t",gyro[field]);
+			if (sample.data.fields & MTDATA2_MAGNETIC_FIELD)
+			{
+				for (int i = 0; i < 3; i++) mag[i] = sample.data.magneticField[i] / 10000; //mag measured in Gauss(G) unit -> 1G = 10^-4 Tesla
 			}
-			printf("\nMagnetometer: ");
-			for(uint32_t field=0; field<3;field++){
-				printf("%f \t",mag[field]);
+			if ((sample.data.fields & imuFields) != imuFields) continue;
+			if (firstSample)
+			{
+#if enable_printf
+				printf("IMU first sample at %lu ms from boot \n", (unsigned long)sample.tick);
+#endif
+				firstSample = 0;
 			}
-			printf("\n");*/
 
-			if (local_imu_struct == NULL) {
-				printf("IMU TASK: allocazione struttura fallita !\n");
+			if (block == NULL)
+			{
+				block = allocIMUBlock();
+				if (block == NULL) continue;	//consumers late, counted in getIMUBlockMisses()
+				block->tick = sample.tick;
 			}
-			else
+			imu_queue_struct *local_imu_struct = &block->sample[block->num++];
+			for (int i = 0; i < 3; i++)
 			{
-				//Riempio struct con valori letti da IMU,per poi inviareli a Task Controllo
-				for (int i = 0; i < 3; i++)
-				{
-					local_imu_struct->gyro_msr[i] = gyro[i];
-					local_imu_struct->mag_msr[i] = mag[i];
-					local_imu_struct->acc_msr[i] = acc[i];
-					printf("AAAAAAAAAAAAAAAAAAAAAAA  Accelerometer axis %d, value %f AAAAAAAAAAAAAA", i, acc[i]);
-				}
-				//Invio queue a Control Task
-			 	if (osMessagePut(IMUQueue1Handle,(uint32_t)local_imu_struct,4) != osOK) {
-			    	printf("Invio a Control Task fallito \n");
-			       	free(local_imu_struct); // Ensure the receiving task has time to process
-				} else {
-			        printf("Dati Inviati a Control Task \n");
-
-			 	}
-			 	//Invio queue a OBC Task
-			 	if (osMessagePut(IMUQueue2Handle,(uint32_t)local_imu_struct,4) != osOK) {
-			    	printf("Invio a OBC Task fallito \n");
-			       	free(local_imu_struct); // Ensure the receiving task has time to process
-			 	} else {
-			    	printf("Dati a Control Inviati \n");
-				}
+				local_imu_struct->gyro_msr[i] = sample.data.rateOfTurn[i];
+				local_imu_struct->mag_msr[i] = mag[i];
+				local_imu_struct->acc_msr[i] = sample.data.acceleration[i];
+			}
+			local_imu_struct->fused = (sample.data.fields & imuFusedFields) == imuFusedFields;
+			for (int i = 0; i < 4; i++) local_imu_struct->quat_msr[i] = local_imu_struct->fused ? sample.data.quaternion[i] : 0;
+			for (int i = 0; i < 3; i++) local_imu_struct->free_acc_msr[i] = local_imu_struct->fused ? sample.data.freeAcceleration[i] : 0;
+			if (block->num == IMU_BLOCK_SAMPLES)
+			{
+				sendIMUBlock(block, imuQueues, 2);
+				block = NULL;
 			}
 		}
-		else{
-			printf("IMU: Error configuring IMU \n");
-			osDelay(100);
+
+		//a block that is not full is sent after IMU_BLOCK_MAX_AGE ms, to bound the latency at low rates
+		if (block != NULL && block->num != 0 && HAL_GetTick() - block->tick >= IMU_BLOCK_MAX_AGE)
+		{
+			sendIMUBlock(block, imuQueues, 2);
+			block = NULL;
 		}
+
+		//no packet within the timeout: the loop goes on at once, the DMA ring (256 bytes, about
+		//11 ms at 230400 baud) must be emptied as soon as data arrives again
+#if enable_printf
+		if(acquired == 0)
+		{
+			printf("IMU: no samples in 100 ms (configured: %u) \n",ret);
+		}
+#else
+		(void)acquired;
+#endif
 	}
   /* USER CODE END IMU_Task */
 }
@@ -6,8 +6,58 @@
  */
 
 #include "queue_structs.h"
+#include <string.h>
 
+//IMU block pool, a set bit in imuBlockFree is a free block
+static imu_block imuBlocks[IMU_BLOCK_NUM];
+static uint32_t imuBlockFree=(IMU_BLOCK_NUM<32) ? ((1U<<IMU_BLOCK_NUM)-1) : 0xFFFFFFFF;
+static uint32_t imuBlockMisses=0;
 
+imu_block* allocIMUBlock(void)
+{
+	uint32_t free=__atomic_load_n(&imuBlockFree,__ATOMIC_RELAXED);
+	while(free!=0){
+		uint32_t b=__builtin_ctz(free);
+		//on failure free is reloaded and the search starts again
+		if(__atomic_compare_exchange_n(&imuBlockFree,&free,free&~(1U<<b),0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)){
+			imuBlocks[b].num=0;
+			imuBlocks[b].refs=0;
+			return &imuBlocks[b];
+		}
+	}
+	__atomic_fetch_add(&imuBlockMisses,1,__ATOMIC_RELAXED);
+	return NULL;
+}
+
+uint32_t sendIMUBlock(imu_block *block,const osMessageQId *queues,uint32_t num)
+{
+	if(block==NULL) return 0;
+
+	//one reference per consumer (plus this function's one, so that the block cannot go back to
+	//the pool while it is still being posted)
+	__atomic_store_n(&block->refs,num+1,__ATOMIC_RELEASE);
+	uint32_t sent=0;
+	for(uint32_t q=0;q<num;q++){
+		if(osMessagePut(queues[q],(uint32_t)block,0)==osOK) sent++;
+		else releaseIMUBlock(block);	//queue full, the consumer reference is dropped
+	}
+	releaseIMUBlock(block);
+	return sent;
+}
+
+void releaseIMUBlock(imu_block *block)
+{
+	if(block==NULL) return;
+
+	if(__atomic_sub_fetch(&block->refs,1,__ATOMIC_ACQ_REL)==0){
+		__atomic_fetch_or(&imuBlockFree,1U<<(block-imuBlocks),__ATOMIC_RELEASE);
+	}
+}
+
+uint32_t getIMUBlockMisses(void)
+{
+	return __atomic_load_n(&imuBlockMisses,__ATOMIC_RELAXED);
+}
 
 void processCombinedData(void *event,void *strct1, CombinedDataProcessor processor) {
     processor(event,strct1);
@@ -15,18 +65,26 @@ void processCombinedData(void *event,void *strct1, CombinedDataProcessor process
 
 void receive_IMUqueue_control(void *event,void *PID_struct) {
 
+	imu_block *int_block;
 	imu_queue_struct *int_queue_struct;
 	PID_Inputs_struct *int_pid_struct = (PID_Inputs_struct *)PID_struct;
 
 	if (((osEvent *)event)->status == osEventMessage)
 	{
-		int_queue_struct = (imu_queue_struct *)((osEvent *) event)->value.p;
+		//the latest sample of the block is used
+		int_block = (imu_block *)((osEvent *) event)->value.p;
+		int_queue_struct = &int_block->sample[int_block->num-1];
 		for(int i=0;i<3;i++){
 
 				int_pid_struct->angSpeed_Measured[i] = int_queue_struct->gyro_msr[i];
 				int_pid_struct->B[i] = int_queue_struct->mag_msr[i];
 		}
-		free(int_queue_struct);
+		//orientation computed by the MTi, when available
+		int_pid_struct->q_Valid = int_queue_struct->fused;
+		if(int_queue_struct->fused){
+			for(int i=0;i<4;i++) int_pid_struct->q_Measured[i] = int_queue_struct->quat_msr[i];
+		}
+		releaseIMUBlock(int_block);
 	}
 	else
 	{
@@ -36,12 +94,15 @@ void receive_IMUqueue_control(void *event,void *PID_struct) {
 
 void receive_IMUqueue_OBC(void *event,void *attitude) {
 
+	imu_block *int_block;
 	imu_queue_struct *int_queue_struct;
 	attitudeADCS *int_attitude_struct = (attitudeADCS *)attitude;
 
 	if (((osEvent *)event)->status == osEventMessage)
 	{
-		int_queue_struct = (imu_queue_struct *)((osEvent *) event)->value.p;
+		//the latest sample of the block is used
+		int_block = (imu_block *)((osEvent *) event)->value.p;
+		int_queue_struct = &int_block->sample[int_block->num-1];
 		int_attitude_struct->omega_x = int_queue_struct->gyro_msr[0];
 		int_attitude_struct->omega_y = int_queue_struct->gyro_msr[1];
 		int_attitude_struct->omega_z = int_queue_struct->gyro_msr[2];
@@ -51,7 +112,14 @@ void receive_IMUqueue_OBC(void *event,void *attitude) {
 		int_attitude_struct->b_x = int_queue_struct->mag_msr[0];
 		int_attitude_struct->b_y = int_queue_struct->mag_msr[1];
 		int_attitude_struct->b_z = int_queue_struct->mag_msr[2];
-		free(int_queue_struct);
+		int_attitude_struct->q_0 = int_queue_struct->quat_msr[0];
+		int_attitude_struct->q_1 = int_queue_struct->quat_msr[1];
+		int_attitude_struct->q_2 = int_queue_struct->quat_msr[2];
+		int_attitude_struct->q_3 = int_queue_struct->quat_msr[3];
+		int_attitude_struct->free_acc_x = int_queue_struct->free_acc_msr[0];
+		int_attitude_struct->free_acc_y = int_queue_struct->free_acc_msr[1];
+		int_attitude_struct->free_acc_z = int_queue_struct->free_acc_msr[2];
+		releaseIMUBlock(int_block);
 		}
 		else
 		{
@@ -76,6 +144,8 @@ void receive_Current_Tempqueue_OBC(void *event,void *current_temp_struct)
 
 	    		}
 		}
+		memcpy(int_HK_struct->currentRAW,int_queue_struct->currentRAW,sizeof(int_HK_struct->currentRAW));
+		memcpy(int_HK_struct->temperatureRAW,int_queue_struct->temperatureRAW,sizeof(int_HK_struct->temperatureRAW));
 		free(int_queue_struct);
 	}
 	else
@@ -85,6 +155,24 @@ void receive_Current_Tempqueue_OBC(void *event,void *current_temp_struct)
 
 }
 
+void receive_Current_Tempqueue_raw_OBC(void *event,void *current_temp_struct)
+{
+	Current_Temp_Struct *int_queue_struct;
+	housekeepingRawADCS *int_HK_struct = (housekeepingRawADCS *)current_temp_struct;
+	if (((osEvent *)event)->status == osEventMessage)
+	{
+		int_queue_struct = (Current_Temp_Struct *)((osEvent *) event)->value.p;
+		memcpy(int_HK_struct->currentRAW,int_queue_struct->currentRAW,sizeof(int_HK_struct->currentRAW));
+		memcpy(int_HK_struct->temperatureRAW,int_queue_struct->temperatureRAW,sizeof(int_HK_struct->temperatureRAW));
+		free(int_queue_struct);
+	}
+	else
+	{
+		printf("OBC TASK: Ricezione codici correnti e temperature fallita con status: %d \n\n", ((osEvent *)event)->status);
+	}
+
+}
+
 void receive_Attitudequeue_control(void *event,void * PID_struct)
 {
 	setAttitudeADCS *int_attitude_adcs;
@@ -1,5 +1,6 @@
 //This is the c file for implementation of functions regarding Sensors handling
 #include "sensors.h"
+#include <string.h>
 
 //Variables
 uint8_t single_mode_pckt[2] = {0x10,0x86};
@@ -28,6 +29,7 @@ void init_tempsens_handler(Temp_values *Temp_values){
     Temp_values->values.R_25 = 10000; //ohm
     Temp_values->values.B = 3977; //k
     Temp_values->values.Vdd = 3.3; //v
+    init_ntc_lut(Temp_values);
 }
 
 void select_input(uint8_t sel)
@@ -105,7 +107,8 @@ void select_input(uint8_t sel)
 
 float ADC_Conversion(SPI_HandleTypeDef *spi_struct,uint8_t mode)
 {
-    uint8_t spi_data[2];
+    uint8_t spi_cmd[3] = {READ_DATAREG,0xFF,0xFF};
+    uint8_t spi_data[3];
     volatile uint16_t dec_data;
     //uint8_t status_reg_val;
     uint32_t time_start = 0; //ms
@@ -120,12 +123,12 @@ float ADC_Conversion(SPI_HandleTypeDef *spi_struct,uint8_t mode)
     	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_RESET);
     	//time_start = HAL_GetTick() + 100;
     	//while(HAL_GetTick()<time_start);
-    	HAL_SPI_Transmit(spi_struct,&READ_DATAREG, 1,timeout);
-    	HAL_SPI_Receive(spi_struct,spi_data, 2,timeout);
+    	//command and readback in the same transfer
+    	HAL_SPI_TransmitReceive(spi_struct,spi_cmd,spi_data,3,timeout);
     	//CS HIGH: Disable communication
     	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_SET);
-    	dec_data = (spi_data[0]<<8)|spi_data[1];
-    	data = ((float)dec_data/pow(2,N))*Vref;
+    	dec_data = (spi_data[1]<<8)|spi_data[2];
+    	data = ((float)dec_data/(float)(1UL<<N))*Vref;
 #if enable_printf
         printf("Transmitted packet and received bytes: %d, data =  %f v \n",dec_data,data);
 #endif
@@ -136,24 +139,17 @@ float ADC_Conversion(SPI_HandleTypeDef *spi_struct,uint8_t mode)
 #if enable_printf
     	printf("Single conversion mode \n");
 #endif
-    	//CS LOW: Enable communication
-    	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_RESET);
-
-    	HAL_SPI_Transmit(spi_struct,single_mode_pckt, 2, timeout);
-    	time_start = HAL_GetTick() + 200;
-    	//printf("time_start : %lu, cpu time: %lu \n",time_start,HAL_GetTick());
-    	while(HAL_GetTick()<time_start);
-    	//Get the result of conversion
-    	HAL_SPI_Transmit(spi_struct,&READ_DATAREG, 1,timeout);
-    	HAL_SPI_Receive(spi_struct,spi_data, 2,timeout);
-    	//HAL_SPI_TransmitReceive(spi_struct,&READ_DATAREG,spi_data,1,timeout+100);
-    	//CS HIGH: Disable communication
-    	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_SET);
-    	//Process result of conversuion
-   		dec_data = (spi_data[0]<<8)|spi_data[1];
-   		data = (((float)dec_data)/(pow(2,N)-1))*Vref;
+    	ADC_Start_Conversion(spi_struct);
+    	//the task sleeps until the RDY bit says that the conversion has ended
+    	time_start = HAL_GetTick();
+    	vTaskDelay(pdMS_TO_TICKS(NTC_CONV_MS));
+    	while(!ADC_Conversion_Ready(spi_struct) && HAL_GetTick() - time_start < NTC_CONV_TIMEOUT_MS)
+    	{
+    		vTaskDelay(pdMS_TO_TICKS(NTC_POLL_MS));
+    	}
+    	data = ADC_Read_Voltage(spi_struct);
 #if enable_printf
-   		printf("Transmitted packet and received bytes: %d, data =  %f v \n",dec_data,data);
+   		printf("Transmitted packet and received bytes: data =  %f v \n",data);
 #endif
    		return data;
     }
@@ -173,6 +169,71 @@ float ADC_Conversion(SPI_HandleTypeDef *spi_struct,uint8_t mode)
 
 }
 
+void init_ntc_lut(Temp_values *Temp_values)
+{
+	//the formula is evaluated once per entry at init, in place of every reading
+	float saved[NUM_TEMP_SENS];
+	memcpy(saved,Temp_values->temp,sizeof(saved));
+	for(uint8_t i=0;i<NUM_TEMP_SENS;i++)
+	{
+		for(uint32_t k=0;k<NTC_LUT_LEN;k++)
+		{
+			uint32_t code = k<<NTC_LUT_SHIFT;
+			if(code > ADC_CODE_MAX) code = ADC_CODE_MAX;
+			if(code == 0) code = 1;	//log(0) for a shorted sensor
+			voltage_to_temperature_conv(ADC_Code_To_Voltage(code),Temp_values,i);
+			float t = Temp_values->temp[i];
+			//beyond the singularities of the formula and the physical range
+			if(!(t >= NTC_LUT_T_MIN)) t = NTC_LUT_T_MIN;
+			if(t > NTC_LUT_T_MAX) t = NTC_LUT_T_MAX;
+			Temp_values->lut[i][k] = t;
+		}
+	}
+	memcpy(Temp_values->temp,saved,sizeof(saved));
+}
+
+float ntc_code_to_temperature(const Temp_values *Temp_values,uint8_t i,uint16_t code)
+{
+	const float *lut = Temp_values->lut[i];
+	uint32_t k = code>>NTC_LUT_SHIFT;
+	float frac = (float)(code&((1<<NTC_LUT_SHIFT)-1))*(1.0f/(1<<NTC_LUT_SHIFT));
+	return lut[k]+(lut[k+1]-lut[k])*frac;
+}
+
+void ADC_Start_Conversion(SPI_HandleTypeDef *spi_struct)
+{
+	//CS LOW: Enable communication
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_RESET);
+	HAL_SPI_Transmit(spi_struct,single_mode_pckt, 2, 100);
+	//CS HIGH: Disable communication
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_SET);
+}
+
+uint8_t ADC_Conversion_Ready(SPI_HandleTypeDef *spi_struct)
+{
+	uint8_t cmd[2] = {READ_STATUSREG,0xFF};
+	uint8_t status[2] = {0,NTC_STATUS_RDY};
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_RESET);
+	HAL_SPI_TransmitReceive(spi_struct,cmd,status,2,100);
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_SET);
+	return (status[1] & NTC_STATUS_RDY) == 0;
+}
+
+float ADC_Read_Voltage(SPI_HandleTypeDef *spi_struct)
+{
+	uint8_t cmd[3] = {READ_DATAREG,0xFF,0xFF};
+	uint8_t spi_data[3] = {0};
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_RESET);
+	HAL_SPI_TransmitReceive(spi_struct,cmd,spi_data,3,100);
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_12, GPIO_PIN_SET);
+	return ADC_Code_To_Voltage((spi_data[1]<<8)|spi_data[2]);
+}
+
+float ADC_Code_To_Voltage(uint16_t code)
+{
+	return (((float)code)/(float)ADC_CODE_MAX)*Vref;
+}
+
 void voltage_to_temperature_conv(float value,Temp_values *s1,uint8_t i){
 
 	//printf("Value: %f, B: %f, Vdd: %f, R_25: %f, R: %f \n",value,s1->values.B,s1->values.Vdd,s1->values.R_25,s1->values.R[i]);
@@ -296,3 +357,152 @@ void get_temperatures(SPI_HandleTypeDef *spi_struct,Temp_values *temp_struct, ui
 	}
 
 }
+
+//NTC acquisition scheduler: transaction callbacks (DMA interrupt) and timer callback (timer task)
+
+static uint8_t ntcStartConversion(ntc_scheduler *sched);
+
+//(re)start the timer from the interrupt, the timer task runs ntcTimer() after (ms)
+static void ntcArmFromISR(ntc_scheduler *sched,uint32_t ms)
+{
+	BaseType_t woken = pdFALSE;
+	xTimerChangePeriodFromISR(sched->timer,pdMS_TO_TICKS(ms),&woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+//a transaction failed or was refused: start the conversion again later
+static void ntcRetryFromISR(ntc_scheduler *sched)
+{
+	sched->errors++;
+	sched->state = ntc_restart;
+	ntcArmFromISR(sched,NTC_POLL_MS);
+}
+
+//same as ntcRetryFromISR() from a task (timer task included)
+static void ntcRetry(ntc_scheduler *sched)
+{
+	sched->errors++;
+	sched->state = ntc_restart;
+	xTimerChangePeriod(sched->timer,pdMS_TO_TICKS(NTC_POLL_MS),0);
+}
+
+//data register read: code of the channel, then the next channel
+static void ntcDataDone(spi_transaction *t)
+{
+	ntc_scheduler *sched = (ntc_scheduler *)t->ctx;
+	if(t->error)
+	{
+		ntcRetryFromISR(sched);
+		return;
+	}
+
+	sched->raw[sched->channel] = (t->rx[1]<<8)|t->rx[2];
+	sched->channel++;
+	if(sched->channel == NUM_TEMP_SENS)
+	{
+		//whole sweep ready: publish it and wake the task
+		BaseType_t woken = pdFALSE;
+		UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+		memcpy(sched->sweep,sched->raw,sizeof(sched->sweep));
+		sched->sweeps++;
+		taskEXIT_CRITICAL_FROM_ISR(mask);
+		sched->channel = 0;
+		if(sched->task != NULL) vTaskNotifyGiveFromISR(sched->task,&woken);
+		portYIELD_FROM_ISR(woken);
+	}
+	if(ntcStartConversion(sched)) ntcRetryFromISR(sched);
+}
+
+//status register read: data read in the same chain if the conversion has ended
+static void ntcStatusDone(spi_transaction *t)
+{
+	ntc_scheduler *sched = (ntc_scheduler *)t->ctx;
+	if(t->error)
+	{
+		ntcRetryFromISR(sched);
+		return;
+	}
+
+	if((t->rx[1] & NTC_STATUS_RDY) == 0)
+	{
+		spi_transaction data = {.tx = {READ_DATAREG,0xFF,0xFF}, .len = 3, .csPort = GPIOA, .csPin = GPIO_PIN_12,
+			.callback = ntcDataDone, .ctx = sched};
+		if(queueDriver_SPI(sched->spi,&data)) ntcRetryFromISR(sched);
+	}
+	else if(xTaskGetTickCountFromISR() - sched->startTick >= pdMS_TO_TICKS(NTC_CONV_TIMEOUT_MS))
+	{
+		sched->timeouts++;	//the same channel is converted again
+		if(ntcStartConversion(sched)) ntcRetryFromISR(sched);
+	}
+	else
+	{
+		ntcArmFromISR(sched,NTC_POLL_MS);
+	}
+}
+
+//conversion started: first status read after NTC_CONV_MS
+static void ntcStartDone(spi_transaction *t)
+{
+	ntc_scheduler *sched = (ntc_scheduler *)t->ctx;
+	if(t->error)
+	{
+		ntcRetryFromISR(sched);
+		return;
+	}
+
+	sched->state = ntc_converting;
+	sched->startTick = xTaskGetTickCountFromISR();
+	ntcArmFromISR(sched,NTC_CONV_MS);
+}
+
+//select the channel and queue the conversion start (interrupt or task)
+//returns 0 in case of success, 1 if the transaction was refused
+static uint8_t ntcStartConversion(ntc_scheduler *sched)
+{
+	spi_transaction start = {.len = 2, .csPort = GPIOA, .csPin = GPIO_PIN_12, .callback = ntcStartDone, .ctx = sched};
+	memcpy(start.tx,single_mode_pckt,2);
+	select_input(sched->channel);
+	return queueDriver_SPI(sched->spi,&start);
+}
+
+//timer expired: status read (or conversion started again)
+static void ntcTimer(TimerHandle_t timer)
+{
+	ntc_scheduler *sched = (ntc_scheduler *)pvTimerGetTimerID(timer);
+	if(sched->state == ntc_restart)
+	{
+		if(ntcStartConversion(sched)) ntcRetry(sched);
+		return;
+	}
+
+	spi_transaction status = {.tx = {READ_STATUSREG,0xFF}, .len = 2, .csPort = GPIOA, .csPin = GPIO_PIN_12,
+		.callback = ntcStatusDone, .ctx = sched};
+	if(queueDriver_SPI(sched->spi,&status))
+	{
+		sched->errors++;
+		xTimerChangePeriod(timer,pdMS_TO_TICKS(NTC_POLL_MS),0);
+	}
+}
+
+void start_ntc_scheduler(ntc_scheduler *sched,SPI_HandleTypeDef *spi_struct,TaskHandle_t task)
+{
+	sched->spi = spi_struct;
+	sched->task = task;
+	sched->state = ntc_converting;
+	sched->channel = 0;
+	sched->startTick = 0;
+	sched->sweeps = 0;
+	sched->timeouts = 0;
+	sched->errors = 0;
+	sched->timer = xTimerCreateStatic("NTC",pdMS_TO_TICKS(NTC_CONV_MS),pdFALSE,sched,ntcTimer,&sched->timerBuffer);
+	if(ntcStartConversion(sched)) ntcRetry(sched);
+}
+
+uint32_t read_ntc_sweep(ntc_scheduler *sched,uint16_t raw[NUM_TEMP_SENS])
+{
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	uint32_t sweeps = sched->sweeps;
+	if(sweeps != 0) memcpy(raw,sched->sweep,sizeof(sched->sweep));
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+	return sweeps;
+}
@@ -0,0 +1,254 @@
+#include "xbus.h"
+#include <string.h>
+
+//MTData2 output decoded into mtdata2_sample
+typedef struct{
+	uint16_t xdi;		//data identifier (XDI_TYPE_MASK bits)
+	uint8_t size;		//payload size (32 bit words only)
+	uint16_t offset;	//destination inside mtdata2_sample
+	uint32_t field;		//flag of the output
+} mtdata2_output;
+
+//known outputs, to decode a new output add its entry (and its member in mtdata2_sample)
+static const mtdata2_output _mtdata2Outputs[]={
+	{XDI_SAMPLE_TIME_FINE,	4,	offsetof(mtdata2_sample,sampleTimeFine),	MTDATA2_SAMPLE_TIME_FINE},
+	{XDI_QUATERNION,		16,	offsetof(mtdata2_sample,quaternion),		MTDATA2_QUATERNION},
+	{XDI_ACCELERATION,		12,	offsetof(mtdata2_sample,acceleration),		MTDATA2_ACCELERATION},
+	{XDI_FREE_ACCELERATION,	12,	offsetof(mtdata2_sample,freeAcceleration),	MTDATA2_FREE_ACCELERATION},
+	{XDI_RATE_OF_TURN,		12,	offsetof(mtdata2_sample,rateOfTurn),		MTDATA2_RATE_OF_TURN},
+	{XDI_MAGNETIC_FIELD,	12,	offsetof(mtdata2_sample,magneticField),		MTDATA2_MAGNETIC_FIELD},
+	{XDI_STATUS_WORD,		4,	offsetof(mtdata2_sample,statusWord),		MTDATA2_STATUS_WORD},
+};
+
+#define MTDATA2_OUTPUTS (sizeof(_mtdata2Outputs)/sizeof(_mtdata2Outputs[0]))
+
+void xbusInit(xbus_decoder* dec, uint8_t* buff, uint16_t buffLen, xbus_msg_callback callback, void* ctx)
+{
+	if(dec==NULL) return;
+
+	//header and checksum must fit
+	if(buffLen<XBUS_FRAME_LEN(0)) buff=NULL;
+	dec->buff=buff;
+	dec->buffLen=(buff==NULL) ? 0 : buffLen;
+	dec->callback=callback;
+	dec->ctx=ctx;
+	dec->msgCount=0;
+	dec->checksumErrors=0;
+	dec->lengthErrors=0;
+	xbusReset(dec);
+}
+
+void xbusSetCallback(xbus_decoder* dec, xbus_msg_callback callback, void* ctx)
+{
+	if(dec==NULL) return;
+
+	dec->callback=callback;
+	dec->ctx=ctx;
+}
+
+//back to the preamble search (the bytes to decode again are kept)
+static void restart(xbus_decoder* dec)
+{
+	dec->state=xbus_preamble;
+	dec->mid=0;
+	dec->len=0;
+	dec->pos=0;
+	dec->hdrLen=0;
+	dec->checksum=0;
+}
+
+void xbusReset(xbus_decoder* dec)
+{
+	if(dec==NULL) return;
+
+	restart(dec);
+	dec->rescanPos=0;
+	dec->rescanEnd=0;
+}
+
+//the message in buff[0..pos) is rejected: its preamble was a data byte, the bytes after it are
+//decoded again before anything else
+//bytes decoded again are stored back in buff always behind the ones still to decode (a message is
+//stored from 0 and starts after a preamble), so the ones left are moved right after this message
+static void rejectMsg(xbus_decoder* dec)
+{
+	uint16_t end=dec->pos;
+	if(dec->rescanPos<dec->rescanEnd){
+		uint16_t rest=dec->rescanEnd-dec->rescanPos;
+		memmove(&dec->buff[end], &dec->buff[dec->rescanPos], rest);
+		end+=rest;
+	}
+	restart(dec);
+	dec->rescanPos=1;
+	dec->rescanEnd=end;
+}
+
+//length field complete: data follows (or the checksum directly for empty messages)
+//a length that no message can have rejects the header
+static void startData(xbus_decoder* dec)
+{
+	if((uint32_t)dec->pos+dec->len+1>dec->buffLen || dec->len>XBUS_MAX_LEN){
+		dec->lengthErrors++;
+		rejectMsg(dec);
+		return;
+	}
+	dec->hdrLen=dec->pos;
+	dec->state=(dec->len==0) ? xbus_checksum : xbus_data;
+}
+
+uint32_t xbusDecode(xbus_decoder* dec, const uint8_t* data, uint32_t len)
+{
+	if(dec==NULL || data==NULL || dec->buff==NULL) return 0;
+
+	uint32_t b=0;
+	for(;;){
+		//bytes of rejected messages first, then the new ones
+		const uint8_t* src;
+		uint32_t avail;
+		uint8_t rescan=(dec->rescanPos<dec->rescanEnd);
+		if(rescan){
+			src=&dec->buff[dec->rescanPos];
+			avail=dec->rescanEnd-dec->rescanPos;
+		}else if(b<len){
+			src=&data[b];
+			avail=len-b;
+		}else{
+			break;
+		}
+
+		//consumed before decoding (a rejected message moves the bytes left)
+		uint8_t byte=src[0];
+		if(rescan) dec->rescanPos++;
+		else b++;
+		uint8_t stop=0;
+
+		switch(dec->state){
+		case xbus_preamble:
+			if(byte==XBUS_PREAMBLE){
+				dec->buff[dec->pos++]=byte;
+				dec->state=xbus_bid;
+			}
+			break;
+
+		case xbus_bid:
+			if(byte==XBUS_BID){
+				dec->buff[dec->pos++]=byte;
+				dec->checksum=byte;
+				dec->state=xbus_mid;
+			}else if(byte!=XBUS_PREAMBLE){	//a repeated preamble may be the real one
+				restart(dec);
+			}
+			break;
+
+		case xbus_mid:
+			dec->buff[dec->pos++]=byte;
+			dec->mid=byte;
+			dec->checksum+=byte;
+			dec->state=xbus_len;
+			break;
+
+		case xbus_len:
+			dec->buff[dec->pos++]=byte;
+			dec->checksum+=byte;
+			if(byte==XBUS_EXTLEN){
+				dec->state=xbus_extlen_h;
+			}else{
+				dec->len=byte;
+				startData(dec);
+			}
+			break;
+
+		case xbus_extlen_h:
+			dec->buff[dec->pos++]=byte;
+			dec->checksum+=byte;
+			dec->len=((uint16_t)byte)<<8;
+			dec->state=xbus_extlen_l;
+			break;
+
+		case xbus_extlen_l:
+			dec->buff[dec->pos++]=byte;
+			dec->checksum+=byte;
+			dec->len|=byte;
+			startData(dec);
+			break;
+
+		case xbus_data:{
+			//copy the whole run of data bytes available at once (in place when decoding again,
+			//the destination is never after the source)
+			uint32_t run=dec->hdrLen+dec->len-dec->pos;
+			if(run>avail) run=avail;
+			uint8_t* dst=&dec->buff[dec->pos];
+			for(uint32_t d=0;d<run;d++){
+				dec->checksum+=src[d];
+				dst[d]=src[d];
+			}
+			dec->pos+=run;
+			if(rescan) dec->rescanPos+=run-1;
+			else b+=run-1;
+			if(dec->pos==dec->hdrLen+dec->len) dec->state=xbus_checksum;
+			break;
+		}
+
+		case xbus_checksum:
+			dec->buff[dec->pos++]=byte;
+			dec->checksum+=byte;
+			if(dec->checksum!=0){
+				dec->checksumErrors++;
+				rejectMsg(dec);
+				break;
+			}
+			dec->msgCount++;
+			stop=(dec->callback!=NULL && dec->callback(dec->ctx, dec->mid, &dec->buff[dec->hdrLen], dec->len));
+			restart(dec);
+			break;
+
+		default:
+			xbusReset(dec);
+			break;
+		}
+
+		if(stop) break;
+	}
+
+	return b;
+}
+
+//copy (words) big endian 32 bit words from src to dst (host order), floats included
+static void copyWordsBE(uint8_t* dst, const uint8_t* src, uint32_t words)
+{
+	for(uint32_t w=0;w<words;w++){
+		uint32_t word;
+		memcpy(&word, &src[w*4], 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		word=__builtin_bswap32(word);
+#endif
+		memcpy(&dst[w*4], &word, 4);
+	}
+}
+
+uint8_t xbusDecodeMTData2(const uint8_t* data, uint16_t len, mtdata2_sample* sample)
+{
+	if(data==NULL || sample==NULL) return 0;
+
+	sample->fields=0;
+
+	uint32_t pos=0;
+	while(pos+3<=len){
+		uint16_t xdi=(((uint16_t)data[pos])<<8) | data[pos+1];
+		uint8_t size=data[pos+2];
+		pos+=3;
+		if(pos+size>len) return 0;	//truncated entry
+
+		for(uint32_t o=0;o<MTDATA2_OUTPUTS;o++){
+			const mtdata2_output* out=&_mtdata2Outputs[o];
+			if((xdi & XDI_TYPE_MASK)==out->xdi && size==out->size){
+				copyWordsBE((uint8_t*)sample+out->offset, &data[pos], size/4);
+				sample->fields|=out->field;
+				break;
+			}
+		}
+		pos+=size;
+	}
+
+	return pos==len;
+}
@@ -0,0 +1,47 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+/* Host replacement of the FreeRTOS kernel API
+ *
+ * The host build runs a single task (the caller of the module functions) on a simulated
+ * clock: interrupts are the peripheral events scripted with hostSim.h, delivered while
+ * the task waits (blocking calls, HAL_Delay, tick polling). Only the kernel calls used
+ * by the ADCS modules built on the host are provided, with the same semantics.
+ * */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_EMPTY ((BaseType_t)0)
+#define errQUEUE_FULL ((BaseType_t)0)
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+
+//same tick rate as Core/Inc/FreeRTOSConfig.h
+#define configTICK_RATE_HZ ((TickType_t)1000)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#define configASSERT(x) assert(x)
+
+//critical sections mask the delivery of the simulated interrupts
+void hostEnterCritical(void);
+void hostExitCritical(void);
+#define taskENTER_CRITICAL() hostEnterCritical()
+#define taskEXIT_CRITICAL() hostExitCritical()
+#define taskENTER_CRITICAL_FROM_ISR() (hostEnterCritical(), 0)
+#define taskEXIT_CRITICAL_FROM_ISR(x) ((void)(x), hostExitCritical())
+
+//interrupts run to completion before the task resumes, nothing to switch
+#define portYIELD_FROM_ISR(x) ((void)(x))
+#define portYIELD() ((void)0)
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+/* Peripheral simulation for the host build
+ *
+ * Time is simulated (nanoseconds) and only moves forward when the code under test waits:
+ * HAL_Delay/vTaskDelay, blocking queue/notification calls, blocking SPI/ADC/UART calls,
+ * and every HAL_GetTick/xTaskGetTickCount call, which costs a small configurable time
+ * (hostSimSetPollCost) so that busy-wait loops end.
+ * While time moves forward the scripted peripheral events are delivered in time order,
+ * by calling the HAL callbacks as the interrupt handlers would:
+ * - UART rx: the bytes pushed with hostUartRxPush() arrive one by one at the line rate,
+ *   either to a pending HAL_UART_Receive_IT() (RxCplt callback when the transfer is
+ *   complete) or to the circular HAL_UARTEx_ReceiveToIdle_DMA() ring (RxEvent callback
+ *   at half buffer, full buffer and after one idle character). Bytes arriving with no
+ *   reception running are dropped and counted as overruns.
+ * - UART tx: a transfer completes after its bytes took their time on the line (TxCplt
+ *   callback), the bytes are logged for hostUartTxRead() and passed to the tx hook, that
+ *   can emulate a device answering on the rx line.
+ * While an uart IRQ is disabled (NVIC_DisableIRQ) or a critical section is open, its
+ * events are held back and delivered late, as a pending interrupt would be.
+ * SPI and ADC are served synchronously by the blocking HAL calls, SPI DMA transfers complete
+ * (TxRxCplt callback) after their bits took their time on the bus. ADC DMA scans start on the
+ * update events of their trigger timer and write the sequence in the circular buffer when the
+ * conversions end (HalfCplt and Cplt callbacks at half and full buffer).
+ * Timers count from the time they are started and transfer their preload registers to the active
+ * ones at every update event (hostTimGetState()), so the PWM seen by the actuators is the one of
+ * the target, register writes included.
+ * Software timers (timers.h) expire as the timer task would run them.
+ * Devices can also schedule their own actions in time (hostSimSchedule()), e.g. a message
+ * sent after a reset: these are not interrupts and are never held back.
+ * */
+
+#include "stm32l4xx_hal.h"
+#include "task.h"
+
+//nanoseconds of simulated time
+typedef uint64_t host_time;
+
+//reset time and peripheral state (queues and driver structures are not touched)
+void hostSimReset(void);
+//current simulated time
+host_time hostSimTime(void);
+//let (ns) nanoseconds pass, delivering the events falling inside
+void hostSimAdvance(host_time ns);
+//time charged to every tick read (default 1us)
+void hostSimSetPollCost(host_time ns);
+//scheduler state returned by xTaskGetSchedulerState() (default taskSCHEDULER_RUNNING)
+void hostSimSetSchedulerState(BaseType_t state);
+
+//device action run at a given simulated time
+typedef void (*host_sim_action)(void* ctx);
+//maximum number of actions scheduled at the same time
+#define HOST_SIM_ACTION_NUM 8
+//run action(ctx) (delay) ns from now, returns 0 if too many actions are scheduled
+uint8_t hostSimSchedule(host_time delay, host_sim_action action, void* ctx);
+
+/* UART */
+//bytes that can be queued on the rx line of a port
+#define HOST_UART_LINE_LEN 16384
+
+//per port line counters
+typedef struct{
+	uint32_t rxBytes;		//bytes arrived on the rx line
+	uint32_t rxOverruns;	//bytes arrived with no reception running (lost)
+	uint32_t txBytes;		//bytes sent on the tx line
+	uint32_t irqs;			//callbacks delivered
+} host_uart_stats;
+
+typedef void (*host_uart_tx_hook)(UART_HandleTypeDef* huart, const uint8_t* data, uint32_t len);
+
+//set up an uart handle as MX_xxx_UART_Init() would: instance, baud rate and, if requested,
+//circular rx DMA and normal tx DMA channels (irq is the uart interrupt used for masking)
+//HAL_UART_Init() can then change the baud rate (huart->Init.BaudRate): bytes are pushed and
+//sent at the rate in use when they are queued
+void hostUartInit(UART_HandleTypeDef* huart, USART_TypeDef* instance, IRQn_Type irq, uint32_t baud, uint8_t dmaRx, uint8_t dmaTx);
+//queue (len) bytes on the rx line: the first one starts (gap) ns after the line is free
+//returns the number of bytes queued (less than len if the line queue is full)
+uint32_t hostUartRxPush(UART_HandleTypeDef* huart, const uint8_t* data, uint32_t len, host_time gap);
+//number of bytes queued on the rx line and not yet arrived
+uint32_t hostUartRxPending(UART_HandleTypeDef* huart);
+//signal a line error (HAL_UART_ERROR_xxx) at the current time, as the HAL does:
+//the running reception is aborted and the error callback is called
+void hostUartRxError(UART_HandleTypeDef* huart, uint32_t errorCode);
+//read (and remove) up to (size) bytes from the tx log, returns the number of bytes read
+uint32_t hostUartTxRead(UART_HandleTypeDef* huart, uint8_t* buff, uint32_t size);
+//function called with the bytes of every completed transmission (NULL to remove)
+void hostUartSetTxHook(UART_HandleTypeDef* huart, host_uart_tx_hook hook);
+void hostUartGetStats(UART_HandleTypeDef* huart, host_uart_stats* stats);
+
+/* SPI */
+//function called for every transfer, it must fill rx (len bytes) from the tx bytes
+//(tx is NULL for receive-only transfers, rx is NULL for transmit-only ones; DMA transfers are
+//full-duplex and are passed at their end)
+typedef void (*host_spi_hook)(SPI_HandleTypeDef* hspi, const uint8_t* tx, uint8_t* rx, uint32_t len);
+
+//set up a spi handle with its bit rate (transfers take 8 bits per byte of simulated time)
+void hostSpiInit(SPI_HandleTypeDef* hspi, SPI_TypeDef* instance, uint32_t bitRate);
+void hostSpiSetHook(SPI_HandleTypeDef* hspi, host_spi_hook hook);
+
+/* ADC */
+//set up an adc handle with the conversion time of one channel
+void hostAdcInit(ADC_HandleTypeDef* hadc, ADC_TypeDef* instance, host_time conversion);
+//value converted on a channel (ADC_CHANNEL_x)
+void hostAdcSet(ADC_HandleTypeDef* hadc, uint32_t channel, uint32_t value);
+//number of DMA scans completed since HAL_ADC_Start_DMA(), and time of the trigger of the last one
+uint32_t hostAdcScans(ADC_HandleTypeDef* hadc, host_time* lastTrigger);
+
+/* TIM */
+//timer kernel clock (the one assumed by actuator_driver.c), a period lasts (PSC+1)*(ARR+1) clocks
+//from the time the counter was started
+#define HOST_TIM_CLOCK 40000000ULL
+
+//set up a timer handle with prescaler and period (ARR), preload disabled on every register but PSC
+void hostTimInit(TIM_HandleTypeDef* htim, TIM_TypeDef* instance, uint32_t prescaler, uint32_t period);
+
+//active registers of a running timer, the ones driving the outputs in the current period: the
+//preloaded ones (PSC, ARR with ARPE, CCRx with OCxPE) are transferred at the update events, unless
+//UDIS is set; the others act as soon as they are written; EGR UG restarts the period
+typedef struct{
+	uint32_t psc;
+	uint32_t arr;
+	uint32_t ccr[4];		//channels 1..4
+	uint32_t updates;		//update events since the counter was started
+	uint32_t glitches;		//periods cut short or stretched since the counter was started: a compare
+							//register without preload written while the counter is between its old
+							//and new value, or ARR without preload written below the counter
+	host_time lastUpdate;	//time of the last update event
+} host_tim_state;
+
+void hostTimGetState(TIM_HandleTypeDef* htim, host_tim_state* state);
+//returns 1 if the PWM output of a channel is running
+uint8_t hostTimPwmRunning(TIM_HandleTypeDef* htim, uint32_t channel);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef HOST_QUEUE_H
+#define HOST_QUEUE_H
+
+/* Host replacement of the FreeRTOS queue API (see FreeRTOS.h) */
+
+#include "FreeRTOS.h"
+
+//queue control block, allocated by the user as in the static allocation API
+typedef struct QueueDefinition{
+	uint8_t* storage;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	UBaseType_t head;	//index of the oldest item
+	UBaseType_t count;	//number of items in the queue
+} StaticQueue_t;
+
+typedef struct QueueDefinition* QueueHandle_t;
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, uint8_t* pucQueueStorage, StaticQueue_t* pxStaticQueue);
+BaseType_t xQueueReset(QueueHandle_t xQueue);
+
+//blocking calls wait on the simulated clock, delivering the simulated interrupts
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait);
+#define xQueueSend(xQueue, pvItemToQueue, xTicksToWait) xQueueSendToBack(xQueue, pvItemToQueue, xTicksToWait)
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t xQueue, const void* pvItemToQueue, BaseType_t* pxHigherPriorityTaskWoken);
+BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void* pvBuffer, BaseType_t* pxHigherPriorityTaskWoken);
+#define xQueueSendFromISR(xQueue, pvItemToQueue, pxHigherPriorityTaskWoken) xQueueSendToBackFromISR(xQueue, pvItemToQueue, pxHigherPriorityTaskWoken)
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue);
+UBaseType_t uxQueueMessagesWaitingFromISR(const QueueHandle_t xQueue);
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue);
+BaseType_t xQueueIsQueueFullFromISR(const QueueHandle_t xQueue);
+BaseType_t xQueueIsQueueEmptyFromISR(const QueueHandle_t xQueue);
+
+#endif
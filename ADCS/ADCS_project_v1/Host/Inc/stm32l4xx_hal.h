@@ -0,0 +1,414 @@
+#ifndef HOST_STM32L4XX_HAL_H
+#define HOST_STM32L4XX_HAL_H
+
+/* Host replacement of the STM32L4 HAL
+ *
+ * Only the types, constants and functions used by the ADCS modules built on the host
+ * (UARTdriver, MTi1, sensors, actuator_driver) are provided. The structures keep the
+ * HAL field names the modules touch, register blocks that the modules read/write
+ * through HAL macros (TIM, DMA channels, GPIO) are plain memory.
+ * The behaviour of the peripherals (byte streams, timings) is scripted with hostSim.h.
+ * */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __weak __attribute__((weak))
+#define UNUSED(X) (void)X
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+#define DISABLE 0U
+#define ENABLE 1U
+
+typedef enum{
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+//interrupt numbers (same values as the L452 ones)
+typedef enum{
+	DMA1_Channel1_IRQn = 11,
+	DMA1_Channel4_IRQn = 14,
+	DMA1_Channel5_IRQn = 15,
+	DMA1_Channel6_IRQn = 16,
+	DMA1_Channel7_IRQn = 17,
+	ADC1_IRQn = 18,
+	TIM2_IRQn = 28,
+	TIM3_IRQn = 29,
+	SPI2_IRQn = 36,
+	USART1_IRQn = 37,
+	USART2_IRQn = 38,
+	USART3_IRQn = 39,
+	UART4_IRQn = 52,
+	DMA2_Channel3_IRQn = 58,
+	DMA2_Channel5_IRQn = 60,
+	DMA2_Channel6_IRQn = 68,
+	DMA2_Channel7_IRQn = 69,
+	HOST_IRQ_NUM = 96
+} IRQn_Type;
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+uint32_t NVIC_GetEnableIRQ(IRQn_Type IRQn);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+/* GPIO */
+typedef struct{
+	volatile uint32_t IDR;
+	volatile uint32_t ODR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef hostGPIO[8];
+#define GPIOA (&hostGPIO[0])
+#define GPIOB (&hostGPIO[1])
+#define GPIOC (&hostGPIO[2])
+#define GPIOD (&hostGPIO[3])
+#define GPIOE (&hostGPIO[4])
+#define GPIOH (&hostGPIO[7])
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+typedef enum{
+	GPIO_PIN_RESET = 0U,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+
+/* DMA */
+typedef struct{
+	volatile uint32_t CCR;
+	volatile uint32_t CNDTR;
+	volatile uint32_t CPAR;
+	volatile uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+#define DMA_NORMAL 0x00000000U
+#define DMA_CIRCULAR 0x00000020U
+
+typedef struct{
+	uint32_t Request;
+	uint32_t Direction;
+	uint32_t Mode;
+	uint32_t Priority;
+} DMA_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef{
+	DMA_Channel_TypeDef* Instance;
+	DMA_InitTypeDef Init;
+	void* Parent;
+} DMA_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->CNDTR)
+
+/* UART */
+//uart instances are only used as identifiers (never dereferenced), so they keep the real addresses
+typedef struct{
+	uint32_t reserved;
+} USART_TypeDef;
+
+#define USART1_BASE 0x40013800UL
+#define USART2_BASE 0x40004400UL
+#define USART3_BASE 0x40004800UL
+#define UART4_BASE 0x40004C00UL
+#define USART1 ((USART_TypeDef*)USART1_BASE)
+#define USART2 ((USART_TypeDef*)USART2_BASE)
+#define USART3 ((USART_TypeDef*)USART3_BASE)
+#define UART4 ((USART_TypeDef*)UART4_BASE)
+
+#define HAL_UART_STATE_RESET 0x00000000U
+#define HAL_UART_STATE_READY 0x00000020U
+#define HAL_UART_STATE_BUSY_TX 0x00000021U
+#define HAL_UART_STATE_BUSY_RX 0x00000022U
+typedef uint32_t HAL_UART_StateTypeDef;
+
+#define HAL_UART_ERROR_NONE 0x00000000U
+#define HAL_UART_ERROR_PE 0x00000001U
+#define HAL_UART_ERROR_NE 0x00000002U
+#define HAL_UART_ERROR_FE 0x00000004U
+#define HAL_UART_ERROR_ORE 0x00000008U
+#define HAL_UART_ERROR_DMA 0x00000010U
+
+typedef struct{
+	uint32_t BaudRate;
+	uint32_t WordLength;
+	uint32_t StopBits;
+	uint32_t Parity;
+	uint32_t Mode;
+	uint32_t HwFlowCtl;
+	uint32_t OverSampling;
+} UART_InitTypeDef;
+
+typedef struct __UART_HandleTypeDef{
+	USART_TypeDef* Instance;
+	UART_InitTypeDef Init;
+	uint8_t* pTxBuffPtr;
+	uint16_t TxXferSize;
+	volatile uint16_t TxXferCount;
+	uint8_t* pRxBuffPtr;
+	uint16_t RxXferSize;
+	volatile uint16_t RxXferCount;
+	DMA_HandleTypeDef* hdmatx;
+	DMA_HandleTypeDef* hdmarx;
+	volatile HAL_UART_StateTypeDef gState;
+	volatile HAL_UART_StateTypeDef RxState;
+	volatile uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef* huart);
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t Size);
+
+/* SPI */
+typedef struct{
+	uint32_t reserved;
+} SPI_TypeDef;
+
+#define SPI2_BASE 0x40003800UL
+#define SPI2 ((SPI_TypeDef*)SPI2_BASE)
+
+typedef struct{
+	uint32_t Mode;
+	uint32_t DataSize;
+	uint32_t BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct __SPI_HandleTypeDef{
+	SPI_TypeDef* Instance;
+	SPI_InitTypeDef Init;
+	uint32_t ErrorCode;
+} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size);
+
+//callbacks (defined by the driver under test)
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef* hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef* hspi);
+
+/* ADC */
+typedef struct{
+	uint32_t reserved;
+} ADC_TypeDef;
+
+#define ADC1 ((ADC_TypeDef*)0x50040000UL)
+
+//channels are plain numbers on the host (the real ones encode the channel bitfields)
+#define ADC_CHANNEL_0 0U
+#define ADC_CHANNEL_1 1U
+#define ADC_CHANNEL_2 2U
+#define ADC_CHANNEL_3 3U
+#define ADC_CHANNEL_4 4U
+#define ADC_CHANNEL_5 5U
+#define ADC_CHANNEL_6 6U
+#define ADC_CHANNEL_7 7U
+#define ADC_CHANNEL_8 8U
+#define ADC_CHANNEL_9 9U
+#define ADC_CHANNEL_10 10U
+#define ADC_CHANNEL_11 11U
+#define ADC_CHANNEL_12 12U
+#define ADC_CHANNEL_13 13U
+#define ADC_CHANNEL_14 14U
+#define ADC_CHANNEL_15 15U
+#define ADC_CHANNEL_16 16U
+#define ADC_CHANNEL_17 17U
+#define ADC_CHANNEL_18 18U
+#define HOST_ADC_CHANNELS 19U
+
+//ranks keep the target encoding (sequence register offset, 6 bits per rank)
+#define ADC_REGULAR_RANK_1 0x00000006U
+#define ADC_REGULAR_RANK_2 0x0000000CU
+#define ADC_REGULAR_RANK_3 0x00000012U
+#define ADC_REGULAR_RANK_4 0x00000018U
+#define ADC_REGULAR_RANK_5 0x0000001EU
+#define HOST_ADC_RANKS 16U
+#define ADC_SAMPLETIME_2CYCLES_5 0x00000000U
+#define ADC_SAMPLETIME_247CYCLES_5 0x00000006U
+#define ADC_SAMPLETIME_640CYCLES_5 0x00000007U
+#define ADC_SINGLE_ENDED 0x0000007FU
+#define ADC_DIFFERENTIAL_ENDED 0x18000000U
+#define ADC_OFFSET_NONE 0x00000004U
+
+typedef struct{
+	uint32_t Channel;
+	uint32_t Rank;
+	uint32_t SamplingTime;
+	uint32_t SingleDiff;
+	uint32_t OffsetNumber;
+	uint32_t Offset;
+} ADC_ChannelConfTypeDef;
+
+#define ADC_SCAN_DISABLE 0x00000000U
+#define ADC_SCAN_ENABLE 0x00000001U
+#define ADC_EOC_SINGLE_CONV 0x00000004U
+#define ADC_EOC_SEQ_CONV 0x00000008U
+#define ADC_OVR_DATA_PRESERVED 0x00000000U
+#define ADC_OVR_DATA_OVERWRITTEN 0x00001000U
+#define ADC_SOFTWARE_START 0x00000001U
+//regular triggers from the TRGO of the PWM timers (target values)
+#define ADC_EXTERNALTRIG_T1_TRGO 0x00000024U
+#define ADC_EXTERNALTRIG_T2_TRGO 0x0000002CU
+#define ADC_EXTERNALTRIG_T3_TRGO 0x00000010U
+#define ADC_EXTERNALTRIGCONVEDGE_NONE 0x00000000U
+#define ADC_EXTERNALTRIGCONVEDGE_RISING 0x00000400U
+
+typedef struct{
+	uint32_t Resolution;
+	uint32_t ScanConvMode;
+	uint32_t EOCSelection;
+	uint32_t ContinuousConvMode;
+	uint32_t NbrOfConversion;
+	uint32_t DiscontinuousConvMode;
+	uint32_t ExternalTrigConv;
+	uint32_t ExternalTrigConvEdge;
+	uint32_t DMAContinuousRequests;
+	uint32_t Overrun;
+} ADC_InitTypeDef;
+
+typedef struct __ADC_HandleTypeDef{
+	ADC_TypeDef* Instance;
+	ADC_InitTypeDef Init;
+	DMA_HandleTypeDef* DMA_Handle;
+	volatile uint32_t State;
+	volatile uint32_t ErrorCode;
+} ADC_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_ConfigChannel(ADC_HandleTypeDef* hadc, ADC_ChannelConfTypeDef* sConfig);
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_Stop(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef* hadc, uint32_t Timeout);
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* pData, uint32_t Length);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef* hadc);
+
+//callbacks (defined by the driver under test)
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc);
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc);
+
+/* TIM */
+typedef struct{
+	volatile uint32_t CR1;
+	volatile uint32_t CR2;
+	volatile uint32_t EGR;
+	volatile uint32_t CCMR1;
+	volatile uint32_t CCMR2;
+	volatile uint32_t CCER;
+	volatile uint32_t CNT;
+	volatile uint32_t PSC;
+	volatile uint32_t ARR;
+	volatile uint32_t CCR1;
+	volatile uint32_t CCR2;
+	volatile uint32_t CCR3;
+	volatile uint32_t CCR4;
+} TIM_TypeDef;
+
+extern TIM_TypeDef hostTIM[3];
+#define TIM1 (&hostTIM[0])
+#define TIM2 (&hostTIM[1])
+#define TIM3 (&hostTIM[2])
+
+#define TIM_CHANNEL_1 0x00000000U
+#define TIM_CHANNEL_2 0x00000004U
+#define TIM_CHANNEL_3 0x00000008U
+#define TIM_CHANNEL_4 0x0000000CU
+
+//register bits used by the drivers (target values)
+#define TIM_CR1_CEN 0x00000001U
+#define TIM_CR1_UDIS 0x00000002U
+#define TIM_CR1_ARPE 0x00000080U
+#define TIM_EGR_UG 0x00000001U
+#define TIM_CCMR1_OC1PE 0x00000008U
+#define TIM_CCMR1_OC2PE 0x00000800U
+#define TIM_CCMR2_OC3PE 0x00000008U
+#define TIM_CCMR2_OC4PE 0x00000800U
+
+//master mode (CR2 MMS), only the update event is used as TRGO
+#define TIM_TRGO_RESET 0x00000000U
+#define TIM_TRGO_UPDATE 0x00000020U
+#define TIM_TRGO2_RESET 0x00000000U
+#define TIM_MASTERSLAVEMODE_DISABLE 0x00000000U
+
+typedef struct{
+	uint32_t Prescaler;
+	uint32_t CounterMode;
+	uint32_t Period;
+	uint32_t ClockDivision;
+	uint32_t RepetitionCounter;
+	uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct __TIM_HandleTypeDef{
+	TIM_TypeDef* Instance;
+	TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+#define __HAL_TIM_SET_COMPARE(__HANDLE__, __CHANNEL__, __COMPARE__) \
+	(((__CHANNEL__) == TIM_CHANNEL_1) ? ((__HANDLE__)->Instance->CCR1 = (__COMPARE__)) :\
+	 ((__CHANNEL__) == TIM_CHANNEL_2) ? ((__HANDLE__)->Instance->CCR2 = (__COMPARE__)) :\
+	 ((__CHANNEL__) == TIM_CHANNEL_3) ? ((__HANDLE__)->Instance->CCR3 = (__COMPARE__)) :\
+	 ((__HANDLE__)->Instance->CCR4 = (__COMPARE__)))
+#define __HAL_TIM_GET_COMPARE(__HANDLE__, __CHANNEL__) \
+	(((__CHANNEL__) == TIM_CHANNEL_1) ? ((__HANDLE__)->Instance->CCR1) :\
+	 ((__CHANNEL__) == TIM_CHANNEL_2) ? ((__HANDLE__)->Instance->CCR2) :\
+	 ((__CHANNEL__) == TIM_CHANNEL_3) ? ((__HANDLE__)->Instance->CCR3) :\
+	 ((__HANDLE__)->Instance->CCR4))
+#define __HAL_TIM_ENABLE_OCxPRELOAD(__HANDLE__, __CHANNEL__) \
+	(((__CHANNEL__) == TIM_CHANNEL_1) ? ((__HANDLE__)->Instance->CCMR1 |= TIM_CCMR1_OC1PE) :\
+	 ((__CHANNEL__) == TIM_CHANNEL_2) ? ((__HANDLE__)->Instance->CCMR1 |= TIM_CCMR1_OC2PE) :\
+	 ((__CHANNEL__) == TIM_CHANNEL_3) ? ((__HANDLE__)->Instance->CCMR2 |= TIM_CCMR2_OC3PE) :\
+	 ((__HANDLE__)->Instance->CCMR2 |= TIM_CCMR2_OC4PE))
+#define __HAL_TIM_SET_PRESCALER(__HANDLE__, __PRESC__) ((__HANDLE__)->Instance->PSC = (__PRESC__))
+#define __HAL_TIM_SET_AUTORELOAD(__HANDLE__, __AUTORELOAD__) \
+	do{ (__HANDLE__)->Instance->ARR = (__AUTORELOAD__); (__HANDLE__)->Init.Period = (__AUTORELOAD__); }while(0)
+#define __HAL_TIM_GET_AUTORELOAD(__HANDLE__) ((__HANDLE__)->Instance->ARR)
+//counter enable (CEN), the emulated periods start from it
+#define __HAL_TIM_ENABLE(__HANDLE__) hostTimEnable((__HANDLE__)->Instance)
+void hostTimEnable(TIM_TypeDef* tim);
+
+typedef struct{
+	uint32_t MasterOutputTrigger;
+	uint32_t MasterOutputTrigger2;
+	uint32_t MasterSlaveMode;
+} TIM_MasterConfigTypeDef;
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef* htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef* htim, TIM_MasterConfigTypeDef* sMasterConfig);
+
+#endif
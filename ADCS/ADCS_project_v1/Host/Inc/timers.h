@@ -0,0 +1,35 @@
+#ifndef HOST_TIMERS_H
+#define HOST_TIMERS_H
+
+/* Host replacement of the FreeRTOS software timer API (see FreeRTOS.h)
+ *
+ * A timer callback runs when the timer expires, as the timer task would, while the host
+ * task waits (it is delivered as a hostSimSchedule() action). Commands take effect at once,
+ * there is no timer command queue.
+ * */
+
+#include "FreeRTOS.h"
+
+typedef struct tmrTimerControl* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t xTimer);
+
+//timer control block, allocated by the user as in the static allocation API
+typedef struct tmrTimerControl{
+	TimerCallbackFunction_t callback;
+	void* id;
+	TickType_t period;
+	UBaseType_t autoReload;
+	uint8_t active;		//flag to signal that the timer is running
+	uint64_t expiry;	//simulated time of the expiry (ns)
+} StaticTimer_t;
+
+TimerHandle_t xTimerCreateStatic(const char* const pcTimerName, const TickType_t xTimerPeriodInTicks, const UBaseType_t uxAutoReload, void* const pvTimerID, TimerCallbackFunction_t pxCallbackFunction, StaticTimer_t* pxTimerBuffer);
+void* pvTimerGetTimerID(const TimerHandle_t xTimer);
+
+//(re)start the timer, it expires (period) ticks from now
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait);
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait);
+BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait);
+BaseType_t xTimerChangePeriodFromISR(TimerHandle_t xTimer, TickType_t xNewPeriod, BaseType_t* pxHigherPriorityTaskWoken);
+
+#endif
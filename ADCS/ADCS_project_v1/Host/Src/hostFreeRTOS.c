@@ -0,0 +1,285 @@
+#include "hostSimInternal.h"
+#include "queue.h"
+#include "timers.h"
+#include <string.h>
+
+//the only host task
+struct tskTaskControlBlock{
+	uint32_t notifyValue;
+	uint8_t notifyPending;	//notified since the last wait (the kernel ucNotifyState)
+};
+
+static struct tskTaskControlBlock _task;
+
+//deadline of a blocking call waiting (ticks), woken at a tick boundary as the kernel does
+static host_time tickDeadline(TickType_t ticks)
+{
+	if(ticks == portMAX_DELAY) return HOST_TIME_NEVER;
+	host_time tick = hostSimTime() / HOST_NS_PER_TICK;
+	return (tick + ticks) * HOST_NS_PER_TICK;
+}
+
+/* Tasks */
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return &_task;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	hostSimPoll();
+	return (TickType_t)(hostSimTime() / HOST_NS_PER_TICK);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+	return (TickType_t)(hostSimTime() / HOST_NS_PER_TICK);
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	if(xTicksToDelay == 0) return;
+	hostSimWaitUntil(tickDeadline(xTicksToDelay));
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+	host_time deadline = tickDeadline(xTicksToWait);
+
+	while(_task.notifyValue == 0 && hostSimTime() < deadline)
+	{
+		//nothing will ever wake the task: return as a timeout instead of hanging
+		if(!hostSimWaitStep(deadline)) break;
+	}
+
+	uint32_t value = _task.notifyValue;
+	if(value != 0)
+	{
+		if(xClearCountOnExit) _task.notifyValue = 0;
+		else _task.notifyValue--;
+	}
+	_task.notifyPending = 0;
+	return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+	if(xTaskToNotify == NULL) return pdFAIL;
+	xTaskToNotify->notifyValue++;
+	xTaskToNotify->notifyPending = 1;
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t* pxHigherPriorityTaskWoken)
+{
+	if(xTaskToNotify == NULL) return;
+	xTaskToNotify->notifyValue++;
+	xTaskToNotify->notifyPending = 1;
+	if(pxHigherPriorityTaskWoken != NULL) *pxHigherPriorityTaskWoken = pdTRUE;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t* pulNotificationValue, TickType_t xTicksToWait)
+{
+	host_time deadline = tickDeadline(xTicksToWait);
+
+	if(!_task.notifyPending)
+	{
+		_task.notifyValue &= ~ulBitsToClearOnEntry;
+		while(!_task.notifyPending && hostSimTime() < deadline)
+		{
+			if(!hostSimWaitStep(deadline)) break;
+		}
+	}
+
+	if(pulNotificationValue != NULL) *pulNotificationValue = _task.notifyValue;
+	BaseType_t received = _task.notifyPending ? pdTRUE : pdFALSE;
+	if(received) _task.notifyValue &= ~ulBitsToClearOnExit;
+	_task.notifyPending = 0;
+	return received;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction)
+{
+	if(xTaskToNotify == NULL) return pdFAIL;
+	switch(eAction)
+	{
+		case eSetBits: xTaskToNotify->notifyValue |= ulValue; break;
+		case eIncrement: xTaskToNotify->notifyValue++; break;
+		case eSetValueWithOverwrite: xTaskToNotify->notifyValue = ulValue; break;
+		case eSetValueWithoutOverwrite:
+			if(xTaskToNotify->notifyPending) return pdFAIL;
+			xTaskToNotify->notifyValue = ulValue;
+			break;
+		case eNoAction: break;
+	}
+	xTaskToNotify->notifyPending = 1;
+	return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, BaseType_t* pxHigherPriorityTaskWoken)
+{
+	BaseType_t ret = xTaskNotify(xTaskToNotify, ulValue, eAction);
+	if(ret == pdPASS && pxHigherPriorityTaskWoken != NULL) *pxHigherPriorityTaskWoken = pdTRUE;
+	return ret;
+}
+
+/* Queues */
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, uint8_t* pucQueueStorage, StaticQueue_t* pxStaticQueue)
+{
+	configASSERT(uxQueueLength != 0 && uxItemSize != 0 && pucQueueStorage != NULL && pxStaticQueue != NULL);
+
+	pxStaticQueue->storage = pucQueueStorage;
+	pxStaticQueue->length = uxQueueLength;
+	pxStaticQueue->itemSize = uxItemSize;
+	pxStaticQueue->head = 0;
+	pxStaticQueue->count = 0;
+	return pxStaticQueue;
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+	xQueue->head = 0;
+	xQueue->count = 0;
+	return pdPASS;
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t xQueue, const void* pvItemToQueue, BaseType_t* pxHigherPriorityTaskWoken)
+{
+	if(pxHigherPriorityTaskWoken != NULL) *pxHigherPriorityTaskWoken = pdFALSE;
+	if(xQueue->count == xQueue->length) return errQUEUE_FULL;
+
+	UBaseType_t pos = (xQueue->head + xQueue->count) % xQueue->length;
+	memcpy(&xQueue->storage[pos * xQueue->itemSize], pvItemToQueue, xQueue->itemSize);
+	xQueue->count++;
+	return pdPASS;
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void* pvBuffer, BaseType_t* pxHigherPriorityTaskWoken)
+{
+	if(pxHigherPriorityTaskWoken != NULL) *pxHigherPriorityTaskWoken = pdFALSE;
+	if(xQueue->count == 0) return pdFAIL;
+
+	memcpy(pvBuffer, &xQueue->storage[xQueue->head * xQueue->itemSize], xQueue->itemSize);
+	xQueue->head = (xQueue->head + 1) % xQueue->length;
+	xQueue->count--;
+	return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait)
+{
+	host_time deadline = tickDeadline(xTicksToWait);
+	while(xQueue->count == xQueue->length && xTicksToWait != 0 && hostSimTime() < deadline)
+	{
+		if(!hostSimWaitStep(deadline)) break;
+	}
+
+	taskENTER_CRITICAL();
+	BaseType_t ret = xQueueSendToBackFromISR(xQueue, pvItemToQueue, NULL);
+	taskEXIT_CRITICAL();
+	return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait)
+{
+	host_time deadline = tickDeadline(xTicksToWait);
+	while(xQueue->count == 0 && xTicksToWait != 0 && hostSimTime() < deadline)
+	{
+		if(!hostSimWaitStep(deadline)) break;
+	}
+
+	taskENTER_CRITICAL();
+	BaseType_t ret = xQueueReceiveFromISR(xQueue, pvBuffer, NULL);
+	taskEXIT_CRITICAL();
+	return ret;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+	return xQueue->count;
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(const QueueHandle_t xQueue)
+{
+	return xQueue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue)
+{
+	return xQueue->length - xQueue->count;
+}
+
+BaseType_t xQueueIsQueueFullFromISR(const QueueHandle_t xQueue)
+{
+	return (xQueue->count == xQueue->length) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueIsQueueEmptyFromISR(const QueueHandle_t xQueue)
+{
+	return (xQueue->count == 0) ? pdTRUE : pdFALSE;
+}
+
+/* Timers */
+
+//timer expiry (stale expiries of a timer restarted or stopped meanwhile are ignored)
+static void timerExpired(void* ctx)
+{
+	TimerHandle_t timer = (TimerHandle_t)ctx;
+	if(!timer->active || timer->expiry != hostSimTime()) return;
+
+	timer->active = 0;
+	if(timer->autoReload) xTimerStart(timer, 0);
+	timer->callback(timer);
+}
+
+TimerHandle_t xTimerCreateStatic(const char* const pcTimerName, const TickType_t xTimerPeriodInTicks, const UBaseType_t uxAutoReload, void* const pvTimerID, TimerCallbackFunction_t pxCallbackFunction, StaticTimer_t* pxTimerBuffer)
+{
+	(void)pcTimerName;
+	if(pxTimerBuffer == NULL || pxCallbackFunction == NULL || xTimerPeriodInTicks == 0) return NULL;
+
+	memset(pxTimerBuffer, 0, sizeof(*pxTimerBuffer));
+	pxTimerBuffer->callback = pxCallbackFunction;
+	pxTimerBuffer->id = pvTimerID;
+	pxTimerBuffer->period = xTimerPeriodInTicks;
+	pxTimerBuffer->autoReload = uxAutoReload;
+	return pxTimerBuffer;
+}
+
+void* pvTimerGetTimerID(const TimerHandle_t xTimer)
+{
+	return xTimer->id;
+}
+
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+	(void)xTicksToWait;
+	if(xTimer == NULL) return pdFAIL;
+
+	host_time expiry = tickDeadline(xTimer->period);
+	if(!hostSimSchedule(expiry - hostSimTime(), timerExpired, xTimer)) return pdFAIL;
+	xTimer->expiry = expiry;
+	xTimer->active = 1;
+	return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+	(void)xTicksToWait;
+	if(xTimer == NULL) return pdFAIL;
+	xTimer->active = 0;
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait)
+{
+	if(xTimer == NULL || xNewPeriod == 0) return pdFAIL;
+	xTimer->period = xNewPeriod;
+	return xTimerStart(xTimer, xTicksToWait);
+}
+
+BaseType_t xTimerChangePeriodFromISR(TimerHandle_t xTimer, TickType_t xNewPeriod, BaseType_t* pxHigherPriorityTaskWoken)
+{
+	if(pxHigherPriorityTaskWoken != NULL) *pxHigherPriorityTaskWoken = pdFALSE;
+	return xTimerChangePeriod(xTimer, xNewPeriod, 0);
+}
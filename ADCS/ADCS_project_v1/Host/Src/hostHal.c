@@ -0,0 +1,587 @@
+#include "hostSimInternal.h"
+#include "usart.h"
+#include "spi.h"
+#include "adc.h"
+#include "tim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_SPI_NUM 2
+#define HOST_ADC_NUM 1
+
+//handles defined by the CubeMX init files on the target
+UART_HandleTypeDef huart1;
+UART_HandleTypeDef huart2;
+UART_HandleTypeDef huart3;
+UART_HandleTypeDef huart4;
+SPI_HandleTypeDef hspi2;
+ADC_HandleTypeDef hadc1;
+TIM_HandleTypeDef htim1;
+TIM_HandleTypeDef htim2;
+TIM_HandleTypeDef htim3;
+
+//register blocks
+GPIO_TypeDef hostGPIO[8];
+TIM_TypeDef hostTIM[3];
+
+//simulated timer: registers acting on the outputs (loaded from the preload ones at update events)
+typedef struct{
+	host_time lastUpdate;	//time of the last update event (or of the counter start)
+	uint32_t psc;
+	uint32_t arr;
+	uint32_t ccr[4];
+	uint32_t updates;		//update events since the counter start
+	uint32_t glitches;		//periods cut or stretched by registers written without preload
+} host_tim;
+
+static host_tim _tim[3];
+static host_time _timSynced;	//time the timers were last brought up to
+
+//simulated spi bus
+typedef struct{
+	SPI_HandleTypeDef* hspi;
+	host_time bitTime;
+	host_spi_hook hook;
+	uint8_t dmaBusy;	//flag to signal that a DMA transfer is in flight
+	uint8_t* dmaTx;		//buffers and size of the DMA transfer
+	uint8_t* dmaRx;
+	uint16_t dmaSize;
+} host_spi;
+
+//simulated adc
+typedef struct{
+	ADC_HandleTypeDef* hadc;
+	host_time conversion;
+	uint32_t channel;	//selected channel
+	uint8_t started;	//flag to signal that a conversion was started
+	uint32_t value[HOST_ADC_CHANNELS];
+	uint32_t seq[HOST_ADC_RANKS];	//channel of each rank of the regular sequence
+	uint8_t dmaRunning;	//flag to signal that a DMA scan acquisition is running
+	uint16_t* dmaBuf;	//circular buffer and its length (samples)
+	uint32_t dmaLen;
+	uint32_t dmaPos;	//next sample written
+	host_time scanEnd;	//end of the scan in progress (HOST_TIME_NEVER if waiting for a trigger)
+	host_time lastTrigger;	//trigger of the last scan
+	uint32_t scans;		//scans completed
+} host_adc;
+
+static host_spi _spi[HOST_SPI_NUM];
+static host_adc _adc[HOST_ADC_NUM];
+
+void hostHalReset(void)
+{
+	memset(hostGPIO, 0, sizeof(hostGPIO));
+	memset(hostTIM, 0, sizeof(hostTIM));
+	memset(_spi, 0, sizeof(_spi));
+	memset(_adc, 0, sizeof(_adc));
+	memset(_tim, 0, sizeof(_tim));
+	_timSynced = 0;
+}
+
+void Error_Handler(void)
+{
+	//on the target the cpu is stopped here, abort so that the debugger/valgrind shows where
+	fprintf(stderr, "Error_Handler() called\n");
+	abort();
+}
+
+/* Tick */
+
+uint32_t HAL_GetTick(void)
+{
+	hostSimPoll();
+	return (uint32_t)(hostSimTime() / 1000000ULL);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	hostSimAdvance((host_time)Delay * 1000000ULL);
+}
+
+/* GPIO */
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if(PinState != GPIO_PIN_RESET) GPIOx->ODR |= GPIO_Pin;
+	else GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	GPIOx->ODR ^= GPIO_Pin;
+}
+
+/* SPI */
+
+static host_spi* getSpi(SPI_HandleTypeDef* hspi)
+{
+	for(uint32_t s = 0; s < HOST_SPI_NUM; s++)
+	{
+		if(_spi[s].hspi == hspi && hspi != NULL) return &_spi[s];
+	}
+	return NULL;
+}
+
+void hostSpiInit(SPI_HandleTypeDef* hspi, SPI_TypeDef* instance, uint32_t bitRate)
+{
+	host_spi* spi = getSpi(hspi);
+	for(uint32_t s = 0; s < HOST_SPI_NUM && spi == NULL; s++)
+	{
+		if(_spi[s].hspi == NULL) spi = &_spi[s];
+	}
+	if(spi == NULL || bitRate == 0) return;
+
+	memset(hspi, 0, sizeof(*hspi));
+	hspi->Instance = instance;
+	spi->hspi = hspi;
+	spi->bitTime = 1000000000ULL / bitRate;
+	spi->hook = NULL;
+}
+
+void hostSpiSetHook(SPI_HandleTypeDef* hspi, host_spi_hook hook)
+{
+	host_spi* spi = getSpi(hspi);
+	if(spi == NULL) return;
+	spi->hook = hook;
+}
+
+//blocking transfer: the hook fills the rx bytes (0xff if no hook, as an idle MISO line)
+static HAL_StatusTypeDef spiTransfer(SPI_HandleTypeDef* hspi, const uint8_t* tx, uint8_t* rx, uint16_t Size)
+{
+	host_spi* spi = getSpi(hspi);
+	if(spi == NULL || Size == 0) return HAL_ERROR;
+	if(spi->dmaBusy) return HAL_BUSY;
+
+	hostSimAdvance(8ULL * Size * spi->bitTime);
+	if(spi->hook != NULL) spi->hook(hspi, tx, rx, Size);
+	else if(rx != NULL) memset(rx, 0xff, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout)
+{
+	UNUSED(Timeout);
+	if(pData == NULL) return HAL_ERROR;
+	return spiTransfer(hspi, pData, NULL, Size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef* hspi, uint8_t* pData, uint16_t Size, uint32_t Timeout)
+{
+	UNUSED(Timeout);
+	if(pData == NULL) return HAL_ERROR;
+	return spiTransfer(hspi, NULL, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size, uint32_t Timeout)
+{
+	UNUSED(Timeout);
+	if(pTxData == NULL || pRxData == NULL) return HAL_ERROR;
+	return spiTransfer(hspi, pTxData, pRxData, Size);
+}
+
+//end of a DMA transfer: the hook sees the whole transfer, then the complete callback
+static void spiDmaDone(void* ctx)
+{
+	host_spi* spi = (host_spi*)ctx;
+	spi->dmaBusy = 0;
+	if(spi->hook != NULL) spi->hook(spi->hspi, spi->dmaTx, spi->dmaRx, spi->dmaSize);
+	else memset(spi->dmaRx, 0xff, spi->dmaSize);
+	HAL_SPI_TxRxCpltCallback(spi->hspi);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef* hspi, uint8_t* pTxData, uint8_t* pRxData, uint16_t Size)
+{
+	host_spi* spi = getSpi(hspi);
+	if(spi == NULL || pTxData == NULL || pRxData == NULL || Size == 0) return HAL_ERROR;
+	if(spi->dmaBusy) return HAL_BUSY;
+
+	if(!hostSimSchedule(8ULL * Size * spi->bitTime, spiDmaDone, spi)) return HAL_ERROR;
+	spi->dmaBusy = 1;
+	spi->dmaTx = pTxData;
+	spi->dmaRx = pRxData;
+	spi->dmaSize = Size;
+	return HAL_OK;
+}
+
+/* ADC */
+
+static host_adc* getAdc(ADC_HandleTypeDef* hadc)
+{
+	for(uint32_t a = 0; a < HOST_ADC_NUM; a++)
+	{
+		if(_adc[a].hadc == hadc && hadc != NULL) return &_adc[a];
+	}
+	return NULL;
+}
+
+void hostAdcInit(ADC_HandleTypeDef* hadc, ADC_TypeDef* instance, host_time conversion)
+{
+	host_adc* adc = getAdc(hadc);
+	for(uint32_t a = 0; a < HOST_ADC_NUM && adc == NULL; a++)
+	{
+		if(_adc[a].hadc == NULL) adc = &_adc[a];
+	}
+	if(adc == NULL) return;
+
+	memset(hadc, 0, sizeof(*hadc));
+	memset(adc, 0, sizeof(*adc));
+	hadc->Instance = instance;
+	adc->hadc = hadc;
+	adc->conversion = conversion;
+}
+
+void hostAdcSet(ADC_HandleTypeDef* hadc, uint32_t channel, uint32_t value)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL || channel >= HOST_ADC_CHANNELS) return;
+	adc->value[channel] = value;
+}
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef* hadc)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL || adc->dmaRunning) return HAL_ERROR;
+	if(hadc->Init.NbrOfConversion == 0 || hadc->Init.NbrOfConversion > HOST_ADC_RANKS) return HAL_ERROR;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_ConfigChannel(ADC_HandleTypeDef* hadc, ADC_ChannelConfTypeDef* sConfig)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL || sConfig == NULL || sConfig->Channel >= HOST_ADC_CHANNELS) return HAL_ERROR;
+	uint32_t rank = sConfig->Rank / ADC_REGULAR_RANK_1;
+	if(rank == 0 || rank > HOST_ADC_RANKS || sConfig->Rank % ADC_REGULAR_RANK_1 != 0) return HAL_ERROR;
+	adc->seq[rank - 1] = sConfig->Channel;
+	adc->channel = sConfig->Channel;	//blocking calls convert the last configured channel
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef* hadc)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL) return HAL_ERROR;
+	adc->started = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop(ADC_HandleTypeDef* hadc)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL) return HAL_ERROR;
+	adc->started = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef* hadc, uint32_t Timeout)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL) return HAL_ERROR;
+	if(!adc->started)
+	{
+		hostSimAdvance((host_time)Timeout * 1000000ULL);
+		return HAL_TIMEOUT;
+	}
+	hostSimAdvance(adc->conversion);
+	return HAL_OK;
+}
+
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef* hadc)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL) return 0;
+	return adc->value[adc->channel];
+}
+
+//timer whose TRGO triggers the regular sequence, NULL for software or unsupported triggers
+static TIM_TypeDef* adcTriggerTimer(host_adc* adc)
+{
+	switch(adc->hadc->Init.ExternalTrigConv)
+	{
+	case ADC_EXTERNALTRIG_T1_TRGO: return TIM1;
+	case ADC_EXTERNALTRIG_T2_TRGO: return TIM2;
+	case ADC_EXTERNALTRIG_T3_TRGO: return TIM3;
+	default: return NULL;
+	}
+}
+
+static void adcScanDone(void* ctx);
+static host_time timPeriod(const host_tim* t);
+
+//wait for the first update event of the trigger timer from now, the scan ends after the
+//conversions of the sequence (triggers arriving while converting are ignored, as on the target)
+static void adcScheduleScan(host_adc* adc)
+{
+	TIM_TypeDef* tim = adcTriggerTimer(adc);
+	adc->scanEnd = HOST_TIME_NEVER;
+	if(tim == NULL || !(tim->CR1 & 1UL) || (tim->CR2 & 0x70U) != TIM_TRGO_UPDATE) return;	//no trigger
+
+	host_time now = hostSimTime();
+	host_tim* t = &_tim[tim - hostTIM];
+	hostTimSync(now);
+	host_time period = timPeriod(t);
+	host_time trigger = t->lastUpdate + period;	//counter stretched past its auto-reload
+	if(now >= t->lastUpdate) trigger = t->lastUpdate + (now - t->lastUpdate + period - 1) / period * period;
+	host_time end = trigger + adc->hadc->Init.NbrOfConversion * adc->conversion;
+	if(!hostSimSchedule(end - now, adcScanDone, adc)) return;
+	adc->lastTrigger = trigger;
+	adc->scanEnd = end;
+}
+
+//end of a scan: the samples go in the circular buffer with the DMA half/full events
+static void adcScanDone(void* ctx)
+{
+	host_adc* adc = (host_adc*)ctx;
+	if(!adc->dmaRunning || adc->scanEnd != hostSimTime()) return;	//stopped or stale
+
+	for(uint32_t r = 0; r < adc->hadc->Init.NbrOfConversion; r++)
+	{
+		adc->dmaBuf[adc->dmaPos++] = (uint16_t)adc->value[adc->seq[r]];
+		if(adc->dmaPos == adc->dmaLen / 2) HAL_ADC_ConvHalfCpltCallback(adc->hadc);
+		if(adc->dmaPos == adc->dmaLen)
+		{
+			adc->dmaPos = 0;
+			HAL_ADC_ConvCpltCallback(adc->hadc);
+		}
+	}
+	adc->scans++;
+	if(adc->dmaRunning) adcScheduleScan(adc);
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* pData, uint32_t Length)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL || pData == NULL || Length == 0 || adc->dmaRunning) return HAL_ERROR;
+	if(adcTriggerTimer(adc) == NULL) return HAL_ERROR;	//only timer triggered scans are emulated
+
+	adc->dmaRunning = 1;
+	adc->dmaBuf = (uint16_t*)pData;
+	adc->dmaLen = Length;
+	adc->dmaPos = 0;
+	adc->scans = 0;
+	adcScheduleScan(adc);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef* hadc)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL) return HAL_ERROR;
+	adc->dmaRunning = 0;
+	adc->scanEnd = HOST_TIME_NEVER;
+	return HAL_OK;
+}
+
+uint32_t hostAdcScans(ADC_HandleTypeDef* hadc, host_time* lastTrigger)
+{
+	host_adc* adc = getAdc(hadc);
+	if(adc == NULL) return 0;
+	if(lastTrigger != NULL) *lastTrigger = adc->lastTrigger;
+	return adc->scans;
+}
+
+/* TIM */
+
+void hostTimInit(TIM_HandleTypeDef* htim, TIM_TypeDef* instance, uint32_t prescaler, uint32_t period)
+{
+	memset(htim, 0, sizeof(*htim));
+	memset(instance, 0, sizeof(*instance));
+	htim->Instance = instance;
+	htim->Init.Prescaler = prescaler;
+	htim->Init.Period = period;
+	instance->PSC = prescaler;
+	instance->ARR = period;
+}
+
+uint8_t hostTimPwmRunning(TIM_HandleTypeDef* htim, uint32_t channel)
+{
+	return (htim->Instance->CCER & (1UL << channel)) != 0;
+}
+
+//length of a period with the active prescaler and auto-reload
+static host_time timPeriod(const host_tim* t)
+{
+	host_time period = (host_time)(t->psc + 1) * (t->arr + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+	return period ? period : 1;
+}
+
+//capture compare register of channel i (0..3)
+static volatile uint32_t* timCcr(TIM_TypeDef* tim, uint32_t i)
+{
+	return &tim->CCR1 + i;
+}
+
+//1 if the compare register of channel i is preloaded (OCxPE)
+static uint8_t timCcrPreloaded(TIM_TypeDef* tim, uint32_t i)
+{
+	uint32_t ccmr = (i < 2) ? tim->CCMR1 : tim->CCMR2;
+	return (ccmr & ((i & 1) ? TIM_CCMR1_OC2PE : TIM_CCMR1_OC1PE)) != 0;
+}
+
+//update event: the preload registers are transferred to the active ones
+static void timLoad(TIM_TypeDef* tim, host_tim* t)
+{
+	t->psc = tim->PSC;
+	t->arr = tim->ARR;
+	for(uint32_t i = 0; i < 4; i++) t->ccr[i] = *timCcr(tim, i);
+}
+
+//the registers are written by the code while time stands still (at _timSynced), so the update
+//events up to (now) see the values written last, the ones without preload act at once
+void hostTimSync(host_time now)
+{
+	for(uint32_t k = 0; k < 3; k++)
+	{
+		TIM_TypeDef* tim = &hostTIM[k];
+		host_tim* t = &_tim[k];
+		if(!(tim->CR1 & TIM_CR1_CEN))
+		{
+			tim->EGR &= ~TIM_EGR_UG;	//registers are loaded when the counter starts
+			continue;
+		}
+
+		if(tim->EGR & TIM_EGR_UG)
+		{
+			//software update: counter restarted, registers transferred unless UDIS
+			tim->EGR &= ~TIM_EGR_UG;
+			t->lastUpdate = _timSynced;
+			if(!(tim->CR1 & TIM_CR1_UDIS)) timLoad(tim, t);
+		}
+		//registers without preload, written at _timSynced with the counter at cnt
+		uint32_t cnt = 0;
+		if(_timSynced > t->lastUpdate) cnt = (uint32_t)((_timSynced - t->lastUpdate) * HOST_TIM_CLOCK / 1000000000ULL / (t->psc + 1));
+		if(!(tim->CR1 & TIM_CR1_ARPE) && tim->ARR != t->arr)
+		{
+			if(cnt > tim->ARR)
+			{
+				//the counter missed the new auto-reload, it runs to its top before the update event
+				uint64_t top = (tim == TIM2) ? 0xFFFFFFFFULL : 0xFFFFULL;
+				host_time wrap = _timSynced + (top - cnt + 1) * (t->psc + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+				t->arr = tim->ARR;
+				t->lastUpdate = wrap - timPeriod(t);
+				t->glitches++;
+			}
+			t->arr = tim->ARR;
+		}
+		for(uint32_t i = 0; i < 4; i++)
+		{
+			uint32_t ccr = *timCcr(tim, i);
+			if(timCcrPreloaded(tim, i) || ccr == t->ccr[i]) continue;
+			//the counter is between the old and the new compare value: the pulse is cut or doubled
+			if(cnt >= (ccr < t->ccr[i] ? ccr : t->ccr[i]) && cnt < (ccr > t->ccr[i] ? ccr : t->ccr[i])) t->glitches++;
+			t->ccr[i] = ccr;
+		}
+
+		host_time period = timPeriod(t);
+		if(now < t->lastUpdate + period) continue;
+		//first update event, then the registers do not change until now
+		t->lastUpdate += period;
+		t->updates++;
+		if(!(tim->CR1 & TIM_CR1_UDIS)) timLoad(tim, t);
+		period = timPeriod(t);
+		host_time num = (now - t->lastUpdate) / period;
+		t->lastUpdate += num * period;
+		t->updates += num;
+	}
+	if(now > _timSynced) _timSynced = now;
+}
+
+void hostTimGetState(TIM_HandleTypeDef* htim, host_tim_state* state)
+{
+	host_tim* t = &_tim[htim->Instance - hostTIM];
+	hostTimSync(hostSimTime());
+	state->psc = t->psc;
+	state->arr = t->arr;
+	for(uint32_t i = 0; i < 4; i++) state->ccr[i] = t->ccr[i];
+	state->updates = t->updates;
+	state->glitches = t->glitches;
+	state->lastUpdate = t->lastUpdate;
+}
+
+//counter enable: the periods start now (with the registers loaded, as after the UG of the init),
+//waiting scans get their trigger
+void hostTimEnable(TIM_TypeDef* tim)
+{
+	if(tim->CR1 & TIM_CR1_CEN) return;
+	hostTimSync(hostSimTime());
+	tim->CR1 |= TIM_CR1_CEN;
+	host_tim* t = &_tim[tim - hostTIM];
+	timLoad(tim, t);
+	t->lastUpdate = hostSimTime();
+	t->updates = 0;
+	t->glitches = 0;
+	for(uint32_t a = 0; a < HOST_ADC_NUM; a++)
+	{
+		if(_adc[a].dmaRunning && _adc[a].scanEnd == HOST_TIME_NEVER) adcScheduleScan(&_adc[a]);
+	}
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t Channel)
+{
+	//CCxE is bit (Channel) of CCER, as on the target
+	htim->Instance->CCER |= (1UL << Channel);
+	hostTimEnable(htim->Instance);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim)
+{
+	hostTimEnable(htim->Instance);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef* htim, TIM_MasterConfigTypeDef* sMasterConfig)
+{
+	if(sMasterConfig == NULL) return HAL_ERROR;
+	htim->Instance->CR2 = (htim->Instance->CR2 & ~0x70U) | (sMasterConfig->MasterOutputTrigger & 0x70U);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef* htim, uint32_t Channel)
+{
+	htim->Instance->CCER &= ~(1UL << Channel);
+	if(htim->Instance->CCER == 0)
+	{
+		hostTimSync(hostSimTime());
+		htim->Instance->CR1 &= ~TIM_CR1_CEN;
+	}
+	return HAL_OK;
+}
+
+/* Default callbacks (overridden by the modules, as the HAL weak ones) */
+
+__weak void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc)
+{
+	UNUSED(hadc);
+}
+
+__weak void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc)
+{
+	UNUSED(hadc);
+}
+
+__weak void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
+{
+	UNUSED(huart);
+}
+
+__weak void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart)
+{
+	UNUSED(huart);
+}
+
+__weak void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
+{
+	UNUSED(huart);
+}
+
+__weak void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t Size)
+{
+	UNUSED(huart);
+	UNUSED(Size);
+}
@@ -0,0 +1,638 @@
+#include "hostSimInternal.h"
+#include <string.h>
+
+#define HOST_UART_NUM 4
+
+//simulated uart port
+typedef struct{
+	UART_HandleTypeDef* huart;	//HAL handle (NULL if the port is not initialized)
+	IRQn_Type irq;				//uart interrupt
+	host_time byteTime;			//time of a character on the line (start + 8 data + stop bits)
+	DMA_HandleTypeDef hdmarx;	//rx DMA handle and channel (linked to the HAL handle if requested)
+	DMA_Channel_TypeDef dmaRxChannel;
+	DMA_HandleTypeDef hdmatx;	//tx DMA handle and channel
+	DMA_Channel_TypeDef dmaTxChannel;
+	uint8_t dmaRxRunning;		//flag to signal that a ReceiveToIdle_DMA reception is running
+
+	//rx line: bytes with their arrival time
+	uint8_t line[HOST_UART_LINE_LEN];
+	host_time lineTime[HOST_UART_LINE_LEN];
+	uint32_t lineHead;
+	uint32_t lineCount;
+	host_time lineFree;			//time at which the last queued byte has arrived
+
+	uint8_t idlePending;		//flag to signal that an idle line event is scheduled
+	host_time idleTime;			//time of the idle line event
+
+	//tx line
+	uint8_t txBusy;				//flag to signal that a transmission is in progress
+	uint8_t txBlocking;			//flag to signal that the transmission in progress is a blocking one (no callback)
+	host_time txEnd;			//end time of the transmission in progress
+	host_time txLineFree;		//time at which the tx line is free
+	uint8_t txLog[HOST_UART_LINE_LEN];
+	uint32_t txLogHead;
+	uint32_t txLogCount;
+	host_uart_tx_hook txHook;
+
+	host_uart_stats stats;
+} host_uart;
+
+static host_uart _uart[HOST_UART_NUM];
+
+//scheduled device action
+typedef struct{
+	host_sim_action action;		//NULL if the slot is free
+	void* ctx;
+	host_time time;
+} host_sim_scheduled;
+
+static host_sim_scheduled _actions[HOST_SIM_ACTION_NUM];
+
+static host_time _now;
+static host_time _pollCost = 1000;
+static uint32_t _criticalNesting;
+static uint8_t _inIsr;	//flag to signal that an event is being delivered (events do not nest)
+static uint8_t _irqEnabled[HOST_IRQ_NUM];
+static BaseType_t _schedulerState = taskSCHEDULER_RUNNING;
+
+/* Time */
+
+void hostSimReset(void)
+{
+	_now = 0;
+	_pollCost = 1000;
+	_criticalNesting = 0;
+	_inIsr = 0;
+	_schedulerState = taskSCHEDULER_RUNNING;
+	memset(_irqEnabled, 0, sizeof(_irqEnabled));
+	memset(_uart, 0, sizeof(_uart));
+	memset(_actions, 0, sizeof(_actions));
+	hostHalReset();
+}
+
+host_time hostSimTime(void)
+{
+	return _now;
+}
+
+void hostSimSetPollCost(host_time ns)
+{
+	_pollCost = ns;
+}
+
+void hostSimSetSchedulerState(BaseType_t state)
+{
+	_schedulerState = state;
+}
+
+uint8_t hostSimSchedule(host_time delay, host_sim_action action, void* ctx)
+{
+	if(action == NULL) return 0;
+	for(uint32_t a = 0; a < HOST_SIM_ACTION_NUM; a++)
+	{
+		if(_actions[a].action != NULL) continue;
+		_actions[a].action = action;
+		_actions[a].ctx = ctx;
+		_actions[a].time = _now + delay;
+		return 1;
+	}
+	return 0;
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+	return _schedulerState;
+}
+
+/* Interrupts */
+
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+	if((uint32_t)IRQn >= HOST_IRQ_NUM) return;
+	_irqEnabled[IRQn] = 1;
+	hostSimWaitUntil(_now);	//deliver what was held back
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+	if((uint32_t)IRQn >= HOST_IRQ_NUM) return;
+	_irqEnabled[IRQn] = 0;
+}
+
+uint32_t NVIC_GetEnableIRQ(IRQn_Type IRQn)
+{
+	if((uint32_t)IRQn >= HOST_IRQ_NUM) return 0;
+	return _irqEnabled[IRQn];
+}
+
+void hostEnterCritical(void)
+{
+	_criticalNesting++;
+}
+
+void hostExitCritical(void)
+{
+	if(_criticalNesting == 0) return;
+	_criticalNesting--;
+	if(_criticalNesting == 0) hostSimWaitUntil(_now);	//deliver what was held back
+}
+
+/* UART ports */
+
+//port of an uart handle, NULL if not initialized
+static host_uart* getPort(UART_HandleTypeDef* huart)
+{
+	for(uint32_t p = 0; p < HOST_UART_NUM; p++)
+	{
+		if(_uart[p].huart == huart && huart != NULL) return &_uart[p];
+	}
+	return NULL;
+}
+
+//time of the next event of a port (HOST_TIME_NEVER if none or if the port is masked)
+static host_time portNextEvent(host_uart* port)
+{
+	if(_inIsr || _criticalNesting != 0 || !_irqEnabled[port->irq]) return HOST_TIME_NEVER;
+
+	host_time next = HOST_TIME_NEVER;
+	if(port->lineCount != 0 && port->lineTime[port->lineHead] < next) next = port->lineTime[port->lineHead];
+	if(port->idlePending && port->idleTime < next) next = port->idleTime;
+	if(port->txBusy && !port->txBlocking && port->txEnd < next) next = port->txEnd;
+	return next;
+}
+
+//a byte arrived on the rx line
+static void portRxByte(host_uart* port)
+{
+	UART_HandleTypeDef* huart = port->huart;
+	uint8_t byte = port->line[port->lineHead];
+	port->lineHead = (port->lineHead + 1) % HOST_UART_LINE_LEN;
+	port->lineCount--;
+	port->stats.rxBytes++;
+
+	if(port->dmaRxRunning)
+	{
+		DMA_Channel_TypeDef* channel = huart->hdmarx->Instance;
+		huart->pRxBuffPtr[huart->RxXferSize - channel->CNDTR] = byte;
+		channel->CNDTR--;
+		port->idlePending = 1;
+		port->idleTime = _now + port->byteTime;
+
+		if(channel->CNDTR == huart->RxXferSize / 2U)
+		{
+			//half transfer
+			port->stats.irqs++;
+			HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize / 2U);
+		}
+		else if(channel->CNDTR == 0)
+		{
+			//transfer complete: the circular DMA reloads, the normal one stops
+			if(huart->hdmarx->Init.Mode == DMA_CIRCULAR)
+			{
+				channel->CNDTR = huart->RxXferSize;
+			}
+			else
+			{
+				port->dmaRxRunning = 0;
+				port->idlePending = 0;
+				huart->RxState = HAL_UART_STATE_READY;
+			}
+			port->stats.irqs++;
+			HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize);
+		}
+	}
+	else if(huart->RxState == HAL_UART_STATE_BUSY_RX)
+	{
+		*huart->pRxBuffPtr = byte;
+		huart->pRxBuffPtr++;
+		huart->RxXferCount--;
+		if(huart->RxXferCount == 0)
+		{
+			huart->RxState = HAL_UART_STATE_READY;
+			port->stats.irqs++;
+			HAL_UART_RxCpltCallback(huart);
+		}
+	}
+	else
+	{
+		//nobody is reading the data register
+		port->stats.rxOverruns++;
+	}
+}
+
+//one idle character after the last byte
+static void portIdle(host_uart* port)
+{
+	UART_HandleTypeDef* huart = port->huart;
+	port->idlePending = 0;
+	if(!port->dmaRxRunning) return;
+
+	//as the HAL: no event if the DMA position is on a half/full boundary already reported
+	uint32_t remaining = huart->hdmarx->Instance->CNDTR;
+	if(remaining > 0 && remaining < huart->RxXferSize)
+	{
+		port->stats.irqs++;
+		HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize - remaining);
+	}
+}
+
+//log the bytes of a completed transmission and pass them to the tx hook
+static void portTxDone(host_uart* port, const uint8_t* data, uint32_t len)
+{
+	for(uint32_t b = 0; b < len; b++)
+	{
+		if(port->txLogCount == HOST_UART_LINE_LEN)
+		{
+			//log full, drop the oldest byte
+			port->txLogHead = (port->txLogHead + 1) % HOST_UART_LINE_LEN;
+			port->txLogCount--;
+		}
+		port->txLog[(port->txLogHead + port->txLogCount) % HOST_UART_LINE_LEN] = data[b];
+		port->txLogCount++;
+	}
+	port->stats.txBytes += len;
+	if(port->txHook != NULL) port->txHook(port->huart, data, len);
+}
+
+//end of a transmission started with Transmit_IT or Transmit_DMA
+static void portTxEnd(host_uart* port)
+{
+	UART_HandleTypeDef* huart = port->huart;
+	port->txBusy = 0;
+	huart->TxXferCount = 0;
+	if(huart->hdmatx != NULL) huart->hdmatx->Instance->CNDTR = 0;
+	huart->gState = HAL_UART_STATE_READY;
+	portTxDone(port, huart->pTxBuffPtr, huart->TxXferSize);
+	port->stats.irqs++;
+	HAL_UART_TxCpltCallback(huart);
+}
+
+//deliver the event of a port falling at the current time
+static void portDeliver(host_uart* port)
+{
+	_inIsr = 1;
+	if(port->txBusy && !port->txBlocking && port->txEnd <= _now)
+	{
+		portTxEnd(port);
+	}
+	else if(port->lineCount != 0 && port->lineTime[port->lineHead] <= _now)
+	{
+		portRxByte(port);
+	}
+	else if(port->idlePending && port->idleTime <= _now)
+	{
+		portIdle(port);
+	}
+	_inIsr = 0;
+}
+
+//earliest port with an event, NULL if none
+static host_uart* nextPort(host_time* time)
+{
+	host_uart* next = NULL;
+	*time = HOST_TIME_NEVER;
+	for(uint32_t p = 0; p < HOST_UART_NUM; p++)
+	{
+		if(_uart[p].huart == NULL) continue;
+		host_time t = portNextEvent(&_uart[p]);
+		if(t < *time)
+		{
+			*time = t;
+			next = &_uart[p];
+		}
+	}
+	return next;
+}
+
+//earliest event: a port event (*port) or a scheduled action (*action, before ports at the same
+//time), returns its time (HOST_TIME_NEVER if none)
+static host_time nextEvent(host_uart** port, host_sim_scheduled** action)
+{
+	host_time time;
+	*port = nextPort(&time);
+	*action = NULL;
+	if(_inIsr) return time;
+	for(uint32_t a = 0; a < HOST_SIM_ACTION_NUM; a++)
+	{
+		if(_actions[a].action != NULL && _actions[a].time <= time)
+		{
+			time = _actions[a].time;
+			*action = &_actions[a];
+			*port = NULL;
+		}
+	}
+	return time;
+}
+
+//time moves forward, the timers follow
+static void moveTo(host_time time)
+{
+	if(time <= _now) return;
+	_now = time;
+	hostTimSync(time);
+}
+
+//deliver the event found by nextEvent()
+static void deliverEvent(host_uart* port, host_sim_scheduled* action, host_time time)
+{
+	moveTo(time);
+	if(action != NULL)
+	{
+		host_sim_action run = action->action;
+		void* ctx = action->ctx;
+		action->action = NULL;
+		_inIsr = 1;
+		run(ctx);
+		_inIsr = 0;
+	}
+	else
+	{
+		portDeliver(port);
+	}
+}
+
+uint8_t hostSimWaitStep(host_time deadline)
+{
+	host_uart* port;
+	host_sim_scheduled* action;
+	host_time time = nextEvent(&port, &action);
+
+	if(time == HOST_TIME_NEVER || time > deadline)
+	{
+		if(deadline == HOST_TIME_NEVER) return 0;
+		moveTo(deadline);
+		return 1;
+	}
+	deliverEvent(port, action, time);
+	return 1;
+}
+
+void hostSimWaitUntil(host_time deadline)
+{
+	//events do not nest: inside an event time just moves forward
+	if(_inIsr)
+	{
+		moveTo(deadline);
+		return;
+	}
+
+	host_uart* port;
+	host_sim_scheduled* action;
+	host_time time;
+	while((time = nextEvent(&port, &action)) != HOST_TIME_NEVER && time <= deadline)
+	{
+		deliverEvent(port, action, time);
+	}
+	moveTo(deadline);
+}
+
+void hostSimAdvance(host_time ns)
+{
+	hostSimWaitUntil(_now + ns);
+}
+
+void hostSimPoll(void)
+{
+	hostSimAdvance(_pollCost);
+}
+
+/* UART scripting */
+
+void hostUartInit(UART_HandleTypeDef* huart, USART_TypeDef* instance, IRQn_Type irq, uint32_t baud, uint8_t dmaRx, uint8_t dmaTx)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL)
+	{
+		for(uint32_t p = 0; p < HOST_UART_NUM && port == NULL; p++)
+		{
+			if(_uart[p].huart == NULL) port = &_uart[p];
+		}
+		if(port == NULL) return;
+	}
+
+	memset(port, 0, sizeof(*port));
+	memset(huart, 0, sizeof(*huart));
+	port->huart = huart;
+	port->irq = irq;
+	port->byteTime = (10ULL * 1000000000ULL) / baud;
+
+	huart->Instance = instance;
+	huart->Init.BaudRate = baud;
+	huart->gState = HAL_UART_STATE_READY;
+	huart->RxState = HAL_UART_STATE_READY;
+	if(dmaRx)
+	{
+		port->hdmarx.Instance = &port->dmaRxChannel;
+		port->hdmarx.Init.Mode = DMA_CIRCULAR;
+		port->hdmarx.Parent = huart;
+		huart->hdmarx = &port->hdmarx;
+	}
+	if(dmaTx)
+	{
+		port->hdmatx.Instance = &port->dmaTxChannel;
+		port->hdmatx.Init.Mode = DMA_NORMAL;
+		port->hdmatx.Parent = huart;
+		huart->hdmatx = &port->hdmatx;
+	}
+
+	//as the MSP init, enable the uart interrupt
+	if((uint32_t)irq < HOST_IRQ_NUM) _irqEnabled[irq] = 1;
+}
+
+uint32_t hostUartRxPush(UART_HandleTypeDef* huart, const uint8_t* data, uint32_t len, host_time gap)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL || data == NULL) return 0;
+
+	host_time time = (port->lineFree > _now) ? port->lineFree : _now;
+	time += gap;
+	uint32_t pushed = 0;
+	while(pushed < len && port->lineCount < HOST_UART_LINE_LEN)
+	{
+		time += port->byteTime;
+		uint32_t pos = (port->lineHead + port->lineCount) % HOST_UART_LINE_LEN;
+		port->line[pos] = data[pushed];
+		port->lineTime[pos] = time;
+		port->lineCount++;
+		pushed++;
+	}
+	if(pushed != 0) port->lineFree = time;
+	return pushed;
+}
+
+uint32_t hostUartRxPending(UART_HandleTypeDef* huart)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL) return 0;
+	return port->lineCount;
+}
+
+void hostUartRxError(UART_HandleTypeDef* huart, uint32_t errorCode)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL) return;
+
+	huart->ErrorCode |= errorCode;
+	//overruns and any error during DMA reception are blocking: the HAL aborts the reception
+	if((errorCode & HAL_UART_ERROR_ORE) || port->dmaRxRunning)
+	{
+		port->dmaRxRunning = 0;
+		port->idlePending = 0;
+		huart->RxState = HAL_UART_STATE_READY;
+	}
+	port->stats.irqs++;
+	_inIsr = 1;
+	HAL_UART_ErrorCallback(huart);
+	_inIsr = 0;
+	huart->ErrorCode = HAL_UART_ERROR_NONE;
+}
+
+uint32_t hostUartTxRead(UART_HandleTypeDef* huart, uint8_t* buff, uint32_t size)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL || buff == NULL) return 0;
+
+	uint32_t read = 0;
+	while(read < size && port->txLogCount != 0)
+	{
+		buff[read++] = port->txLog[port->txLogHead];
+		port->txLogHead = (port->txLogHead + 1) % HOST_UART_LINE_LEN;
+		port->txLogCount--;
+	}
+	return read;
+}
+
+void hostUartSetTxHook(UART_HandleTypeDef* huart, host_uart_tx_hook hook)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL) return;
+	port->txHook = hook;
+}
+
+void hostUartGetStats(UART_HandleTypeDef* huart, host_uart_stats* stats)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL || stats == NULL) return;
+	*stats = port->stats;
+}
+
+/* UART HAL */
+
+//start a transmission, the end is delivered as an event (or waited for if blocking)
+static HAL_StatusTypeDef portTxStart(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size, uint8_t blocking)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL) return HAL_ERROR;
+	if(huart->gState != HAL_UART_STATE_READY) return HAL_BUSY;
+	if(pData == NULL || Size == 0) return HAL_ERROR;
+
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	huart->pTxBuffPtr = (uint8_t*)pData;
+	huart->TxXferSize = Size;
+	huart->TxXferCount = Size;
+
+	host_time start = (port->txLineFree > _now) ? port->txLineFree : _now;
+	port->txEnd = start + Size * port->byteTime;
+	port->txLineFree = port->txEnd;
+	port->txBusy = 1;
+	port->txBlocking = blocking;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size, uint32_t Timeout)
+{
+	UNUSED(Timeout);
+	HAL_StatusTypeDef status = portTxStart(huart, pData, Size, 1);
+	if(status != HAL_OK) return status;
+
+	host_uart* port = getPort(huart);
+	hostSimWaitUntil(port->txEnd);
+	port->txBusy = 0;
+	huart->TxXferCount = 0;
+	huart->gState = HAL_UART_STATE_READY;
+	portTxDone(port, pData, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size)
+{
+	return portTxStart(huart, pData, Size, 0);
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart, const uint8_t* pData, uint16_t Size)
+{
+	if(huart->hdmatx == NULL) return HAL_ERROR;
+	HAL_StatusTypeDef status = portTxStart(huart, pData, Size, 0);
+	if(status == HAL_OK) huart->hdmatx->Instance->CNDTR = Size;
+	return status;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size)
+{
+	if(getPort(huart) == NULL) return HAL_ERROR;
+	if(huart->RxState != HAL_UART_STATE_READY) return HAL_BUSY;
+	if(pData == NULL || Size == 0) return HAL_ERROR;
+
+	huart->pRxBuffPtr = pData;
+	huart->RxXferSize = Size;
+	huart->RxXferCount = Size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* huart, uint8_t* pData, uint16_t Size)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL || huart->hdmarx == NULL) return HAL_ERROR;
+	if(huart->RxState != HAL_UART_STATE_READY) return HAL_BUSY;
+	if(pData == NULL || Size == 0) return HAL_ERROR;
+
+	huart->pRxBuffPtr = pData;
+	huart->RxXferSize = Size;
+	huart->RxXferCount = Size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	huart->hdmarx->Instance->CNDTR = Size;
+	port->dmaRxRunning = 1;
+	port->idlePending = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef* huart)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL) return HAL_ERROR;
+
+	//the transmission in progress is cut: its bytes are not logged
+	if(port->txBusy)
+	{
+		port->txBusy = 0;
+		port->txLineFree = _now;
+	}
+	huart->TxXferCount = 0;
+	if(huart->hdmatx != NULL) huart->hdmatx->Instance->CNDTR = 0;
+	huart->gState = HAL_UART_STATE_READY;
+	return HAL_UART_AbortReceive(huart);
+}
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef* huart)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL || huart->Init.BaudRate == 0) return HAL_ERROR;
+	if(huart->gState != HAL_UART_STATE_READY || huart->RxState != HAL_UART_STATE_READY) return HAL_BUSY;
+
+	port->byteTime = (10ULL * 1000000000ULL) / huart->Init.BaudRate;
+	huart->ErrorCode = HAL_UART_ERROR_NONE;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef* huart)
+{
+	host_uart* port = getPort(huart);
+	if(port == NULL) return HAL_ERROR;
+
+	port->dmaRxRunning = 0;
+	port->idlePending = 0;
+	huart->RxXferCount = 0;
+	huart->RxState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
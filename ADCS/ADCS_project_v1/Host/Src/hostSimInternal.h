@@ -0,0 +1,25 @@
+#ifndef HOST_SIM_INTERNAL_H
+#define HOST_SIM_INTERNAL_H
+
+/* Functions shared by the host HAL and kernel replacements */
+
+#include "hostSim.h"
+
+#define HOST_TIME_NEVER UINT64_MAX
+#define HOST_NS_PER_TICK (1000000000ULL / configTICK_RATE_HZ)
+
+//let the poll cost pass (called at every tick read)
+void hostSimPoll(void);
+//wait for something to happen: let time pass up to the next event (and deliver it) or up to
+//(deadline), whichever comes first
+//returns 0 if nothing will ever happen (no events scheduled and no deadline)
+uint8_t hostSimWaitStep(host_time deadline);
+//wait until (deadline) delivering the events falling inside
+void hostSimWaitUntil(host_time deadline);
+
+//peripheral state reset, called by hostSimReset()
+void hostHalReset(void);
+//timer update events up to (now), called every time simulated time moves forward
+void hostTimSync(host_time now);
+
+#endif
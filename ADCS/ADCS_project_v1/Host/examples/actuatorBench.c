@@ -0,0 +1,399 @@
+/**
+ * @file actuatorBench.c
+ * @brief Actuator commands run on the host against the emulated PWM timers
+ *
+ * The five actuators are set up as the Control task does (Reaction1 on TIM1, Reaction2 and
+ * MagneTorquer3 on TIM2, MagneTorquer1 and MagneTorquer2 on TIM3, ACT_PWM_RESOLUTION) and started.
+ * The emulated timers transfer the preloaded registers at their update events
+ * (hostTimGetState()), so the checks are on the registers that drive the outputs:
+ * - the first period after actuator_START() already has the commanded prescaler and duty cycle;
+ * - Q15 duty cycles are converted to counts (rounding, clamping, sign as direction);
+ * - actuator_apply_all() changes nothing in the running periods, and every timer moves all its
+ *   channels at its next update event; called inside a batch of another caller (the current loop
+ *   interrupt), it and actuator_set_pwm() leave the update events disabled;
+ * - actuator_set_pwm()/update_pwm_Frequency() change the frequency of a timer at the end of the
+ *   running period, with the duty cycles of all the actuators on it kept, with the best duty
+ *   resolution for the frequency and without glitches (the emulated timers count the periods
+ *   cut or stretched by registers written without preload);
+ * - the dipole of MagneTorquer1, commanded in Q15 over its range every PWM period, is compared
+ *   with the average of the active duty cycles, with the CubeMX resolution (200 counts), with the
+ *   best resolution at the frequency and with the best resolution and dithering;
+ * - the current loop of MagneTorquer1 (actuator_current_loop_start(), run by the ADC1 scans
+ *   triggered by TIM1) drives an emulated coil (R/L, supply voltage, current sense code on the
+ *   ADC channel) to the setpoint, keeps it when the coil heats up and the bus voltage drops (where
+ *   the open loop duty cycle would be off), leaves a saturation without windup and reverses;
+ * then the CPU time of a command of the five actuators is measured, with actuator_apply_all()
+ * and with update_duty_dir() (float percent) one actuator at a time.
+ *
+ * usage: actuatorBench [commands]
+ */
+
+#include "hostSim.h"
+#include "actuator_driver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#define ALL_ACTUATORS ((1UL << NUM_ACTUATORS) - 1)
+#define SWITCH_STEP 250	//ns between two looks at the active registers
+
+//magnetorquer constants of pid_conversions.c (PID_current_2_DutyCycle()), dipole at 100% duty
+#define MT_SPIRES 1000.0
+#define MT_AREA 0.01	//m^2
+#define MT_R 142.0		//Ohm
+#define MT_VDD 12.0		//V
+#define MT_DIPOLE_MAX (MT_SPIRES * MT_AREA * MT_VDD / MT_R)	//A*m^2
+#define DIPOLE_FREQ 10000	//Hz, PWM frequency of the dipole test
+#define DIPOLE_COMMANDS 200	//dipoles commanded over -MT_DIPOLE_MAX..MT_DIPOLE_MAX
+#define DIPOLE_PERIODS 32	//PWM periods averaged per command
+
+//emulated coil of MagneTorquer1 for the current loop (Rmagnetorquer[0] of actuator_driver.c)
+#define COIL_R 30.5			//Ohm, at 20 degrees
+#define COIL_L 0.005		//H
+#define COIL_DRIVER 2		//current sense channel (ADC_CHANNEL_3)
+#define COIL_STEP 10000		//ns, integration step of the coil
+#define LOOP_SCAN_TIME 130000	//ns, conversion of a channel (16 oversamples of 247.5 + 12.5 cycles)
+
+static Actuator_struct Reaction1, Reaction2, MagneTorquer1, MagneTorquer2, MagneTorquer3;
+static Actuator_struct *const actuators[NUM_ACTUATORS] = {&Reaction1, &Reaction2, &MagneTorquer1, &MagneTorquer2, &MagneTorquer3};
+
+static double elapsedMs(struct timespec* start, struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+//compare value of a channel (TIM_CHANNEL_x) in the active registers
+static uint32_t activeCcr(const host_tim_state* state, uint32_t channel)
+{
+	return state->ccr[channel / 4];
+}
+
+//mask of the actuators whose active compare registers are the ones of (counts, dir)
+static uint32_t activeMatches(const uint32_t counts[], const uint8_t dir[])
+{
+	uint32_t matches = 0;
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+	{
+		host_tim_state state;
+		hostTimGetState(actuators[a]->htim, &state);
+		uint32_t ch1 = dir[a] ? state.arr : counts[a];
+		uint32_t ch2 = dir[a] ? counts[a] : state.arr;
+		if(activeCcr(&state, actuators[a]->pwm_channel1) == ch1 && activeCcr(&state, actuators[a]->pwm_channel2) == ch2) matches |= 1UL << a;
+	}
+	return matches;
+}
+
+static double coilCurrent;	//A, signed
+
+//lets time pass with the coil driven by the active registers of MagneTorquer1, the current sense
+//code follows the coil current (magnitude)
+static void coilRun(host_time duration, double r, double vdd)
+{
+	double code = 0;
+	for(host_time t = 0; t < duration; t += COIL_STEP)
+	{
+		host_tim_state state;
+		hostTimGetState(MagneTorquer1.htim, &state);
+		uint32_t ch1 = activeCcr(&state, MagneTorquer1.pwm_channel1), ch2 = activeCcr(&state, MagneTorquer1.pwm_channel2);
+		double v = (ch1 == state.arr) ? vdd * ch2 / state.arr : -vdd * ch1 / state.arr;
+		coilCurrent = v / r + (coilCurrent - v / r) * exp(-COIL_STEP * 1e-9 * r / COIL_L);
+		code = fabs(coilCurrent) * Rsense[COIL_DRIVER] * Aipropri * (4095.0 / 3.3);
+		hostAdcSet(&hadc1, ADC_CHANNEL_3, code > 4095 ? 4095 : (uint32_t)(code + 0.5));
+		hostSimAdvance(COIL_STEP);
+	}
+}
+
+//time (ns) until the coil current is within tolerance of current (duration if never)
+static host_time coilSettle(double current, double tolerance, host_time duration, double r, double vdd)
+{
+	host_time t;
+	for(t = 0; t < duration && fabs(coilCurrent - current) > tolerance; t += COIL_STEP) coilRun(COIL_STEP, r, vdd);
+	return t;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t commands = 100000;
+	if(argc > 1) commands = strtoul(argv[1], NULL, 0);
+	if(commands == 0) commands = 1;
+
+	hostSimReset();
+	hostTimInit(&htim1, TIM1, 0, 199);
+	hostTimInit(&htim2, TIM2, 0, 199);
+	hostTimInit(&htim3, TIM3, 0, 199);
+
+	init_actuator_handler(&Reaction1, &htim1, TIM_CHANNEL_1, TIM_CHANNEL_2, 100000, 50);
+	init_actuator_handler(&Reaction2, &htim2, TIM_CHANNEL_3, TIM_CHANNEL_4, 20000, 50);
+	init_actuator_handler(&MagneTorquer1, &htim3, TIM_CHANNEL_1, TIM_CHANNEL_2, 89000, 50);
+	init_actuator_handler(&MagneTorquer2, &htim3, TIM_CHANNEL_3, TIM_CHANNEL_4, 10000, 50);
+	init_actuator_handler(&MagneTorquer3, &htim2, TIM_CHANNEL_1, TIM_CHANNEL_2, 94000, 50);
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++) actuator_START(actuators[a]);
+
+	/* First period: prescaler and duty cycle of the init, loaded when the counters started */
+	uint32_t errors = 0;
+	uint32_t counts[NUM_ACTUATORS];
+	uint8_t dir[NUM_ACTUATORS];
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+	{
+		host_tim_state state;
+		hostTimGetState(actuators[a]->htim, &state);
+		counts[a] = actuators[a]->counts;
+		dir[a] = 1;
+		errors += (state.psc != actuators[a]->htim->Instance->PSC);
+	}
+	errors += (activeMatches(counts, dir) != ALL_ACTUATORS);
+
+	/* Q15 conversion (rounded to the nearest count) */
+	uint32_t arr1 = TIM1->ARR;
+	errors += (actuator_duty_counts(&Reaction1, ACT_DUTY_ONE) != arr1) + (actuator_duty_counts(&Reaction1, -ACT_DUTY_ONE) != arr1) +
+		(actuator_duty_counts(&Reaction1, 0) != 0) + (actuator_duty_counts(&Reaction1, ACT_DUTY_ONE / 2) != (arr1 + 1) / 2) +
+		(actuator_duty_counts(&Reaction1, 4 * ACT_DUTY_ONE) != arr1) + (actuator_duty_counts(&Reaction1, -ACT_DUTY_ONE / 4) != (arr1 + 2) / 4);
+	printf("init: PSC/ARR TIM1 %u/%u TIM2 %u/%u TIM3 %u/%u\n", TIM1->PSC, TIM1->ARR, TIM2->PSC, TIM2->ARR, TIM3->PSC, TIM3->ARR);
+
+	/* Batch command: nothing moves until the update events, then every channel does */
+	hostSimAdvance(3000);	//inside a period of every timer
+	const int32_t duty[NUM_ACTUATORS] = {ACT_DUTY_ONE / 4, -ACT_DUTY_ONE / 2, ACT_DUTY_ONE * 3 / 4, -ACT_DUTY_ONE / 8, ACT_DUTY_ONE};
+	uint32_t newCounts[NUM_ACTUATORS];
+	uint8_t newDir[NUM_ACTUATORS];
+	host_tim_state before[NUM_ACTUATORS];
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++) hostTimGetState(actuators[a]->htim, &before[a]);
+	host_time applyTime = hostSimTime();
+	actuator_apply_all(actuators, duty, NUM_ACTUATORS);
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+	{
+		newCounts[a] = actuator_duty_counts(actuators[a], duty[a]);
+		newDir[a] = (duty[a] >= 0);
+		errors += (actuators[a]->counts != newCounts[a]) + (actuators[a]->dir != newDir[a]);
+	}
+	uint32_t oldActive = activeMatches(counts, dir);
+	uint32_t newActive = activeMatches(newCounts, newDir);
+	errors += (oldActive != ALL_ACTUATORS) + (newActive != 0) + ((actuators[0]->htim->Instance->CR1 & TIM_CR1_UDIS) != 0);
+
+	//each actuator must switch at the first update event of its timer after the command
+	host_time switchTime[NUM_ACTUATORS] = {0}, longest = 0;
+	while(newActive != ALL_ACTUATORS && hostSimTime() < applyTime + 1000000)
+	{
+		hostSimAdvance(SWITCH_STEP);
+		uint32_t active = activeMatches(newCounts, newDir);
+		for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+		{
+			if((active & ~newActive) & (1UL << a)) switchTime[a] = hostSimTime();
+		}
+		newActive |= active;
+	}
+	errors += (newActive != ALL_ACTUATORS);
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+	{
+		host_time period = (host_time)(before[a].psc + 1) * (before[a].arr + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+		host_time update = before[a].lastUpdate + period;	//first update event after the command
+		errors += (switchTime[a] < update) + (switchTime[a] >= update + SWITCH_STEP);
+		if(period > longest) longest = period;
+	}
+	//channels of the same timer switch together
+	errors += (switchTime[1] != switchTime[4]) + (switchTime[2] != switchTime[3]);
+	printf("apply_all: %u/%u actuators on the old command before the update events, switched at "
+		"%.2f %.2f %.2f %.2f %.2f us (longest period %.1f us), errors %u\n", __builtin_popcount(oldActive), NUM_ACTUATORS,
+		(switchTime[0] - applyTime) / 1e3, (switchTime[1] - applyTime) / 1e3, (switchTime[2] - applyTime) / 1e3,
+		(switchTime[3] - applyTime) / 1e3, (switchTime[4] - applyTime) / 1e3, longest / 1e3, errors);
+
+	/* Calls nested in an interrupt (current loop on MagneTorquer3) inside a batch or a frequency
+	 * change of a task on the shared TIM2: the update events stay disabled until the task is done */
+	Actuator_struct *const nested[1] = {&MagneTorquer3};
+	TIM2->CR1 |= TIM_CR1_UDIS;
+	actuator_apply_all(nested, &duty[4], 1);
+	uint32_t nestedErrors = !(TIM2->CR1 & TIM_CR1_UDIS);
+	nestedErrors += update_pwm_Frequency(&Reaction2) + !(TIM2->CR1 & TIM_CR1_UDIS);
+	TIM2->CR1 &= ~TIM_CR1_UDIS;
+	actuator_apply_all(nested, &duty[4], 1);
+	nestedErrors += (TIM2->CR1 & TIM_CR1_UDIS) != 0;
+	printf("nested calls: update events left disabled, errors %u\n", nestedErrors);
+	errors += nestedErrors;
+
+	/* Run-time frequency: MagneTorquer1 to 25 kHz, MagneTorquer2 shares TIM3 and follows */
+	hostSimAdvance(40000);	//inside a TIM3 period
+	host_tim_state tim3Before, tim3;
+	hostTimGetState(&htim3, &tim3Before);
+	float mt1Duty = (float)MagneTorquer1.counts / TIM3->ARR, mt2Duty = (float)MagneTorquer2.counts / TIM3->ARR;
+	host_time freqTime = hostSimTime();
+	uint32_t freqErrors = actuator_set_pwm(&MagneTorquer1, 25000, 0);
+	hostTimGetState(&htim3, &tim3);
+	freqErrors += (tim3.psc != tim3Before.psc) + (tim3.arr != tim3Before.arr) + (tim3.ccr[0] != tim3Before.ccr[0]) + (tim3.ccr[3] != tim3Before.ccr[3]);
+	while(tim3.updates == tim3Before.updates && hostSimTime() < freqTime + 1000000)
+	{
+		hostSimAdvance(SWITCH_STEP);
+		hostTimGetState(&htim3, &tim3);
+	}
+	host_time oldPeriod = (host_time)(tim3Before.psc + 1) * (tim3Before.arr + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+	freqErrors += (tim3.lastUpdate != tim3Before.lastUpdate + oldPeriod);	//the running period ended whole
+	freqErrors += (tim3.psc != 0) + (tim3.arr != 1599) + (MagneTorquer1.Freq != 25000.0f) + (MagneTorquer2.Freq != 25000.0f);
+	//duty cycles and directions kept (within a count of the old period)
+	float mt1After = (float)activeCcr(&tim3, MagneTorquer1.dir ? MagneTorquer1.pwm_channel2 : MagneTorquer1.pwm_channel1) / tim3.arr;
+	float mt2After = (float)activeCcr(&tim3, MagneTorquer2.dir ? MagneTorquer2.pwm_channel2 : MagneTorquer2.pwm_channel1) / tim3.arr;
+	freqErrors += (fabsf(mt1After - mt1Duty) > 1.0f / tim3Before.arr) + (fabsf(mt2After - mt2Duty) > 1.0f / tim3Before.arr);
+	freqErrors += (activeMatches(newCounts, newDir) & ((1UL << 2) | (1UL << 3))) != 0;	//counts rescaled
+	printf("frequency: TIM3 %.0f Hz -> %.0f Hz (PSC %u ARR %u) at the end of the running period, duty %.4f/%.4f -> %.4f/%.4f\n",
+		(double)HOST_TIM_CLOCK / ((tim3Before.psc + 1) * (tim3Before.arr + 1)), MagneTorquer1.Freq, tim3.psc, tim3.arr,
+		mt1Duty, mt2Duty, mt1After, mt2After);
+
+	//best resolution: the largest auto-reload, period within half a prescaled clock of the requested one
+	const uint32_t freqs[] = {4, 50, 1000, 12345, 89000, 200000};
+	for(uint32_t f = 0; f < sizeof(freqs) / sizeof(freqs[0]); f++)
+	{
+		Reaction1.Freq = freqs[f];
+		freqErrors += update_pwm_Frequency(&Reaction1);
+		double clocks = (double)(TIM1->PSC + 1) * (TIM1->ARR + 1);
+		freqErrors += (TIM1->ARR > ACT_ARR_MAX) + (TIM1->PSC != 0 && TIM1->ARR < ACT_ARR_MAX / 2) +
+			(fabs(clocks - (double)ACT_TIM_CLOCK / freqs[f]) > (TIM1->PSC + 1) / 2.0 + 0.5);
+		printf("frequency %u Hz: PSC %u ARR %u, %.3f Hz\n", freqs[f], TIM1->PSC, TIM1->ARR, Reaction1.Freq);
+	}
+	//given resolution, out of range requests
+	freqErrors += actuator_set_pwm(&Reaction1, 20000, 1000) + (TIM1->PSC != 1) + (TIM1->ARR != 999) + (Reaction1.Freq != 20000.0f);
+	freqErrors += (actuator_set_pwm(&Reaction1, 3, 0) != 1) + (actuator_set_pwm(&Reaction1, 1000, 1) != 1) + (actuator_set_pwm(&Reaction1, 250000, 0) != 1);
+
+	//no glitches with preload; an auto-reload written without it below the counter is one
+	uint32_t glitches = 0;
+	for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+	{
+		host_tim_state state;
+		hostTimGetState(actuators[a]->htim, &state);
+		glitches += state.glitches;
+	}
+	hostSimAdvance(100000);
+	host_tim_state tim1;
+	hostTimGetState(&htim1, &tim1);
+	host_time tim1Period = (host_time)(tim1.psc + 1) * (tim1.arr + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+	hostSimAdvance(tim1.lastUpdate + tim1Period + 30000 - hostSimTime());	//counter at 600 of 999
+	TIM1->CR1 &= ~TIM_CR1_ARPE;
+	TIM1->ARR = 199;
+	hostSimAdvance(1000);
+	hostTimGetState(&htim1, &tim1);
+	freqErrors += (glitches != 0) + (tim1.glitches != 1);
+	TIM1->CR1 |= TIM_CR1_ARPE;
+	printf("frequency changes: glitches %u, %u with an auto-reload written without preload, errors %u\n", glitches, tim1.glitches, freqErrors);
+	errors += freqErrors;
+
+	/* Dipole of MagneTorquer1: commanded against the average of the active duty cycles */
+	const struct { const char* name; uint32_t resolution; bool dither; } modes[] = {
+		{"CubeMX", 200, false}, {"best", 0, false}, {"best+dither", 0, true}
+	};
+	double maxError[3], rmsError[3];
+	uint32_t dipoleErrors = 0, modeArr[3];
+	for(uint32_t m = 0; m < 3; m++)
+	{
+		dipoleErrors += actuator_set_pwm(&MagneTorquer1, DIPOLE_FREQ, modes[m].resolution);
+		actuator_set_dither(&MagneTorquer1, modes[m].dither);
+		modeArr[m] = TIM3->ARR;
+		host_time period = (host_time)(TIM3->PSC + 1) * (TIM3->ARR + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+		hostSimAdvance(period);	//new prescaler and auto-reload active
+		maxError[m] = 0;
+		rmsError[m] = 0;
+		for(uint32_t c = 0; c < DIPOLE_COMMANDS; c++)
+		{
+			double dipole = MT_DIPOLE_MAX * (2.0 * (c + 0.37) / DIPOLE_COMMANDS - 1.0);
+			int32_t duty = (int32_t)lround(dipole / MT_DIPOLE_MAX * ACT_DUTY_ONE);
+			double achieved = 0;
+			for(uint32_t p = 0; p < DIPOLE_PERIODS; p++)
+			{
+				//the command of every period, active in the next one
+				actuator_set_duty_q15(&MagneTorquer1, duty);
+				hostSimAdvance(period);
+				host_tim_state state;
+				hostTimGetState(&htim3, &state);
+				uint32_t ccr = activeCcr(&state, duty >= 0 ? MagneTorquer1.pwm_channel2 : MagneTorquer1.pwm_channel1);
+				achieved += (duty >= 0 ? 1.0 : -1.0) * ccr / state.arr;
+			}
+			double error = fabs(achieved / DIPOLE_PERIODS * MT_DIPOLE_MAX - dipole);
+			if(error > maxError[m]) maxError[m] = error;
+			rmsError[m] += error * error;
+		}
+		rmsError[m] = sqrt(rmsError[m] / DIPOLE_COMMANDS);
+		//half a count (rounded) or a count over the periods (dithered), plus the Q15 rounding of the command
+		double bound = MT_DIPOLE_MAX * ((modes[m].dither ? 1.0 / DIPOLE_PERIODS : 0.5) / modeArr[m] + 0.5 / ACT_DUTY_ONE) * 1.0001;
+		dipoleErrors += (maxError[m] > bound);
+		printf("dipole %s: %u counts, max error %.3e A*m^2 (%.4f%%), rms %.3e A*m^2\n", modes[m].name, modeArr[m] + 1,
+			maxError[m], maxError[m] / MT_DIPOLE_MAX * 100, rmsError[m]);
+	}
+	actuator_set_dither(&MagneTorquer1, false);
+	dipoleErrors += (modeArr[0] != 199) + (modeArr[1] != ACT_TIM_CLOCK / DIPOLE_FREQ - 1) + !(maxError[2] < maxError[1] && maxError[1] < maxError[0]);
+	printf("dipole of MagneTorquer1 at %u Hz (max %.4f A*m^2, %u commands over %u periods each), errors %u\n",
+		DIPOLE_FREQ, MT_DIPOLE_MAX, DIPOLE_COMMANDS, DIPOLE_PERIODS, dipoleErrors);
+	errors += dipoleErrors;
+
+	/* Current loop of MagneTorquer1 on an emulated coil */
+	hostAdcInit(&hadc1, ADC1, LOOP_SCAN_TIME);
+	uint32_t loopErrors = actuator_scan_start(&hadc1, &htim1) + actuator_current_loop_start(COIL_DRIVER, &MagneTorquer1, 0, 0);
+	double codeCurrent = 1.0 / (Rsense[COIL_DRIVER] * Aipropri * (4095.0 / 3.3));	//A per code
+	double r = COIL_R, vdd = 12.0;
+	act_loop_state loop;
+	//0.2 A on the cold coil at 12 V
+	host_time loopStart = hostSimTime();
+	loopErrors += actuator_current_setpoint(COIL_DRIVER, 0.2f);
+	host_time coldSettle = coilSettle(0.2, 0.002, 50000000, r, vdd);
+	coilRun(20000000, r, vdd);
+	actuator_current_loop_read(COIL_DRIVER, &loop);
+	double coldDuty = (double)loop.duty / ACT_DUTY_ONE, coldError = fabs(coilCurrent - 0.2);
+	loopErrors += (coldSettle >= 50000000) + (coldError > 2 * codeCurrent);
+	printf("current loop: %.0f scans/s, 0.2 A (setpoint code %d) in %.2f ms, error %.3f mA, duty %.4f\n",
+		loop.runs * 1e9 / (hostSimTime() - loopStart), loop.setpoint, coldSettle / 1e6, coldError * 1e3, coldDuty);
+	//coil 75 degrees warmer (copper +0.39%/degree) and bus at 10 V: the open loop duty gives less current
+	r = COIL_R * (1 + 0.0039 * 75);
+	vdd = 10.0;
+	double openLoopError = fabs(coldDuty * vdd / r - 0.2);
+	host_time settle = coilSettle(0.2, 0.002, 50000000, r, vdd);
+	coilRun(20000000, r, vdd);
+	actuator_current_loop_read(COIL_DRIVER, &loop);
+	double hotError = fabs(coilCurrent - 0.2);
+	loopErrors += (settle >= 50000000) + (hotError > 2 * codeCurrent);
+	printf("current loop: hot coil (%.1f Ohm) at %.0f V, error %.3f mA (open loop %.1f mA), duty %.4f\n",
+		r, vdd, hotError * 1e3, openLoopError * 1e3, (double)loop.duty / ACT_DUTY_ONE);
+	//above the current the supply can give: saturated, then back without windup
+	uint32_t saturatedBefore = loop.saturated;
+	loopErrors += actuator_current_setpoint(COIL_DRIVER, 0.5f);
+	coilRun(50000000, r, vdd);
+	actuator_current_loop_read(COIL_DRIVER, &loop);
+	uint32_t saturated = loop.saturated - saturatedBefore;
+	loopErrors += (loop.duty != ACT_DUTY_ONE) + (saturated == 0);
+	loopErrors += actuator_current_setpoint(COIL_DRIVER, 0.1f);
+	host_time recovery = coilSettle(0.1, 0.002, 50000000, r, vdd);
+	loopErrors += (recovery > 2 * coldSettle);	//as fast as a step from 0, nothing to unwind
+	//reverse direction
+	loopErrors += actuator_current_setpoint(COIL_DRIVER, -0.1f);
+	host_time reverse = coilSettle(-0.1, 0.002, 50000000, r, vdd);
+	coilRun(20000000, r, vdd);
+	actuator_current_loop_read(COIL_DRIVER, &loop);
+	loopErrors += (reverse >= 50000000) + (fabs(coilCurrent + 0.1) > 2 * codeCurrent) + (loop.duty >= 0) + MagneTorquer1.dir;
+	printf("current loop: 0.5 A saturated for %u scans, back to 0.1 A in %.2f ms, to -0.1 A in %.2f ms (%.3f A)\n",
+		saturated, recovery / 1e6, reverse / 1e6, coilCurrent);
+	actuator_current_loop_stop(COIL_DRIVER);
+	actuator_scan_stop(&hadc1);
+	loopErrors += (MagneTorquer1.counts != 0) + (actuator_current_setpoint(COIL_DRIVER, 0.1f) != 1) + (actuator_current_loop_start(1, &Reaction2, 0, 0) != 1);
+	printf("current loop: errors %u\n", loopErrors);
+	errors += loopErrors;
+
+	/* CPU time of a command of the five actuators */
+	struct timespec wallStart, wallEnd;
+	int32_t sweep[NUM_ACTUATORS];
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	for(uint32_t c = 0; c < commands; c++)
+	{
+		for(uint32_t a = 0; a < NUM_ACTUATORS; a++) sweep[a] = (int32_t)((c * 37 + a * 5000) % (2 * ACT_DUTY_ONE)) - ACT_DUTY_ONE;
+		actuator_apply_all(actuators, sweep, NUM_ACTUATORS);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	double batchNs = elapsedMs(&wallStart, &wallEnd) * 1e6 / commands;
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	for(uint32_t c = 0; c < commands; c++)
+	{
+		for(uint32_t a = 0; a < NUM_ACTUATORS; a++)
+		{
+			float percent = ((int32_t)((c * 37 + a * 5000) % (2 * ACT_DUTY_ONE)) - ACT_DUTY_ONE) * (100.0f / ACT_DUTY_ONE);
+			update_duty_dir(actuators[a], percent, percent >= 0);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	double floatNs = elapsedMs(&wallStart, &wallEnd) * 1e6 / commands;
+	printf("command of %u actuators: actuator_apply_all %.1f ns, update_duty_dir %.1f ns\n", NUM_ACTUATORS, batchNs, floatNs);
+
+	return errors != 0;
+}
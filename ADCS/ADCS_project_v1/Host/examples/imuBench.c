@@ -0,0 +1,548 @@
+/**
+ * @file imuBench.c
+ * @brief IMU traffic replayed through UARTdriver and MTi1 on the host
+ *
+ * The IMU line (UART4, 115200 baud, as on the board) is simulated with hostSim.h:
+ *  ____________                              ____________
+ * |            |---commands (tx hook)------>|            |
+ * | UARTdriver |                            | emulated   |
+ * | + MTi1     |<--acks and MTData2---------| MTi        |
+ * |____________|     (rx line)              |____________|
+ *
+ * The emulated MTi boots (WakeUp message, measurement mode if not acknowledged in 500 ms),
+ * answers the commands sent by initIMUProfile() in config mode (baud rate change and reset
+ * included) and streams MTData2 packets in measurement mode, with the outputs it was configured
+ * with (each at its own rate, plus a temperature output that the decoder must skip).
+ * It can start as a new device (115200 baud, no outputs), powered up with the MCU with the
+ * configuration of the profile kept from a previous run (cold), or already measuring (warm,
+ * only the MCU restarted). The IMU line can be captured (startIMUCapture()) and the capture
+ * ring written to a file, to be replayed with imuReplay.
+ * acquireIMUSamples() is called in a loop as the IMU task does, until the traffic ends, one
+ * consumer reads every sample through a cursor of the sample ring and another one reads the
+ * samples decimated to 50 Hz.
+ *
+ * usage: imuBench [it|dma] [packets] [rate (Hz)] [new|cold|warm] [capture output file]
+ * it: per byte interrupt mode, dma: circular DMA rx + DMA tx (default)
+ * rate: profile rate (100, 200 or 400 Hz, default 100), 100q or 200q for the orientation profiles
+ * new|cold|warm: MTi state at start (default cold)
+ *
+ * At the end the bring-up time, the decoded packets, the simulated and the wall clock time and
+ * the driver counters are printed, so that modes and code changes can be compared (also under
+ * valgrind --tool=callgrind or perf, the simulation is deterministic). The xbus decoder is also
+ * checked on false headers with extended lengths no message can have.
+ */
+
+#include "hostSim.h"
+#include "UARTdriver.h"
+#include "MTi1.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IMU_PREAMBLE 0xfa
+#define IMU_BID 0xff
+#define IMU_DATA_MID 0x36
+#define IMU_GOTO_CONFIG_MID 0x30
+#define IMU_GOTO_MEAS_MID 0x10
+#define IMU_SET_OCONFIG_MID 0xC0
+#define IMU_SET_BAUD_MID 0x18
+#define IMU_RESET_MID 0x40
+#define IMU_WAKEUP_MID 0x3E
+#define IMU_WAKEUP_ACK_MID 0x3F
+#define IMU_REPLY_DELAY 1000000ULL	//ns between a command and its ack
+#define IMU_BOOT_TIME 150000000ULL	//ns between power up (or reset) and the WakeUp message
+#define IMU_WAKEUP_TIME 500000000ULL	//ns given to acknowledge WakeUp
+#define IMU_MAX_OUTPUTS 16
+#define IMU_DECIMATED_RATE 50
+#define XDI_TEMPERATURE 0x0810
+
+//emulated MTi state
+typedef enum{
+	imu_booting,	//commands are ignored
+	imu_wakeup,		//WakeUp sent, waiting for WakeUpAck
+	imu_config,
+	imu_measurement
+} imu_state;
+
+static imu_state state = imu_booting;
+//command parser state
+static uint8_t cmdBuff[260];
+static uint32_t cmdLen = 0;
+//output configuration (data identifiers and rates)
+static uint16_t outputs[IMU_MAX_OUTPUTS];
+static uint16_t outputRates[IMU_MAX_OUTPUTS];
+static uint32_t outputNum = 0;
+//baud rate of the MTi, and the one set by SetBaudrate (applied at reset)
+static uint32_t imuBaud = 115200;
+static uint32_t imuNextBaud = 115200;
+static uint32_t baudMismatches = 0;
+//streaming: packets to send, packets sent (also the packet number k), current stream
+static uint32_t packets = 1000;
+static uint32_t sent = 0;
+static uintptr_t streamId = 0;
+
+//build an xbus message in (buff), returns its length
+static uint32_t buildMsg(uint8_t* buff, uint8_t mid, const uint8_t* data, uint8_t len)
+{
+	uint8_t crc = IMU_BID + mid + len;
+	buff[0] = IMU_PREAMBLE;
+	buff[1] = IMU_BID;
+	buff[2] = mid;
+	buff[3] = len;
+	for(uint32_t d = 0; d < len; d++)
+	{
+		buff[4 + d] = data[d];
+		crc += data[d];
+	}
+	buff[4 + len] = -crc;
+	return 5 + len;
+}
+
+//SetBaudrate code to baud rate (0 if unknown)
+static uint32_t baudFromCode(uint8_t code)
+{
+	switch(code)
+	{
+	case 0x80: return 921600;
+	case 0x00: return 460800;
+	case 0x01: return 230400;
+	case 0x02: return 115200;
+	default: return 0;
+	}
+}
+
+//the MTi sends (len) bytes, lost if the uart is not at the MTi rate
+static void imuSend(const uint8_t* data, uint32_t len, host_time gap)
+{
+	if(huart4.Init.BaudRate != imuBaud)
+	{
+		baudMismatches++;
+		return;
+	}
+	hostUartRxPush(&huart4, data, len, gap);
+}
+
+//big endian float
+static void putFloat(uint8_t* buff, float value)
+{
+	uint32_t raw;
+	memcpy(&raw, &value, sizeof(raw));
+	for(uint32_t b = 0; b < 4; b++) buff[b] = (uint8_t)(raw >> (8 * (3 - b)));
+}
+
+//append an MTData2 entry, returns the new data length
+static uint32_t putEntry(uint8_t* data, uint32_t pos, uint16_t xdi, const float* values, uint32_t num)
+{
+	data[pos++] = xdi >> 8;
+	data[pos++] = xdi & 0xff;
+	data[pos++] = num * 4;
+	for(uint32_t v = 0; v < num; v++, pos += 4) putFloat(&data[pos], values[v]);
+	return pos;
+}
+
+//highest configured output rate
+static uint32_t maxOutputRate(void)
+{
+	uint32_t max = 1;
+	for(uint32_t o = 0; o < outputNum; o++)
+	{
+		if(outputRates[o] != 0xFFFF && outputRates[o] > max) max = outputRates[o];
+	}
+	return max;
+}
+
+//MTData2 packet number (k) with the configured outputs (unknown ones are left out), each output
+//is in one packet every (highest rate/output rate):
+//gyro {k, k+0.5, -k}, mag {k/2, 1, 2}, acc {0, 0, 9.81}, quaternion {1, 0, 0, 0}, free acc {0, 0, k/4},
+//sample time fine and status word k (as integers), then a temperature entry
+static uint32_t buildDataPacket(uint8_t* buff, uint32_t k)
+{
+	uint8_t data[255];
+	uint32_t len = 0;
+	const float gyro[3] = {(float)k, (float)k + 0.5f, -(float)k};
+	const float mag[3] = {(float)k / 2.0f, 1.0f, 2.0f};
+	const float acc[3] = {0.0f, 0.0f, 9.81f};
+	const float quat[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+	const float freeAcc[3] = {0.0f, 0.0f, (float)k / 4.0f};
+	const float temp = 25.0f;
+
+	for(uint32_t o = 0; o < outputNum && len < sizeof(data) - 16; o++)
+	{
+		if(outputRates[o] != 0xFFFF && outputRates[o] != 0 && k % (maxOutputRate() / outputRates[o]) != 0) continue;
+		switch(outputs[o] & XDI_TYPE_MASK)
+		{
+		case XDI_RATE_OF_TURN: len = putEntry(data, len, outputs[o], gyro, 3); break;
+		case XDI_MAGNETIC_FIELD: len = putEntry(data, len, outputs[o], mag, 3); break;
+		case XDI_ACCELERATION: len = putEntry(data, len, outputs[o], acc, 3); break;
+		case XDI_QUATERNION: len = putEntry(data, len, outputs[o], quat, 4); break;
+		case XDI_FREE_ACCELERATION: len = putEntry(data, len, outputs[o], freeAcc, 3); break;
+		case XDI_SAMPLE_TIME_FINE:
+		case XDI_STATUS_WORD:
+			data[len++] = outputs[o] >> 8;
+			data[len++] = outputs[o] & 0xff;
+			data[len++] = 4;
+			for(uint32_t b = 0; b < 4; b++) data[len++] = (uint8_t)(k >> (8 * (3 - b)));
+			break;
+		default: break;
+		}
+	}
+	len = putEntry(data, len, XDI_TEMPERATURE, &temp, 1);
+	return buildMsg(buff, IMU_DATA_MID, data, len);
+}
+
+//measurement mode: one packet per period of the highest output rate, until all are sent
+//(ctx is the stream the action belongs to, actions of a stopped stream do nothing)
+static void imuStream(void* ctx)
+{
+	if((uintptr_t)ctx != streamId || state != imu_measurement || sent == packets) return;
+
+	uint8_t pckt[260];
+	uint32_t pcktLen = buildDataPacket(pckt, sent++);
+	imuSend(pckt, pcktLen, 0);
+	hostSimSchedule(1000000000ULL / maxOutputRate(), imuStream, ctx);
+}
+
+static void imuStartMeasurement(void)
+{
+	state = imu_measurement;
+	streamId++;
+	hostSimSchedule(1000000000ULL / maxOutputRate(), imuStream, (void*)streamId);
+}
+
+//WakeUp not acknowledged in time: measurement mode
+static void imuWakeUpTimeout(void* ctx)
+{
+	if(state == imu_wakeup) imuStartMeasurement();
+}
+
+//end of the boot: WakeUp message
+static void imuWakeUp(void* ctx)
+{
+	uint8_t msg[5];
+	uint32_t msgLen = buildMsg(msg, IMU_WAKEUP_MID, NULL, 0);
+	state = imu_wakeup;
+	imuSend(msg, msgLen, 0);
+	hostSimSchedule(IMU_WAKEUP_TIME, imuWakeUpTimeout, NULL);
+}
+
+//power up or reset, the baud rate set by SetBaudrate is applied
+static void imuBoot(void)
+{
+	state = imu_booting;
+	imuBaud = imuNextBaud;
+	hostSimSchedule(IMU_BOOT_TIME, imuWakeUp, NULL);
+}
+
+//emulated MTi: parse the commands sent by the driver and acknowledge them (MID+1)
+//commands sent at another rate or not accepted in the current state are lost
+static void imuTxHook(UART_HandleTypeDef* huart, const uint8_t* data, uint32_t len)
+{
+	if(huart->Init.BaudRate != imuBaud)
+	{
+		baudMismatches++;
+		return;
+	}
+
+	for(uint32_t b = 0; b < len; b++)
+	{
+		if(cmdLen == 0 && data[b] != IMU_PREAMBLE) continue;
+		cmdBuff[cmdLen++] = data[b];
+		if(cmdLen < 4 || cmdLen != 5U + cmdBuff[3]) continue;
+		cmdLen = 0;
+
+		uint8_t mid = cmdBuff[2];
+		uint8_t ack[260];
+		uint8_t ackData[4 * IMU_MAX_OUTPUTS];
+		uint8_t ackLen = 0;
+
+		if(state == imu_booting) continue;
+		if(state == imu_wakeup && mid != IMU_WAKEUP_ACK_MID && mid != IMU_GOTO_CONFIG_MID) continue;
+		if(state == imu_measurement && mid != IMU_GOTO_CONFIG_MID && mid != IMU_RESET_MID) continue;
+
+		switch(mid)
+		{
+		case IMU_WAKEUP_ACK_MID:
+			if(state == imu_wakeup) state = imu_config;
+			continue;	//not acknowledged
+		case IMU_GOTO_CONFIG_MID:
+			state = imu_config;
+			break;
+		case IMU_GOTO_MEAS_MID:
+			imuStartMeasurement();
+			break;
+		case IMU_SET_OCONFIG_MID:
+			if(cmdBuff[3] != 0)
+			{
+				//{XDI, rate} couples
+				outputNum = 0;
+				for(uint32_t o = 0; o + 4 <= cmdBuff[3] && outputNum < IMU_MAX_OUTPUTS; o += 4)
+				{
+					outputs[outputNum] = (cmdBuff[4 + o] << 8) | cmdBuff[5 + o];
+					outputRates[outputNum++] = (cmdBuff[6 + o] << 8) | cmdBuff[7 + o];
+				}
+			}
+			//the (new) configuration is sent back
+			for(uint32_t o = 0; o < outputNum; o++)
+			{
+				ackData[ackLen++] = outputs[o] >> 8;
+				ackData[ackLen++] = outputs[o] & 0xff;
+				ackData[ackLen++] = outputRates[o] >> 8;
+				ackData[ackLen++] = outputRates[o] & 0xff;
+			}
+			break;
+		case IMU_SET_BAUD_MID:
+			if(cmdBuff[3] == 1 && baudFromCode(cmdBuff[4]) != 0) imuNextBaud = baudFromCode(cmdBuff[4]);
+			break;
+		default:
+			break;
+		}
+
+		uint32_t msgLen = buildMsg(ack, mid + 1, ackData, ackLen);
+		imuSend(ack, msgLen, IMU_REPLY_DELAY);
+		if(mid == IMU_RESET_MID) imuBoot();
+	}
+}
+
+//configuration of a profile as MTi1.c writes it
+static void setProfileOutputs(uint16_t rate, uint8_t orientation)
+{
+	const uint16_t config[6][2] = {
+		{XDI_SAMPLE_TIME_FINE, 0xFFFF},
+		{XDI_RATE_OF_TURN, rate},
+		{XDI_MAGNETIC_FIELD, (rate < IMU_MAG_MAX_RATE) ? rate : IMU_MAG_MAX_RATE},
+		{XDI_ACCELERATION, rate},
+		{XDI_QUATERNION, rate},
+		{XDI_FREE_ACCELERATION, rate},
+	};
+	for(outputNum = 0; outputNum < (orientation ? 6U : 4U); outputNum++)
+	{
+		outputs[outputNum] = config[outputNum][0];
+		outputRates[outputNum] = config[outputNum][1];
+	}
+}
+
+//counts the messages with the data written by buildMsg() in checkFalseHeaders()
+static uint8_t countMsg(void* ctx, uint8_t mid, const uint8_t* data, uint16_t len)
+{
+	static const uint8_t expected[4] = {1, 2, 3, 4};
+	if((mid == IMU_DATA_MID && len == 4 && memcmp(data, expected, 4) == 0) || (mid == 0x30 && len == 0)) (*(uint32_t*)ctx)++;
+	return 0;
+}
+
+//false headers in the stream: extended lengths no message can have, rejected at the length, and a
+//plausible length whose checksum fails after swallowing real messages; the messages starting inside
+//them are decoded, with the stream in one chunk and byte by byte
+static uint32_t checkFalseHeaders(void)
+{
+	static uint8_t buff[XBUS_FRAME_LEN(IMU_MSG_MAX_LEN)];
+	const uint8_t data[4] = {1, 2, 3, 4};
+	uint8_t stream[64] = {IMU_PREAMBLE, IMU_BID, IMU_DATA_MID, XBUS_EXTLEN, 0xFF, 0xFF};
+	uint32_t len = 6;
+	len += buildMsg(&stream[len], IMU_DATA_MID, data, sizeof(data));
+	stream[len++] = IMU_PREAMBLE;	//preamble, bid, then a real message read as mid and length 0x3000
+	stream[len++] = IMU_BID;
+	len += buildMsg(&stream[len], 0x30, NULL, 0);
+	stream[len++] = IMU_PREAMBLE;	//length 20: two messages and the start of a third swallowed
+	stream[len++] = IMU_BID;
+	stream[len++] = IMU_DATA_MID;
+	stream[len++] = 20;
+	for(uint32_t m = 0; m < 3; m++) len += buildMsg(&stream[len], IMU_DATA_MID, data, sizeof(data));
+
+	uint32_t errors = 0;
+	for(uint32_t chunk = 1; chunk <= len; chunk += len - 1)
+	{
+		xbus_decoder dec;
+		uint32_t found = 0;
+		xbusInit(&dec, buff, sizeof(buff), countMsg, &found);
+		for(uint32_t b = 0; b < len; b += chunk) xbusDecode(&dec, &stream[b], (len - b < chunk) ? len - b : chunk);
+		errors += (dec.msgCount != 5) + (found != 5) + (dec.lengthErrors != 2) + (dec.checksumErrors != 1);
+	}
+	printf("xbus false headers: errors %u\n", errors);
+	return errors;
+}
+
+static double elapsedMs(struct timespec* start, struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+	uint8_t dma = 1;
+	uint32_t rate = 100;
+	uint8_t orientation = 0;
+	const char* start = "cold";
+	FILE* capture = NULL;
+
+	if(argc > 1) dma = (strcmp(argv[1], "it") != 0);
+	if(argc > 2) packets = strtoul(argv[2], NULL, 0);
+	if(argc > 3)
+	{
+		char* end;
+		rate = strtoul(argv[3], &end, 0);
+		orientation = (*end == 'q');
+	}
+	if(argc > 4) start = argv[4];
+	if(argc > 5)
+	{
+		capture = fopen(argv[5], "wb");
+		if(capture == NULL)
+		{
+			printf("Cannot open %s\n", argv[5]);
+			return 1;
+		}
+	}
+
+	imu_profile profile = imu_profile_100hz;
+	uint32_t profileBaud = 115200;
+	if(orientation && rate == 200)
+	{
+		profile = imu_profile_200hz_orientation;
+		profileBaud = 460800;
+	}
+	else if(orientation)
+	{
+		profile = imu_profile_100hz_orientation;
+		profileBaud = 230400;
+		rate = 100;
+	}
+	else if(rate == 200)
+	{
+		profile = imu_profile_200hz;
+		profileBaud = 230400;
+	}
+	else if(rate == 400)
+	{
+		profile = imu_profile_400hz;
+		profileBaud = 460800;
+	}
+	else
+	{
+		rate = 100;
+	}
+
+	hostSimReset();
+	hostUartInit(&huart4, UART4, UART4_IRQn, 115200, dma, dma);
+	hostUartSetTxHook(&huart4, imuTxHook);
+	initDriver_UART();
+	addDriver_UART(&huart4, UART4_IRQn, keep_new);
+
+	//MTi at start: new, powered up with the MCU (configuration kept), already measuring
+	if(strcmp(start, "new") != 0)
+	{
+		imuNextBaud = profileBaud;
+		setProfileOutputs(rate, orientation);
+	}
+	if(strcmp(start, "warm") == 0)
+	{
+		imuBaud = profileBaud;
+		imuStartMeasurement();
+	}
+	else
+	{
+		imuBoot();
+	}
+
+	imu_sample_cursor cursor;
+	imu_sample samples[IMU_SAMPLE_RING_LEN];
+	initIMUCursor(&cursor);
+
+	struct timespec wallStart, wallEnd;
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+	if(!initIMUProfile(&huart4, profile))
+	{
+		printf("IMU configuration failed\n");
+		return 1;
+	}
+	host_time simStart = hostSimTime();
+	printf("start: %s, configured in %.3f s, %u Hz at %u baud\n", start, simStart / 1e9, getIMURate(), huart4.Init.BaudRate);
+	if(capture != NULL) startIMUCapture();
+
+	uint32_t decoded = 0, errors = 0, lastK = 0, firstTick = 0;
+	imu_decimator decimator;
+	imu_sample average;
+	uint32_t averaged = 0;
+	initIMUDecimator(&decimator, IMU_DECIMATED_RATE);
+	//another notification of the task (as the NTC sweep one of the check task) left pending
+	//across every wait: the uart wait must not consume it
+	uint32_t otherNotifications = 0;
+
+	for(;;)
+	{
+		xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+		otherNotifications++;
+		if(acquireIMUSamples(&huart4, 100))
+		{
+			uint32_t num = readIMUSamples(&cursor, samples, IMU_SAMPLE_RING_LEN);
+			for(uint32_t n = 0; n < num; n++)
+			{
+				if(decoded++ == 0) firstTick = samples[n].tick;
+				//check the decoded values and the ordering
+				const mtdata2_sample* d = &samples[n].data;
+				uint32_t k = d->sampleTimeFine;
+				if(!(d->fields & MTDATA2_SAMPLE_TIME_FINE) || d->rateOfTurn[0] != (float)k
+					|| d->rateOfTurn[1] != (float)k + 0.5f || d->rateOfTurn[2] != -(float)k
+					|| ((d->fields & MTDATA2_MAGNETIC_FIELD) && d->magneticField[0] != (float)k / 2.0f)
+					|| d->acceleration[2] != 9.81f
+					|| (orientation && (d->fields & (MTDATA2_QUATERNION | MTDATA2_FREE_ACCELERATION))
+						!= (MTDATA2_QUATERNION | MTDATA2_FREE_ACCELERATION))
+					|| ((d->fields & MTDATA2_QUATERNION) && d->quaternion[0] != 1.0f)
+					|| ((d->fields & MTDATA2_FREE_ACCELERATION) && d->freeAcceleration[2] != (float)k / 4.0f)
+					|| (decoded > 1 && k != lastK + 1)) errors++;
+				lastK = k;
+			}
+
+			//decimated consumer: the average of the rate of turn x of k-factor+1..k is k-(factor-1)/2
+			while(readIMUDecimated(&decimator, &average))
+			{
+				averaged++;
+				uint32_t k = average.data.sampleTimeFine;
+				if(decimator.cursor.dropped == 0
+					&& average.data.rateOfTurn[0] != (float)k - (decimator.factor - 1) / 2.0f) errors++;
+			}
+		}
+		else if(hostUartRxPending(&huart4) == 0 && (sent == packets || state != imu_measurement))
+		{
+			break;	//traffic ended
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	uint32_t otherPending = ulTaskNotifyTake(pdTRUE, 0) & ~UART_NOTIFY_RX_BIT;
+	//capture ring (the last IMU_CAPTURE_LEN bytes at most) to file
+	if(capture != NULL)
+	{
+		uint8_t chunk[256];
+		uint32_t captured = getIMUCaptureLen(), len;
+		for(uint32_t offset = 0; (len = readIMUCapture(offset, chunk, sizeof(chunk))) != 0; offset += len)
+		{
+			fwrite(chunk, 1, len, capture);
+		}
+		fclose(capture);
+		printf("capture: %u bytes written to %s\n", captured, argv[5]);
+	}
+
+	uart_stats stats;
+	host_uart_stats line;
+	getStatsDriver_UART(&huart4, &stats);
+	hostUartGetStats(&huart4, &line);
+	double wall = elapsedMs(&wallStart, &wallEnd);
+
+	printf("mode: %s, first sample at %u ms\n", dma ? "dma" : "it", firstTick);
+	printf("packets sent: %u, decoded: %u, errors: %u\n", sent, decoded, errors);
+	printf("simulated time: %.3f s, wall time: %.3f ms (%.3f us per packet)\n",
+		(hostSimTime() - simStart) / 1e9, wall, decoded ? wall * 1e3 / decoded : 0.0);
+	printf("driver: rxBytes %u rxEvents %u rxDropped %u rxHighWater %u txBytes %u txEvents %u\n",
+		stats.rxBytes, stats.rxEvents, stats.rxDropped, stats.rxHighWater, stats.txBytes, stats.txEvents);
+	printf("line: rxBytes %u rxOverruns %u interrupts %u\n", line.rxBytes, line.rxOverruns, line.irqs);
+	printf("ring: samples %u dropped %u, decimated (x%u) %u dropped %u\n", decoded, cursor.dropped,
+		decimator.factor, averaged, decimator.cursor.dropped);
+	printf("other task notifications: %u given, %u pending\n", otherNotifications, otherPending);
+	if(otherPending != otherNotifications) errors++;
+	if(baudMismatches != 0) printf("bytes lost for baud rate mismatch: %u times\n", baudMismatches);
+	errors += checkFalseHeaders();
+
+	return errors != 0 || decoded != sent;
+}
@@ -0,0 +1,170 @@
+/**
+ * @file imuReplay.c
+ * @brief Raw IMU captures replayed through UARTdriver and the MTi1 decoder on the host
+ *
+ * A capture file, made of the records of the MTi1.c capture ring (| TICK | LEN | LEN bytes |,
+ * see startIMUCapture(), dumped over sdl by the imuCaptureCmdADCS command or written by imuBench),
+ * is pushed on the simulated UART4 line and acquired with acquireIMUSamples() as the IMU task
+ * does. Each chunk ends on the line at its recorded tick (divided by the speed), or the chunks are
+ * sent back to back at line rate.
+ *
+ * usage: imuReplay <capture file> [speed] [baud] [it|dma]
+ * speed: 1 recorded timing (default), n n times faster, 0 back to back at line rate
+ * baud: line baud rate, the one of the profile used for the capture (default 115200)
+ * it: per byte interrupt mode, dma: circular DMA rx + DMA tx (default)
+ *
+ * At the end the samples decoded, the samples per second (simulated and wall clock), the CPU time
+ * per sample and the decoder errors (checksum, length, malformed packets) are printed, so that
+ * decoder changes can be compared on real traffic (CPU time includes the simulation, which is the
+ * same for two builds replaying the same file; use valgrind --tool=callgrind for instruction
+ * counts of MTi1.c and xbus.c alone).
+ */
+
+#include "hostSim.h"
+#include "UARTdriver.h"
+#include "MTi1.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORD_HEADER_LEN 6	//tick (4 bytes) and length (2 bytes), little endian
+
+static double elapsedMs(struct timespec* start, struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static uint32_t recordTick(const uint8_t* record)
+{
+	return record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+}
+
+static uint32_t recordLen(const uint8_t* record)
+{
+	return record[4] | (record[5] << 8);
+}
+
+int main(int argc, char** argv)
+{
+	double speed = 1;
+	uint32_t baud = 115200;
+	uint8_t dma = 1;
+
+	if(argc < 2)
+	{
+		printf("usage: imuReplay <capture file> [speed] [baud] [it|dma]\n");
+		return 1;
+	}
+	if(argc > 2) speed = strtod(argv[2], NULL);
+	if(argc > 3) baud = strtoul(argv[3], NULL, 0);
+	if(argc > 4) dma = (strcmp(argv[4], "it") != 0);
+
+	//whole capture in memory
+	FILE* file = fopen(argv[1], "rb");
+	if(file == NULL)
+	{
+		printf("Cannot open %s\n", argv[1]);
+		return 1;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t* capture = malloc(size > 0 ? size : 1);
+	if(capture == NULL || fread(capture, 1, size, file) != (size_t)size)
+	{
+		printf("Cannot read %s\n", argv[1]);
+		return 1;
+	}
+	fclose(file);
+
+	//checking the records (a truncated last one is left out)
+	uint32_t records = 0, bytes = 0, end = 0, lastTick = 0;
+	while(end + RECORD_HEADER_LEN <= (uint32_t)size && end + RECORD_HEADER_LEN + recordLen(&capture[end]) <= (uint32_t)size)
+	{
+		lastTick = recordTick(&capture[end]);
+		bytes += recordLen(&capture[end]);
+		end += RECORD_HEADER_LEN + recordLen(&capture[end]);
+		records++;
+	}
+	if(records == 0)
+	{
+		printf("No records in %s\n", argv[1]);
+		return 1;
+	}
+	uint32_t firstTick = recordTick(capture);
+
+	hostSimReset();
+	hostUartInit(&huart4, UART4, UART4_IRQn, baud, dma, dma);
+	initDriver_UART();
+	addDriver_UART(&huart4, UART4_IRQn, keep_new);
+	initIMUDecoder();
+
+	imu_sample_cursor cursor;
+	imu_sample samples[IMU_SAMPLE_RING_LEN];
+	initIMUCursor(&cursor);
+
+	host_time byteTime = 10ULL * 1000000000ULL / baud;
+	host_time simStart = hostSimTime();
+	host_time lineEnd = simStart;	//when the last byte pushed leaves the line
+	host_time simLast = simStart;	//when the last sample was decoded
+	uint32_t pos = 0, decoded = 0;
+
+	struct timespec wallStart, wallEnd, cpuStart, cpuEnd;
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+
+	for(;;)
+	{
+		//keep the line filled ahead, each chunk ending at its recorded time
+		while(pos < end && hostUartRxPending(&huart4) + recordLen(&capture[pos]) < HOST_UART_LINE_LEN)
+		{
+			uint32_t len = recordLen(&capture[pos]);
+			host_time gap = 0;
+			if(lineEnd < hostSimTime()) lineEnd = hostSimTime();
+			if(speed > 0)
+			{
+				host_time chunkEnd = simStart + (host_time)((recordTick(&capture[pos]) - firstTick) * 1e6 / speed);
+				if(chunkEnd > lineEnd + len * byteTime) gap = chunkEnd - lineEnd - len * byteTime;
+			}
+			hostUartRxPush(&huart4, &capture[pos + RECORD_HEADER_LEN], len, gap);
+			lineEnd += gap + len * byteTime;
+			pos += RECORD_HEADER_LEN + len;
+		}
+
+		if(acquireIMUSamples(&huart4, 100))
+		{
+			uint32_t num;
+			while((num = readIMUSamples(&cursor, samples, IMU_SAMPLE_RING_LEN)) != 0) decoded += num;
+			simLast = hostSimTime();
+		}
+		else if(pos == end && hostUartRxPending(&huart4) == 0)
+		{
+			break;	//capture ended
+		}
+	}
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	free(capture);
+
+	imu_stats imu;
+	uart_stats stats;
+	getIMUStats(&imu);
+	getStatsDriver_UART(&huart4, &stats);
+	double sim = (simLast - simStart) / 1e9;
+	double wall = elapsedMs(&wallStart, &wallEnd);
+	double cpu = elapsedMs(&cpuStart, &cpuEnd);
+
+	printf("capture: %u records, %u bytes, %.3f s recorded, replayed %s at %u baud (%s)\n", records, bytes,
+		(lastTick - firstTick) / 1e3, speed > 0 ? "with recorded timing" : "back to back", baud, dma ? "dma" : "it");
+	if(speed > 0 && speed != 1) printf("speed: x%g\n", speed);
+	printf("samples: %u (ring drops %u), %.1f samples/s simulated, %.0f samples/s wall clock\n", decoded,
+		cursor.dropped, sim > 0 ? decoded / sim : 0.0, wall > 0 ? decoded * 1e3 / wall : 0.0);
+	printf("cpu: %.3f ms, %.3f us per sample\n", cpu, decoded ? cpu * 1e3 / decoded : 0.0);
+	printf("decoder: messages %u checksumErrors %u lengthErrors %u malformed %u\n", imu.messages,
+		imu.checksumErrors, imu.lengthErrors, imu.malformed);
+	printf("driver: rxBytes %u rxDropped %u rxHighWater %u\n", stats.rxBytes, stats.rxDropped, stats.rxHighWater);
+
+	return 0;
+}
@@ -0,0 +1,304 @@
+/**
+ * @file sensorsBench.c
+ * @brief Temperature sensors and actuator drivers run on the host
+ *
+ * Temperatures: the external ADC on SPI2 is emulated with hostSim.h, a single conversion
+ * samples the voltage of the NTC selected by the analog mux (select lines read back from the
+ * GPIO registers) for a set of known temperatures, and ends (RDY bit of the status register
+ * cleared) after the conversion time. The 8 channels are converted with get_temperatures()
+ * (blocking SPI calls) and with the acquisition scheduler on the SPI DMA queue, started by
+ * start_ntc_scheduler() as the Check task does: the task sleeps until a sweep is ready and the
+ * codes are converted with the lookup tables. The results are compared with the known values.
+ * The lookup tables are then compared with the Beta formula (voltage_to_temperature_conv()) on
+ * every code of every sensor in -40..125 degrees, with the time of a conversion for both (the
+ * error bound follows NTC_LUT_BITS, that can be set with compflags="-DNTC_LUT_BITS=10").
+ * Actuators: the internal ADC returns fixed codes on the current sense channels, read with the
+ * blocking calls and then scanned continuously (actuator_scan_start(), scans triggered by the TIM1
+ * update event and written by DMA in a double buffer), with the window statistics of a pulse above
+ * the over current threshold (min/max/mean/RMS, crossings); the scans keep running when the actuator
+ * on the trigger timer is set up after them (and start again after a stop); the PWM timer registers
+ * are checked after init_actuator_handler() and update_duty_dir().
+ *
+ * usage: sensorsBench [sweeps] [conversion ms]
+ *
+ * The simulated time of a sweep is the time the conversions take; with the scheduler the task
+ * is woken once per sweep, the SPI transfers run on the DMA in the meantime.
+ */
+
+#include "hostSim.h"
+#include "sensors.h"
+#include "actuator_driver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+//largest error of the lookup tables against the formula, divided by 4 for each bit of NTC_LUT_BITS
+#define NTC_LUT_MAX_ERROR (6000.0f / (1UL << (2 * NTC_LUT_BITS)))
+
+//temperatures of the emulated NTCs (degrees)
+static const float ntcTemp[NUM_TEMP_SENS] = {-20.0f, -5.0f, 0.0f, 10.0f, 25.0f, 40.0f, 60.0f, 85.0f};
+static Temp_values temps;
+static uint8_t adcCommand = 0;	//last command written to the external ADC
+static host_time convTime = 60000000;	//single conversion time (ns)
+static host_time convEnd = 0;			//end of the running conversion
+static uint8_t convChannel = 0;			//channel sampled by the conversion
+static uint8_t convReady = 0;			//data register updated and not read yet
+
+//channel selected by the mux (s2 = PB0, s1 = PD2, s0 = PB8)
+static uint8_t muxChannel(void)
+{
+	return ((GPIOB->ODR & GPIO_PIN_0) ? 4 : 0) | ((GPIOD->ODR & GPIO_PIN_2) ? 2 : 0) | ((GPIOB->ODR & GPIO_PIN_8) ? 1 : 0);
+}
+
+//voltage code of an NTC divider Vdd*Rntc/(Rntc+R)
+static uint16_t ntcCode(uint8_t ch)
+{
+	double tk = ntcTemp[ch] + 273.15;
+	double rntc = temps.values.R_25 * exp(temps.values.B * (1.0 / tk - 1.0 / 298.15));
+	double v = temps.values.Vdd * rntc / (rntc + temps.values.R[ch]);
+	return (uint16_t)lround(v / Vref * (pow(2, N) - 1));
+}
+
+//emulated external ADC: the single conversion packet starts a conversion of the selected channel,
+//READ_STATUSREG returns RDY (bit 7) set until it ends, READ_DATAREG returns its result (the reply
+//follows the command byte in the same full-duplex transfer)
+static void adcSpiHook(SPI_HandleTypeDef* hspi, const uint8_t* tx, uint8_t* rx, uint32_t len)
+{
+	if(tx == NULL) return;
+	adcCommand = tx[0];
+	if(len == 2 && tx[0] == single_mode_pckt[0] && tx[1] == single_mode_pckt[1])
+	{
+		convEnd = hostSimTime() + convTime;
+		convChannel = muxChannel();
+		convReady = 0;
+	}
+	if(rx == NULL) return;
+
+	if(convEnd != 0 && hostSimTime() >= convEnd)
+	{
+		convEnd = 0;
+		convReady = 1;
+	}
+	for(uint32_t b = 0; b < len; b++) rx[b] = 0xff;
+	if(adcCommand == READ_STATUSREG && len >= 2)
+	{
+		rx[1] = convReady ? 0x08 : (NTC_STATUS_RDY | 0x08);
+	}
+	else if(adcCommand == READ_DATAREG && len >= 3)
+	{
+		uint16_t code = ntcCode(convChannel);
+		rx[1] = code >> 8;
+		rx[2] = code & 0xff;
+		convReady = 0;
+	}
+}
+
+//largest error of the measured temperatures
+static float maxTempError(int print)
+{
+	float maxError = 0;
+	for(uint32_t c = 0; c < NUM_TEMP_SENS; c++)
+	{
+		float error = fabsf(temps.temp[c] - ntcTemp[c]);
+		if(error > maxError) maxError = error;
+		if(print) printf("NTC %u: %.3f (expected %.1f)\n", c, temps.temp[c], ntcTemp[c]);
+	}
+	return maxError;
+}
+
+static double elapsedMs(struct timespec* start, struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t sweeps = 10;
+	if(argc > 1) sweeps = strtoul(argv[1], NULL, 0);
+	if(argc > 2) convTime = strtoul(argv[2], NULL, 0) * 1000000ULL;
+	if(sweeps == 0) sweeps = 1;
+
+	hostSimReset();
+	hostSpiInit(&hspi2, SPI2, 1000000);
+	hostSpiSetHook(&hspi2, adcSpiHook);
+	hostAdcInit(&hadc1, ADC1, 25000);
+	hostTimInit(&htim1, TIM1, 0, 999);
+
+	/* Temperatures, channel by channel (the task sleeps while converting) */
+	init_tempsens_handler(&temps);
+
+	struct timespec wallStart, wallEnd;
+	host_time simStart = hostSimTime();
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	for(uint32_t s = 0; s < sweeps; s++)
+	{
+		for(uint8_t c = 0; c < NUM_TEMP_SENS; c++) get_temperatures(&hspi2, &temps, c);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	float maxError = maxTempError(1);
+	printf("get_temperatures sweep: max error %.4f, simulated %.3f ms, wall %.3f ms per sweep\n",
+		maxError, (hostSimTime() - simStart) / 1e6 / sweeps, elapsedMs(&wallStart, &wallEnd) / sweeps);
+
+	/* Temperatures, acquisition scheduler on the SPI DMA queue */
+	ntc_scheduler sched;
+	uint16_t raw[NUM_TEMP_SENS];
+	uint32_t wakeups = 0, done = 0;
+	init_tempsens_handler(&temps);
+	initDriver_SPI();
+	addDriver_SPI(&hspi2);
+
+	simStart = hostSimTime();
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	start_ntc_scheduler(&sched, &hspi2, xTaskGetCurrentTaskHandle());
+	while(done < sweeps && wakeups < 2 * sweeps)	//a task woken without a new sweep ends the test
+	{
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NTC_SWEEP_TIMEOUT_MS));
+		wakeups++;
+		done = read_ntc_sweep(&sched, raw);
+		for(uint32_t c = 0; c < NUM_TEMP_SENS && done != 0; c++)
+		{
+			temps.temp[c] = ntc_code_to_temperature(&temps, c, raw[c]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	float schedError = maxTempError(0);
+	if(schedError > maxError) maxError = schedError;
+	spi_stats spi;
+	getStatsDriver_SPI(&hspi2, &spi);
+	double sweepMs = (hostSimTime() - simStart) / 1e6 / sweeps;
+	printf("scheduler sweep: max error %.4f, simulated %.3f ms (%.1f ms per channel, conversion %.1f ms), "
+		"task wakeups %u, timeouts %u, errors %u, wall %.3f ms per sweep\n", schedError, sweepMs, sweepMs / NUM_TEMP_SENS,
+		convTime / 1e6, wakeups, sched.timeouts, sched.errors, elapsedMs(&wallStart, &wallEnd) / sweeps);
+	printf("spi: %.1f DMA transactions per sweep, errors %u, queue high water %u\n",
+		(double)spi.transactions / sweeps, spi.errors, spi.highWater);
+
+	/* Lookup tables against the Beta formula, every code of every sensor */
+	float lutError = 0;
+	uint32_t compared = 0;
+	for(uint8_t c = 0; c < NUM_TEMP_SENS; c++)
+	{
+		for(uint32_t code = 1; code <= ADC_CODE_MAX; code++)
+		{
+			voltage_to_temperature_conv(ADC_Code_To_Voltage(code), &temps, c);
+			if(!(temps.temp[c] >= -40.0f && temps.temp[c] <= 125.0f)) continue;
+			float error = fabsf(ntc_code_to_temperature(&temps, c, code) - temps.temp[c]);
+			if(error > lutError) lutError = error;
+			compared++;
+		}
+	}
+	volatile float sink = 0;
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	for(uint32_t code = 0; code <= ADC_CODE_MAX; code++)
+	{
+		voltage_to_temperature_conv(ADC_Code_To_Voltage(code), &temps, code % NUM_TEMP_SENS);
+		sink += temps.temp[code % NUM_TEMP_SENS];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	double formulaNs = elapsedMs(&wallStart, &wallEnd) * 1e6 / (ADC_CODE_MAX + 1);
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	for(uint32_t code = 0; code <= ADC_CODE_MAX; code++) sink += ntc_code_to_temperature(&temps, code % NUM_TEMP_SENS, code);
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	double lutNs = elapsedMs(&wallStart, &wallEnd) * 1e6 / (ADC_CODE_MAX + 1);
+	printf("lookup tables: %u entries per sensor, max error %.5f over %u codes in -40..125, "
+		"%.1f ns per conversion (formula %.1f ns)\n", NTC_LUT_LEN, lutError, compared, lutNs, formulaNs);
+
+	/* Actuators */
+	uint8_t mask[NUM_DRIVERS] = {1, 1, 1, 1, 1};
+	const uint32_t channel[NUM_DRIVERS] = {ADC_CHANNEL_1, ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_4, ADC_CHANNEL_16};
+	volatile float voltage[NUM_DRIVERS], current[NUM_DRIVERS];
+	for(uint32_t d = 0; d < NUM_DRIVERS; d++) hostAdcSet(&hadc1, channel[d], 500 * (d + 1));
+
+	simStart = hostSimTime();
+	clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	for(uint32_t s = 0; s < sweeps; s++) get_actuator_current(&hadc1, voltage, current, mask);
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+
+	//raw codes, as sent by the housekeepingRawADCS message
+	uint16_t raw12[NUM_DRIVERS] = {0};
+	uint32_t rawErrors = 0;
+	get_actuator_current_raw(&hadc1, raw12, mask);
+	for(uint32_t d = 0; d < NUM_DRIVERS; d++) rawErrors += (raw12[d] != 500 * (d + 1));
+
+	for(uint32_t d = 0; d < NUM_DRIVERS; d++) printf("driver %u: %.4f V, %.4f A, code %u\n", d, voltage[d], current[d], raw12[d]);
+	printf("current sweep: simulated %.3f ms, wall %.3f us per sweep\n",
+		(hostSimTime() - simStart) / 1e6 / sweeps, elapsedMs(&wallStart, &wallEnd) * 1e3 / sweeps);
+
+	/* Actuator currents, scan mode: triggered by the TIM1 update event, DMA double buffer */
+	host_time pwmPeriod = (host_time)(TIM1->PSC + 1) * (TIM1->ARR + 1) * 1000000000ULL / HOST_TIM_CLOCK;
+	host_time scanStart = hostSimTime(), lastTrigger = 0;
+	uint32_t scanErrors = actuator_scan_start(&hadc1, &htim1);
+	vTaskDelay(pdMS_TO_TICKS(10));
+	uint32_t scans = actuator_scan_read(raw12);
+	for(uint32_t d = 0; d < NUM_DRIVERS; d++) scanErrors += (raw12[d] != 500 * (d + 1));
+	hostAdcSet(&hadc1, ADC_CHANNEL_16, 1234);	//a new value shows up in the next scans
+	vTaskDelay(pdMS_TO_TICKS(1));
+	uint32_t scansAfter = get_actuator_current_scan(voltage, current);
+	actuator_scan_read(raw12);
+	scanErrors += (raw12[4] != 1234) + (scansAfter <= scans);
+	uint32_t hostScans = hostAdcScans(&hadc1, &lastTrigger);
+	uint32_t phase = (uint32_t)((lastTrigger - scanStart) % pwmPeriod);
+	actuator_scan_stop(&hadc1);
+	printf("current scan: %u scans in %.3f ms (%.1f us per scan, PWM period %.1f us), trigger phase %u ns, "
+		"driver 4 %.4f A, errors %u\n", hostScans, (hostSimTime() - scanStart) / 1e6,
+		(hostSimTime() - scanStart) / 1e3 / hostScans, pwmPeriod / 1e3, phase, current[4], scanErrors);
+	scanErrors += (phase != 0) + (hostScans != scansAfter);
+
+	/* Current statistics: a pulse above the magnetorquer threshold on driver 2 inside a window */
+	const uint32_t window = 64;
+	act_current_stats stats;
+	uint32_t statsErrors = actuator_stats_window(window);
+	hostAdcSet(&hadc1, ADC_CHANNEL_3, 100);
+	statsErrors += actuator_scan_start(&hadc1, &htim1);
+	while(actuator_stats_read(&stats) == 0) xTaskGetTickCount();	//first window, at its end
+	for(uint32_t d = 0; d < NUM_DRIVERS; d++)
+	{
+		uint16_t code = (d == 2) ? 100 : (d == 4) ? 1234 : 500 * (d + 1);
+		uint8_t above = (code > stats.threshold[d]);	//drivers 3 and 4 are above the magnetorquer threshold
+		statsErrors += (stats.ch[d].min != code) + (stats.ch[d].max != code) + (stats.ch[d].mean != 16 * code) +
+			(stats.ch[d].rms != 16 * code) + (stats.ch[d].over != above * window) + (stats.crossings[d] != above);
+	}
+	hostAdcSet(&hadc1, ADC_CHANNEL_3, 300);
+	vTaskDelay(pdMS_TO_TICKS(1));
+	hostAdcSet(&hadc1, ADC_CHANNEL_3, 100);
+	while(actuator_stats_read(&stats) == 1) xTaskGetTickCount();
+	act_window_stats* pulse = &stats.ch[2];
+	double meanSquare = (pulse->over * 300.0 * 300.0 + (window - pulse->over) * 100.0 * 100.0) / window;
+	uint32_t expectedMean = (pulse->over * 300 + (window - pulse->over) * 100) * 16 / window;
+	statsErrors += (pulse->min != 100) + (pulse->max != 300) + (pulse->over == 0) + (pulse->over == window) +
+		(stats.crossings[2] != 1) + (stats.scans != window) + (pulse->mean != expectedMean) +
+		(abs((int)pulse->rms - (int)(16 * sqrt(meanSquare))) > 1);
+	float meanCurrent[NUM_DRIVERS], rmsCurrent[NUM_DRIVERS], maxCurrent[NUM_DRIVERS];
+	get_actuator_current_stats(&stats, meanCurrent, rmsCurrent, maxCurrent);
+	actuator_scan_stop(&hadc1);
+	actuator_stats_window(ACT_STATS_WINDOW);
+	printf("current statistics: window %u scans, driver 2 threshold code %u, pulse of %u scans: "
+		"mean %.4f A, RMS %.4f A, peak %.4f A, crossings %u, errors %u\n", stats.scans, stats.threshold[2],
+		pulse->over, meanCurrent[2], rmsCurrent[2], maxCurrent[2], stats.crossings[2], statsErrors);
+
+	/* Scans started before the actuators (the Check task runs first): init_actuator_handler() on
+	 * the trigger timer must not stop its counter, a second actuator_scan_start() must succeed */
+	Actuator_struct act;
+	uint32_t orderErrors = actuator_scan_start(&hadc1, &htim1);
+	vTaskDelay(pdMS_TO_TICKS(2));
+	init_actuator_handler(&act, &htim1, TIM_CHANNEL_1, TIM_CHANNEL_2, 1000, 50);
+	uint32_t scansInit = hostAdcScans(&hadc1, NULL);
+	vTaskDelay(pdMS_TO_TICKS(5));
+	uint32_t scansAfterInit = hostAdcScans(&hadc1, NULL) - scansInit;
+	orderErrors += (scansInit == 0) + (scansAfterInit < 4) + !(TIM1->CR1 & TIM_CR1_CEN);
+	actuator_START(&act);
+	update_duty_dir(&act, 30, 1);
+	vTaskDelay(pdMS_TO_TICKS(5));
+	uint32_t scansStarted = actuator_scan_read(raw12);
+	actuator_scan_stop(&hadc1);
+	orderErrors += actuator_scan_start(&hadc1, &htim1);
+	vTaskDelay(pdMS_TO_TICKS(5));
+	orderErrors += (actuator_scan_read(raw12) == 0) + (scansStarted == 0);
+	actuator_scan_stop(&hadc1);
+	printf("scan before actuator init: %u scans in 5 ms after init_actuator_handler(), restart %s, errors %u\n",
+		scansAfterInit, orderErrors ? "failed" : "ok", orderErrors);
+	printf("PWM: PSC %u ARR %u CCR1 %u CCR2 %u running %u\n", TIM1->PSC, TIM1->ARR, TIM1->CCR1, TIM1->CCR2,
+		hostTimPwmRunning(&htim1, TIM_CHANNEL_1) && hostTimPwmRunning(&htim1, TIM_CHANNEL_2));
+
+	return !(maxError < 0.05f && rawErrors == 0 && scanErrors == 0 && statsErrors == 0 && orderErrors == 0 && lutError < NTC_LUT_MAX_ERROR && done >= sweeps && wakeups == sweeps && sched.timeouts == 0 && sched.errors == 0 && TIM1->CCR1 == TIM1->ARR && TIM1->CCR2 == (uint32_t)roundf(TIM1->ARR * 0.3f));
+}
@@ -15,6 +15,7 @@ sys.stdout.reconfigure(line_buffering=True)
 
 sys.path.append("./messages")
 import messages as msg
+import calibration
 serial = ctypes.CDLL("./serial/serialInterface.so")
 print("Maximum serial payload length: {0}\n".format(serial.getMaxLen()))
 
@@ -36,7 +37,8 @@ uartRetries=2 #number of retries in case of failed ack (total 3 tries)
 #--------------------------------------
 
 #CDH thread ---------------------------
-availableCommands=[0,1] #command codes available from client
+availableCommands=[0,1,2] #command codes available from client
+imuCapturePath="imuCapture.bin" #file where IMU raw captures dumped by ADCS are written
 clientQueueRxTimeout=0.002 #timeout for reaing from client rx queue
 #--------------------------------------
 
@@ -343,14 +345,14 @@ def cdhThread():
 			#check message code
 			code=buffrx[0]
 			#print(l)
-			# keep only codes 21 and 22
-			if code==21:
+			# keep only codes 21 and 22 (and 23, IMU capture dumps, 24, raw housekeeping, 25 and 26, current statistics)
+			if code in (21,22,23,24,25,26):
 				#print(buffrx)
 				#if the code and the length correspond to a valid message
 				if code in msg.msgDict.keys() and ctypes.sizeof(msg.msgDict[code]) == l:
 					# ------ HERE WE HANDLE EACH MESSAGE CODE FROM ADCS -------			
 					match msg.msgDict[code].__name__:
-						case "attitudeADCS" | "housekeepingADCS" | "opmodeADCS": #attitude telemetry message
+						case "attitudeADCS" | "housekeepingADCS" | "currentStatsADCS" | "opmodeADCS": #attitude telemetry message
 							#saving current timestamp
 							currt=time.time_ns()
 							
@@ -382,6 +384,67 @@ def cdhThread():
 							#print(f"\n Data sent to logQueue...")
 							#print(influxstr)
 							
+						case "housekeepingRawADCS": #housekeeping as raw ADC codes, converted here
+							currt=time.time_ns()
+							raw=msg.msgDict[code].from_buffer_copy(buffrx[:l])
+							try:
+								temperature,current=calibration.calibrateHousekeeping(raw)
+							except KeyError:
+								print("WARNING: unknown ADCS sensor configuration {0}, housekeeping not converted".format(raw.config))
+								temperature,current=[],[]
+							
+							#written as housekeepingADCS, with the converted values next to the codes
+							fields=[]
+							for index in range(len(temperature)):
+								if temperature[index] is not None: #shorted or open NTC
+									fields.append("temperature[{0}]={1}".format(index,temperature[index]))
+							for index in range(len(current)):
+								fields.append("current[{0}]={1}".format(index,current[index]))
+							for f in ("temperatureRAW","currentRAW"):
+								arraylist=getattr(raw,f)[:]
+								for index in range(len(arraylist)):
+									fields.append("{0}[{1}]={2}".format(f,index,arraylist[index]))
+							fields.append("config={0}".format(raw.config))
+							fields.append("ticktime={0}".format(raw.ticktime))
+							logQueue.put("housekeepingADCS,source=ADCS {0} {1}\n".format(",".join(fields),currt))
+							
+						case "currentStatsRawADCS": #current statistics of a window as raw ADC codes, converted here
+							currt=time.time_ns()
+							raw=msg.msgDict[code].from_buffer_copy(buffrx[:l])
+							try:
+								stats=calibration.calibrateCurrentStats(raw)
+							except KeyError:
+								print("WARNING: unknown ADCS sensor configuration {0}, current statistics not converted".format(raw.config))
+								stats={}
+							
+							#written as currentStatsADCS, with the converted values next to the codes
+							fields=[]
+							for f in stats:
+								for index in range(len(stats[f])):
+									fields.append("{0}[{1}]={2}".format(f,index,stats[f][index]))
+							for f in ("currentMinRAW","currentMaxRAW","currentMeanRAW","currentRmsRAW","currentOver","currentCrossings"):
+								arraylist=getattr(raw,f)[:]
+								for index in range(len(arraylist)):
+									fields.append("{0}[{1}]={2}".format(f,index,arraylist[index]))
+							fields.append("currentScans={0}".format(raw.currentScans))
+							fields.append("config={0}".format(raw.config))
+							fields.append("ticktime={0}".format(raw.ticktime))
+							logQueue.put("currentStatsADCS,source=ADCS {0} {1}\n".format(",".join(fields),currt))
+							
+						case "imuCaptureADCS": #chunk of an IMU raw capture dump
+							chunk=msg.msgDict[code].from_buffer_copy(buffrx[:l])
+							try:
+								#a dump starts from offset 0, the file is truncated
+								#(created also by a later chunk if the first one was lost)
+								mode="r+b" if chunk.offset and os.path.exists(imuCapturePath) else "wb"
+								with open(imuCapturePath,mode) as capfile:
+									capfile.seek(chunk.offset)
+									capfile.write(bytes(chunk.data[:chunk.len]))
+							except Exception as e:
+								print("ERROR writing {0}: {1}".format(imuCapturePath,e))
+							if chunk.offset+chunk.len>=chunk.total:
+								print("IMU capture of {0} bytes received in {1}".format(chunk.total,imuCapturePath))
+							
 						case _: #default case
 							print("WARNING: {0} message from ADCS not handled".format(msg.msgDict[code].__name__))
 				else:
@@ -0,0 +1,65 @@
+#!/bin/python3
+
+# Ground calibration of the ADCS raw housekeeping (housekeepingRawADCS message)
+#
+# The ADCS sends the raw ADC codes of the NTCs (external 16 bit ADC) and of the actuator
+# current sense channels (ADC1, 12 bit), with the version of the sensor constants it was
+# built with (SENSOR_CONFIG_VERSION in constants.h). Here the codes are converted to degrees
+# and amperes with the same formulas used on board (voltage_to_temperature_conv() in sensors.c,
+# get_actuator_current() in actuator_driver.c).
+# When the constants change on board a new version must be added to sensorConfigs.
+
+import math
+
+#sensor constants for each SENSOR_CONFIG_VERSION
+sensorConfigs={
+	1:{
+		"ntcR":[10040,10020,10000,10020,10000,10010,10000,10000], #ohm, divider resistor of each NTC
+		"ntcR25":10000, #ohm, NTC resistance at 25 degrees
+		"ntcB":3977, #K, NTC Beta
+		"ntcVdd":3.3, #volt, divider supply
+		"ntcVref":3.3, #volt, external ADC reference
+		"ntcCodeMax":65535, #largest code of the external ADC
+		"Rsense":[1973,2028,1962,1992,1979], #ohm, sense resistor of each motor driver
+		"Aipropri":1575e-6, #mirror ratio of the driver current mirror
+		"adcVref":3.3, #volt, ADC1 reference
+		"adcCodeMax":4095 #largest code of ADC1
+	}
+}
+
+#NTC temperature (degrees) from the code of sensor ch, None if the code is out of the formula range
+#(shorted or open sensor)
+def ntcTemperature(code,ch,cfg):
+	v=code*cfg["ntcVref"]/cfg["ntcCodeMax"]
+	if v<=0 or v>=cfg["ntcVdd"]:
+		return None
+	B=cfg["ntcB"]
+	den=B-298.15*math.log((cfg["ntcVdd"]/v-1)*(cfg["ntcR25"]/cfg["ntcR"][ch]))
+	if den<=0:
+		return None
+	return 298.15*B/den-273.15
+
+#actuator current (ampere) from the code of driver ch
+def actuatorCurrent(code,ch,cfg):
+	v=code*cfg["adcVref"]/cfg["adcCodeMax"]
+	return v/(cfg["Rsense"][ch]*cfg["Aipropri"])
+
+#converts a housekeepingRawADCS message, returns the lists of temperatures and currents
+#raises KeyError if the sensor configuration version is not known
+def calibrateHousekeeping(raw):
+	cfg=sensorConfigs[raw.config]
+	temperature=[ntcTemperature(code,ch,cfg) for ch,code in enumerate(raw.temperatureRAW)]
+	current=[actuatorCurrent(code,ch,cfg) for ch,code in enumerate(raw.currentRAW)]
+	return temperature,current
+
+#converts a currentStatsRawADCS message (statistics of a window of scans),
+#returns a dictionary of lists: min, max, mean and rms current of each driver (mean and rms codes are Q4)
+#raises KeyError if the sensor configuration version is not known
+def calibrateCurrentStats(raw):
+	cfg=sensorConfigs[raw.config]
+	return {
+		"currentMin":[actuatorCurrent(code,ch,cfg) for ch,code in enumerate(raw.currentMinRAW)],
+		"currentMax":[actuatorCurrent(code,ch,cfg) for ch,code in enumerate(raw.currentMaxRAW)],
+		"currentMean":[actuatorCurrent(code/16,ch,cfg) for ch,code in enumerate(raw.currentMeanRAW)],
+		"currentRms":[actuatorCurrent(code/16,ch,cfg) for ch,code in enumerate(raw.currentRmsRAW)]
+	}
@@ -36,6 +36,13 @@ class attitudeADCS(Structure):
 		("b_x",c_float),
 		("b_y",c_float),
 		("b_z",c_float),
+		("q_0",c_float),
+		("q_1",c_float),
+		("q_2",c_float),
+		("q_3",c_float),
+		("free_acc_x",c_float),
+		("free_acc_y",c_float),
+		("free_acc_z",c_float),
 		("DC_x",c_float),
 		("DC_y",c_float),
 		("DC_z",c_float),
@@ -48,9 +55,9 @@ class attitudeADCS(Structure):
 		("ticktime",c_uint32)]
 
 	def __str__(self):
-		return "attitudeADCS <c_float omega_x> <c_float omega_y> <c_float omega_z> <c_float acc_x> <c_float acc_y> <c_float acc_z> <c_float b_x> <c_float b_y> <c_float b_z> <c_float DC_x> <c_float DC_y> <c_float DC_z> <c_float P_x> <c_float P_y> <c_float P_z> <c_float D_x> <c_float D_y> <c_float D_z> <c_uint32 ticktime>"
+		return "attitudeADCS <c_float omega_x> <c_float omega_y> <c_float omega_z> <c_float acc_x> <c_float acc_y> <c_float acc_z> <c_float b_x> <c_float b_y> <c_float b_z> <c_float q_0> <c_float q_1> <c_float q_2> <c_float q_3> <c_float free_acc_x> <c_float free_acc_y> <c_float free_acc_z> <c_float DC_x> <c_float DC_y> <c_float DC_z> <c_float P_x> <c_float P_y> <c_float P_z> <c_float D_x> <c_float D_y> <c_float D_z> <c_uint32 ticktime>"
 
-	convList=[int,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,int]
+	convList=[int,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,float,int]
 
 # message name: housekeepingADCS code: 22
 class housekeepingADCS(Structure):
@@ -71,6 +78,86 @@ class housekeepingADCS(Structure):
 
 	convList=[int,float,int,float,int,int]
 
+# message name: imuCaptureADCS code: 23
+class imuCaptureADCS(Structure):
+	def __init__(self):
+		super().__init__()
+		self.code=23
+
+	_pack_=1
+	_fields_=[("code",c_uint8),
+		("offset",c_uint32),
+		("total",c_uint32),
+		("len",c_uint16),
+		("data",c_uint8*117)]
+
+	def __str__(self):
+		return "imuCaptureADCS <c_uint32 offset> <c_uint32 total> <c_uint16 len> <c_uint8*117 data>"
+
+	convList=[int,int,int,int,int]
+
+# message name: housekeepingRawADCS code: 24
+class housekeepingRawADCS(Structure):
+	def __init__(self):
+		super().__init__()
+		self.code=24
+
+	_pack_=1
+	_fields_=[("code",c_uint8),
+		("config",c_uint8),
+		("temperatureRAW",c_uint16*8),
+		("currentRAW",c_uint16*5),
+		("ticktime",c_uint32)]
+
+	def __str__(self):
+		return "housekeepingRawADCS <c_uint8 config> <c_uint16*8 temperatureRAW> <c_uint16*5 currentRAW> <c_uint32 ticktime>"
+
+	convList=[int,int,int,int,int]
+
+# message name: currentStatsADCS code: 25
+class currentStatsADCS(Structure):
+	def __init__(self):
+		super().__init__()
+		self.code=25
+
+	_pack_=1
+	_fields_=[("code",c_uint8),
+		("currentMean",c_float*5),
+		("currentRms",c_float*5),
+		("currentMax",c_float*5),
+		("currentOver",c_uint16*5),
+		("currentCrossings",c_uint32*5),
+		("currentScans",c_uint16),
+		("ticktime",c_uint32)]
+
+	def __str__(self):
+		return "currentStatsADCS <c_float*5 currentMean> <c_float*5 currentRms> <c_float*5 currentMax> <c_uint16*5 currentOver> <c_uint32*5 currentCrossings> <c_uint16 currentScans> <c_uint32 ticktime>"
+
+	convList=[int,float,float,float,int,int,int,int]
+
+# message name: currentStatsRawADCS code: 26
+class currentStatsRawADCS(Structure):
+	def __init__(self):
+		super().__init__()
+		self.code=26
+
+	_pack_=1
+	_fields_=[("code",c_uint8),
+		("config",c_uint8),
+		("currentMinRAW",c_uint16*5),
+		("currentMaxRAW",c_uint16*5),
+		("currentMeanRAW",c_uint16*5),
+		("currentRmsRAW",c_uint16*5),
+		("currentOver",c_uint16*5),
+		("currentCrossings",c_uint32*5),
+		("currentScans",c_uint16),
+		("ticktime",c_uint32)]
+
+	def __str__(self):
+		return "currentStatsRawADCS <c_uint8 config> <c_uint16*5 currentMinRAW> <c_uint16*5 currentMaxRAW> <c_uint16*5 currentMeanRAW> <c_uint16*5 currentRmsRAW> <c_uint16*5 currentOver> <c_uint32*5 currentCrossings> <c_uint16 currentScans> <c_uint32 ticktime>"
+
+	convList=[int,int,int,int,int,int,int,int,int,int]
+
 # message name: setOpmodeADCS code: 0
 class setOpmodeADCS(Structure):
 	def __init__(self):
@@ -112,14 +199,34 @@ class setAttitudeADCS(Structure):
 
 	convList=[int,float,float,float,float,float,float,float,float,float,float,float,float]
 
+# message name: imuCaptureCmdADCS code: 2
+class imuCaptureCmdADCS(Structure):
+	def __init__(self):
+		super().__init__()
+		self.code=2
+
+	_pack_=1
+	_fields_=[("code",c_uint8),
+		("command",c_uint8)]
+
+	def __str__(self):
+		return "imuCaptureCmdADCS <c_uint8 command>"
+
+	convList=[int,int]
+
 # messages dictionary (keys are the codes)
 # can be used to instantiate class from msg code
 msgDict={
 20:opmodeADCS,
 21:attitudeADCS,
 22:housekeepingADCS,
+23:imuCaptureADCS,
+24:housekeepingRawADCS,
+25:currentStatsADCS,
+26:currentStatsRawADCS,
 0:setOpmodeADCS,
-1:setAttitudeADCS
+1:setAttitudeADCS,
+2:imuCaptureCmdADCS
 }
 
 # String parsing function, this can be used to fill and return a
@@ -85,6 +85,7 @@ typedef struct{
 typedef struct{
     uint8_t (*txFunc)(uint8_t byte); ///< TX function pointer
     uint8_t (*rxFunc)(uint8_t* byte); ///< RX function pointer
+    void (*waitFunc)(uint32_t timeout); ///< RX wait function pointer (NULL to poll), see sdlSetWaitFunc()
     circular_buffer_handle rxBuff;   ///< Rx buffer handle
     uint8_t rxBuffArray[(sizeof(frameHeader)+SDL_MAX_PAY_LEN+2)*2]; ///< Rx buffer memory array
     circular_buffer_handle tmpBuff; ///< Temporary buffer for frame
@@ -92,6 +93,8 @@ typedef struct{
     uint32_t timeout; ///< Serial line timeout value (same unit of sdlTimeTick())
     uint32_t retries; ///< Number of retries in case of ack not received
     uint16_t lastRxHash; ///< Last frame hash received
+    search_frame_context rxCtx[2]; ///< Frame search contexts on rxBuff (one per searched frame code: data and ack)
+    uint32_t rxScanned[2]; ///< Number of rxBuff bytes already examined by each search context
 #ifdef SDL_ANTILOCK_DEPTH
     circular_buffer_handle alockBuff; ///< Anti lock buffer handle
     uint8_t alockBuffArray[SDL_ANTILOCK_DEPTH*SDL_MAX_PAY_LEN]; ///< Anti lock buffer array
@@ -135,6 +138,23 @@ uint32_t sdlTimeTick();
  */
 void sdlInitLine(serial_line_handle* line, uint8_t (*txFunc)(uint8_t byte), uint8_t (*rxFunc)(uint8_t* byte), uint32_t timeout, uint32_t retries);
 
+/**
+ * @brief Set the RX wait function of a serial line handle.
+ * 
+ * By default sdlSend() polls the line until the ack arrives or the timeout
+ * expires, keeping the CPU busy. If a wait function is set, it is called
+ * every time no ack was found, with the time left before the timeout (same
+ * unit of sdlTimeTick()): the function should block until new bytes are
+ * available on the line or that time has passed (e.g. by waiting on a
+ * driver event), letting the CPU do something else in the meantime.
+ * NB: the function must be set after sdlInitLine(), which clears it, and
+ * can be set to NULL to go back to polling.
+ * 
+ * @param line serial line handle
+ * @param waitFunc wait function pointer (or NULL)
+ */
+void sdlSetWaitFunc(serial_line_handle* line, void (*waitFunc)(uint32_t timeout));
+
 /**
  * @brief Send payload through serial line
  * 
@@ -6,6 +6,7 @@
 
 #include "frameUtils.h"
 #include <stdio.h>
+#include <string.h>
 
 /* utility function that checks if byte at virtual index pos of circular buffer is part of a pattern patt (length pattLen)
  * returns 0 if it's not part of it, returns 1 if the byte is part of pattern but is not inside a complete occurrence of
@@ -71,18 +72,21 @@ static uint8_t checkByteIsPartOfPattern(circular_buffer_handle* handle, uint32_t
 	return 0;
 }
 
-uint32_t searchFrame(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule){
+//frame search state machine states
+typedef enum{
+    _waiting,
+    _inside
+} machine_state;
+
+/* generic implementation of searchFrame(), every byte is checked against all the possible shifts of head and tail
+ * sequences, so it's O(stream*pattLen^2), it's used only for rules that cannot be compiled with compileFrameRule()
+ */
+static uint32_t searchFrameScan(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule){
 	//guard checks
 	if(stream==NULL || stream->buff == NULL || rule==NULL || stream->elemNum==0 || rule->headLen==0 || rule->head==NULL) return stream->elemNum;
 	//If packet cannot fit in available bytes
 	if(stream->elemNum<(rule->headLen+rule->minLen+rule->tailLen)) return stream->elemNum;
 
-	//state machine states
-	typedef enum{
-	    _waiting,
-	    _inside
-	} machine_state;
-
 	//variables and flags
 	machine_state state=_waiting;	//decoding state machine state
     uint32_t startPos=0;	//temporary variable were we save the last byte of head
@@ -136,6 +140,8 @@ uint32_t searchFrame(circular_buffer_handle* stream, circular_buffer_handle* fra
 				canBeLast=checkByteIsPartOfPattern(stream, b+1, rule->tail, rule->tailLen, &tmpTailIndex, 0);
 				canBeLast=(canBeLast == 2) && (tmpTailIndex==0);
 			}
+		}else{
+			canBeLast=0;
 		}
 
 		//STATE MACHINE
@@ -207,14 +213,371 @@ uint32_t searchFrame(circular_buffer_handle* stream, circular_buffer_handle* fra
 }
 
 
-uint8_t searchFrameAdvance(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule, uint8_t shiftFlags){
-	if(stream==NULL || stream->buff == NULL || rule==NULL || stream->elemNum==0 || rule->headLen==0 || rule->head==NULL) return 0;
 
-	uint32_t startVIndex;
-	uint8_t found=0;
+/* incremental matcher used by searchFrameCompiled(), stream bytes are fed to head and tail KMP automatons and the
+ * positions where complete occurrences end are remembered inside two masks (bit k of a mask is set if a complete
+ * occurrence ends at virtual index nextIndex-1-k)
+ */
+typedef struct{
+	uint32_t nextIndex;	//virtual index of next byte to be fed
+	uint32_t memIndex;	//memory index of next byte to be fed
+	uint32_t headState;	//number of head bytes currently matched
+	uint32_t tailState;	//number of tail bytes currently matched
+	uint32_t headEnds;	//mask of complete head occurrences ends
+	uint32_t tailEnds;	//mask of complete tail occurrences ends
+} pattern_matcher;
+
+/* builds the KMP failure function of pattern patt (length pattLen) into fail array, fail[i] is the length of the
+ * longest proper prefix of patt[0..i] which is also a suffix of it
+ */
+static void buildFailure(uint8_t* patt, uint32_t pattLen, uint8_t* fail){
+	uint32_t k=0;
+
+	fail[0]=0;
+	for(uint32_t i=1;i<pattLen;i++){
+		while(k>0 && patt[i]!=patt[k]) k=fail[k-1];
+		if(patt[i]==patt[k]) k++;
+		fail[i]=k;
+	}
+}
+
+/* advances the KMP automaton of pattern patt by one byte, returns 1 if a complete occurrence ends with this byte */
+static uint8_t kmpStep(uint8_t* patt, uint32_t pattLen, uint8_t* fail, uint32_t* state, uint8_t byte){
+	uint32_t q=*state;
+
+	if(q==pattLen) q=fail[q-1];
+	while(q>0 && patt[q]!=byte) q=fail[q-1];
+	if(patt[q]==byte) q++;
+
+	*state=q;
+	return q==pattLen;
+}
+
+/* feeds the matcher with all stream bytes until virtual index end (excluded) */
+static void matcherFeed(pattern_matcher* m, circular_buffer_handle* stream, compiled_frame_rule* compiled, uint32_t end){
+	search_frame_rule* rule=&compiled->rule;
+
+	while(m->nextIndex<end){
+		uint8_t byte=stream->buff[m->memIndex];
+
+		m->headEnds=(m->headEnds<<1) | kmpStep(rule->head, rule->headLen, compiled->headFail, &m->headState, byte);
+		if(compiled->tailLen!=0){
+			m->tailEnds=(m->tailEnds<<1) | kmpStep(rule->tail, compiled->tailLen, compiled->tailFail, &m->tailState, byte);
+		}
+
+		m->nextIndex++;
+		m->memIndex++;
+		if(m->memIndex>=stream->buffLen) m->memIndex=0;
+	}
+}
+
+/* restarts the matcher so that the next byte fed will be the one at virtual index index, automatons are
+ * re-synchronized by feeding them the previous bytes (a match state is never longer than the pattern, so
+ * pattLen-1 bytes are enough)
+ */
+static void matcherSync(pattern_matcher* m, circular_buffer_handle* stream, compiled_frame_rule* compiled, uint32_t index){
+	uint32_t history=compiled->rule.headLen;
+	if(compiled->tailLen>history) history=compiled->tailLen;
+	history--;
+
+	m->nextIndex=(index>history) ? index-history : 0;
+	m->memIndex=cBuffGetMemIndex(stream,m->nextIndex);
+	m->headState=0;
+	m->tailState=0;
+	m->headEnds=0;
+	m->tailEnds=0;
+
+	matcherFeed(m,stream,compiled,index);
+}
 
-	//we start searching for the frame by using searchFrame
-	startVIndex=searchFrame(stream, frame, rule);
+/* returns !0 if a complete occurrence of the mask ends ends between virtual indexes from and to (included),
+ * positions not yet fed to the matcher are considered as not matching
+ */
+static uint8_t matcherEndsIn(pattern_matcher* m, uint32_t ends, uint32_t from, uint32_t to){
+	if(to>=m->nextIndex) to=m->nextIndex-1;
+	if(m->nextIndex==0 || from>to) return 0;
+
+	uint32_t lo=m->nextIndex-1-to;
+	uint32_t hi=m->nextIndex-1-from;
+	return ((ends>>lo) & ((2u<<(hi-lo))-1))!=0;
+}
+
+/* returns the virtual index of the first occurrence of byte inside stream between virtual indexes from (included)
+ * and to (excluded), or to if not found, memchr is applied on the (at most two) contiguous memory regions
+ */
+static uint32_t findByte(circular_buffer_handle* stream, uint8_t byte, uint32_t from, uint32_t to){
+	while(from<to){
+		uint32_t mem=cBuffGetMemIndex(stream,from);
+		uint32_t span=stream->buffLen-mem;
+		if(span>(to-from)) span=to-from;
+
+		uint8_t* found=memchr(&stream->buff[mem],byte,span);
+		if(found!=NULL) return from+(uint32_t)(found-&stream->buff[mem]);
+
+		from+=span;
+	}
+	return to;
+}
+
+/* fills frame handle with the frame having last head byte at virtual index startPos and length len (head and tail
+ * excluded), returns the starting virtual index of the frame
+ */
+static uint32_t outputFrame(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule* rule, uint32_t startPos, uint32_t len){
+	//computing packet length and starting virtual index
+	uint32_t tmpLen=len+rule->headLen;
+	if(rule->tail!=NULL) tmpLen+=rule->tailLen;
+	uint32_t startVIndex=startPos+1-rule->headLen;
+
+	//filling output handle
+	if(frame!=NULL){
+		frame->buff=stream->buff;
+		frame->buffLen=stream->buffLen;
+		frame->elemNum=tmpLen;
+		frame->startIndex=cBuffGetMemIndex(stream,startVIndex);
+	}
+	return startVIndex;
+}
+
+uint8_t compileFrameRule(compiled_frame_rule* compiled, search_frame_rule* rule){
+	if(compiled==NULL || rule==NULL || rule->head==NULL || rule->headLen==0 || rule->headLen>FRAMEUTILS_MAX_PATT_LEN) return 0;
+
+	uint32_t tailLen=0; //tail length used for matching (0 in tail-less mode)
+	if(rule->tail!=NULL) tailLen=rule->tailLen;
+	if(tailLen>FRAMEUTILS_MAX_PATT_LEN) return 0;
+
+	if(rule->policy != hard && rule->policy!=medium) rule->policy=soft;	//correct eventual policy error
+
+	compiled->rule=*rule;
+	compiled->tailLen=tailLen;
+
+	//bytes needed after the current one to take a decision on it
+	compiled->lookAhead=rule->headLen-1;
+	if(tailLen>compiled->lookAhead) compiled->lookAhead=tailLen;
+
+	//automatons and forbidden bytes table
+	memset(compiled->forbidden,0,sizeof(compiled->forbidden));
+	buildFailure(rule->head, rule->headLen, compiled->headFail);
+	for(uint32_t h=0;h<rule->headLen;h++) compiled->forbidden[rule->head[h]>>3] |= 1<<(rule->head[h]&0x07);
+	if(tailLen!=0){
+		buildFailure(rule->tail, tailLen, compiled->tailFail);
+		for(uint32_t t=0;t<tailLen;t++) compiled->forbidden[rule->tail[t]>>3] |= 1<<(rule->tail[t]&0x07);
+	}
+
+	return 1;
+}
+
+/* stores the search state inside ctx */
+static void contextSave(search_frame_context* ctx, machine_state state, uint32_t startPos, uint32_t nextHead, uint32_t scanIndex){
+	ctx->state=state;
+	ctx->startPos=startPos;
+	ctx->nextHead=nextHead;
+	ctx->scanIndex=scanIndex;
+}
+
+/* moves the search state of ctx after shift bytes have been pulled from the stream head.
+ * The bytes before scanIndex don't need to be scanned again since the outcome of the search on them can't depend
+ * on the pulled bytes, except when the current frame head has been pulled (or with medium policy and a tail longer
+ * than head plus one, where a complete tail partially pulled could have made a byte forbidden), in those cases the
+ * search restarts from the stream head
+ */
+static void contextShift(search_frame_context* ctx, compiled_frame_rule* compiled, uint32_t shift){
+	search_frame_rule* rule=&compiled->rule;
+
+	if(rule->policy==medium && compiled->tailLen>(rule->headLen+1)){
+		ctx->valid=0;
+	}else if(ctx->state==_inside){
+		if((ctx->startPos+1)<(rule->headLen+shift)){
+			ctx->valid=0;
+		}else{
+			ctx->startPos-=shift;
+			ctx->scanIndex-=shift;
+			if(ctx->nextHead!=0) ctx->nextHead-=shift;
+		}
+	}else{
+		ctx->scanIndex=(ctx->scanIndex>shift) ? ctx->scanIndex-shift : 0;
+	}
+}
+
+/* aligns ctx to the current content of stream: bytes pulled from stream head since the last search are detected
+ * by the movement of its start index, bytes pushed to the tail by the increase of its elements, any other change
+ * (or an invalid context) restarts the search from the stream head
+ */
+static void contextAlign(search_frame_context* ctx, circular_buffer_handle* stream, compiled_frame_rule* compiled){
+	if(ctx->valid && (ctx->compiled!=compiled || ctx->buff!=stream->buff || stream->elemNum==0)) ctx->valid=0;
+
+	if(ctx->valid){
+		uint32_t pulled=(stream->startIndex+stream->buffLen-ctx->streamStart)%stream->buffLen;
+
+		if(pulled>ctx->streamElem || stream->elemNum<(ctx->streamElem-pulled)) ctx->valid=0;
+		else if(pulled!=0) contextShift(ctx,compiled,pulled);
+	}
+
+	if(!ctx->valid){
+		contextSave(ctx,_waiting,0,0,0);
+		ctx->valid=1;
+	}
+
+	ctx->compiled=compiled;
+	ctx->buff=stream->buff;
+	ctx->streamStart=stream->startIndex;
+	ctx->streamElem=stream->elemNum;
+}
+
+/* core of the compiled search, starts from the state saved inside ctx (already aligned to stream) and saves there
+ * the state reached with the bytes that can't change their outcome when new bytes are pushed to the stream tail
+ */
+static uint32_t searchFrameCore(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, search_frame_context* ctx){
+	search_frame_rule* rule=&compiled->rule;
+	//If packet cannot fit in available bytes
+	if(stream->elemNum<(rule->headLen+rule->minLen+rule->tailLen)) return stream->elemNum;
+
+	//variables and flags
+	machine_state state=ctx->state;	//decoding state machine state
+	uint32_t startPos=ctx->startPos;	//last byte of head of current frame
+	uint32_t nextHead=ctx->nextHead;	//first head end found inside current frame (0 if none), used to restart with soft policy
+	uint32_t endPos=stream->elemNum-rule->tailLen;	//avoiding to check the last tailLen bytes
+	//decisions on bytes before stableEnd don't depend on bytes that will be pushed in the future
+	uint32_t stableEnd=(stream->elemNum>compiled->lookAhead) ? stream->elemNum-compiled->lookAhead : 0;
+	uint8_t saved=0; //flag to signal that the stable state was already saved inside ctx
+	uint8_t forbiddenByte=0; //flag to signal that current byte is of forbidden type (head/tail or parts of it depending on mode)
+	uint8_t canBeLast=0; //flag to signal if the current byte can be the last byte of a frame
+	uint32_t currLen=0; //current packet length (head and tail excluded)
+	uint32_t b=ctx->scanIndex;
+	pattern_matcher m;
+
+	matcherSync(&m,stream,compiled,b);
+
+	for(;b<endPos;b++){
+
+		if(!saved && b>=stableEnd){
+			contextSave(ctx,state,startPos,nextHead,b);
+			saved=1;
+		}
+
+		//fast path: while waiting for a single byte head, jump directly to its next occurrence
+		if(state==_waiting && rule->headLen==1){
+			uint32_t next=findByte(stream,rule->head[0],b,endPos);
+			if(!saved && next>=stableEnd){
+				contextSave(ctx,_waiting,0,0,stableEnd);
+				saved=1;
+			}
+			b=next;
+			if(b>=endPos) break;
+			if(b>m.nextIndex) matcherSync(&m,stream,compiled,b);
+		}
+
+		//feeding the matcher with the bytes needed to take decisions on this byte
+		matcherFeed(&m,stream,compiled,(stream->elemNum-b>compiled->lookAhead) ? b+compiled->lookAhead+1 : stream->elemNum);
+
+		if(state==_inside) currLen=b-startPos; else currLen=0;
+
+		//checking if current byte can be the last frame byte
+		canBeLast=0;
+		if(currLen>=rule->minLen){
+			if(compiled->tailLen==0) canBeLast=1; //tail-less mode
+			else canBeLast=matcherEndsIn(&m,m.tailEnds,b+compiled->tailLen,b+compiled->tailLen); //normal mode
+		}
+
+		//STATE MACHINE
+		if(state==_waiting){
+			//checking if current byte can be the first frame byte (last head byte)
+			if(matcherEndsIn(&m,m.headEnds,b,b)){
+				state=_inside;
+				startPos=b;
+				nextHead=0;
+
+				//we check if we already found a 0 length frame
+				if(canBeLast){
+					ctx->valid=0;
+					return outputFrame(stream,frame,rule,startPos,0);
+				}
+			}
+		}else{
+			//check if byte is forbidden byte
+			if(rule->policy==hard){
+				uint8_t byte=cBuffReadByte(stream,0,b);
+				forbiddenByte=(compiled->forbidden[byte>>3]>>(byte&0x07)) & 0x01;
+			}else if(rule->policy==medium){
+				forbiddenByte=matcherEndsIn(&m,m.headEnds,b,b+rule->headLen-1) ||
+						((compiled->tailLen!=0) && matcherEndsIn(&m,m.tailEnds,b,b+compiled->tailLen-1));
+			}else{
+				forbiddenByte=0;
+			}
+
+			if(forbiddenByte || ((rule->maxLen!=0) && (currLen > rule->maxLen))){
+				/* discard frame and restart with next possible frame:
+				 * with hard and medium policies a head can't end inside the discarded frame without making one of
+				 * its bytes forbidden, so the next frame can only start from this byte, which is checked again in
+				 * waiting state.
+				 * With soft policy the frame can also be discarded because too long, in that case we restart from
+				 * the first head found inside it (if any).
+				 */
+				state=_waiting;
+				if(!forbiddenByte && nextHead!=0){
+					matcherSync(&m,stream,compiled,nextHead);
+					b=nextHead-1;
+				}else{
+					b--;
+				}
+			}else{
+				if(nextHead==0 && rule->policy==soft && matcherEndsIn(&m,m.headEnds,b,b)) nextHead=b;
+
+				//frame found!
+				if(canBeLast){
+					ctx->valid=0;
+					return outputFrame(stream,frame,rule,startPos,currLen);
+				}
+			}
+		}
+	}
+
+	if(!saved) contextSave(ctx,state,startPos,nextHead,b);
+
+	//no valid packet found :(
+	return stream->elemNum;
+}
+
+void searchContextReset(search_frame_context* ctx){
+	if(ctx==NULL) return;
+
+	ctx->valid=0;
+}
+
+uint32_t searchFrameCompiled(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled){
+	search_frame_context ctx;
+
+	ctx.valid=0;
+	return searchFrameResume(stream,frame,compiled,&ctx);
+}
+
+uint32_t searchFrameResume(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, search_frame_context* ctx){
+	if(stream==NULL) return 0;
+	//guard checks
+	if(compiled==NULL || ctx==NULL || stream->buff == NULL || stream->elemNum==0 || compiled->rule.headLen==0 || compiled->rule.head==NULL){
+		searchContextReset(ctx);
+		return stream->elemNum;
+	}
+
+	contextAlign(ctx,stream,compiled);
+
+	return searchFrameCore(stream,frame,compiled,ctx);
+}
+
+uint32_t searchFrame(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule){
+	compiled_frame_rule compiled;
+
+	if(stream==NULL) return 0;
+	//rules with too long sequences can't be compiled, using generic search
+	if(!compileFrameRule(&compiled,rule)) return searchFrameScan(stream,frame,rule);
+
+	return searchFrameCompiled(stream,frame,&compiled);
+}
+
+/* performs the stream buffer shifts of searchFrameAdvance() after a search which returned startVIndex,
+ * headByte is the first byte of head sequence, returns !0 if a frame was found
+ */
+static uint8_t advanceStream(circular_buffer_handle* stream, circular_buffer_handle* frame, uint32_t startVIndex, uint8_t headByte, uint8_t shiftFlags){
+	uint8_t found=0;
 
 	//if frame was found
 	if(startVIndex!=stream->elemNum){
@@ -232,21 +595,40 @@ uint8_t searchFrameAdvance(circular_buffer_handle* stream, circular_buffer_handl
 
 	//regardless of packet found or not, perform SHIFTOUT_FAST if requested
 	if(shiftFlags & SHIFTOUT_FAST){
-		//temporary rule for searcing next occurrence of first head byte
-		search_frame_rule tmpRule={ 
-			.head=rule->head,
-			.headLen=1,
-			.minLen=0,
-			.maxLen=0,
-			.tail=NULL,
-			.tailLen=0,
-			.policy=hard,
-		};
 		//search next occurrence of first head byte
-		uint32_t nextHead=searchFrame(stream,NULL,&tmpRule);
+		cBuffPull(stream, NULL, findByte(stream,headByte,0,stream->elemNum), 0);
+	}
+
+	return found;
+}
+
+uint8_t searchFrameAdvance(circular_buffer_handle* stream, circular_buffer_handle* frame, search_frame_rule * rule, uint8_t shiftFlags){
+	if(stream==NULL || stream->buff == NULL || rule==NULL || stream->elemNum==0 || rule->headLen==0 || rule->head==NULL) return 0;
 
-		cBuffPull(stream, NULL, nextHead, 0);
+	compiled_frame_rule compiled;
+
+	if(compileFrameRule(&compiled,rule)) return searchFrameAdvanceCompiled(stream,frame,&compiled,shiftFlags);
+
+	//rules with too long sequences can't be compiled, using generic search
+	return advanceStream(stream,frame,searchFrameScan(stream,frame,rule),rule->head[0],shiftFlags);
+}
+
+uint8_t searchFrameAdvanceCompiled(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, uint8_t shiftFlags){
+	if(stream==NULL || stream->buff == NULL || compiled==NULL || stream->elemNum==0 || compiled->rule.headLen==0 || compiled->rule.head==NULL) return 0;
+
+	return advanceStream(stream,frame,searchFrameCompiled(stream,frame,compiled),compiled->rule.head[0],shiftFlags);
+}
+
+uint8_t searchFrameAdvanceResume(circular_buffer_handle* stream, circular_buffer_handle* frame, compiled_frame_rule* compiled, search_frame_context* ctx, uint8_t shiftFlags){
+	if(stream==NULL || stream->buff == NULL || compiled==NULL || ctx==NULL || stream->elemNum==0 || compiled->rule.headLen==0 || compiled->rule.head==NULL){
+		searchContextReset(ctx);
+		return 0;
 	}
 
+	uint8_t found=advanceStream(stream,frame,searchFrameResume(stream,frame,compiled,ctx),compiled->rule.head[0],shiftFlags);
+
+	//taking note of the bytes pulled by the advance
+	if(ctx->valid) contextAlign(ctx,stream,compiled);
+
 	return found;
 }
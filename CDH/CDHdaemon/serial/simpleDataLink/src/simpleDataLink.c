@@ -30,6 +30,8 @@ search_frame_rule rule={
 	.maxLen=(SDL_MAX_PAY_LEN+2)*2,
 	.policy=hard,
 };
+//compiled search rule (compiled by sdlInitLine())
+compiled_frame_rule compiledRule;
 
 // NETWORK ORDERING -----------------------------------------------------------
 
@@ -374,6 +376,8 @@ uint8_t sendFrame(serial_line_handle* line, uint8_t frameCode, uint8_t ackWanted
 //it also removes those codes from rxBuff, otherwise it leaves them unchanged
 //the eventually received frame will be placed inside line tmpBuff (HEADER INCLUDED!)
 //returns 0 if no frame found, !0 otherwise
+//without remCodes the search resumes from the rxBuff bytes not yet examined for frameCode (the frames before them
+//have already been rejected), with remCodes the whole rxBuff is searched again to remove them
 uint8_t receiveFrame(serial_line_handle* line, uint8_t frameCode, circular_buffer_handle* remCodes){
     if(line==NULL || line->rxFunc==NULL) return 0;
 
@@ -388,14 +392,23 @@ uint8_t receiveFrame(serial_line_handle* line, uint8_t frameCode, circular_buffe
         }else break;
     }
    
+    //search context of frameCode
+    uint8_t ctxIndx=(frameCode==FRMCODE_ACK);
+    search_frame_context* ctx=&line->rxCtx[ctxIndx];
+    if(remCodes!=NULL && remCodes->elemNum!=0){
+        searchContextReset(ctx);
+        line->rxScanned[ctxIndx]=0;
+    }
+
     //handle to store found frames
     circular_buffer_handle frameHandle;
     //dummy buffer to perform buffer advancement
     circular_buffer_handle dummyBuff;
-    //copying rxBuff into dummy buffer
+    //copying rxBuff into dummy buffer, skipping already examined bytes
     cBuffToCirc(&dummyBuff,&line->rxBuff);
+    cBuffPull(&dummyBuff,NULL,line->rxScanned[ctxIndx],0);
     //we search on dummy handle, shifting it out to current found frame
-    while(searchFrameAdvance(&dummyBuff,&frameHandle,&rule,SHIFTOUT_NEXT | SHIFTOUT_FAST)){
+    while(searchFrameAdvanceResume(&dummyBuff,&frameHandle,&compiledRule,ctx,SHIFTOUT_NEXT | SHIFTOUT_FAST)){
         //flush tmp buffer
         cBuffFlush(&line->tmpBuff);
         //copy on temporary buffer
@@ -436,11 +449,19 @@ uint8_t receiveFrame(serial_line_handle* line, uint8_t frameCode, circular_buffe
             //reconstructing dummy buffer
             cBuffToCirc(&dummyBuff,&line->rxBuff);
             cBuffPull(&dummyBuff,NULL,frameIndx+1,0);
+            //rxBuff changed, all the contexts restart from its head
+            for(uint8_t c=0;c<2;c++){
+                searchContextReset(&line->rxCtx[c]);
+                line->rxScanned[c]=0;
+            }
         }
 
         if(found) return 1;
     }
 
+    //saving examined bytes
+    line->rxScanned[ctxIndx]=line->rxBuff.elemNum-dummyBuff.elemNum;
+
     return 0;
 }
 
@@ -562,11 +583,17 @@ void sdlInitLine(serial_line_handle* line, uint8_t (*txFunc)(uint8_t byte), uint
 
     line->txFunc=txFunc;
     line->rxFunc=rxFunc;
+    line->waitFunc=NULL;
     cBuffInit(&line->rxBuff,line->rxBuffArray,sizeof(line->rxBuffArray),0);
     line->timeout=timeout;
     line->retries=retries;
     line->lastRxHash=0;
     cBuffInit(&line->tmpBuff,line->tmpBuffArray,sizeof(line->tmpBuffArray),0);
+    for(uint8_t c=0;c<2;c++){
+        searchContextReset(&line->rxCtx[c]);
+        line->rxScanned[c]=0;
+    }
+    compileFrameRule(&compiledRule,&rule);
 
 #ifdef SDL_ANTILOCK_DEPTH
     cBuffInit(&line->alockBuff,line->alockBuffArray,sizeof(line->alockBuffArray),0);
@@ -574,6 +601,12 @@ void sdlInitLine(serial_line_handle* line, uint8_t (*txFunc)(uint8_t byte), uint
 #endif
 }
 
+void sdlSetWaitFunc(serial_line_handle* line, void (*waitFunc)(uint32_t timeout)){
+    if(line==NULL) return;
+
+    line->waitFunc=waitFunc;
+}
+
 uint8_t sdlSend(serial_line_handle* line, uint8_t* buff, uint32_t len, uint8_t ackWanted){
     if(line==NULL || line->txFunc==NULL || buff==NULL || len==0) return 0;
 
@@ -605,6 +638,12 @@ uint8_t sdlSend(serial_line_handle* line, uint8_t* buff, uint32_t len, uint8_t a
         //if anti lock active, fill the queue while waiting
         receiveInQueueAndAck(line,FRMCODE_DATA,NULL);
 #endif
+
+            //nothing yet, sleep until new bytes arrive instead of polling (if possible)
+            uint32_t elapsed=sdlTimeTick()-startTick;
+            if(line->waitFunc!=NULL && elapsed<line->timeout){
+                line->waitFunc(line->timeout-elapsed);
+            }
         }while((sdlTimeTick()-startTick)<=line->timeout);
 
     }while(retryNum<=line->retries);